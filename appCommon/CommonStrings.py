@@ -217,7 +217,8 @@ kCamDbFile = 'camdb'
 kObjDbFile = 'objdb2'
 kClipDbFile = 'clipdb'
 kResponseDbFile = 'responsedb'
-kSQLiteDatabases = [kObjDbFile, kClipDbFile, kResponseDbFile]
+kHeatmapDbFile = 'heatmapdb'
+kSQLiteDatabases = [kObjDbFile, kClipDbFile, kResponseDbFile, kHeatmapDbFile]
 
 # A special setting indicating that any camera will do.  Not necessarily
 # human readable in the current locale...
@@ -247,6 +248,9 @@ kCameraOff = "off"
 kCameraConnecting = "connecting"
 kCameraFailed = "failed"
 
+# The reason a camera gives for failing when it stops because of low disk space.
+kCameraDiskSpaceReason = "Low disk space on system volume"
+
 
 # We'll communicate this key between the back end and the front end to make
 # sure that the back end and front end have matching versions...
@@ -317,6 +321,14 @@ kDefaultPreRecord = 5
 # The directory in which files pertaining to remote sessions are stored.
 kRemoteFolder = "remote"
 
+# The directory, in the remote folder, in which clips exported for remote
+# sessions are kept to be handed out again.  Manages its own size.
+kRemoteClipCacheFolder = "clips"
+
+# The directory, in the remote folder, in which segments of clips played over
+# HLS are kept.  Manages its own size.
+kRemoteHlsFolder = "hls"
+
 # Displayed in the results list while a search is ongoing.
 kSearchingString = "Searching..."
 kSearchingOnString = "Searching on %s..."
@@ -440,6 +452,9 @@ kMinFreeSysDriveSpaceMB = 1024
 
 kThumbsSubfolder="thumbs"
 
+# Extension of the files in the thumbs folders holding an hour of thumbnails.
+kThumbArchiveExt=".thb"
+
 # Mapping choice labels to settings in the model...
 kTargetMapping = [
     ('anything', "Any object"),
@@ -42,11 +42,13 @@ import sqlite3 as sqlite
 from appCommon.CommonStrings import kObjDbFile
 from appCommon.CommonStrings import kClipDbFile
 from appCommon.CommonStrings import kResponseDbFile
+from appCommon.CommonStrings import kHeatmapDbFile
 from appCommon.CommonStrings import kSQLiteDatabases
 from appCommon.CommonStrings import kCorruptDbFileName
 from backEnd.ClipManager import ClipManager
 from backEnd.DataManager import DataManager
 from backEnd.ResponseDbManager import ResponseDbManager
+from backEnd.HeatmapManager import HeatmapManager
 
 
 """ Database recovery module. Knows about the current databases, their tables
@@ -166,11 +168,14 @@ def _createDatabase(cls, path, logger):
 # indices etc)
 _kDescriptors = {
     kClipDbFile: (ClipManager,
-        [('clips', 11)]),
+        [('clips', 11), ('clipLocations', 2), ('clipRelocation', 2)]),
     kObjDbFile: (DataManager,
-        [("objects", 16), ('actions', 7), ('motion', 7)]),
+        [("objects", 16), ('actions', 7), ('motion', 7), ('motionSpans', 3),
+         ('trackCompaction', 2)]),
     kResponseDbFile: (ResponseDbManager,
-        [('clipsToSend', 12), ('lastSentInfo', 6), ('pushNotifications', 4)])
+        [('clipsToSend', 12), ('lastSentInfo', 6), ('pushNotifications', 4)]),
+    kHeatmapDbFile: (HeatmapManager,
+        [('heatmaps', 7), ('backfill', 2), ('heatmapInfo', 2)])
 }
 
 ###############################################################################s
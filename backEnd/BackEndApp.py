@@ -91,15 +91,22 @@ from vitaToolbox.sysUtils.TimeUtils import getTimeAsMs
 from vitaToolbox.strUtils.EnsureUnicode import ensureUtf8
 from vitaToolbox.threading.ThreadPool import ThreadPool
 from vitaToolbox.process.ProcessUtils import listChildProcessesOfPID
+from vitaToolbox.process.ProcessUtils import getMemoryUsage
+from vitaToolbox.process.ProcessUtils import ResourceClasses
+from vitaToolbox.process.ProcessUtils import kResourceClassRealtime
+from vitaToolbox.process.ProcessUtils import kResourceClassService
+from vitaToolbox.process.ProcessUtils import kResourceClassBulk
 from vitaToolbox.profiling.QueueStats import QueueStats
+from vitaToolbox.profiling.ObjectCensus import CensusSampler
 
 # Local imports...
 from appCommon.CommonStrings import kPortFileName, isLocalCamera
-from appCommon.CommonStrings import kRuleDir, kRuleExt, kQueryExt
+from appCommon.CommonStrings import kRuleDir
 from appCommon.CommonStrings import kPrefsFile, kCamDbFile
 from appCommon.CommonStrings import kAnyCameraStr
 from appCommon.CommonStrings import kCameraUndefined, kCameraOn, kCameraOff
 from appCommon.CommonStrings import kCameraConnecting, kCameraFailed
+from appCommon.CommonStrings import kCameraDiskSpaceReason
 from appCommon.CommonStrings import kEmailResponse, kRecordResponse
 from appCommon.CommonStrings import kSoundResponse, kCommandResponse
 from appCommon.CommonStrings import kFtpResponse, kPushResponse
@@ -119,6 +126,7 @@ from appCommon.CommonStrings import kSupportEmail
 from appCommon.CommonStrings import kClipDbFile
 from appCommon.CommonStrings import kResponseDbFile
 from appCommon.CommonStrings import kObjDbFile
+from appCommon.CommonStrings import kHeatmapDbFile
 from appCommon.CommonStrings import kDefaultRecordSize, kMaxRecordSize
 from appCommon.CommonStrings import kMatchSourceSize
 from appCommon.CommonStrings import kExecAlertThreshold
@@ -132,6 +140,7 @@ from appCommon.DbRecovery import getCorruptDatabaseStatus
 from appCommon.DbRecovery import runDatabaseRecovery
 from appCommon.DbRecovery import kStatusRecover
 from appCommon.DbRecovery import kStatusReset
+from appCommon.DebugPrefs import getDebugPref
 from appCommon.DebugPrefs import getDebugPrefAsInt, getDebugPrefAsFloat
 from BackEndPrefs import BackEndPrefs
 from BackEndPrefs import kLiveMaxBitrate
@@ -143,6 +152,7 @@ from BackEndPrefs import kGenThumbnailResolution
 from BackEndPrefs import kFpsLimit
 from BackEndPrefs import kRecordInMemory, kClipMergeThreshold, kHardwareAccelerationDevice
 from BackEndProcessJumper import startCapture
+from BackEndProcessJumper import startCameraWorker
 from BackEndProcessJumper import startDiskCleaner
 from BackEndProcessJumper import startNetworkMessageServer
 from BackEndProcessJumper import startResponseRunner
@@ -151,9 +161,16 @@ from BackEndProcessJumper import startWebServer
 from BackEndProcessJumper import startPacketCapture
 from BackEndProcessJumper import startPlatformHTTPWrapper
 from CameraManager import CameraManager
+from CameraWorker import CameraWorkerPool, HostedCamera
 from ClipManager import ClipManager
+from ClipManager import kOutageOpenFailed, kOutageDiskSpace, kOutageRestart
+from ClipManager import kOutageOff, kOutageNotRunning
 from DataManager import DataManager
 from DebugLogManager import DebugLogManager
+from HeatmapManager import HeatmapManager
+from HeartbeatTable import HeartbeatTable, kHeartbeatOk, kHeartbeatStalled
+from StorageMover import StorageMover
+from VideoRelocator import VideoRelocator
 if kOpenSourceVersion:
     from LicenseManagerOSS import LicenseManager
 else:
@@ -176,8 +193,12 @@ from WebServer import killWebServerProcesses
 from launch.Launch import Launch
 from launch.Launch import serviceAvailable
 from appCommon.hostedServices.IftttClient import IftttClient
-from SavedQueryDataModel import convertOld2NewSavedQueryDataModel
+from RuleRegistry import RuleRegistry, hashRuleData
 from NetworkScanner import NetworkScanner, OnvifNetworkScanner
+from OverloadGovernor import OverloadGovernor, CpuMeter
+from OverloadGovernor import kShedSearchInterval, kShedBackground
+from MemoryWatchdog import MemoryWatchdog, kSoftLimitKB, kHardLimitKB
+from MemoryWatchdog import kMemoryOk, kMemoryRecycleQuiet, kMemoryRestart
 
 
 
@@ -192,6 +213,14 @@ except NameError:
 
 _kTmpFolder = 'tmp'
 _kCameraCheckInterval = 10
+
+# How often (seconds) to write out activity heatmaps; they're only kept in
+# memory in between.
+_kHeatmapFlushInterval = 60
+
+# How often (seconds) to build another camera-hour of heatmaps from data that
+# was recorded before heatmaps existed.
+_kHeatmapBackfillInterval = 5
 _kLogName = "BackEndApp.log"
 _kLogSize = 1024*1024*5
 _kOnvifLogName = "Onvif.log"
@@ -201,6 +230,22 @@ _kUpnpLogSize = 1024 * 1024 * 2
 _kPipeCleanupWait = 60*5
 _kMinimumSearchDelayMs = 1000
 
+# While overloaded, cameras whose rules only record are searched this rarely.
+_kShedSearchDelayMs = 10000
+
+# How often to tell the overload governor how we're doing, in seconds.
+_kGovernorInterval = 2
+
+# How often to check how much memory camera processes use, in seconds.
+_kMemoryCheckInterval = 30
+
+# A camera is between clips once nothing of it was saved for this long, in ms;
+# camera processes that use too much memory are recycled then.
+_kRecycleQuietMs = 30*1000
+
+# How long a camera process's replacement may take to get ready, in seconds.
+_kStandbyTimeout = 90
+
 # After stopping a camera, we'll tell responses to flush after this many secs.
 _kResponseFlushTime = 60
 
@@ -225,6 +270,9 @@ _kMessageServerPingTime = 120
 # camera to give any pending information time to be processed.
 _kRuleCleanupTimeout = 120
 
+# Seconds to keep the compiled query of a removed rule, in case it's added back.
+_kRetiredRuleTimeout = 60
+
 # If a temp video file could not be moved we'll try again for this many seconds
 # before giving up and deleting it.
 _kTmpFileLifetime = 20*60
@@ -249,6 +297,19 @@ _kWebServerQuitTimeout = 5
 # Number of worker threads for the (global) thread-pool.
 _kThreadPoolSize = multiprocessing.cpu_count() * 4
 
+# Default number of tmp video files to move to the archive at once.
+_kStorageMoverThreads = 2
+
+# How long to wait before restarting a background move of video that failed.
+_kVideoRelocatorRetrySecs = 60
+
+# Heartbeat slots for child processes; one per camera, plus the response
+# runner.  Children that don't get one fall back to sending pings.
+_kMaxHeartbeatSlots = 256
+
+# How long a connected camera may go without processing a frame.
+_kCameraStallTimeout = _kCameraTimeout
+
 # Timeout for communicating with the network message server. If we exceed this
 # we assume it is hung and destroy the world.
 _kNetworkMessageServerTimeout = 300
@@ -269,6 +330,7 @@ _kFakeMessageIdDataManagerIdleProcessing = 90000
 _kFakeMessageIdRealTimeSearch            = 90001
 _kFakeMessageIPCUtility                  = 90002
 _kFakeMessageIPCCamera                   = 90003
+_kFakeMessageIdHeatmapBackfill           = 90004
 
 # Queue statistics constants
 _kStatsDefaultInterval = 60*60 # by default, log stats every hour
@@ -325,6 +387,23 @@ class BackEndApp(object):
 
         self._threadPool = ThreadPool(_kThreadPoolSize)
 
+        # Moves tmp video files to the archive, so that a slow archive drive
+        # never stalls the main loop.  Bandwidth is applied to the current
+        # video dir as part of _moveTmpFiles().
+        self._storageMover = StorageMover(self._logger,
+            getDebugPrefAsInt("storageMoverThreads", _kStorageMoverThreads,
+                              userLocalDataDir),
+            getDebugPrefAsInt("storageMoverVerify", 0, userLocalDataDir) != 0)
+        self._storageMoverKBps = getDebugPrefAsInt("storageMoverMaxKBps", 0,
+                                                   userLocalDataDir)
+        self._storageMoverDir = None
+
+        # Moves existing video to a new video location in the background;
+        # None unless such a move is in progress.  If it fails, it's created
+        # again once the retry time, if any, has passed.
+        self._videoRelocator = None
+        self._videoRelocatorRetryTime = None
+
         self._iftttStatePending = None  # state to be sent
         self._iftttStateSending = False # some state is currently being sent
         self._iftttStateCleared = None  # state got set to empty on the server
@@ -333,6 +412,33 @@ class BackEndApp(object):
         # Key = Camera Location
         # value = (process, cameraPipe, dataMgrPipeId, lastPingTime)
         self._captureStreams = {}
+
+        # Shared memory the camera processes and response runner show they're
+        # alive in.  Must exist before any of them start.
+        self._heartbeats = HeartbeatTable(_kMaxHeartbeatSlots)
+
+        # Key = Camera Location, value = heartbeat slot of the process.
+        self._heartbeatSlots = {}
+        self._responseRunnerSlot = None
+
+        # Gives each child process its CPU and I/O priority, and optionally
+        # pins it to CPUs and puts it in a cgroup v2 group, as configured.
+        self._resourceClasses = None
+        if getDebugPrefAsInt("resourceClasses", 1, userLocalDataDir):
+            self._resourceClasses = ResourceClasses(self._logger,
+                getDebugPrefAsInt("resourceClassPinning", 0,
+                                  userLocalDataDir) != 0,
+                getDebugPref("resourceClassCgroup", None, userLocalDataDir))
+
+        # Runs cameras a few to a process, if so configured; otherwise each
+        # camera gets a process of its own.
+        self._cameraWorkers = None
+        camerasPerWorker = getDebugPrefAsInt("camerasPerWorker", 1,
+                                             userLocalDataDir)
+        if camerasPerWorker > 1:
+            self._cameraWorkers = CameraWorkerPool(self._logger,
+                camerasPerWorker, self._heartbeats.getSlots(),
+                self._startCameraWorker)
         # Key = id, value = data manager pipe
         self._dataMgrPipes = {}
         self._nextPipeId = 0
@@ -356,7 +462,24 @@ class BackEndApp(object):
         # Key = camera location, value = ruleDict:
         #    key = ruleName, value = (rule, isScheduled, nextSchedChange, query,
         #                             responseList)
+        # Rules on kAnyCameraStr get an entry under every configured camera,
+        # each with its own query and responses.  A compiled query is the
+        # camera's partition: besides tracking state, setProcessingCoordSpace()
+        # scales its regions and lines into C arrays for that camera's
+        # processing size, and triggers have no way to save and restore that.
         self._ruleDicts = {}
+        # Key = lowercase rule name of a kAnyCameraStr rule,
+        # value = (rule, queryModel).  The rule is shared by all cameras.
+        self._anyCameraRules = {}
+        # Watches the rule directory; created when rules are first loaded.
+        self._ruleRegistry = None
+        # Key = lowercase rule name, value = hash of its pickled query, which
+        # tells us if the compiled queries in _ruleDicts are still current.
+        self._ruleQueryHashes = {}
+        # Compiled rules that were recently removed, in case they come back
+        # unchanged.  Key = (camera location, rule name, query hash),
+        # value = (query, responses, expire time).
+        self._retiredRules = {}
         # Key = camera location, value = last time a search was run
         self._lastSearchTimes = {}
 
@@ -375,6 +498,36 @@ class BackEndApp(object):
         maxExecTime = getDebugPrefAsFloat("backEndQueueMaxExecTime", float(kExecAlertThreshold), userLocalDataDir)
         self._childProcQueueStats = QueueStats(self._logger, interval, _kStatsAlertInterval, maxQueueSize, maxExecTime)
 
+        # Sheds optional work while we can't keep up; see OverloadGovernor.
+        # We sample how we're doing every _kGovernorInterval seconds, with
+        # the longest a message waited since the last sample.
+        self._governor = OverloadGovernor(self._logger)
+        self._cpuMeter = CpuMeter()
+        self._lastGovernorUpdate = 0
+        self._maxMessageAge = 0
+
+        # Recycles camera processes that grew too big; see
+        # _checkCameraMemory().  Limits are per camera.
+        self._memoryWatchdog = MemoryWatchdog(self._logger,
+            getDebugPrefAsInt("cameraMemorySoftMB", kSoftLimitKB/1024,
+                              userLocalDataDir)*1024,
+            getDebugPrefAsInt("cameraMemoryHardMB", kHardLimitKB/1024,
+                              userLocalDataDir)*1024)
+        self._lastMemoryCheck = 0
+
+        # Logs what grows in this process every so many seconds, if asked.
+        self._censusSampler = CensusSampler(self._logger,
+            getDebugPrefAsInt("objectCensusSecs", 0, userLocalDataDir))
+
+        # Key = camera location, value = (proc, pipe, pipeId, heartbeat slot,
+        # start time) of a process started to replace the camera's, which
+        # waits until it has the stream open to take over.
+        self._standbyCameras = {}
+
+        # Cameras whose replacements couldn't get ready next to the old
+        # process; those are restarted instead.
+        self._noStandby = set()
+
         self._lastCameraCheck = 0
 
         # The time.time() of the last time we did a realtime search...
@@ -411,6 +564,16 @@ class BackEndApp(object):
         # data manager stops using the temp Id.
         self._tempIdMap = {}
 
+        # The camera location that feeds each data manager pipe.
+        # Key: pipeId, value: camera location
+        self._pipeLocations = {}
+
+        # Activity heatmaps; see HeatmapManager.
+        self._heatmapManager = None
+        self._lastHeatmapFlush = 0
+        self._lastHeatmapBackfill = 0
+        self._heatmapBackfillPending = False
+
         # A process handle to the current test camera, or None; also keep URI...
         self._testCamProc = None
         self._testCamUri = None
@@ -480,12 +643,43 @@ class BackEndApp(object):
         self._logger.info("Finished back end shutdown, in dtor.")
 
 
+    ###########################################################
+    def _applyResourceClass(self, proc, resourceClass, spread=False):
+        """Give a child process we just started its resource class.
+
+        @param  proc           The process, or None.
+        @param  resourceClass  One of the kResourceClass constants.
+        @param  spread         True to spread the process across NUMA nodes
+                               with others like it; see ResourceClasses.
+        """
+        if self._resourceClasses is not None and proc is not None:
+            self._resourceClasses.apply(proc.pid, resourceClass, spread)
+
+
+    ###########################################################
+    def _startCameraWorker(self, *args):
+        """Start a camera worker process, for CameraWorkerPool.
+
+        @param  args  Arguments for startCameraWorker().
+        @return proc  The process.
+        """
+        proc = startCameraWorker(*args)
+        self._applyResourceClass(proc, kResourceClassRealtime, True)
+        return proc
+
+
     ###########################################################
     def _terminateCameraProcess(self, proc):
         """Terminate the process, and all of its children too, if any.
 
         @param proc process to kill.
         """
+        # A camera in a worker process shares it, and its children, with
+        # other cameras; it knows what may be terminated.
+        if isinstance(proc, HostedCamera):
+            proc.terminate()
+            return
+
         childrenPIDs = listChildProcessesOfPID(proc.pid)
 
         for childPID in childrenPIDs:
@@ -509,6 +703,11 @@ class BackEndApp(object):
 
         # Bring down the thread pool. Don't wait though.
         self._threadPool.shutdown()
+        self._storageMover.shutdown()
+        if self._videoRelocator is not None:
+            self._videoRelocator.shutdown()
+        if self._ruleRegistry is not None:
+            self._ruleRegistry.close()
 
         if self._upnpScanner:
             self._upnpScanner.shutdown()
@@ -563,7 +762,10 @@ class BackEndApp(object):
             proc, camPipe, _, _ = self._captureStreams[camLoc]
             self._sendMsg(camPipe, [MessageIds.msgIdQuit], camLoc)
             cameraProcesses.append(proc)
+            self._setOutage(camLoc, kOutageNotRunning)
         self._captureStreams = {}
+        for camLoc in self._standbyCameras.keys():
+            self._dropStandby(camLoc)
 
         # Make sure that dead cameras get killed too...
         for (proc, _) in self._deadCameras:
@@ -589,6 +791,8 @@ class BackEndApp(object):
         self._logger.info("Terminating cameras...")
         for proc in cameraProcesses:
             self._terminateCameraProcess(proc)
+        if self._cameraWorkers is not None:
+            self._cameraWorkers.shutdown()
 
         # Handle any last minute messages
         self._logger.info("Handling last messages...")
@@ -621,6 +825,13 @@ class BackEndApp(object):
                 self._logger.error("final idle queue flush failed (%s)" %
                                    sys.exc_info()[1])
 
+        if self._heatmapManager:
+            try:
+                self._heatmapManager.close()
+            except:
+                self._logger.error("final heatmap flush failed (%s)" %
+                                   sys.exc_info()[1])
+
         # Make sure that the disk cleaner is gone; give a longer timeout
         # than for cameras, since killing it can cause data loss...
         self._logger.info("Waiting for disk monitor...")
@@ -725,6 +936,39 @@ class BackEndApp(object):
         # Update the web server
         self._putMsgWS([MessageIds.msgIdWsgiPortChanged, camLocation, wsgiPortSet])
 
+    ###########################################################
+    def _setOutage(self, camLocation, reason, isAttempt=False):
+        """Record in the outage ledger that a camera isn't recording.
+
+        @param  camLocation  The camera's location.
+        @param  reason       Why; one of the kOutageXXX constants.
+        @param  isAttempt    True if this follows a failed attempt to connect.
+        """
+        if self._clipManager is None:
+            return
+        try:
+            self._clipManager.setOutage(camLocation, int(time.time()*1000),
+                                        reason, isAttempt)
+        except Exception:
+            self._logger.warning("Couldn't record outage for %s" %
+                                 ensureUtf8(camLocation), exc_info=True)
+
+
+    ###########################################################
+    def _endOutage(self, camLocation):
+        """Record in the outage ledger that a camera is recording again.
+
+        @param  camLocation  The camera's location.
+        """
+        if self._clipManager is None:
+            return
+        try:
+            self._clipManager.endOutage(camLocation, int(time.time()*1000))
+        except Exception:
+            self._logger.warning("Couldn't end outage for %s" %
+                                 ensureUtf8(camLocation), exc_info=True)
+
+
     ###########################################################
     def _enableDiskLogging(self, enable):
         if enable:
@@ -747,14 +991,28 @@ class BackEndApp(object):
         self._analyticsPort = msg[1]
         self._broadcastMsg(msg)
 
+    ###########################################################
+    def _addLocalQueueMessage(self, msg, depositTime):
+        """Add a message from a child to our local queue.
+
+        Batches from camera workers are taken apart here.
+
+        @param  msg          The message.
+        @param  depositTime  When we got the message.
+        """
+        if msg[0] == MessageIds.msgIdCameraWorkerBatch:
+            for batchedMsg in msg[1]:
+                self._childProcLocalQueue.append((batchedMsg, depositTime))
+        else:
+            self._childProcLocalQueue.append((msg, depositTime))
+
     ###########################################################
     def _getQueueMessage(self, timeout):
         # Attempt to empty all of the shared queue first
         while True:
             try:
                 msg = self._childProcQueue.get(False)
-                msgEx = (msg, time.time())
-                self._childProcLocalQueue.append(msgEx)
+                self._addLocalQueueMessage(msg, time.time())
             except QueueEmpty:
                 break
 
@@ -776,7 +1034,11 @@ class BackEndApp(object):
             return (msg, time.time() - depositTime)
 
         # Time to wait for a message from the far end
-        return ( self._childProcQueue.get(timeout=timeout), 0 )
+        msg = self._childProcQueue.get(timeout=timeout)
+        if msg[0] == MessageIds.msgIdCameraWorkerBatch:
+            self._addLocalQueueMessage(msg, time.time())
+            msg, _ = self._childProcLocalQueue.popleft()
+        return ( msg, 0 )
 
     ###########################################################
     def _getQueueSize(self):
@@ -853,6 +1115,8 @@ class BackEndApp(object):
         self._objDbPath = os.path.join(self._dataStorageLocation, kObjDbFile)
         self._responseDbPath = os.path.join(self._dataStorageLocation,
                                             kResponseDbFile)
+        self._heatmapDbPath = os.path.join(self._dataStorageLocation,
+                                           kHeatmapDbFile)
         self._videoDir = os.path.join(videoStorageLocation, kVideoFolder)
         self._tmpDir = os.path.join(self._dataStorageLocation, _kTmpFolder)
         self._remoteDir = os.path.join(self._userLocalDataDir, kRemoteFolder)
@@ -892,6 +1156,7 @@ class BackEndApp(object):
 
         try:
             self._openDatabases()
+            self._resumeVideoRelocation()
         except DatabaseError, e:
             self._logger.error("Couldn't open databases.", exc_info=True)
             if e.message in kCorruptDbErrorStrings:
@@ -1009,6 +1274,7 @@ class BackEndApp(object):
                     self._processQueueMessage(queueMsg)
                     timeToProcess = time.time() - start
                     self._childProcQueueStats.update(qsize, msgId, timeInQueue, timeToProcess)
+                    self._maxMessageAge = max(self._maxMessageAge, timeInQueue)
                 except DatabaseError, e:
                     self._logger.error("Process message exception: %s", traceback.format_exc())
                     if e.message in kCorruptDbErrorStrings:
@@ -1038,10 +1304,24 @@ class BackEndApp(object):
                     if isIdle:
                         idlePendingSince = None
                         self._doIdleProcessing()
+                elif self._heatmapBackfillPending and \
+                        kShedBackground not in self._governor.getActions() \
+                        and curTime > \
+                        self._lastHeatmapBackfill+_kHeatmapBackfillInterval:
+                    self._lastHeatmapBackfill = curTime
+                    self._doHeatmapBackfill()
 
                 # Flush any responses that might be waiting...
                 self._flushResponses()
 
+                if curTime > self._lastGovernorUpdate+_kGovernorInterval:
+                    self._updateGovernor(curTime)
+
+                if curTime > self._lastMemoryCheck+_kMemoryCheckInterval:
+                    self._checkCameraMemory(curTime)
+
+                self._censusSampler.update(curTime)
+
                 # Restart any cameras that have unexpectedly terminated
                 if curTime > self._lastCameraCheck+_kCameraCheckInterval:
                     locations = self._captureStreams.keys()
@@ -1061,6 +1341,7 @@ class BackEndApp(object):
                             self._captureStreams[location] = (p, pipe, pipeId, curTime)
 
                         self._lastResponseRunnerPing = curTime
+                        self._heartbeats.extendGrace()
 
                     self._lastCameraCheck = curTime
                     deadCameras = []
@@ -1092,6 +1373,7 @@ class BackEndApp(object):
                     # dead loop. Skip straight to "could not connect" instead.
                     for cam in deadCameras:
                         self._setCameraStatus(cam, kCameraFailed)
+                        self._setOutage(cam, kOutageRestart, True)
 
                     pipeIds = self._deadPipes.keys()
                     for pipeId in pipeIds:
@@ -1100,6 +1382,7 @@ class BackEndApp(object):
                             if pipeId in self._dataMgrPipes:
                                 del self._dataMgrPipes[pipeId]
                                 del self._tempIdMap[pipeId]
+                                self._pipeLocations.pop(pipeId, None)
 
                     # Ensure that the disk cleaner is still running
                     if not self._diskCleanupProc.is_alive():
@@ -1142,6 +1425,7 @@ class BackEndApp(object):
                     for loc in self._pendingRuleCleanupDict.keys():
                         if self._pendingRuleCleanupDict[loc] < curTime:
                             self._cleanupCameraData(loc)
+                    self._purgeRetiredRules(curTime)
 
                     # Clean up any dead camera processes
                     for i in xrange(len(self._deadCameras)-1, -1, -1):
@@ -1151,6 +1435,9 @@ class BackEndApp(object):
                                 self._terminateCameraProcess(proc)
                             self._deadCameras.pop(i)
 
+                    if self._cameraWorkers is not None:
+                        self._cameraWorkers.update()
+
                     # If a camera was supposed to alert us to a rename but was
                     # frozen and never did, execute it now.
                     if self._pendingRenameMsg and \
@@ -1169,6 +1456,10 @@ class BackEndApp(object):
                     self._netMsgServerClient.backEndPing()
                     self._moveTmpFiles()
 
+                self._handleStorageMoverResults()
+                self._updateVideoRelocation()
+                self._updateRules()
+
             except DatabaseError, e:
                 if e.message in kCorruptDbErrorStrings:
                     self._handleCorruptDatabase()
@@ -1191,6 +1482,29 @@ class BackEndApp(object):
             self._deadPipes[pipeId] = time.time() + _kPipeCleanupWait
 
         del self._captureStreams[location]
+        self._heartbeats.freeSlot(self._heartbeatSlots.pop(location, None))
+        self._dropStandby(location)
+
+
+    ###########################################################
+    def _dropStandby(self, location):
+        """Stop a camera's replacement that's waiting to take over, if any.
+
+        @param  location  The camera location.
+        """
+        standby = self._standbyCameras.pop(location, None)
+        if standby is None:
+            return
+
+        proc, pipe, pipeId, slot, _ = standby
+        try:
+            self._sendMsg(pipe, [MessageIds.msgIdQuit], location)
+        except Exception:
+            # It quit by itself already.
+            pass
+        self._deadPipes[pipeId] = time.time() + _kPipeCleanupWait
+        self._heartbeats.freeSlot(slot)
+        self._deadCameras.append((proc, time.time()))
 
 
     ###########################################################
@@ -1220,7 +1534,7 @@ class BackEndApp(object):
             for camName, ms in self._pendingRealTimeSearches.iteritems():
                 lastSearchTime = self._lastSearchTimes.get(camName, 0)
                 dt = ms - lastSearchTime
-                if dt > _kMinimumSearchDelayMs:
+                if dt > self._getSearchDelayMs(camName):
                     return True
 
             # We don't get given any new motion data after an object has left
@@ -1238,6 +1552,81 @@ class BackEndApp(object):
 
         return False
 
+    ###########################################################
+    def _getSearchDelayMs(self, camLoc):
+        """Return how much motion data to gather before searching a camera.
+
+        @param  camLoc   The camera location.
+        @return delayMs  The amount of data, in milliseconds.
+        """
+        if kShedSearchInterval in self._governor.getActions() and \
+           not self._hasUrgentResponses(camLoc):
+            return _kShedSearchDelayMs
+        return _kMinimumSearchDelayMs
+
+
+    ###########################################################
+    def _hasUrgentResponses(self, camLoc):
+        """Tell whether a camera has rules that do more than record.
+
+        Recording can wait, since clips are made from what was saved anyway;
+        notifications and the like can't.
+
+        @param  camLoc     The camera location.
+        @return hasUrgent  True if an enabled rule has other responses.
+        """
+        for rule, _, _, _, responses in \
+                self._ruleDicts.get(camLoc, {}).itervalues():
+            if rule.isEnabled():
+                for response in responses:
+                    if not isinstance(response, RecordResponse):
+                        return True
+        return False
+
+
+    ###########################################################
+    def _updateGovernor(self, curTime):
+        """Tell the overload governor how we're doing, and shed or restore
+        work if it says so.
+
+        @param  curTime  The current time.
+        """
+        self._lastGovernorUpdate = curTime
+
+        # How far behind real time searches are, from the cameras that were
+        # searched before.
+        searchLagMs = 0
+        for camName, ms in self._pendingRealTimeSearches.iteritems():
+            if camName in self._lastSearchTimes:
+                searchLagMs = max(searchLagMs,
+                                  ms - self._lastSearchTimes[camName])
+
+        samples = {
+            'queue': len(self._childProcLocalQueue),
+            'addFrames': len(self._pendingAddFrames),
+            'messageAge': self._maxMessageAge,
+            'searchLag': searchLagMs/1000.,
+            'cpu': self._cpuMeter.sample(curTime),
+        }
+        self._maxMessageAge = 0
+
+        if self._governor.update(curTime, samples):
+            self._logger.info("Shedding %s, counts: %s" %
+                              (self._governor.getActions(),
+                               self._governor.getStats()))
+            self._sendLoadShedding()
+
+
+    ###########################################################
+    def _sendLoadShedding(self):
+        """Tell child processes what to shed; search intervals and heatmap
+        backfill are up to us."""
+        msg = [MessageIds.msgIdSetLoadShedding, self._governor.getActions()]
+        self._broadcastMsg(msg)
+        self._putMsgDC(msg)
+        self._putMsgRR(msg)
+
+
     ###########################################################
     def _updateCameraUri(self, camLoc, protocol):
         uri, _, _, _ = self._cameraInfo[camLoc]
@@ -1343,6 +1732,9 @@ class BackEndApp(object):
             addFrameArgs = self._pendingAddFrames.pop(0)
             self._dataManager.addFrame(*addFrameArgs)
         self._dataManager.save()
+        if force or start > self._lastHeatmapFlush+_kHeatmapFlushInterval:
+            self._lastHeatmapFlush = start
+            self._heatmapManager.flush()
         self._childProcQueueStats.update(None, _kFakeMessageIdDataManagerIdleProcessing, None, time.time()-start)
 
         if self._wantRealtimeSearch(force):
@@ -1360,6 +1752,23 @@ class BackEndApp(object):
 
 
 
+    ###########################################################
+    def _doHeatmapBackfill(self):
+        """Build heatmaps for one more hour of old data, if there is any."""
+        start = time.time()
+        try:
+            self._heatmapManager.runBackfill(self._dataManager)
+            self._heatmapBackfillPending = \
+                self._heatmapManager.isBackfillPending()
+        except DatabaseError:
+            self._logger.error("Heatmap backfill failed", exc_info=True)
+            self._heatmapBackfillPending = False
+        if not self._heatmapBackfillPending:
+            self._logger.info("Heatmap backfill done")
+        self._childProcQueueStats.update(None, _kFakeMessageIdHeatmapBackfill,
+                                         None, time.time()-start)
+
+
     ###########################################################
     def _flushIdleQueue(self):
         """Make sure any things buffered to do at idle time are done."""
@@ -1396,67 +1805,236 @@ class BackEndApp(object):
         """
         configuredCams = cameraManager.getCameraLocations()
 
-        ruleDir = os.path.join(self._userLocalDataDir, kRuleDir)
-        if not os.path.isdir(ruleDir):
-            return
-        fileNames = os.listdir(ruleDir)
-        for fileName in fileNames:
-            fileName = normalizePath(fileName)
-            name, ext = os.path.splitext(fileName)
-            if ext == kRuleExt:
-                try:
-                    # Load the rule
-                    ruleFilePath = os.path.join(ruleDir, fileName)
-                    ruleFile = file(ruleFilePath, 'r')
-                    rule = cPickle.load(ruleFile)
-                    ruleFile.close()
-
-                    # Load it's associated query
-                    queryFilePath = os.path.join(ruleDir,
-                                                 rule.getQueryName()+kQueryExt)
-                    queryFile = file(queryFilePath, 'r')
-                    queryModel = cPickle.load(queryFile)
-                    queryFile.close()
-
-                    # First, convert old queries to have coordinate spaces.
-                    convertOld2NewSavedQueryDataModel(
-                        self._dataManager, queryModel
-                    )
-
-                    query = queryModel.getUsableQuery(self._dataManager)
-
-                    # Remove rules created prior to the addition of responses
-                    # in the saved query data model.
-                    if not hasattr(queryModel, '_responses'):
-                        self._logger.warn("Removing old rule %s" % ruleFile)
-                        os.remove(queryFilePath)
-                        os.remove(ruleFilePath)
-                        continue
-
-                    # Get the camera location and current schedule status
-                    camLoc = queryModel.getVideoSource().getLocationName()
-                    if camLoc == kAnyCameraStr:
-                        continue
+        if self._ruleRegistry is None:
+            ruleDir = os.path.join(self._userLocalDataDir, kRuleDir)
+            self._ruleRegistry = RuleRegistry(self._logger, ruleDir,
+                                              self._dataManager)
+
+        # Only rules whose files changed since we last looked get loaded again.
+        self._ruleRegistry.update(True)
 
+        for entry in self._ruleRegistry.getRules():
+            try:
+                # Get the camera location
+                camLoc = entry.queryModel.getVideoSource().getLocationName()
+                if camLoc == kAnyCameraStr:
+                    camLocs = configuredCams
+                    self._anyCameraRules[entry.name] = \
+                        (entry.rule, entry.queryModel)
+                elif camLoc in configuredCams:
                     # Ensure that this rule is associated with a currently
-                    # configured camera AND it's using the correct caps.
-                    if camLoc not in configuredCams:
-                        continue
+                    # configured camera.
+                    camLocs = [camLoc]
+                else:
+                    continue
 
-                    isScheduled, nextSchedChange = rule.getScheduleInfo()
+                for camLoc in camLocs:
+                    self._addRuleForCamera(camLoc, entry.name, entry.rule,
+                                           entry.queryModel, entry.queryHash)
+                self._ruleQueryHashes[entry.name] = entry.queryHash
+            except Exception:
+                self._logger.error("Load rules exception", exc_info=True)
 
-                    # Get the responses
-                    responses = self._loadResponses(queryModel, camLoc, query,
-                            name.lower())
 
-                    # Add to the rules dict
-                    if camLoc not in self._ruleDicts:
-                        self._ruleDicts[camLoc] = {}
+    ###########################################################
+    def _updateRules(self):
+        """Pick up rules whose files changed since we last looked.
 
-                    self._ruleDicts[camLoc][name.lower()] = \
-                        (rule, isScheduled, nextSchedChange, query, responses)
-                except Exception:
-                    self._logger.error("Load rules exception", exc_info=True)
+        Runs between realtime searches, so a search always sees either the old
+        or the new version of a rule.  Rules that didn't change keep their
+        queries, and so whatever their triggers are tracking.
+        """
+        if self._ruleRegistry is None:
+            return
+
+        try:
+            changed, removed = self._ruleRegistry.update()
+        except Exception:
+            self._logger.error("Rule update exception", exc_info=True)
+            return
+
+        for ruleName in removed:
+            self._logger.info("Rule %s was removed" % ruleName)
+            self._removeRule(ruleName)
+
+        for entry, queryChanged in changed:
+            self._logger.info("Rule %s changed%s" % (entry.name,
+                              "" if queryChanged else " (schedule/enable only)"))
+            try:
+                self._applyRule(entry.name, entry.rule, entry.queryModel,
+                                entry.queryHash)
+            except Exception:
+                self._logger.error("Rule update exception", exc_info=True)
+
+
+    ###########################################################
+    def _applyRule(self, ruleName, rule, queryModel, queryHash):
+        """Add a rule, or replace the current version of it.
+
+        @param  ruleName    The lowercase name of the rule.
+        @param  rule        The RealTimeRule.
+        @param  queryModel  The SavedQueryDataModel of the rule.
+        @param  queryHash   The hash of the pickled query model.
+        """
+        camLoc = queryModel.getVideoSource().getLocationName()
+
+        # A rule on any camera runs against each configured camera.
+        camLocs = [camLoc]
+        if camLoc == kAnyCameraStr:
+            self._anyCameraRules[ruleName] = (rule, queryModel)
+            camLocs = self._cameraInfo.keys()
+        else:
+            self._anyCameraRules.pop(ruleName, None)
+            if camLoc not in self._cameraInfo:
+                # Ensure that this rule is associated with a currently
+                # configured camera.
+                self._logger.warn("Rule %s is for %s, which isn't a "
+                                  "configured camera" % (ruleName, camLoc))
+                camLocs = []
+
+        # If the rule moved to other cameras, stop running it on the old ones.
+        # Cameras that were just renamed or deleted keep their rules until
+        # their data is cleaned up.
+        syncCamLocs = set(camLocs)
+        for oldCamLoc in self._ruleDicts:
+            if oldCamLoc not in syncCamLocs and \
+               oldCamLoc not in self._pendingRuleCleanupDict and \
+               self._retireRuleForCamera(oldCamLoc, ruleName):
+                syncCamLocs.add(oldCamLoc)
+
+        for camLoc in camLocs:
+            self._addRuleForCamera(camLoc, ruleName, rule, queryModel,
+                                   queryHash)
+        self._ruleQueryHashes[ruleName] = queryHash
+
+        self._putMsgRR([MessageIds.msgIdSetLocalExportSettings, self._localExportSettings])
+
+        # Ensure the related cameras are now running if scheduled.
+        for camLoc in syncCamLocs:
+            self._syncCameraStateWithSchedule(camLoc)
+
+
+    ###########################################################
+    def _removeRule(self, ruleName):
+        """Stop running a rule.
+
+        @param  ruleName  The lowercase name of the rule.
+        """
+        self._anyCameraRules.pop(ruleName, None)
+
+        for camLoc in self._ruleDicts.keys():
+            if self._retireRuleForCamera(camLoc, ruleName):
+                # Ensure the related camera is stopped if not scheduled.
+                self._syncCameraStateWithSchedule(camLoc)
+
+        self._ruleQueryHashes.pop(ruleName, None)
+
+        if ruleName in self._localExportSettings:
+            del self._localExportSettings[ruleName]
+
+
+    ###########################################################
+    def _addRuleForCamera(self, camLoc, ruleName, rule, queryModel,
+                          queryHash=None):
+        """Start running a rule against a camera.
+
+        If we're already running the same query, or ran it recently, the
+        compiled query and responses are reused rather than built again, so
+        triggers don't lose track of objects they're in the middle of.
+
+        @param  camLoc      The camera location to watch.
+        @param  ruleName    The lowercase name of the rule.
+        @param  rule        The RealTimeRule.
+        @param  queryModel  The SavedQueryDataModel of the rule.
+        @param  queryHash   The hash of the pickled query model, or None if
+                            not known.
+        """
+        ruleDict = self._ruleDicts.setdefault(camLoc, {})
+        isScheduled, nextSchedChange = rule.getScheduleInfo()
+
+        compiled = None
+        if ruleName in ruleDict:
+            oldRule, wasScheduled, _, query, responses = ruleDict[ruleName]
+            if queryHash is not None and \
+               queryHash == self._ruleQueryHashes.get(ruleName):
+                compiled = (query, responses)
+
+                # Do what we'd have done if the old rule had been changed.
+                if (oldRule.isEnabled() and not rule.isEnabled()) or \
+                   (wasScheduled and not isScheduled):
+                    query.reset()
+            else:
+                self._retireRuleForCamera(camLoc, ruleName)
+
+        if compiled is None and queryHash is not None:
+            retired = self._retiredRules.pop((camLoc, ruleName, queryHash),
+                                             None)
+            if retired is not None:
+                compiled = retired[:2]
+
+        if compiled is None:
+            query = queryModel.getUsableQuery(self._dataManager)
+            responses = self._loadResponses(queryModel, camLoc, query,
+                                            ruleName)
+            compiled = (query, responses)
+        query, responses = compiled
+
+        # Tell the query about the processing size if the camera is open.
+        if camLoc in self._cameraProcSizes:
+            procSize = self._cameraProcSizes[camLoc]
+            query.setProcessingCoordSpace(procSize)
+
+        ruleDict[ruleName] = \
+                    (rule, isScheduled, nextSchedChange, query, responses)
+
+
+    ###########################################################
+    def _retireRuleForCamera(self, camLoc, ruleName):
+        """Stop running a rule against a camera.
+
+        The compiled query and responses are kept for a little while, in case
+        the same rule comes right back (like when it's edited).
+
+        @param  camLoc    The camera location.
+        @param  ruleName  The lowercase name of the rule.
+        @return removed   True if the rule was running against the camera.
+        """
+        ruleDict = self._ruleDicts.get(camLoc, {})
+        if ruleName not in ruleDict:
+            return False
+
+        _, _, _, query, responses = ruleDict.pop(ruleName)
+        queryHash = self._ruleQueryHashes.get(ruleName)
+        if queryHash is not None:
+            self._retiredRules[(camLoc, ruleName, queryHash)] = \
+                (query, responses, time.time()+_kRetiredRuleTimeout)
+        return True
+
+
+    ###########################################################
+    def _purgeRetiredRules(self, curTime):
+        """Forget compiled rules that didn't come back in time.
+
+        @param  curTime  The current time.
+        """
+        for key, (_, _, expireTime) in self._retiredRules.items():
+            if expireTime < curTime:
+                del self._retiredRules[key]
+
+
+    ###########################################################
+    def _addAnyCameraRules(self, camLoc):
+        """Start running all kAnyCameraStr rules against a new camera.
+
+        @param  camLoc  The camera location that was added.
+        """
+        for ruleName, (rule, queryModel) in self._anyCameraRules.iteritems():
+            try:
+                self._addRuleForCamera(camLoc, ruleName, rule, queryModel,
+                                       self._ruleQueryHashes.get(ruleName))
+            except Exception:
+                self._logger.error("Couldn't add rule %s to %s" %
+                                   (ruleName, camLoc), exc_info=True)
 
 
     ###########################################################
@@ -1580,6 +2158,17 @@ class BackEndApp(object):
                                         self._clipManager,
                                         self._videoDir)
         self._dataManager.open(self._objDbPath)
+        self._openHeatmapDatabase()
+
+
+    ###########################################################
+    def _openHeatmapDatabase(self):
+        """Open the heatmap database, queueing up a build of old data."""
+        if self._heatmapManager is None:
+            self._heatmapManager = HeatmapManager(self._logger)
+        self._heatmapManager.open(self._heatmapDbPath)
+        self._heatmapManager.startBackfill(self._dataManager)
+        self._heatmapBackfillPending = self._heatmapManager.isBackfillPending()
 
 
     ###########################################################
@@ -1591,6 +2180,7 @@ class BackEndApp(object):
         """
         self._clipManager.open(self._clipDbPath)
         self._dataManager.open(self._objDbPath)
+        self._openHeatmapDatabase()
 
 
     ###########################################################
@@ -1612,6 +2202,7 @@ class BackEndApp(object):
             )
         finally:
             self._enableDiskLogging(True)
+        self._applyResourceClass(self._netMsgServerProc, kResourceClassService)
 
         # Wait up to 10 seconds for the server to start
         try:
@@ -1681,10 +2272,13 @@ class BackEndApp(object):
 
 
     ###########################################################
-    def _openCamera(self, camLocation):
+    def _openCamera(self, camLocation, standby=False):
         """Start a process for a camera stream.
 
         @param  camLocation  The camera's location.
+        @param  standby      True to start a replacement for the camera's
+                             running process instead; it takes over once it
+                             has the stream open, see _takeOverCamera().
         @return camState     The new camera state if it changed, 'None'
                              otherwise.
         """
@@ -1695,22 +2289,12 @@ class BackEndApp(object):
             # If the camera is frozen then ignore this wish.
             return None
 
-        if camLocation in self._captureStreams:
+        if camLocation in self._captureStreams and not standby:
             # If the camera is already open don't do anything.
             return None
 
-        # Remove it from the forced back end save times list.
-        if camLocation in self._selfAddSavedTimes:
-            self._selfAddSavedTimes.remove(camLocation)
-
-        # Don't need to flush anymore--we're gonna get more data...
-        self._responsesToFlush.pop(camLocation, None)
-
-        # Inform any loaded rules for this camera about the new session.
-        ruleDict = self._ruleDicts.get(camLocation, {})
-        for _, _, _, _, responses in ruleDict.values():
-            for response in responses:
-                response.startNewSession()
+        if not standby:
+            self._startCameraSession(camLocation)
 
         if not enabled:
             # Don't open the camera if it is disabled
@@ -1728,6 +2312,7 @@ class BackEndApp(object):
                     (camLocation,)
                 )
                 self._setCameraStatus(camLocation, kCameraFailed)
+                self._setOutage(camLocation, kOutageOpenFailed, True)
                 return kCameraFailed
             else:
                 self._logger.info("No ONVIF/UPNP results are available for " + \
@@ -1777,6 +2362,7 @@ class BackEndApp(object):
         extra['useUSDate'] = self._timePrefs[1]
         extra['use12HrTime'] = self._timePrefs[0]
         extra[kHardwareAccelerationDevice] = self._hardwareDevice
+        extra['loadShedding'] = self._governor.getActions()
         if _kDebugConfig is not None:
             extra['debugConfig'] = _kDebugConfig
 
@@ -1787,17 +2373,42 @@ class BackEndApp(object):
                 pendingMoves.append(os.path.basename(targetPath))
         extra['pendingMoves'] = pendingMoves
 
+        slot, heartbeat = self._heartbeats.allocSlot()
+
+        if standby:
+            extra = dict(extra, standby=True)
+
+        startFn = startCapture
+        if self._cameraWorkers is not None:
+            startFn = self._cameraWorkers.startCapture
+
         self._enableDiskLogging(False)
         try:
-            p = startCapture(self._childProcQueue, camPipe2, dmPipe2, pipeId,
-                             camLocation, uri, self._clipDbPath, self._tmpDir,
-                             self._videoDir, self._userLocalDataDir, extra)
+            p = startFn(self._childProcQueue, camPipe2, dmPipe2, pipeId,
+                        camLocation, uri, self._clipDbPath, self._tmpDir,
+                        self._videoDir, self._userLocalDataDir, extra,
+                        heartbeat)
         finally:
             self._enableDiskLogging(True)
+        if self._cameraWorkers is None:
+            self._applyResourceClass(p, kResourceClassRealtime, True)
 
-        self._captureStreams[camLocation] = (p, camPipe1, pipeId, time.time())
         self._dataMgrPipes[pipeId] = dmPipe1
         self._tempIdMap[pipeId] = []
+        self._pipeLocations[pipeId] = camLocation
+
+        if _kDebugConfig is not None:
+            self._sendMsg(camPipe1, [MessageIds.msgIdSetDebugConfig, _kDebugConfig], camLocation)
+        if self._analyticsPort is not None:
+            self._sendMsg(camPipe1, [MessageIds.msgIdAnalyticsPortChanged, self._analyticsPort], camLocation)
+
+        if standby:
+            self._standbyCameras[camLocation] = (p, camPipe1, pipeId, slot,
+                                                 time.time())
+            return None
+
+        self._captureStreams[camLocation] = (p, camPipe1, pipeId, time.time())
+        self._heartbeatSlots[camLocation] = slot
 
         self._setCameraStatus(camLocation, kCameraConnecting)
 
@@ -1805,17 +2416,136 @@ class BackEndApp(object):
             self._pendingLiveViewStatus[camLocation] = \
                                 [MessageIds.msgIdEnableLiveView, camLocation]
 
-        if _kDebugConfig is not None:
-            self._sendMsg(camPipe1, [MessageIds.msgIdSetDebugConfig, _kDebugConfig], camLocation)
-        if self._analyticsPort is not None:
-            self._sendMsg(camPipe1, [MessageIds.msgIdAnalyticsPortChanged, self._analyticsPort], camLocation)
-
         # Update the disk cleaner with the number of active cameras
         self._putMsgDC([MessageIds.msgIdSetNumCameras, len(self._captureStreams)])
 
         return kCameraConnecting
 
 
+    ###########################################################
+    def _startCameraSession(self, camLocation):
+        """Get ready for a new process of a camera to send us data.
+
+        @param  camLocation  The camera's location.
+        """
+        # Remove it from the forced back end save times list.
+        if camLocation in self._selfAddSavedTimes:
+            self._selfAddSavedTimes.remove(camLocation)
+
+        # Don't need to flush anymore--we're gonna get more data...
+        self._responsesToFlush.pop(camLocation, None)
+
+        # Inform any loaded rules for this camera about the new session.
+        ruleDict = self._ruleDicts.get(camLocation, {})
+        for _, _, _, _, responses in ruleDict.values():
+            for response in responses:
+                response.startNewSession()
+
+
+    ###########################################################
+    def _takeOverCamera(self, camLocation):
+        """Switch a camera to its replacement, which has the stream open.
+
+        The old process is told to hand over and quit, flushing what it has,
+        and the replacement to go on from there, both right away.  The
+        replacement's WSGI server tells us its port once it's up, which
+        hands the camera's endpoint and live view over to it.
+
+        @param  camLocation  The camera's location.
+        """
+        standby = self._standbyCameras.pop(camLocation, None)
+        if standby is None or camLocation not in self._captureStreams:
+            return
+        proc, pipe, pipeId, slot, startTime = standby
+
+        oldProc, oldPipe, _, _ = self._captureStreams[camLocation]
+        self._sendMsg(oldPipe, [MessageIds.msgIdCameraHandOver], camLocation)
+        self._delCaptureStream(camLocation)
+        self._deadCameras.append((oldProc, time.time()))
+
+        self._sendMsg(pipe, [MessageIds.msgIdCameraTakeOver], camLocation)
+        self._captureStreams[camLocation] = (proc, pipe, pipeId, time.time())
+        self._heartbeatSlots[camLocation] = slot
+        self._startCameraSession(camLocation)
+
+        if self._cameraInfo[camLocation][2]:
+            self._pendingLiveViewStatus[camLocation] = \
+                                [MessageIds.msgIdEnableLiveView, camLocation]
+
+        self._logger.info("Recycled %s, replacement took %.1f seconds to get "
+                          "ready" % (ensureUtf8(camLocation),
+                                     time.time()-startTime))
+
+
+    ###########################################################
+    def _restartCamera(self, camLocation):
+        """Stop a camera's process and start a new one right away.
+
+        @param  camLocation  The camera's location.
+        """
+        self._logger.info("Restarting %s" % ensureUtf8(camLocation))
+        proc, pipe, _, _ = self._captureStreams[camLocation]
+        self._sendMsg(pipe, [MessageIds.msgIdQuit], camLocation)
+        self._delCaptureStream(camLocation)
+        self._deadCameras.append((proc, time.time()))
+        self._openCamera(camLocation)
+
+
+    ###########################################################
+    def _checkCameraMemory(self, now):
+        """Recycle camera processes that use too much memory.
+
+        Over the soft limit, a replacement is started for each camera once
+        it's between clips, and takes over once it has the stream open, so
+        that little or no video is missed.  Over the hard limit, or if a
+        camera's replacements can't get ready, cameras are restarted.
+
+        @param  now  The current time.
+        """
+        self._lastMemoryCheck = now
+
+        for camLocation, standby in self._standbyCameras.items():
+            if now > standby[4]+_kStandbyTimeout:
+                self._logger.warn("Replacement for %s never got ready" %
+                                  ensureUtf8(camLocation))
+                self._dropStandby(camLocation)
+                self._noStandby.add(camLocation)
+
+        # Cameras in a worker share its process, and its limits.
+        camerasByPid = {}
+        for camLocation, (proc, _, _, _) in self._captureStreams.iteritems():
+            camerasByPid.setdefault(proc.pid, []).append(camLocation)
+        self._memoryWatchdog.forget(camerasByPid)
+
+        for pid, camLocations in camerasByPid.iteritems():
+            rssKB, pssKB = getMemoryUsage(pid)
+            usedKB = rssKB if pssKB is None else pssKB
+            if usedKB is None:
+                continue
+            action = self._memoryWatchdog.check(now, pid, usedKB,
+                                                len(camLocations))
+            if action == kMemoryOk:
+                continue
+
+            # Replacements of a worker's cameras go to other workers.
+            if self._cameraWorkers is not None:
+                self._cameraWorkers.drain(pid)
+
+            for camLocation in camLocations:
+                if camLocation in self._standbyCameras:
+                    continue
+                if action == kMemoryRecycleQuiet and now*1000 < \
+                   self._lastTaggedTimes.get(camLocation, 0)+_kRecycleQuietMs:
+                    continue
+                if action == kMemoryRestart or \
+                   camLocation in self._noStandby:
+                    self._restartCamera(camLocation)
+                else:
+                    self._logger.info("Starting replacement for %s" %
+                                      ensureUtf8(camLocation))
+                    self._openCamera(camLocation, True)
+
+
     ###########################################################
     def _stopCamera(self, camLocation):
         """Stop a process for a camera stream.
@@ -1835,6 +2565,7 @@ class BackEndApp(object):
         self._putMsgDC([MessageIds.msgIdSetNumCameras, len(self._captureStreams)-1])
 
         self._setCameraStatus(camLocation, kCameraOff)
+        self._setOutage(camLocation, kOutageOff)
 
         self._delCaptureStream(camLocation)
 
@@ -1891,6 +2622,7 @@ class BackEndApp(object):
                     self._userLocalDataDir, self._childProcQueue, extras)
         finally:
             self._enableDiskLogging(True)
+        self._applyResourceClass(self._testCamProc, kResourceClassRealtime)
 
 
     ###########################################################
@@ -1937,6 +2669,7 @@ class BackEndApp(object):
             )
         finally:
             self._enableDiskLogging(True)
+        self._applyResourceClass(self._pcapCamProc, kResourceClassBulk)
 
 
     ###########################################################
@@ -1996,6 +2729,7 @@ class BackEndApp(object):
                 self._createCertificateData())
         finally:
             self._enableDiskLogging(True)
+        self._applyResourceClass(self._webServerProc, kResourceClassService)
         self._logger.info("web directory: %s" % webDir)
 
     ###########################################################
@@ -2015,6 +2749,8 @@ class BackEndApp(object):
                 self._childProcQueue,
                 self._userLocalDataDir,
                 0)
+            self._applyResourceClass(self._platformHTTPWrapperProc,
+                                     kResourceClassRealtime)
             self._logger.info("Successfully launched platform HTTP wrapper")
         except:
             error = traceback.format_exc()
@@ -2036,12 +2772,20 @@ class BackEndApp(object):
             tmpDir = os.path.join(self._dataStorageLocation, "tmp")
             self._diskCleanupProc = startDiskCleaner(
                 self._childProcQueue, self._diskCleanupQueue, self._clipDbPath,
-                self._objDbPath, len(self._captureStreams), maxStorage,
+                self._objDbPath, self._heatmapDbPath,
+                len(self._captureStreams), maxStorage,
                 self._videoDir, tmpDir, self._logDir, self._userLocalDataDir,
                 self._remoteDir, self._disableDiskCleanup, self._cacheDuration
             )
         finally:
             self._enableDiskLogging(True)
+        # Not idle: when the disk fills up, deleting must keep up with what
+        # the cameras record, and idle I/O can starve behind them.
+        self._applyResourceClass(self._diskCleanupProc, kResourceClassBulk)
+
+        if self._governor.getActions():
+            self._putMsgDC([MessageIds.msgIdSetLoadShedding,
+                            self._governor.getActions()])
 
 
     ###########################################################
@@ -2142,6 +2886,8 @@ class BackEndApp(object):
         """Start a process to handle doing slow responses."""
         tmpDir = os.path.join(self._dataStorageLocation, "tmp")
         self._lastResponseRunnerPing = time.time()
+        self._heartbeats.freeSlot(self._responseRunnerSlot)
+        self._responseRunnerSlot, heartbeat = self._heartbeats.allocSlot()
         self._enableDiskLogging(False)
         try:
             self._responseRunnerProc = startResponseRunner(
@@ -2149,10 +2895,15 @@ class BackEndApp(object):
                 self._objDbPath, self._responseDbPath, self._videoDir, tmpDir,
                 self._logDir, self._userLocalDataDir, self._ftpSettings,
                 self._localExportSettings, self._notificationSettings,
-                self._licenseManager.getAuthToken()
+                self._licenseManager.getAuthToken(), heartbeat
             )
         finally:
             self._enableDiskLogging(True)
+        self._applyResourceClass(self._responseRunnerProc, kResourceClassBulk)
+
+        if self._governor.getActions():
+            self._putMsgRR([MessageIds.msgIdSetLoadShedding,
+                            self._governor.getActions()])
 
 
     ###########################################################
@@ -2306,13 +3057,32 @@ class BackEndApp(object):
         isResponseRunner = location is None
         if isResponseRunner:
             timeout = _kResponseRunnerTimeout
+            stallTimeout = None
             lastPingTime = self._lastResponseRunnerPing
+            slot = self._responseRunnerSlot
             location = "ResponseRunner"
         else:
             timeout = _kCameraTimeout
+            stallTimeout = _kCameraStallTimeout
             p, camPipe, dataMgrPipe, lastPingTime = self._captureStreams[location]
+            slot = self._heartbeatSlots.get(location)
+
+            # A ping time of zero means the camera asked to be terminated.
+            if lastPingTime == 0:
+                return True
 
-        # Check if we've timed out based on the last ping
+        if slot is not None:
+            status, secs = self._heartbeats.check(slot, timeout, stallTimeout)
+            if status == kHeartbeatOk:
+                return False
+            state, progress, pid = self._heartbeats.getInfo(slot)
+            self._logger.warn("Process %s (pid %d) %s for %.1f sec, state=%d, "
+                              "progress=%d" % (ensureUtf8(location), pid,
+                              "stalled" if status == kHeartbeatStalled else
+                              "hung", secs, state, progress))
+            return True
+
+        # No heartbeat slot; check if we've timed out based on the last ping
         if lastPingTime+timeout > time.time():
             return False
 
@@ -2406,6 +3176,12 @@ class BackEndApp(object):
                 self._pendingAddFrames.append((dbId, frame, frameTime, bbox,
                                                objType, action))
 
+                camLoc = self._pipeLocations.get(pipeId)
+                procSize = self._cameraProcSizes.get(camLoc)
+                if procSize is not None:
+                    self._heatmapManager.addFrame(camLoc, objType, frameTime,
+                                                  bbox, procSize)
+
         # Camera capture messages
         elif msgId == MessageIds.msgIdStreamOpenSucceeded:
             cam = msg[1]
@@ -2418,6 +3194,7 @@ class BackEndApp(object):
                 # NOTE: These terms should be revised. This message added so
                 #       wsgi knows we're no longer in failed state (if we were)
                 self._setCameraStatus(cam, kCameraConnecting)
+                self._endOutage(cam)
 
             # Store the processing size for later use, like when new rules are
             # added, edited, or enabled.
@@ -2444,6 +3221,10 @@ class BackEndApp(object):
                 self._captureStreams[cam] = (p, camPipe, dataMgrPipe,
                                              time.time())
                 self._setCameraStatus(cam, kCameraFailed, None, reason)
+                if reason == kCameraDiskSpaceReason:
+                    self._setOutage(cam, kOutageDiskSpace)
+                else:
+                    self._setOutage(cam, kOutageOpenFailed, True)
 
             # If this camera is a UPnP camera, initiate an active search for it,
             # just to make sure...
@@ -2482,6 +3263,7 @@ class BackEndApp(object):
             if msg[1] in self._dataMgrPipes:
                 del self._dataMgrPipes[msg[1]]
                 del self._tempIdMap[msg[1]]
+                self._pipeLocations.pop(msg[1], None)
         elif msgId == MessageIds.msgIdStreamProcessedData:
             self._logger.debug("Received msgIdStreamProcessedData, cam: %s, "
                                "ms: %i" % (msg[1], msg[2]))
@@ -2514,6 +3296,9 @@ class BackEndApp(object):
         elif msgId == MessageIds.msgIdTestCameraFailed:
             self._logger.info("Received msgIdTestCameraFailed")
             self._netMsgServerClient.setTestCameraFailed(True)
+        elif msgId == MessageIds.msgIdPushNotificationAdded:
+            self._logger.debug("Received msgIdPushNotificationAdded")
+            self._netMsgServerClient.notePushNotification(msg[1])
         elif msgId == MessageIds.msgIdSetCamCanTerminate:
             # Upon receiving this message we will no longer send AddSaveTime
             # messages to the camera process, and will send it a confirmation
@@ -2527,6 +3312,18 @@ class BackEndApp(object):
                 _, pipe, _, _ = self._captureStreams[location]
                 self._selfAddSavedTimes.append(location)
                 self._sendMsg(pipe, msg, location)
+        elif msgId == MessageIds.msgIdCameraStandbyReady:
+            location = msg[1]
+            self._logger.info("Received msgIdCameraStandbyReady, loc: %s"
+                              % location)
+            self._takeOverCamera(location)
+        elif msgId == MessageIds.msgIdCameraStandbyFailed:
+            # The camera may take just one client at a time.
+            location = msg[1]
+            self._logger.info("Received msgIdCameraStandbyFailed, loc: %s"
+                              % location)
+            self._dropStandby(location)
+            self._noStandby.add(location)
         elif msgId == MessageIds.msgIdSetTerminate:
             # Upon receiving this message we know the camera process is
             # waiting to be killed.  We will set its ping time to zero
@@ -2558,6 +3355,7 @@ class BackEndApp(object):
 
             # Save the camera URI
             self._cameraInfo[loc] = (msg[2], True, False, msg[3])
+            self._addAnyCameraRules(loc)
             self._syncCameraStateWithSchedule(loc)
 
             # If this location previously existed with alternate name
@@ -2616,6 +3414,7 @@ class BackEndApp(object):
 
                 # If we still have data from a prior cam with this name, remove it.
                 self._cleanupCameraData(newLoc)
+                self._addAnyCameraRules(newLoc)
 
             self._stopCamera(origLoc)
 
@@ -2641,6 +3440,7 @@ class BackEndApp(object):
                     self._terminateCameraProcess(proc)
                 self._putMsgDC([MessageIds.msgIdRemoveDataAtLocation, camLoc])
                 self._dataManager.removeCameraLocation(camLoc)
+                self._heatmapManager.removeCameraLocation(camLoc)
         elif msgId == MessageIds.msgIdCameraEnabled:
             camLoc = msg[1]
             self._logger.info("Received msgIdCameraEnabled, loc: %s" % (camLoc))
@@ -2684,7 +3484,7 @@ class BackEndApp(object):
                 # If we're going to be cutting a clip we need to find an exact
                 # ms that occurred so we can properly update the created clips
                 # and database objects.
-                msList = getMsList(os.path.join(self._videoDir, changeClip), self._logger.getCLogFn())
+                msList = getMsList(self._clipManager.getClipPath(self._videoDir, changeClip), self._logger.getCLogFn())
 
                 first, _ = self._clipManager.getFileTimeInformation(changeClip)
 
@@ -2693,6 +3493,7 @@ class BackEndApp(object):
                 changeMs = msList[bisectIndex]+first
 
             self._dataManager.updateLocationName(msg[1], msg[2], changeMs)
+            self._heatmapManager.updateLocationName(msg[1], msg[2], changeMs)
             self._clipManager.updateLocationName(msg[1], msg[2], changeMs,
                     self._videoDir, self._userLocalDataDir)
             self._dataManager.save()
@@ -2712,6 +3513,9 @@ class BackEndApp(object):
                 camMgr = CameraManager(self._logger)
                 camMgr.load(msg[1])
                 self._ruleDicts = {}
+                self._anyCameraRules = {}
+                self._ruleQueryHashes = {}
+                self._retiredRules = {}
                 self._logger.info("rules cleared, reloading them...")
                 self._loadRules(camMgr)
                 self._logger.info("restarting cameras...")
@@ -2851,6 +3655,9 @@ class BackEndApp(object):
                               "move: %s, preserveExisting: %s"
                               % (videoDir, moveData, preserveExisting))
             self._setNewVideoLocation(videoDir, moveData, preserveExisting)
+        elif msgId == MessageIds.msgIdCancelVideoRelocation:
+            self._logger.info("Received msgIdCancelVideoRelocation")
+            self._cancelVideoRelocation()
         # Storage setting messages
         elif msgId == MessageIds.msgIdSetCacheDuration:
             self._logger.info("Received msgIdSetCacheDuration, hours: %i" % msg[1])
@@ -2914,29 +3721,18 @@ class BackEndApp(object):
             ruleName = msg[1].lower()
             self._logger.info("Received msgIdRuleAdded, rule: %s" % ruleName)
 
-            # Retrieve the new rule, query, schedule information, and responses
+            # Retrieve the new rule and query
             rule = cPickle.loads(msg[2])
             queryModel = cPickle.loads(msg[3])
-            query = queryModel.getUsableQuery(self._dataManager)
-            camLoc = queryModel.getVideoSource().getLocationName()
-            isScheduled, nextSchedChange = rule.getScheduleInfo()
-            responses = self._loadResponses(queryModel, camLoc, query, ruleName)
-
-            self._putMsgRR([MessageIds.msgIdSetLocalExportSettings, self._localExportSettings])
-
-            # Tell the query about the processing size if the camera is open.
-            if camLoc in self._cameraProcSizes:
-                procSize = self._cameraProcSizes[camLoc]
-                query.setProcessingCoordSpace(procSize)
 
-            # Add to the rule dict
-            if camLoc not in self._ruleDicts:
-                self._ruleDicts[camLoc] = {}
-            self._ruleDicts[camLoc][ruleName] = \
-                        (rule, isScheduled, nextSchedChange, query, responses)
+            # Tell the registry, so it doesn't load the files again.
+            queryHash = hashRuleData(msg[3])
+            if self._ruleRegistry is not None:
+                entry, _ = self._ruleRegistry.noteRule(msg[1], msg[2], msg[3],
+                                                       rule, queryModel)
+                queryHash = entry.queryHash
 
-            # Ensure the related camera is now running if scheduled.
-            self._syncCameraStateWithSchedule(camLoc)
+            self._applyRule(ruleName, rule, queryModel, queryHash)
 
         elif msgId == MessageIds.msgIdRuleScheduleUpdated:
             # Find the edited rule in ruleDicts
@@ -2969,15 +3765,9 @@ class BackEndApp(object):
             ruleName = msg[1].lower()
             self._logger.info("Received msgIdRuleDeleted, rule: %s" % ruleName)
 
-            for camLoc in self._ruleDicts:
-                if ruleName in self._ruleDicts[camLoc]:
-                    del self._ruleDicts[camLoc][ruleName]
-
-                    # Ensure the related camera is stopped if not scheduled.
-                    self._syncCameraStateWithSchedule(camLoc)
-
-            if ruleName in self._localExportSettings:
-                del self._localExportSettings[ruleName]
+            if self._ruleRegistry is not None:
+                self._ruleRegistry.forgetRule(ruleName)
+            self._removeRule(ruleName)
 
         elif msgId == MessageIds.msgIdRuleEnabled:
             # Enable or disable the specified rule
@@ -3288,40 +4078,22 @@ class BackEndApp(object):
             location = location.decode('utf-8')
         success = False
         try:
-            self._logger.info("Shutting down processes.")
-            # Stop cameras, disk cleaner, and response runner.
-            procs = [streamInfo[0] for streamInfo in self._captureStreams.values()]
-            for cameraLocation in self._captureStreams.keys():
-                self._stopCamera(cameraLocation)
-
-            if self._diskCleanupProc:
-                procs.append(self._diskCleanupProc)
-                self._putMsgDC([MessageIds.msgIdQuit])
-
-            if self._responseRunnerProc:
-                procs.append(self._responseRunnerProc)
-                self._putMsgRR([MessageIds.msgIdQuit])
-
-            # We'll wait for a while to let them quit gracefully, but we don't
-            # want it to be forever...
-            startTime = time.time()
-            anyAlive = True
-            while anyAlive and (time.time()-startTime < 45):
-                for proc in procs:
-                    if proc.is_alive():
-                        time.sleep(1)
-                        break
-                else:
-                    anyAlive = False
+            if self._clipManager.getRelocationInfo()[0] is not None:
+                # Clips are mapped to the folder they're moving from; another
+                # change now would lose track of them.
+                self._logger.warn("Video is still moving to %s, aborting "
+                                  "location change." % self._videoDir)
+                return
 
-            self._logger.info("Terminating any remaining processes.")
+            destination = os.path.join(location, kVideoFolder)
+            relocateOnline = preserveData and \
+                             self._canRelocateVideoOnline(destination)
 
-            # Ensure all processes are dead in case they didn't quit themselves.
-            for proc in procs:
-                self._terminateCameraProcess(proc)
+            self._stopProcessesForVideoMove()
 
-            destination = os.path.join(location, kVideoFolder)
-            if preserveData:
+            if relocateOnline:
+                success = self._beginVideoRelocation(destination)
+            elif preserveData:
                 # Move data.
                 try:
                     if os.path.isdir(self._videoDir):
@@ -3371,6 +4143,8 @@ class BackEndApp(object):
                     if not keepExisting:
                         self._dataManager.reset()
                         self._clipManager.reset()
+                        self._heatmapManager.reset()
+                        self._heatmapManager.startBackfill(self._dataManager)
 
                         # Remove the existing data.
                         try:
@@ -3399,15 +4173,7 @@ class BackEndApp(object):
 
             self._logger.info("Move status: %s.  Restarting processes." % str(success))
 
-            # Restart the disk cleaner.
-            self._initDiskCleanup(self._maxStorage)
-
-            # Restart the response runner.
-            self._initResponseRunner()
-
-            # Restart any cameras that should be running.
-            for cameraName in self._cameraInfo:
-                self._syncCameraStateWithSchedule(cameraName)
+            self._restartProcessesAfterVideoMove()
         finally:
             # Ensure that no matter what errors occur we always let the
             # front end know to stop blocking.
@@ -3415,63 +4181,306 @@ class BackEndApp(object):
                                                                   success)
 
 
+    ###########################################################
+    def _stopProcessesForVideoMove(self):
+        """Stop the processes that write to the video folder."""
+        self._logger.info("Shutting down processes.")
+        # Stop cameras, disk cleaner, and response runner.
+        procs = [streamInfo[0] for streamInfo in self._captureStreams.values()]
+        for cameraLocation in self._captureStreams.keys():
+            self._stopCamera(cameraLocation)
+
+        if self._diskCleanupProc:
+            procs.append(self._diskCleanupProc)
+            self._putMsgDC([MessageIds.msgIdQuit])
+
+        if self._responseRunnerProc:
+            procs.append(self._responseRunnerProc)
+            self._putMsgRR([MessageIds.msgIdQuit])
+
+        # We'll wait for a while to let them quit gracefully, but we don't
+        # want it to be forever...
+        startTime = time.time()
+        anyAlive = True
+        while anyAlive and (time.time()-startTime < 45):
+            for proc in procs:
+                if proc.is_alive():
+                    time.sleep(1)
+                    break
+            else:
+                anyAlive = False
+
+        self._logger.info("Terminating any remaining processes.")
+
+        # Ensure all processes are dead in case they didn't quit themselves.
+        for proc in procs:
+            self._terminateCameraProcess(proc)
+
+
+    ###########################################################
+    def _restartProcessesAfterVideoMove(self):
+        """Restart what _stopProcessesForVideoMove() stopped."""
+        # Restart the disk cleaner.
+        self._initDiskCleanup(self._maxStorage)
+
+        # Restart the response runner.
+        self._initResponseRunner()
+
+        # Restart any cameras that should be running.
+        for cameraName in self._cameraInfo:
+            self._syncCameraStateWithSchedule(cameraName)
+
+
+    ###########################################################
+    def _canRelocateVideoOnline(self, destination):
+        """Return whether to move video in the background.
+
+        A move on the same volume is just a rename, which is quicker than
+        anything else; only moves to another volume are done online.
+
+        @param  destination  The new video folder.
+        @return online       True to use _beginVideoRelocation().
+        """
+        if not os.path.isdir(self._videoDir):
+            return False
+        try:
+            parentDir = os.path.dirname(destination)
+            if not os.path.isdir(parentDir):
+                os.makedirs(parentDir)
+            return os.stat(self._videoDir).st_dev != os.stat(parentDir).st_dev
+        except Exception:
+            self._logger.warn("Couldn't compare volumes of %s and %s" %
+                              (self._videoDir, destination), exc_info=True)
+            return False
+
+
+    ###########################################################
+    def _beginVideoRelocation(self, destination):
+        """Start moving existing video to a new folder in the background.
+
+        New video is recorded to the new folder right away; existing clips
+        are found in the old one until they're moved.  Must be called while
+        the processes using the video folder are stopped.
+
+        @param  destination  The new video folder.
+        @return success      True if the move was started.
+        """
+        try:
+            if not os.path.isdir(destination):
+                os.makedirs(destination)
+        except Exception:
+            self._logger.error("Couldn't create %s" % destination,
+                               exc_info=True)
+            self._netMsgServerClient.addMessage(
+                [MessageIds.msgIdDirectoryCreateFailed, destination])
+            return False
+
+        self._logger.info("Beginning background move from %s to %s" %
+                          (self._videoDir, destination))
+        self._clipManager.beginRelocation(self._videoDir, destination)
+        self._startVideoRelocator()
+        return True
+
+
+    ###########################################################
+    def _startVideoRelocator(self):
+        """Create the relocator for a move recorded in the clip database."""
+        self._videoRelocatorRetryTime = None
+        self._videoRelocator = VideoRelocator(self._logger, self._clipManager,
+            lambda path: self._putMsgDC([MessageIds.msgIdDeleteFile, path]),
+            getDebugPrefAsInt("videoRelocatorThreads", _kStorageMoverThreads,
+                              self._userLocalDataDir),
+            bytesPerSec=getDebugPrefAsInt("videoRelocatorMaxKBps", 0,
+                                          self._userLocalDataDir)*1024)
+
+
+    ###########################################################
+    def _resumeVideoRelocation(self):
+        """Pick up a background move of video that didn't finish last run."""
+        fromDir, toDir, total, remaining = \
+            self._clipManager.getRelocationInfo()
+        if fromDir is None:
+            return
+
+        if toDir != self._videoDir:
+            self._logger.warn("Video was moving to %s, but the video folder "
+                              "is %s" % (toDir, self._videoDir))
+        self._logger.info("Resuming move from %s to %s, %d of %d clips left" %
+                          (fromDir, toDir, remaining, total))
+        self._startVideoRelocator()
+
+
+    ###########################################################
+    def _updateVideoRelocation(self):
+        """Let a background move of video make progress.
+
+        The move is recorded in the clip database, so if the relocator fails
+        it's started again a little later, picking up where it left off.
+        """
+        try:
+            if self._videoRelocator is None:
+                if self._videoRelocatorRetryTime is None or \
+                   time.time() < self._videoRelocatorRetryTime:
+                    return
+                self._videoRelocatorRetryTime = None
+                self._resumeVideoRelocation()
+            elif self._videoRelocator.update():
+                self._videoRelocator = None
+        except DatabaseError:
+            raise
+        except Exception:
+            self._logger.error("Moving video failed, retrying in %d seconds" %
+                               _kVideoRelocatorRetrySecs, exc_info=True)
+            if self._videoRelocator is not None:
+                self._videoRelocator.shutdown()
+                self._videoRelocator = None
+            self._videoRelocatorRetryTime = \
+                time.time() + _kVideoRelocatorRetrySecs
+
+
+    ###########################################################
+    def _cancelVideoRelocation(self):
+        """Move video back to where a background move started from."""
+        if self._clipManager.getRelocationInfo()[0] is None:
+            self._logger.info("No video move in progress to cancel.")
+            return
+        if self._videoRelocator is None:
+            # It failed and is waiting to be retried; turn it around now.
+            self._startVideoRelocator()
+
+        toDir = self._videoDir
+        try:
+            self._stopProcessesForVideoMove()
+
+            toDir = self._videoRelocator.reverse()
+            self._videoDir = toDir
+            self._dataManager.setVideoStoragePath(toDir)
+            self._clipUploader.updateVideoStoragePath(toDir)
+
+            self._logger.info("Cancelled video move, moving back to %s.  "
+                              "Restarting processes." % toDir)
+
+            self._restartProcessesAfterVideoMove()
+        finally:
+            self._netMsgServerClient.setVideoLocationChangeStatus(
+                os.path.dirname(toDir), True)
+
+
     ###########################################################
     def _moveTmpFiles(self):
-        """Move any pending tmp videos to their archive location."""
-        now = time.time()
+        """Start moving any pending tmp videos to their archive location.
 
-        kMinFreePercentageSys = 1          # Require at least 1% free drive space on system drive (start trim)
-                                           # The idea is to start trimming pending moves, before camera processes deem
-                                           # storage situation critical (which happens at 1GB)
-        kMinFreeSpaceMB       = 2*1024     # require at least 2GB left, before we remove files
-                                           # which previously failed to move to permanent storage location
+        The moves themselves happen on the storage mover's threads; see
+        _handleStorageMoverResults() for what happens when they finish.
+        """
+        now = time.time()
 
+        if self._storageMoverDir != self._videoDir:
+            if self._storageMoverDir is not None:
+                self._storageMover.setBandwidthLimit(self._storageMoverDir, 0)
+            self._storageMoverDir = self._videoDir
+            self._storageMover.setBandwidthLimit(self._videoDir,
+                                                 self._storageMoverKBps*1024)
 
+        diskCritical = None
         for targetPath, (loc, lastTime) in self._pendingFileMoves.items():
+            # Leave it be while it's being moved; we'll hear how it went.
+            if self._storageMover.isPending(targetPath):
+                continue
+
             src = os.path.join(self._tmpDir, loc, os.path.basename(targetPath))
             dst = os.path.join(self._videoDir, targetPath)
-            moved = False
-            try:
-                if os.path.isfile(src):
-                    shutil.move(src, dst)
-                    moved = True
-                else:
-                    self._logger.error("Pending move item " + ensureUtf8(src) + " does not exist")
-            except Exception, e:
-                self._logger.error("Failed to move file (" + ensureUtf8(src) + "->" + ensureUtf8(dst) + "): " + str(e))
+            if os.path.isfile(src):
+                if self._storageMover.submit(targetPath, src, dst):
+                    continue
+            else:
+                self._logger.error("Pending move item " + ensureUtf8(src) + " does not exist")
+
+            if diskCritical is None:
+                diskCritical = self._isTmpSpaceCritical()
+
+            if now > lastTime:
+                reason = "move timeout expired"
+            elif diskCritical:
+                reason = "insufficient local storage"
+            else:
+                reason = ""
+
+            if now > lastTime or diskCritical:
+                self._removeTmpFile(targetPath, loc, src, reason)
+
+
+    ###########################################################
+    def _handleStorageMoverResults(self):
+        """Deal with any tmp video moves that finished since last time."""
+        for targetPath, success, numBytes, secs, error in \
+                self._storageMover.getResults():
+            if targetPath not in self._pendingFileMoves:
+                continue
 
-            if moved:
+            loc, lastTime = self._pendingFileMoves[targetPath]
+            src = os.path.join(self._tmpDir, loc, os.path.basename(targetPath))
+            if success:
                 # If it was successfully relocated remove it from the dict.
-                self._logger.info("Moved tmp file %s" % ensureUtf8(src))
+                self._logger.info("Moved tmp file %s (%d bytes, %.1f sec)" %
+                                  (ensureUtf8(src), numBytes, secs))
                 del self._pendingFileMoves[targetPath]
-            else:
-                diskCritical = not checkFreeSpace(self._tmpDir, kMinFreeSpaceMB, kMinFreePercentageSys, None)
+                continue
 
-                if now > lastTime:
-                    reason = "move timeout expired"
-                elif diskCritical:
-                    reason = "insufficient local storage"
-                else:
-                    reason = ""
+            dst = os.path.join(self._videoDir, targetPath)
+            self._logger.error("Failed to move file (" + ensureUtf8(src) + "->" + ensureUtf8(dst) + "): " + error)
 
-                if now > lastTime or diskCritical:
-                    # If it hasn't been moved in the time we allocated, delete the
-                    # file and remove the associated time period from the databases.
-                    self._logger.info("Removing tmp file %s due to %s" % (ensureUtf8(src), reason))
-                    del self._pendingFileMoves[targetPath]
-                    try:
-                        os.remove(src)
-                    except Exception:
-                        self._logger.info("Queuing file for deletion: %s" % ensureUtf8(src))
-                        self._putMsgDC([MessageIds.msgIdDeleteFile, src])
-                    start, stop = \
-                        self._clipManager.getFileTimeInformation(targetPath.lower())
-                    if start != -1:
-                        # Remove these times from the object database.
-                        self._dataManager.deleteCameraLocationDataBetween(
-                                                                loc, start, stop)
-                        # Remove this file from the clip database.
-                        self._clipManager.removeClip(targetPath.lower())
+            # We'll try again next time around, unless we're out of time or
+            # local space.
+            if time.time() > lastTime:
+                self._removeTmpFile(targetPath, loc, src,
+                                    "move timeout expired")
+            elif self._isTmpSpaceCritical():
+                self._removeTmpFile(targetPath, loc, src,
+                                    "insufficient local storage")
+
+
+    ###########################################################
+    def _isTmpSpaceCritical(self):
+        """Check whether we must give up on moves to free local space.
+
+        @return isCritical  True if tmp files that failed to move should go.
+        """
+        kMinFreePercentageSys = 1          # Require at least 1% free drive space on system drive (start trim)
+                                           # The idea is to start trimming pending moves, before camera processes deem
+                                           # storage situation critical (which happens at 1GB)
+        kMinFreeSpaceMB       = 2*1024     # require at least 2GB left, before we remove files
+                                           # which previously failed to move to permanent storage location
+        return not checkFreeSpace(self._tmpDir, kMinFreeSpaceMB, kMinFreePercentageSys, None)
+
+
+    ###########################################################
+    def _removeTmpFile(self, targetPath, loc, src, reason):
+        """Give up on moving a tmp video, and forget about its time period.
+
+        @param  targetPath  The path the file was to be moved to, relative to
+                            the video dir.
+        @param  loc         The camera location of the file.
+        @param  src         The path of the tmp file.
+        @param  reason      Why we're giving up, for the log.
+        """
+        # If it hasn't been moved in the time we allocated, delete the
+        # file and remove the associated time period from the databases.
+        self._logger.info("Removing tmp file %s due to %s" % (ensureUtf8(src), reason))
+        del self._pendingFileMoves[targetPath]
+        try:
+            os.remove(src)
+        except Exception:
+            self._logger.info("Queuing file for deletion: %s" % ensureUtf8(src))
+            self._putMsgDC([MessageIds.msgIdDeleteFile, src])
+        start, stop = \
+            self._clipManager.getFileTimeInformation(targetPath.lower())
+        if start != -1:
+            # Remove these times from the object database.
+            self._dataManager.deleteCameraLocationDataBetween(
+                                                    loc, start, stop)
+            # Remove this file from the clip database.
+            self._clipManager.removeClip(targetPath.lower())
 
 
     ###########################################################
@@ -81,6 +81,15 @@ if sys.platform=='darwin':
         p.start()
         return p
 
+    def doRunCameraWorker(*args):
+        import CameraWorker
+        CameraWorker.runCameraWorker(*args)
+
+    def startCameraWorker(*args):
+        p = Process(target=doRunCameraWorker, args=args)
+        p.start()
+        return p
+
     def startDiskCleaner(*args):
         from DiskCleaner import runDiskCleaner
         p = Process(target=runDiskCleaner, args=args)
@@ -131,6 +140,14 @@ else:
         p.start()
         return p
 
+    def runCameraWorker(*args):
+        import CameraWorker
+        CameraWorker.runCameraWorker(*args)
+    def startCameraWorker(*args): #PYCHECKER OK: redefining attribute startCameraWorker
+        p = Process(target=runCameraWorker, args=args)
+        p.start()
+        return p
+
     def runDiskCleaner(*args):
         import DiskCleaner
         DiskCleaner.runDiskCleaner(*args)
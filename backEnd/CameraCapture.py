@@ -45,6 +45,7 @@ Contains the CameraCapture class.
 
 # Python imports...
 import os, glob
+import json
 import sys
 import time
 import collections
@@ -60,9 +61,13 @@ from vitaToolbox.networking.WsgiServer import makeServerAddressInfos
 from vitaToolbox.listUtils.RandomRange import randomRange
 from vitaToolbox.strUtils.EnsureUnicode import simplifyString, ensureUtf8
 from vitaToolbox.path.GetDiskSpaceAvailable import checkFreeSpace
+from vitaToolbox.threading.ReadyWaiter import ReadyWaiter
+from vitaToolbox.profiling.ObjectCensus import CensusSampler, reportCensus
+from vitaToolbox.sysUtils.TimeUtils import getMonotonicTime
 
 # Local imports...
 from appCommon.CommonStrings import kRemoteFolder, isLocalCamera, kMinFreeSysDriveSpaceMB
+from appCommon.CommonStrings import kCameraDiskSpaceReason
 from ClipManager import ClipManager
 import MessageIds
 from QueuedDataManagerCloud import QueuedDataManagerCloud
@@ -79,6 +84,9 @@ from BackEndPrefs import kLiveEnableTimestamp, kLiveEnableTimestampDefault, kLiv
 from BackEndPrefs import kLiveEnableFastStart, kLiveEnableFastStartDefault, kGenThumbnailResolution, kGenThumbnailResolutionDefault
 from BackEndPrefs import kClipMergeThreshold, kClipMergeThresholdDefault
 from DebugLogManager import DebugLogManager
+from HeartbeatTable import kStateRunning, kStateIdle, kStateExiting
+from OverloadGovernor import kShedSampling, kShedBackground
+from TimeBase import TimeBase, StampedClipManager
 
 def OB_KEYARG(a): return a
 
@@ -109,6 +117,11 @@ _kLiveStreamTimeoutSecs = 10
 # The frequency at which we ping the back end to inform that we're still alive
 _kPingSecInterval = 120
 
+# How long a replacement waits on standby for the back end to let it take
+# over, in seconds, and how often it checks meanwhile.
+_kStandbySecs = 60
+_kStandbyPollSecs = .02
+
 # For webcams, we skip the pipeline processing for this many initial frames.
 # This avoids tracking initial AWB and AE changes caused by camera startup.
 _kLocalCamFramesToSkip = 25
@@ -139,6 +152,28 @@ _kWsgiShutdownTimeout = 5
 # How often we check current drive utilization limits
 _kFreeSpaceCheckInterval = 30
 
+# How often we check whether live streams should be started or stopped, in
+# seconds, if nobody asks sooner.
+_kLiveStreamCheckInterval = 1
+
+# How long to wait for a frame, in seconds.  We guess when the next frame is
+# due from how they've been coming in, sleep through most of the gap, then
+# look every _kMinFrameWait.  If the frame is very late we wait twice as long
+# each time up to the maximum, so that a stream that stopped costs few wake
+# ups.
+_kMinFrameWait = .005
+_kMaxFrameWait = .1
+_kFrameDueFraction = .9
+
+# What to expect between frames until we know better, in seconds, and the
+# longest gap that's still used to learn from.
+_kDefaultFrameInterval = .1
+_kMaxFrameInterval = 1
+
+# The most seconds to wait between retries to open a stream without telling
+# the back end we're alive.
+_kOpenRetryBeatSecs = 10
+
 # Triggers a warning if we get more than that between frame arrival or timestamps
 _kFrameWarningTimeout = 1000
 
@@ -146,11 +181,16 @@ _kFrameWarningTimeout = 1000
 _kMemoryStatsInterval = 15*60*1000
 
 # Message when we drop camera connection due to insufficient space
-_kDiskSpaceMessage = "Low disk space on system volume"
+_kDiskSpaceMessage = kCameraDiskSpaceReason
+
+# While the back end is overloaded, only every this many frames go to
+# analytics; the others are interpolated, like dummy frames.
+_kShedSamplingStride = 2
 
 ###############################################################
 def runCapture(msgQueue, cameraPipe, dataMgrPipe, dataMgrId, cameraLocation, #PYCHECKER OK: Function has too many arguments
-               cameraUri, clipMgrPath, tmpPath, archivePath, userDir, extras):
+               cameraUri, clipMgrPath, tmpPath, archivePath, userDir, extras,
+               heartbeat=None, host=None):
     """Create and start a CameraCapture process.
 
     @param  msgQueue        A queue to add received commands to.
@@ -166,12 +206,50 @@ def runCapture(msgQueue, cameraPipe, dataMgrPipe, dataMgrId, cameraLocation, #PY
                             be stored.
     @param  userDir         Directory where user data should be stored
     @param  extras          A dict of configuration values.
+    @param  heartbeat       A HeartbeatWriter to show we're alive with, or
+                            None to send pings instead.
+    @param  host            The CameraWorker running us on one of its threads,
+                            or None if we have the process to ourselves.
     """
     camera = CameraCapture(msgQueue, cameraPipe, dataMgrPipe, dataMgrId,
                            cameraLocation, cameraUri, clipMgrPath, tmpPath,
-                           archivePath, userDir, extras)
+                           archivePath, userDir, extras, heartbeat, host)
     camera.run()
 
+
+###############################################################
+def createWsgiServer(app, notify, logger, threadPoolSize=20):
+    """ Creates a WSGI server instance for camera requests. The task of
+    starting it (and shutting it down is left the caller. Notice that after
+    launching it the server will a (hopefully) short period of time to become
+    ready to handle HTTP requests.
+
+    @param  app             The WSGI application.
+    @param  notify          Called with the server address once it's up.
+    @param  logger          The logger to use.
+    @param  threadPoolSize  Number of request processing threads to run.
+    @return  The new server instance.
+    """
+    # the port gets picked randomly out of a certain range
+    serverAddressInfos = makeServerAddressInfos( [0],
+        _kWsgiServerPortOpenDelay,
+        _kWsgiServerPortOpenLoopDelay,
+        _kWsgiServerAddress)
+
+    # NOTE: choosing the server name explicitly solves an odd issue we
+    #       encounter at least under OSX 10.6 where the call to getfqdn() in
+    #       the server bind method caused issues with network connectivity,
+    #       reaching from not being able to talk to the camera to sending
+    #       messages to the backend via the pipe stalling ...
+    serverNameOverride = "localhost"
+
+    return WsgiServer(serverAddressInfos,
+                      app,
+                      notify,
+                      sharedLogger = logger,
+                      threadPoolSize = threadPoolSize,
+                      serverName = serverNameOverride)
+
 ##############################################################################
 class OutOfSpaceException(Exception):
     pass
@@ -185,7 +263,7 @@ class CameraCapture(object):
     ###########################################################
     def __init__(self, msgQueue, cameraPipe, dataMgrPipe, dataMgrId, #PYCHECKER OK: Function has too many arguments
                  cameraLocation, cameraUri, clipMgrPath, tmpPath, archivePath,
-                 userDir, extras):
+                 userDir, extras, heartbeat=None, host=None):
         """Initialize CameraCapture.
 
         @param  msgQueue        A queue to add received commands to.
@@ -201,6 +279,14 @@ class CameraCapture(object):
                                 should be stored.
         @param  userDir         Directory where user data should be stored
         @param  extras          A dict of configuration values.
+        @param  heartbeat       A HeartbeatWriter to show we're alive with, or
+                                None to send pings instead.
+        @param  host            The CameraWorker running us on one of its
+                                threads, or None if we have the process to
+                                ourselves.  The host owns the things there's
+                                only one of per process: stdout/stderr, FFmpeg
+                                logging, forced quit handling, the memory
+                                limit and the WSGI server.
         """
         # Call the superclass constructor.
         super(CameraCapture, self).__init__()
@@ -211,14 +297,23 @@ class CameraCapture(object):
         self._userLocalDataDir = userDir
         self._logDir = os.path.join(self._userLocalDataDir, "logs", "cameras")
         self._logger = getLogger(cameraLocation + '.log', self._logDir)
-        self._logger.grabStdStreams()
+        self._host = host
+        if host is None:
+            self._logger.grabStdStreams()
 
         assert type(userDir) == unicode
         assert type(clipMgrPath) == unicode
 
         self._lastMemoryStats = 0
+
+        # Logs what grows in this process every so many seconds, if asked;
+        # a host does it for all of its cameras.
+        self._censusSampler = CensusSampler(self._logger,
+                getDebugPrefAsInt("objectCensusSecs", 0, userDir))
+
         self._lastFreeSpaceCheck = 0
         self._cleaningUp = False
+        self._quitRequested = False
         self._userDir = userDir
 
         self._queue = msgQueue
@@ -229,11 +324,21 @@ class CameraCapture(object):
         self._archivePath = archivePath
 
         self._extras = extras
+
+        # True if we replace an older process of this camera, which runs until
+        # we take over; see _runStandby().  True in the older one once it's
+        # told to leave things to us.
+        self._standby = extras.get('standby', False)
+        self._handingOver = False
+
         width, height = extras.get('recordSize', (320, 240))
         self._liveImageMemorySize = width*height*3
 
         self._runner = None
         self._ms = 0
+        # When the last frame came in, in ms on the monotonic clock, so that
+        # the wall clock stepping doesn't make the stream look timed out.
+        self._lastFrameArrivalMs = 0
         self._finishedProcessingMs = 0
         self._nInitialFramesSkipped = 0
 
@@ -248,9 +353,26 @@ class CameraCapture(object):
         self._clipMgr.open(clipMgrPath)
         self._clipMgrLock = threading.RLock()
 
+        # Stamps frames, and the clips the stream reader adds, so that they
+        # stay after everything recorded before even if the clock steps.
+        mostRecentMs = self._clipMgr.getMostRecentTimeAt(cameraLocation)
+        if mostRecentMs is None or mostRecentMs < 0:
+            mostRecentMs = None
+        self._timeBase = TimeBase(self._logger, mostRecentMs)
+
         self._wsgiServer = None
         self._wsgiServerMessages = collections.deque()
 
+        # Waits for messages from the back end, and is woken up by other
+        # threads that have something for our loop.
+        self._waiter = ReadyWaiter(cameraPipe)
+        self._nextLiveStreamCheck = 0
+
+        # When the last frame came in, and the usual time between frames.
+        self._lastFrameArrival = None
+        self._frameInterval = _kDefaultFrameInterval
+        self._frameWait = _kMinFrameWait
+
         self._hasMmap = False
 
         self._liveViewFile = os.path.join(userDir, 'live',
@@ -283,7 +405,8 @@ class CameraCapture(object):
         self._streamReaderOpened = False
         self._streamReaderLock = threading.RLock()
         self._streamReader = StreamReader(cameraLocation,
-                                                       self._clipMgr, self._clipMgrLock, tmpPath,
+                                                       StampedClipManager(self._clipMgr, self._timeBase),
+                                                       self._clipMgrLock, tmpPath,
                                                        archivePath, userDir,
                                                        self._logger.getCLogFn(),
                                                        True, self._moveFailed,
@@ -298,8 +421,10 @@ class CameraCapture(object):
         # even if nothing is going on...
         self._lastNotifyMs = 0
 
-        # Track the we last pinged the back end
+        # Track the we last pinged the back end; only needed if we have no
+        # heartbeat slot.
         self._lastPingTime = 0
+        self._heartbeat = heartbeat
 
         # NOTE: this is wrong because we leave it up to the caller to pass in
         #       the file name for the camera, which must always be the same, or
@@ -317,11 +442,19 @@ class CameraCapture(object):
         self._lastFrameTime = None
         self._lastFrameTimestamp = None
 
-        self._cleanupTmpStorage()
+        # The process we replace may still be writing there.
+        if not self._standby:
+            self._cleanupTmpStorage()
 
         self._framesProcessed = 0
         self._framesInterpolated = 0
 
+        # How many frames go to analytics for each one that does, and how
+        # many frames we got since the last one did.
+        self._samplingStride = 1
+        self._framesSinceSampled = 0
+        self._setLoadShedding(extras.get('loadShedding', []))
+
 
 
     ###########################################################
@@ -338,6 +471,8 @@ class CameraCapture(object):
         except Exception:
             pass
 
+        self._waiter.close()
+
     ###########################################################
     def _cleanupTmpStorage(self):
         """ Delete all files in our tmp directory, except those for which
@@ -362,6 +497,7 @@ class CameraCapture(object):
     def _openStream(self):
         """Attempt to open the stream"""
         self._logger.info("Beginning stream open")
+        self._setHeartbeatState(kStateIdle)
         self._timingInfo.associateKeys({ 'videoPath' : self._cameraLocation, 'source' : 'CameraCapture' })
         retry = 0
 
@@ -399,12 +535,16 @@ class CameraCapture(object):
                 oldURI = self._cameraUri
                 while sleepTime >= 0 and \
                         self._cameraUri == oldURI:
-                    if self._pipe.poll(sleepTime):
-                        while(self._pipe.poll()):
-                            msg = self._pipe.recv()
-                            self._processMessage(msg)
-                            if not self._running:
-                                return
+                    self._waiter.wait(min(sleepTime, _kOpenRetryBeatSecs))
+                    while(self._pipe.poll()):
+                        msg = self._pipe.recv()
+                        self._processMessage(msg)
+                        if not self._running:
+                            return
+                    if self._quitRequested:
+                        self._processMessage([MessageIds.msgIdQuit])
+                        return
+                    self._beat()
                     sleepTime = sleepTill - time.time()
             except Exception:
                 self._logger.warning("Camera open exception", exc_info=True)
@@ -420,6 +560,14 @@ class CameraCapture(object):
                                     str(retry) + " retries")
 
         self._logger.info("Stream open successful")
+        self._onStreamOpened()
+
+
+    ###########################################################
+    def _onStreamOpened(self):
+        """Get going once the stream is open."""
+        self._setHeartbeatState(kStateRunning)
+        self._beat(1)
 
         self._streamReaderLock.acquire()
         self._streamReaderOpened = True
@@ -435,6 +583,10 @@ class CameraCapture(object):
         # Prevent a cleanup from executing if we don't have a frame ready on
         # the first call to _processFrame
         self._ms = time.time()*1000
+        self._lastFrameArrivalMs = getMonotonicTime()*1000
+
+        # Whatever the stream gives us now goes in new clips.
+        self._timeBase.newSegment()
 
         self._nInitialFramesSkipped = 0
 
@@ -442,6 +594,48 @@ class CameraCapture(object):
         self._runner = VideoPipeline(self._cameraLocation, self._queuedDataMgr)
 
 
+    ###########################################################
+    def _runStandby(self):
+        """Open the stream and wait to take over from the camera's old process.
+
+        The old process keeps going until we have the stream, so that
+        replacing it leaves only the time the back end takes to switch us
+        without video.  Frames we get meanwhile are dropped; the old process
+        still analyzes them.  If the stream won't open, maybe because the
+        camera takes just one client, we give up right away and the back end
+        restarts the camera the usual way instead.
+
+        @return tookOver  True if we took over, False if we should quit.
+        """
+        self._logger.info("Opening stream on standby")
+        self._setHeartbeatState(kStateIdle)
+        if self._streamReader.open(self._cameraUri, self._extras):
+            self._queue.put([MessageIds.msgIdCameraStandbyReady,
+                             self._cameraLocation])
+
+            deadline = time.time() + _kStandbySecs
+            while time.time() < deadline and not self._quitRequested:
+                self._streamReader.getNewFrame(False)
+                self._beat()
+                if self._pipe.poll(_kStandbyPollSecs):
+                    msg = self._pipe.recv()
+                    if msg[0] == MessageIds.msgIdCameraTakeOver:
+                        self._logger.info("Taking over from the old process")
+                        self._standby = False
+                        return True
+                    self._processMessage(msg)
+                    if not self._running:
+                        return False
+            self._logger.warn("Never told to take over, quitting")
+        else:
+            self._logger.warn("Couldn't open stream on standby")
+
+        self._queue.put([MessageIds.msgIdCameraStandbyFailed,
+                         self._cameraLocation])
+        self._processMessage([MessageIds.msgIdQuit])
+        return False
+
+
     ###########################################################
     def run(self):
         try:
@@ -456,6 +650,25 @@ class CameraCapture(object):
             self._logger.error(traceback.format_exc(t))
             self._logger.error(e)
 
+    ###########################################################
+    def _beat(self, progress=0):
+        """Let the back end know we're alive, if it gave us a heartbeat.
+
+        @param  progress  The number of frames processed since the last beat.
+        """
+        if self._heartbeat is not None:
+            self._heartbeat.beat(progress)
+
+    ###########################################################
+    def _setHeartbeatState(self, state):
+        """Let the back end know what we're up to, if it gave us a heartbeat.
+
+        @param  state  One of the HeartbeatTable kState constants; progress is
+                       only expected in kStateRunning.
+        """
+        if self._heartbeat is not None:
+            self._heartbeat.setState(state)
+
     ###########################################################
     def _checkFreeSpace(self):
         kMinFreePercentage    = 0                           # do not limit storage dir based on percentage ... only on absolute value
@@ -466,13 +679,15 @@ class CameraCapture(object):
     ###########################################################
     def _run(self):
         """Run a camera capture process."""
-        self.__callbackFunc = registerForForcedQuitEvents(self._cleanup)
-
-        # Start with FFmpeg logging.
-        ffmpegLog = FFmpegLog("videolib", "FFMPEG >> ")
-        res = ffmpegLog.open(self._logger.log, 100)
-        if res:
-            self._logger.warn("FFmpeg logging not working (%d)" % res)
+        ffmpegLog = None
+        if self._host is None:
+            self.__callbackFunc = registerForForcedQuitEvents(self._cleanup)
+
+            # Start with FFmpeg logging.
+            ffmpegLog = FFmpegLog("videolib", "FFMPEG >> ")
+            res = ffmpegLog.open(self._logger.log, 100)
+            if res:
+                self._logger.warn("FFmpeg logging not working (%d)" % res)
         ffmpegLogDrops = 0
 
         # Set running to True; this doesn't mean we've opened the stream yet,
@@ -480,42 +695,74 @@ class CameraCapture(object):
         self._running = True
 
         # Open the stream; will set self._running to False if needed...
-        self._openStream()
+        if not self._standby:
+            self._openStream()
+        elif self._runStandby():
+            self._onStreamOpened()
 
         # Only now we can actually think about running the WSGI server. This
         # will not block, the server runs completely in its own thread, which
-        # we have to start.
-        self._wsgiServer = self._createWsgiServer()
-        self._wsgiServer.start()
+        # we have to start.  A host has one server for all of its cameras.  A
+        # replacement that never took over leaves the endpoint to the old
+        # process.
+        if self._standby:
+            self._running = False
+        elif self._host is None:
+            self._wsgiServer = createWsgiServer(self._wsgiApp,
+                                                self._wsgiServerNotify,
+                                                self._logger)
+            self._wsgiServer.start()
+        else:
+            self._host.addWsgiApp(self._m3u8FileBase, self._wsgiApp,
+                                  self._wsgiServerNotify)
 
         # Enter the main loop
         while(self._running):
             try:
                 # Ping the back end if necessary
                 now = time.time()
-                if now > self._lastPingTime+_kPingSecInterval:
+                if self._heartbeat is None and \
+                   now > self._lastPingTime+_kPingSecInterval:
                     self._lastPingTime = now
                     self._queue.put([MessageIds.msgIdCameraCapturePing,
                                     self._streamReader.locationName])
 
                 # Process the next frame
-                if not self._processFrame():
-                    time.sleep(.04)
+                gotFrame = self._processFrame()
+                self._beat(1 if gotFrame else 0)
 
                 # Flush the FFmpeg logs
-                ffmpegLogDrops += ffmpegLog.flush()
+                if ffmpegLog is not None:
+                    ffmpegLogDrops += ffmpegLog.flush()
+
+                # If there was no frame, wait until the next one is due, or
+                # until the back end or one of our other threads wants
+                # something, whichever comes first.
+                waitTime = 0
+                if not gotFrame:
+                    waitTime = min(self._getFrameWait(getMonotonicTime()),
+                                   self._nextLiveStreamCheck - now)
+                woken = self._waiter.wait(waitTime)
 
                 # Process all pending messages
                 while(self._running and self._pipe.poll()):
                     msg = self._pipe.recv()
                     self._processMessage(msg)
 
+                # Our host may want us gone, e.g. to get its memory back.
+                if self._running and self._quitRequested:
+                    self._processMessage([MessageIds.msgIdQuit])
+
                 # Do not attempt to do anything else if told to quit
                 if not self._running:
                     break
 
-                # Check our live stream lifetime
-                self._checkLiveStream()
+                # Check our live stream lifetime, right away if somebody just
+                # asked for one.
+                now = time.time()
+                if woken or now >= self._nextLiveStreamCheck:
+                    self._nextLiveStreamCheck = now + _kLiveStreamCheckInterval
+                    self._checkLiveStream()
 
                 # Make sure we're not filling up drive space
                 if (now - self._lastFreeSpaceCheck) > _kFreeSpaceCheckInterval:
@@ -525,6 +772,9 @@ class CameraCapture(object):
                                          _kDiskSpaceMessage])
                         raise OutOfSpaceException("Terminating camera due to low disk space")
 
+                if self._host is None:
+                    self._censusSampler.update(now)
+
                 # Send all WSGI messages up to the backend
                 try:
                     while self._running:
@@ -541,6 +791,12 @@ class CameraCapture(object):
                 self._logger.warning("Camera exception", exc_info=True)
                 self._running = False
 
+        self._setHeartbeatState(kStateExiting)
+
+        if self._host is not None:
+            self._host.removeWsgiApp(self._m3u8FileBase)
+            return
+
         # Finish FFmpeg logging
         ffmpegLogDrops += ffmpegLog.flush()
         ffmpegLog.close()
@@ -578,6 +834,12 @@ class CameraCapture(object):
                 self._running = False
                 if msgId == MessageIds.msgIdQuitWithResponse:
                     self._queue.put(msg[1])
+            elif msgId == MessageIds.msgIdCameraHandOver:
+                self._logger.info("Handing over to our replacement")
+                self._handingOver = True
+                if not ignoreCleanups:
+                    self._cleanup()
+                self._running = False
             elif msgId == MessageIds.msgIdAnalyticsPortChanged:
                 self._analyticsPort = msg[1]
                 self._logger.info("Analytics port had changed to %d" % msg[1] )
@@ -639,6 +901,8 @@ class CameraCapture(object):
 
             elif msgId == MessageIds.msgIdSetDebugConfig:
                 self._debugLogManager.SetLogConfig(msg[1])
+            elif msgId == MessageIds.msgIdSetLoadShedding:
+                self._setLoadShedding(msg[1])
             elif msgId == MessageIds.msgIdSetAudioVolume:
                 self._streamReader.setAudioVolume(msg[1])
             elif msgId == MessageIds.msgIdCameraUriUpdated:
@@ -665,6 +929,7 @@ class CameraCapture(object):
 
         frame = self._streamReader.getNewFrame(self._liveViewEnabled)
         currentTimeMs = int(time.time()*1000)
+        arrivalMs = getMonotonicTime()*1000
 
         # Drop something in the log, if we've spent too much time without seeing a frame
         if self._lastFrameTime is not None:
@@ -678,20 +943,32 @@ class CameraCapture(object):
             if not self._streamReader.isRunning:
                 self._logger.warning("Stream not running")
                 self._cleanup(True, False)
-                self._openStream()
-            elif currentTimeMs > self._ms+_kTimeout:
-                self._logger.warning("Stream timeout time=%d lastFrameTime=%s last=%d" %
-                                    (currentTimeMs, str(self._lastFrameTime), self._ms))
+                if self._running:
+                    self._openStream()
+            elif arrivalMs > self._lastFrameArrivalMs+_kTimeout:
+                self._logger.warning("Stream timeout time=%d lastFrameTime=%s waited=%d" %
+                                    (currentTimeMs, str(self._lastFrameTime), arrivalMs-self._lastFrameArrivalMs))
                 self._cleanup(True, False)
                 #self._queue.put([MessageIds.msgIdStreamTimeout,
                 #                 self._cameraLocation])
-                self._openStream()
+                if self._running:
+                    self._openStream()
             self._timingInfo.inputItemIncrement( 'capture.ANoFrame' )
             return False
 
         self._timingInfo.inputIncrement( int( 1 ))
+        self._noteFrameArrival(arrivalMs/1000.)
+        self._lastFrameArrivalMs = arrivalMs
+
+        # If the clock stepped, finish the clip we're recording and start
+        # over, so that nothing straddles the step.
+        if self._timeBase.checkStep():
+            self._cleanup(True, False)
+            if self._running:
+                self._openStream()
+            return True
 
-        self._ms = frame.ms
+        self._ms = self._timeBase.stamp(frame.ms)
 
         if not self._hasMmap and self._liveViewEnabled:
             self._openSharedMemory(self._liveViewFile)
@@ -701,13 +978,13 @@ class CameraCapture(object):
             self._nInitialFramesSkipped < _kLocalCamFramesToSkip):
             self._nInitialFramesSkipped += 1
             self._timingInfo.inputItemIncrement( 'capture.BSkipped' )
-        elif frame.dummy:
+        elif frame.dummy or not self._shouldSample():
             # The frame was saved, but not given for analytics. We use it for interpolation
             self._framesInterpolated += 1
-            self._queuedDataMgr.reportFrame(frame.ms)
+            self._queuedDataMgr.reportFrame(self._ms)
         else:
             self._framesProcessed += 1
-            self._queuedDataMgr.reportFrame(frame.ms, frame)
+            self._queuedDataMgr.reportFrame(self._ms, frame)
 
             self._timingInfo.inputItemIncrement( 'capture.CToNumpy' )
 
@@ -742,8 +1019,10 @@ class CameraCapture(object):
                     self._lastNotifyMs = processedMs
             self._timingInfo.inputItemIncrement( 'capture.DProcessed' )
 
-        # Report memory stats every 15 minutes
-        if (currentTimeMs - self._lastMemoryStats) > _kMemoryStatsInterval:
+        # Report memory stats every 15 minutes; a host checks for all of its
+        # cameras at once.
+        if self._host is None and \
+           (currentTimeMs - self._lastMemoryStats) > _kMemoryStatsInterval:
             memoryUnderLimit, memStats = checkMemoryLimit(os.getpid())
 
             if not memoryUnderLimit:
@@ -755,6 +1034,68 @@ class CameraCapture(object):
 
         return True
 
+    ###########################################################
+    def _setLoadShedding(self, actions):
+        """Shed work the back end asked us to, or take it up again.
+
+        @param  actions  A list of OverloadGovernor.kShedActions to take.
+        """
+        stride = _kShedSamplingStride if kShedSampling in actions else 1
+        if stride != self._samplingStride:
+            self._logger.info("Giving analytics 1 of every %d frames" % stride)
+            self._samplingStride = stride
+        self._queuedDataMgr.setThumbnailsPaused(kShedBackground in actions)
+
+
+    ###########################################################
+    def _shouldSample(self):
+        """Tell whether to give the next frame to analytics.
+
+        @return shouldSample  True to give it to analytics.
+        """
+        self._framesSinceSampled += 1
+        if self._framesSinceSampled < self._samplingStride:
+            return False
+        self._framesSinceSampled = 0
+        return True
+
+
+    ###########################################################
+    def _noteFrameArrival(self, now):
+        """Learn how often frames come in.
+
+        @param  now  The time the frame came in, in seconds; see
+                     getMonotonicTime().
+        """
+        if self._lastFrameArrival is not None:
+            gap = now - self._lastFrameArrival
+            if 0 < gap < _kMaxFrameInterval:
+                self._frameInterval = .8*self._frameInterval + .2*gap
+        self._lastFrameArrival = now
+        self._frameWait = _kMinFrameWait
+
+
+    ###########################################################
+    def _getFrameWait(self, now):
+        """Return how long to wait for the next frame.
+
+        @param  now       The current time, in seconds; see getMonotonicTime().
+        @return waitTime  Seconds to wait before asking for a frame again.
+        """
+        if self._lastFrameArrival is not None:
+            sinceLast = now - self._lastFrameArrival
+            untilDue = _kFrameDueFraction*self._frameInterval - sinceLast
+            if untilDue >= _kMinFrameWait:
+                return min(untilDue, _kMaxFrameWait)
+            if sinceLast < 2*self._frameInterval:
+                return _kMinFrameWait
+
+        # The frame is very late, or we don't know when to expect one.
+        waitTime = self._frameWait
+        self._frameWait = min(2*waitTime, _kMaxFrameWait)
+        return waitTime
+
+
     ###########################################################
     def _flushPipeline(self):
         # Close the pipeline runner first.  It is important to do this in
@@ -836,7 +1177,26 @@ class CameraCapture(object):
 
         self._streamReader.close(termFunc)
         self._logger.info("stream reader closed")
-        self._removeM3U8All()
+
+        # Our replacement, or the process we were to replace, serves live
+        # streams from the same files.
+        if not self._handingOver and not self._standby:
+            self._removeM3U8All()
+
+
+    ###########################################################
+    def cleanup(self):
+        """Ensure all data has been written; for a host being forced to quit.
+        """
+        self._cleanup()
+
+
+    ###########################################################
+    def requestQuit(self):
+        """Ask us to quit as soon as we can; may be called from any thread.
+        """
+        self._quitRequested = True
+        self._waiter.wake()
 
 
     ###########################################################
@@ -916,9 +1276,16 @@ class CameraCapture(object):
             pass
 
         # If we got confirmation, or we broke somehow, go ahead and give
-        # permission to terminate us.
+        # permission to terminate us.  A host can't be terminated for just one
+        # of its cameras, so instead we stop once the stream reader is closed;
+        # the host has to know before the back end does.
+        if self._host is not None:
+            self._host.allowTermination(self)
+            self._running = False
         self._queue.put([MessageIds.msgIdSetTerminate,
                          self._cameraLocation])
+        if self._host is not None:
+            return
 
         # Sleep, we're assuming we won't return from the close
         # most of the time on windows, so we ensure that we don't
@@ -1080,6 +1447,26 @@ class CameraCapture(object):
         return jpeg
 
 
+    ###########################################################
+    def _wsgiAppCensus(self, environ, startResponse):
+        """ WSGI handler telling what this process holds on to, to find
+        leaks; see ObjectCensus.reportCensus().  Counts are for the whole
+        process, which may run other cameras too.  Passing "sample=<n>"
+        counts only every n-th object.
+
+        @param  environ        The request information, CGI style.
+        @param  startResponse  The WSGI response sender.
+        """
+        query = cgi.parse_qs(environ.get('QUERY_STRING', ''))
+        sampleStride = max(1, int(query.get("sample", [1])[0]))
+        report = json.dumps(reportCensus(sampleStride))
+        startResponse('200 OK',
+               [('Content-Type' , 'application/json'),
+                ('Content-Length', str(len(report))),
+                ('Cache-Control', 'no-cache, no-store, must-revalidate')])
+        return report
+
+
     ###########################################################
     def _wsgiAppStreaming(self, environ, startResponse):
         """ WSGI handler for streaming video initiation and continuation. The
@@ -1133,6 +1520,11 @@ class CameraCapture(object):
         self._m3u8StreamingProfiles[profileId] = (filePath, time.time(), streamActiveFlag)
         self._m3u8Lock.release()
 
+        # Have the main loop start the stream now, rather than on its next
+        # regular check.
+        if not streamActiveFlag:
+            self._waiter.wake()
+
         waited = 0
         if not streamActiveFlag:
             # wait a bit for the file to show up, instead of just asking for a
@@ -1203,10 +1595,13 @@ class CameraCapture(object):
                     ('Content-Length', str(len(errorText)))])
                 yield errorText
             else:
-                if path == "/image.jpg":
+                if path == "/image.jpg" or \
+                   path == "/" + self._m3u8FileBase + ".jpg":
                     yield self._wsgiAppImage(environ, startResponse)
                 elif path.endswith(".m3u8"):
                     yield self._wsgiAppStreaming(environ, startResponse)
+                elif path == "/" + self._m3u8FileBase + ".census":
+                    yield self._wsgiAppCensus(environ, startResponse)
                 else:
                     errorText = "unknown request path '%s'" % path
                     startResponse('404 WRONG PATH',
@@ -1235,32 +1630,4 @@ class CameraCapture(object):
         msg = [MessageIds.msgIdWsgiPortChanged,
                self._cameraLocation, currentAddress[1]]
         self._wsgiServerMessages.append(msg)
-
-
-    ###########################################################
-    def _createWsgiServer(self):
-        """ Creates a WSGI server instance. The task of starting it (and
-        shutting it down is left the caller. Notice that after launching it the
-        server will a (hopefully) short period of time to become ready to
-        handle HTTP requests.
-
-        @return  The new server instance.
-        """
-        # the port gets picked randomly out of a certain range
-        serverAddressInfos = makeServerAddressInfos( [0],
-            _kWsgiServerPortOpenDelay,
-            _kWsgiServerPortOpenLoopDelay,
-            _kWsgiServerAddress)
-
-        # NOTE: choosing the server name explicitly solves an odd issue we
-        #       encounter at least under OSX 10.6 where the call to getfqdn() in
-        #       the server bind method caused issues with network connectivity,
-        #       reaching from not being able to talk to the camera to sending
-        #       messages to the backend via the pipe stalling ...
-        serverNameOverride = "localhost"
-
-        return WsgiServer(serverAddressInfos,
-                          self._wsgiApp,
-                          self._wsgiServerNotify,
-                          sharedLogger = self._logger,
-                          serverName = serverNameOverride)
+        self._waiter.wake()
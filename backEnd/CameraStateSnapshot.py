@@ -0,0 +1,368 @@
+#!/usr/bin/env python
+
+#*****************************************************************************
+#
+# CameraStateSnapshot.py
+#     Versioned state of cameras and rules, for remote clients.
+#
+#
+#*****************************************************************************
+#
+#
+# Copyright 2013-2022 Sighthound, Inc.
+#
+# Licensed under the GNU GPLv3 license found at
+# https://www.gnu.org/licenses/gpl-3.0.txt
+#
+# Alternative licensing available from Sighthound, Inc.
+# by emailing opensource@sighthound.com
+#
+# This file is part of the Sighthound Video project which can be found at
+# https://github.com/sighthoundinc/SighthoundVideo
+#
+# This program is free software; you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation; using version 3 of the License.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program; if not, write to the Free Software
+# Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02111, USA.
+#
+#
+#*****************************************************************************
+
+"""
+## @file
+Contains the CameraStateSnapshot class.
+"""
+
+# Python imports...
+import collections
+import random
+import threading
+import time
+
+# Common 3rd-party imports...
+
+# Toolbox imports...
+
+# Local imports...
+
+# How many removals to remember.  Clients further behind than that get the
+# whole snapshot again.
+_kKeepRemoved = 256
+
+
+###############################################################
+class CameraStateSnapshot(object):
+    """Keeps one entry (a dict) per camera, and a version number which goes
+    up whenever an entry changes.
+
+    Whoever changes a camera calls update() with its new entry; entries that
+    come out the same don't make a new version.  Clients get everything once,
+    then ask for just what changed since the version they have, optionally
+    waiting for something to change.  Entries are never modified after being
+    handed to update(), so they can be given out without copying.
+
+    Versions also name the snapshot they came from, so clients holding one
+    of an earlier back end get everything again, instead of changes which
+    don't apply to what they have.
+    """
+    ###########################################################
+    def __init__(self, longPoll, keepRemoved=_kKeepRemoved, snapshotId=None):
+        """Initializer for CameraStateSnapshot
+
+        @param  longPoll     The LongPoll limiting how many clients wait, and
+                             for how long.
+        @param  keepRemoved  How many removals to remember.
+        @param  snapshotId   Tells this snapshot apart from others in the
+                             versions it gives out; None for a random one.
+        """
+        self._longPoll = longPoll
+        self._keepRemoved = keepRemoved
+
+        # Tells this snapshot apart from ones of earlier back ends.
+        if snapshotId is None:
+            snapshotId = "%08x" % random.getrandbits(32)
+        self._snapshotId = snapshotId
+
+        # Guards everything below; waiters wait on it.
+        self._cond = threading.Condition()
+
+        self._version = 0
+
+        # Key to (version, entry), where version is the one it last changed in.
+        self._entries = {}
+
+        # Names of removed entries, oldest first, as (version, name).  We know
+        # of every removal after _floorVersion.
+        self._removed = collections.deque()
+        self._floorVersion = 0
+
+        # All entries as a list, made when first asked for after a change.
+        self._snapshot = []
+        self._snapshotVersion = 0
+
+        self._running = True
+
+
+    ###########################################################
+    def shutdown(self):
+        """Release all waiters."""
+        self._cond.acquire()
+        try:
+            self._running = False
+            self._cond.notifyAll()
+        finally:
+            self._cond.release()
+
+
+    ###########################################################
+    def update(self, key, entry):
+        """Set the entry of a camera.
+
+        @param  key      The camera's key.
+        @param  entry    A dict with at least a 'name'; None removes it.
+        @return changed  True if this made a new version.
+        """
+        self._cond.acquire()
+        try:
+            _, oldEntry = self._entries.get(key, (None, None))
+            if entry == oldEntry:
+                return False
+
+            self._version += 1
+            if entry is None:
+                del self._entries[key]
+            else:
+                self._entries[key] = (self._version, entry)
+
+            # Clients know cameras by name, so a new name is a removal too.
+            if oldEntry is not None and \
+               (entry is None or entry['name'] != oldEntry['name']):
+                self._removed.append((self._version, oldEntry['name']))
+                while len(self._removed) > self._keepRemoved:
+                    self._floorVersion = self._removed.popleft()[0]
+
+            self._cond.notifyAll()
+            return True
+        finally:
+            self._cond.release()
+
+
+    ###########################################################
+    def getKeys(self):
+        """Return the keys of all cameras.
+
+        @return keys  A list of keys.
+        """
+        self._cond.acquire()
+        try:
+            return self._entries.keys()
+        finally:
+            self._cond.release()
+
+
+    ###########################################################
+    def getSnapshot(self):
+        """Return all entries.
+
+        @return version  The current version; see getChanges().
+        @return entries  A list of all entries; don't modify it.
+        """
+        self._cond.acquire()
+        try:
+            if self._snapshotVersion != self._version:
+                self._snapshot = [entry for _, entry in
+                                  self._entries.itervalues()]
+                self._snapshotVersion = self._version
+            return self._makeVersion(self._version), self._snapshot
+        finally:
+            self._cond.release()
+
+
+    ###########################################################
+    def getChanges(self, version):
+        """Return what changed since the given version.
+
+        @param  version  The version the client has; -1 if none.
+        @return version  The current version, a string the client should
+                         just hand back next time.
+        @return changed  Entries that are new or changed.
+        @return removed  Names of entries that are gone.
+        @return isFull   True if changed has all entries, because the given
+                         version was too old, unknown or of another
+                         snapshot; the client should
+                         then drop everything it had.
+        """
+        self._cond.acquire()
+        try:
+            return self._getChanges(version)
+        finally:
+            self._cond.release()
+
+
+    ###########################################################
+    def wait(self, version, timeout):
+        """Wait for changes since the given version.
+
+        @param  version  The version the client has; -1 if none.
+        @param  timeout  Most seconds to wait; capped by the LongPoll.
+        @return changes  Like getChanges(); nothing changed if the version
+                         didn't go up.
+        """
+        seq = self._parseVersion(version)
+
+        self._cond.acquire()
+        try:
+            if seq is not None:
+                self._longPoll.wait(self._cond, lambda: not self._running or
+                                    self._version != seq, timeout)
+            return self._getChanges(version)
+        finally:
+            self._cond.release()
+
+
+    ###########################################################
+    def _getChanges(self, version):
+        """Return what changed since the given version; see getChanges().
+
+        Must be called with _cond held.
+        """
+        seq = self._parseVersion(version)
+        if seq is None or seq < self._floorVersion or seq > self._version:
+            return self._makeVersion(self._version), \
+                   [entry for _, entry in self._entries.itervalues()], [], True
+
+        changed = [entry for entryVersion, entry in self._entries.itervalues()
+                   if entryVersion > seq]
+        changedNames = set(entry['name'] for entry in changed)
+        removed = []
+        for removedVersion, name in reversed(self._removed):
+            if removedVersion <= seq:
+                break
+            if name not in changedNames and name not in removed:
+                removed.append(name)
+        return self._makeVersion(self._version), changed, removed, False
+
+
+    ###########################################################
+    def _makeVersion(self, seq):
+        """Return the version clients get for one of our version numbers.
+
+        @param  seq      The version number.
+        @return version  The version, naming this snapshot.
+        """
+        return "%s:%d" % (self._snapshotId, seq)
+
+
+    ###########################################################
+    def _parseVersion(self, version):
+        """Return our version number of a version a client handed back.
+
+        @param  version  The version the client has.
+        @return seq      The version number, or None if the version isn't
+                         one of this snapshot.
+        """
+        try:
+            snapshotId, seq = version.split(':')
+            if snapshotId == self._snapshotId:
+                return int(seq)
+        except (AttributeError, ValueError):
+            pass
+        return None
+
+
+
+##############################################################################
+def _testCameraStateSnapshot():
+    """Test keeping camera state.
+
+    >>> from vitaToolbox.threading.LongPoll import LongPoll
+    >>> snapshot = CameraStateSnapshot(LongPoll(4, 50), keepRemoved=2,
+    ...                                snapshotId='s')
+    >>> snapshot.update('a', {'name': 'a', 'status': 'on'})
+    True
+    >>> snapshot.update('b', {'name': 'b', 'status': 'off'})
+    True
+    >>> version, entries = snapshot.getSnapshot()
+    >>> version, sorted(entry['name'] for entry in entries)
+    ('s:2', ['a', 'b'])
+
+    The same entry again is not a change, and the snapshot isn't made again:
+
+    >>> snapshot.update('a', {'name': 'a', 'status': 'on'})
+    False
+    >>> snapshot.getSnapshot()[1] is entries
+    True
+
+    Clients get just what changed, including removals, and everything when
+    they don't have a version:
+
+    >>> snapshot.update('a', {'name': 'a', 'status': 'failed'})
+    True
+    >>> snapshot.getChanges('s:2')
+    ('s:3', [{'status': 'failed', 'name': 'a'}], [], False)
+    >>> snapshot.update('b', {'name': 'b (inactive)', 'status': 'off'})
+    True
+    >>> snapshot.getChanges('s:3')
+    ('s:4', [{'status': 'off', 'name': 'b (inactive)'}], ['b'], False)
+    >>> snapshot.update('a', None)
+    True
+    >>> snapshot.getChanges('s:3')
+    ('s:5', [{'status': 'off', 'name': 'b (inactive)'}], ['a', 'b'], False)
+    >>> snapshot.getChanges('s:5')
+    ('s:5', [], [], False)
+    >>> snapshot.getChanges(-1)
+    ('s:5', [{'status': 'off', 'name': 'b (inactive)'}], [], True)
+
+    Clients behind the removals we remember get everything too:
+
+    >>> snapshot.update('c', {'name': 'c'}); snapshot.update('c', None)
+    True
+    True
+    >>> snapshot.getChanges('s:3')
+    ('s:7', [{'status': 'off', 'name': 'b (inactive)'}], [], True)
+    >>> snapshot.getChanges('s:5')
+    ('s:7', [], ['c'], False)
+
+    Waiters wake up on changes, or wait out the timeout:
+
+    >>> _ = threading.Timer(.1, snapshot.update, ('d', {'name': 'd'})).start()
+    >>> start = time.time()
+    >>> snapshot.wait('s:7', 5), time.time() - start < 1
+    (('s:8', [{'name': 'd'}], [], False), True)
+    >>> start = time.time()
+    >>> snapshot.wait('s:8', .2), time.time() - start >= .15
+    (('s:8', [], [], False), True)
+
+    Versions of another snapshot, like one of an earlier back end, get
+    everything right away:
+
+    >>> start = time.time()
+    >>> version, changed, removed, isFull = snapshot.wait('t:8', 5)
+    >>> version, len(changed), isFull, time.time() - start < 1
+    ('s:8', 2, True, True)
+    >>> snapshot.getChanges('s:x')[3], snapshot.getChanges(8)[3]
+    (True, True)
+    >>> snapshot.shutdown()
+    """
+
+
+##############################################################################
+def test_main():
+    """OB_REDACT
+    Our main function, which runs test code
+    """
+    import doctest
+    doctest.testmod(verbose=True)
+
+
+##############################################################################
+if __name__ == '__main__':
+    test_main()
@@ -0,0 +1,1172 @@
+#!/usr/bin/env python
+
+#*****************************************************************************
+#
+# CameraWorker.py
+#    Worker processes that each run several cameras on their own threads
+#
+#
+#*****************************************************************************
+#
+#
+# Copyright 2013-2022 Sighthound, Inc.
+#
+# Licensed under the GNU GPLv3 license found at
+# https://www.gnu.org/licenses/gpl-3.0.txt
+#
+# Alternative licensing available from Sighthound, Inc.
+# by emailing opensource@sighthound.com
+#
+# This file is part of the Sighthound Video project which can be found at
+# https://github.com/sighthoundinc/SighthoundVideo
+#
+# This program is free software; you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation; using version 3 of the License.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program; if not, write to the Free Software
+# Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02111, USA.
+#
+#*****************************************************************************
+
+
+"""
+## @file
+Contains the CameraWorkerPool class, which runs cameras a few to a process,
+and the CameraWorker class, which is what runs in each of those processes.
+
+Every camera used to get a process of its own, and with it its own copy of
+the interpreter, the video libraries, a WSGI server with a pool of request
+threads, FFmpeg logging and so on.  A worker hosts several CameraCapture
+objects on their own threads, and they share:
+- the WSGI server, whose request threads also do the JPEG encoding for live
+  view; requests are routed to cameras by path.
+- the queue to the back end; messages are batched so that a busy worker
+  takes one queue operation instead of one per message.
+- logging of stdout/stderr and FFmpeg, and the memory limit check.
+
+A camera crashing the process takes down the other cameras of its worker,
+but no others.
+
+The back end talks to each hosted camera through its pipes just like before,
+and gets a HostedCamera back instead of a Process.  It behaves like one: it's
+alive while the camera's thread is running, and terminating it terminates the
+worker (which is what a hung camera needs) unless the camera is already on
+its way out.
+
+Which slot a camera is in, and whether it's still running, is kept in shared
+memory, so the back end can check on it without asking the worker.
+"""
+
+# Python imports...
+import ctypes
+import os
+import sys
+import threading
+import time
+import traceback
+from multiprocessing import Pipe
+from multiprocessing.sharedctypes import RawArray
+from signal import SIGTERM
+
+if sys.platform == 'win32':
+    from multiprocessing.reduction import reduce_pipe_connection \
+         as _reduceConnection
+else:
+    from multiprocessing.reduction import reduce_connection \
+         as _reduceConnection
+
+# Common 3rd-party imports...
+
+# Toolbox imports...
+from vitaToolbox.loggingUtils.LoggingUtils import EmptyLogger
+from vitaToolbox.loggingUtils.LoggingUtils import getLogger
+from vitaToolbox.process.ProcessUtils import checkMemoryLimit
+from vitaToolbox.process.ProcessUtils import listChildProcessesOfPID
+from vitaToolbox.profiling.ObjectCensus import CensusSampler
+from vitaToolbox.strUtils.EnsureUnicode import ensureUtf8
+from vitaToolbox.windows.winUtils import registerForForcedQuitEvents
+
+# Local imports...
+from appCommon.DebugPrefs import getDebugPrefAsInt
+from HeartbeatTable import HeartbeatWriter
+import MessageIds
+
+# Constants...
+
+# States of a camera slot in a worker.
+kSlotFree = 0
+kSlotRunning = 1
+kSlotStopping = 2
+
+# How long to hold messages for the back end, to batch them up, in seconds.
+_kBatchWindow = .02
+
+# The most messages to send in one batch.
+_kMaxBatch = 256
+
+# Seconds a worker may sit without cameras before we let it go.
+_kIdleWorkerSecs = 30
+
+# Seconds a worker gets to quit by itself before it's terminated.
+_kWorkerQuitSecs = 10
+
+# Seconds between checks of the control pipe in a worker.
+_kControlPollSecs = .1
+
+# Seconds between memory checks in a worker.
+_kMemoryStatsInterval = 15*60
+
+# Request threads in a worker's WSGI server, per camera it can host, and the
+# most to run in total.
+_kWsgiThreadsPerCamera = 4
+_kMaxWsgiThreads = 40
+
+
+##############################################################################
+class _BatchingQueue(object):
+    """Stands in for the back end's queue, sending messages in batches.
+
+    Messages are held for a short while so that the ones that come in while
+    waiting go along in the same msgIdCameraWorkerBatch message.  The order
+    of messages is kept.
+    """
+    ###########################################################
+    def __init__(self, queue, window=_kBatchWindow, maxBatch=_kMaxBatch):
+        """Initializer for _BatchingQueue
+
+        @param  queue     The queue to send to.
+        @param  window    Seconds to wait for more messages before sending.
+        @param  maxBatch  The most messages to send in one batch.
+        """
+        self._queue = queue
+        self._window = window
+        self._maxBatch = maxBatch
+
+        self._cond = threading.Condition()
+        self._pending = []
+        self._closed = False
+
+        self._thread = threading.Thread(target=self._flushLoop,
+                                        name="BatchingQueue")
+        self._thread.setDaemon(True)
+        self._thread.start()
+
+
+    ###########################################################
+    def put(self, msg, block=True, timeout=None): #PYCHECKER OK: Function (put) has unused arguments
+        """Queue a message; never blocks.
+
+        @param  msg      The message to send.
+        @param  block    Ignored; here to look like Queue.put().
+        @param  timeout  Ignored; here to look like Queue.put().
+        """
+        self._cond.acquire()
+        try:
+            self._pending.append(msg)
+            if len(self._pending) == 1:
+                self._cond.notify()
+        finally:
+            self._cond.release()
+
+
+    ###########################################################
+    def close(self, timeout=None):
+        """Send what's left and stop.
+
+        @param  timeout  Seconds to wait for the sending to finish.
+        """
+        self._cond.acquire()
+        try:
+            self._closed = True
+            self._cond.notify()
+        finally:
+            self._cond.release()
+        self._thread.join(timeout)
+
+
+    ###########################################################
+    def _flushLoop(self):
+        """Send messages as they come in, until we're closed."""
+        while True:
+            self._cond.acquire()
+            try:
+                while not self._pending and not self._closed:
+                    self._cond.wait()
+                closed = self._closed
+            finally:
+                self._cond.release()
+
+            if not closed:
+                time.sleep(self._window)
+
+            self._cond.acquire()
+            try:
+                msgs = self._pending
+                self._pending = []
+            finally:
+                self._cond.release()
+
+            self._send(msgs)
+            if closed:
+                return
+
+
+    ###########################################################
+    def _send(self, msgs):
+        """Send messages to the back end, batched.
+
+        @param  msgs  The messages to send.
+        """
+        for i in xrange(0, len(msgs), self._maxBatch):
+            batch = msgs[i:i+self._maxBatch]
+            if len(batch) == 1:
+                self._queue.put(batch[0])
+            else:
+                self._queue.put([MessageIds.msgIdCameraWorkerBatch, batch])
+
+
+##############################################################################
+def _rebuildConnection(reduced):
+    """Rebuild a pipe end sent to us by the back end.
+
+    @param  reduced     What _reduceConnection() made of the pipe end.
+    @return connection  The pipe end.
+    """
+    rebuildFn, args = reduced
+    return rebuildFn(*args)
+
+
+##############################################################################
+def _getCameraName(path):
+    """Return the name of the camera a WSGI request is for.
+
+    Camera requests look like "/<name>.jpg", "/<name>.m3u8" or
+    "/<name>-<profile>.m3u8", where the name is what simplifyString() made of
+    the camera location.
+
+    @param  path  The request path.
+    @return name  The camera name; may be empty.
+    """
+    return path.lstrip('/').split('.', 1)[0].split('-', 1)[0]
+
+
+##############################################################################
+class _Worker(object):
+    """What the back end knows about one worker process."""
+    ###########################################################
+    def __init__(self, workerId, numSlots):
+        """Initializer for _Worker
+
+        @param  workerId  An id for the worker, for logging.
+        @param  numSlots  The most cameras the worker can have at once,
+                          counting ones still on their way out.
+        """
+        self.workerId = workerId
+        self.numSlots = numSlots
+        self.proc = None
+        self.ctlPipe = None
+
+        # The generation of the camera in each slot, so that a HostedCamera
+        # can tell whether its slot has been reused.
+        self.gens = RawArray(ctypes.c_int, numSlots)
+
+        # The kSlot state of each slot, followed by 1 if the worker is
+        # draining, i.e. wants its cameras to go elsewhere.
+        self.states = RawArray(ctypes.c_int, numSlots+1)
+
+        # The camera location last put in each slot.
+        self.locations = [None] * numSlots
+
+        self.idleSince = time.time()
+
+
+    ###########################################################
+    def isRunning(self, index, gen):
+        """Tell whether the camera in a slot is still running.
+
+        @param  index      The slot index.
+        @param  gen        The generation the camera was started with.
+        @return isRunning  True if the camera's thread is running.
+        """
+        return self.gens[index] == gen and \
+               self.states[index] == kSlotRunning and \
+               self.proc.is_alive()
+
+
+    ###########################################################
+    def isDraining(self):
+        """Tell whether the worker wants no more cameras.
+
+        @return isDraining  True if the worker is draining.
+        """
+        return self.states[self.numSlots] != 0
+
+
+    ###########################################################
+    def numActive(self):
+        """Return the number of cameras the worker has running.
+
+        @return numActive  The number of slots in use.
+        """
+        return sum(1 for i in xrange(self.numSlots)
+                   if self.states[i] == kSlotRunning)
+
+
+    ###########################################################
+    def isEmpty(self):
+        """Tell whether the worker has no cameras at all.
+
+        @return isEmpty  True if every slot is free.
+        """
+        return all(self.states[i] == kSlotFree for i in xrange(self.numSlots))
+
+
+    ###########################################################
+    def isHosting(self, cameraLocation):
+        """Tell whether a camera might still have a thread in the worker.
+
+        @param  cameraLocation  The camera location.
+        @return isHosting       True if the camera has a slot in use.
+        """
+        return any(self.locations[i] == cameraLocation and
+                   self.states[i] != kSlotFree for i in xrange(self.numSlots))
+
+
+    ###########################################################
+    def findFreeSlot(self):
+        """Find a slot for a new camera.
+
+        @return index  The index of a free slot, or None.
+        """
+        for i in xrange(self.numSlots):
+            if self.states[i] == kSlotFree:
+                return i
+        return None
+
+
+##############################################################################
+class HostedCamera(object):
+    """Stands in for the Process of a camera that runs in a worker."""
+    ###########################################################
+    def __init__(self, pool, worker, index, gen):
+        """Initializer for HostedCamera
+
+        @param  pool    The CameraWorkerPool.
+        @param  worker  The _Worker the camera is in.
+        @param  index   The camera's slot in the worker.
+        @param  gen     The generation the camera was started with.
+        """
+        self._pool = pool
+        self._worker = worker
+        self._index = index
+        self._gen = gen
+
+
+    ###########################################################
+    @property
+    def pid(self):
+        """The process id of the worker."""
+        return self._worker.proc.pid
+
+
+    ###########################################################
+    def is_alive(self):
+        """Tell whether the camera is running.
+
+        A camera that gave permission to be terminated counts as gone; it's
+        just closing up and will never do anything for the back end again.
+
+        @return isAlive  True if the camera is running.
+        """
+        return self._worker.isRunning(self._index, self._gen)
+
+
+    ###########################################################
+    def terminate(self):
+        """Terminate the camera, which means its whole worker.
+
+        Nothing happens if the camera is no longer running, so that cameras
+        that quit or gave permission to be terminated don't take the others
+        with them.
+        """
+        if self.is_alive():
+            self._pool.terminateWorker(self._worker)
+
+
+##############################################################################
+class CameraWorkerPool(object):
+    """Starts cameras in worker processes, starting workers as needed."""
+    ###########################################################
+    def __init__(self, logger, camerasPerWorker, heartbeatSlots, startFn):
+        """Initializer for CameraWorkerPool
+
+        @param  logger            Logger to use, or None.
+        @param  camerasPerWorker  The most cameras to run in one worker.
+        @param  heartbeatSlots    The shared slots of the HeartbeatTable the
+                                  cameras' heartbeats come from.
+        @param  startFn           Starts a worker process; takes the
+                                  arguments of runCameraWorker() and returns
+                                  the Process.
+        """
+        self._logger = EmptyLogger() if logger is None else logger
+        self._camerasPerWorker = max(1, camerasPerWorker)
+        self._heartbeatSlots = heartbeatSlots
+        self._startFn = startFn
+
+        self._workers = []
+        self._nextWorkerId = 1
+        self._nextGen = 1
+
+        # List of (worker, time it was told to quit).
+        self._quittingWorkers = []
+
+
+    ###########################################################
+    def startCapture(self, msgQueue, cameraPipe, dataMgrPipe, dataMgrId, #PYCHECKER OK: Function has too many arguments
+                     cameraLocation, cameraUri, clipMgrPath, tmpPath,
+                     archivePath, userDir, extras, heartbeat=None):
+        """Start a camera in a worker; takes the arguments of runCapture().
+
+        @return camera  A HostedCamera standing in for the camera's process.
+        """
+        worker = self._pickWorker(cameraLocation, msgQueue, userDir)
+        index = worker.findFreeSlot()
+
+        gen = self._nextGen
+        self._nextGen += 1
+        worker.gens[index] = gen
+        worker.states[index] = kSlotRunning
+        worker.locations[index] = cameraLocation
+
+        heartbeatIndex = None
+        if heartbeat is not None:
+            heartbeatIndex = heartbeat.getIndex()
+
+        try:
+            worker.ctlPipe.send([MessageIds.msgIdCameraWorkerStart, index,
+                                 gen, _reduceConnection(cameraPipe),
+                                 _reduceConnection(dataMgrPipe), dataMgrId,
+                                 cameraLocation, cameraUri, clipMgrPath,
+                                 tmpPath, archivePath, userDir, extras,
+                                 heartbeatIndex])
+        except Exception:
+            # The worker must be gone; the camera will look dead and be
+            # restarted elsewhere.
+            self._logger.warn("Couldn't start %s in camera worker %d" %
+                              (ensureUtf8(cameraLocation), worker.workerId),
+                              exc_info=True)
+        else:
+            self._logger.info("Started %s in camera worker %d, slot %d" %
+                              (ensureUtf8(cameraLocation), worker.workerId,
+                               index))
+
+        return HostedCamera(self, worker, index, gen)
+
+
+    ###########################################################
+    def _pickWorker(self, cameraLocation, msgQueue, userDir):
+        """Find the worker a camera should go to, starting one if needed.
+
+        @param  cameraLocation  The camera location.
+        @param  msgQueue        The queue to the back end, for a new worker.
+        @param  userDir         Directory where user data should be stored.
+        @return worker          The _Worker, with a free slot.
+        """
+        self._reapWorkers()
+
+        candidates = [worker for worker in self._workers
+                      if not worker.isDraining() and
+                      worker.findFreeSlot() is not None]
+
+        # A camera being restarted goes back to where its old thread may
+        # still be closing up; the worker waits for it, so that the two never
+        # run at once.
+        for worker in candidates:
+            if worker.isHosting(cameraLocation):
+                return worker
+
+        for worker in candidates:
+            if worker.numActive() < self._camerasPerWorker:
+                return worker
+
+        return self._startWorker(msgQueue, userDir)
+
+
+    ###########################################################
+    def _startWorker(self, msgQueue, userDir):
+        """Start a new worker process.
+
+        @param  msgQueue  The queue to the back end.
+        @param  userDir   Directory where user data should be stored.
+        @return worker    The new _Worker.
+        """
+        # Leave room for cameras that are still on their way out.
+        worker = _Worker(self._nextWorkerId, 2*self._camerasPerWorker)
+        self._nextWorkerId += 1
+
+        ctlPipe1, ctlPipe2 = Pipe()
+        worker.ctlPipe = ctlPipe1
+        worker.proc = self._startFn(msgQueue, ctlPipe2, worker.workerId,
+                                    userDir, worker.gens, worker.states,
+                                    self._heartbeatSlots,
+                                    self._camerasPerWorker)
+        ctlPipe2.close()
+
+        self._workers.append(worker)
+        self._logger.info("Started camera worker %d, pid %d" %
+                          (worker.workerId, worker.proc.pid))
+        return worker
+
+
+    ###########################################################
+    def terminateWorker(self, worker):
+        """Terminate a worker, and everything it started.
+
+        @param  worker  The _Worker to terminate.
+        """
+        if not worker.proc.is_alive():
+            return
+
+        self._logger.warn("Terminating camera worker %d" % worker.workerId)
+        for childPID in listChildProcessesOfPID(worker.proc.pid):
+            try:
+                os.kill(childPID, SIGTERM)
+            except OSError:
+                # We expect this if the child was already stopped or killed...
+                pass
+        worker.proc.terminate()
+
+
+    ###########################################################
+    def drain(self, processId):
+        """Have a worker take no more cameras, so that it goes away once the
+        ones it has moved elsewhere.
+
+        @param  processId  The worker's process ID.
+        """
+        for worker in self._workers:
+            if worker.proc.pid == processId and not worker.isDraining():
+                self._logger.info("Draining camera worker %d" %
+                                  worker.workerId)
+                worker.states[worker.numSlots] = 1
+
+
+    ###########################################################
+    def _reapWorkers(self):
+        """Forget about workers that died."""
+        for worker in self._workers[:]:
+            if not worker.proc.is_alive():
+                self._logger.warn("Camera worker %d exited, code %s" %
+                                  (worker.workerId, worker.proc.exitcode))
+                self._workers.remove(worker)
+                worker.ctlPipe.close()
+
+
+    ###########################################################
+    def update(self):
+        """Let go of idle workers; should be called every now and then."""
+        self._reapWorkers()
+
+        now = time.time()
+        for worker in self._workers[:]:
+            if not worker.isEmpty():
+                worker.idleSince = now
+            elif worker.isDraining() or \
+                 now - worker.idleSince > _kIdleWorkerSecs:
+                self._logger.info("Camera worker %d idle, stopping" %
+                                  worker.workerId)
+                self._workers.remove(worker)
+                self._quitWorker(worker, now)
+
+        for i in xrange(len(self._quittingWorkers)-1, -1, -1):
+            worker, quitTime = self._quittingWorkers[i]
+            if not worker.proc.is_alive():
+                self._quittingWorkers.pop(i)
+            elif now - quitTime > _kWorkerQuitSecs:
+                self.terminateWorker(worker)
+                self._quittingWorkers.pop(i)
+
+
+    ###########################################################
+    def _quitWorker(self, worker, now):
+        """Tell a worker to quit.
+
+        @param  worker  The _Worker.
+        @param  now     The current time.
+        """
+        try:
+            worker.ctlPipe.send([MessageIds.msgIdQuit])
+        except Exception:
+            pass
+        worker.ctlPipe.close()
+        self._quittingWorkers.append((worker, now))
+
+
+    ###########################################################
+    def shutdown(self, timeout=_kWorkerQuitSecs):
+        """Stop all workers; their cameras should have been told to quit.
+
+        @param  timeout  Seconds to give workers to quit by themselves.
+        """
+        now = time.time()
+        for worker in self._workers:
+            self._quitWorker(worker, now)
+        self._workers = []
+
+        for worker, _ in self._quittingWorkers:
+            worker.proc.join(max(0, now + timeout - time.time()))
+            self.terminateWorker(worker)
+        self._quittingWorkers = []
+
+
+##############################################################################
+def runCameraWorker(msgQueue, ctlPipe, workerId, userDir, gens, states, #PYCHECKER OK: Function has too many arguments
+                    heartbeatSlots, camerasPerWorker):
+    """Create and run a CameraWorker process.
+
+    @param  msgQueue          A queue to send messages to the back end on.
+    @param  ctlPipe           A pipe to receive control messages on.
+    @param  workerId          An id for the worker, for logging.
+    @param  userDir           Directory where user data should be stored.
+    @param  gens              Shared array of the camera generation per slot.
+    @param  states            Shared array of the kSlot state per slot,
+                              followed by the draining flag.
+    @param  heartbeatSlots    The shared slots of the back end's
+                              HeartbeatTable.
+    @param  camerasPerWorker  The most cameras we'll normally run.
+    """
+    worker = CameraWorker(msgQueue, ctlPipe, workerId, userDir, gens, states,
+                          heartbeatSlots, camerasPerWorker)
+    worker.run()
+
+
+##############################################################################
+class CameraWorker(object):
+    """Runs several CameraCapture objects, each on a thread of its own."""
+    ###########################################################
+    def __init__(self, msgQueue, ctlPipe, workerId, userDir, gens, states, #PYCHECKER OK: Function has too many arguments
+                 heartbeatSlots, camerasPerWorker):
+        """Initializer for CameraWorker
+
+        See runCameraWorker() for the parameters.
+        """
+        self._logDir = os.path.join(userDir, "logs", "cameras")
+        self._logger = getLogger("cameraWorker%d.log" % workerId, self._logDir)
+        self._logger.grabStdStreams()
+
+        self._queue = _BatchingQueue(msgQueue)
+        self._ctlPipe = ctlPipe
+        self._workerId = workerId
+        self._gens = gens
+        self._states = states
+        self._numSlots = len(gens)
+        self._heartbeatSlots = heartbeatSlots
+        self._camerasPerWorker = camerasPerWorker
+
+        self._lock = threading.RLock()
+
+        # Key = slot index, value = (thread, camera location).
+        self._threads = {}
+
+        # Key = slot index, value = CameraCapture.
+        self._cameras = {}
+
+        # List of (index, gen, args) of cameras waiting to start.
+        self._pendingStarts = []
+
+        # Key = camera name, value = (WSGI app, port notification function).
+        self._wsgiApps = {}
+        self._wsgiAddress = None
+        self._wsgiServer = None
+
+        self._running = False
+        self._lastMemoryStats = 0
+
+        # Logs what grows in this process every so many seconds, if asked.
+        self._censusSampler = CensusSampler(self._logger,
+                getDebugPrefAsInt("objectCensusSecs", 0, userDir))
+
+        self._logger.info("Camera worker initialized, pid: %d" % os.getpid())
+
+
+    ###########################################################
+    def run(self):
+        """Run until told to quit."""
+        try:
+            self._run()
+        except:
+            self._logger.error(traceback.format_exc())
+        finally:
+            self._shutdown()
+
+
+    ###########################################################
+    def _run(self):
+        """Run the worker's main loop."""
+        # Imported here, in the worker, for the same reasons as in
+        # BackEndProcessJumper.
+        from videoLib2.python.ffmpegLog import FFmpegLog
+        from CameraCapture import createWsgiServer
+
+        self.__callbackFunc = registerForForcedQuitEvents(self._forcedQuit)
+
+        ffmpegLog = FFmpegLog("videolib", "FFMPEG >> ")
+        res = ffmpegLog.open(self._logger.log, 100)
+        if res:
+            self._logger.warn("FFmpeg logging not working (%d)" % res)
+        ffmpegLogDrops = 0
+
+        threadPoolSize = min(_kMaxWsgiThreads,
+                             _kWsgiThreadsPerCamera*self._camerasPerWorker)
+        self._wsgiServer = createWsgiServer(self._wsgiApp,
+                                            self._wsgiServerNotify,
+                                            self._logger, threadPoolSize)
+        self._wsgiServer.start()
+
+        self._running = True
+        while self._running:
+            try:
+                if self._ctlPipe.poll(_kControlPollSecs):
+                    self._processMessage(self._ctlPipe.recv())
+            except (EOFError, IOError):
+                self._logger.warn("Lost the back end, quitting")
+                self._running = False
+
+            self._startPendingCameras()
+            ffmpegLogDrops += ffmpegLog.flush()
+            self._checkMemory()
+            self._censusSampler.update(time.time())
+
+        self._logger.info("Camera worker quitting")
+        self._stopCameras()
+
+        ffmpegLogDrops += ffmpegLog.flush()
+        ffmpegLog.close()
+        if ffmpegLogDrops:
+            self._logger.warn("%d FFmpeg logs dropped" % ffmpegLogDrops)
+
+
+    ###########################################################
+    def _processMessage(self, msg):
+        """Process a message from the back end.
+
+        @param  msg  The received message.
+        """
+        msgId = msg[0]
+        if msgId == MessageIds.msgIdQuit:
+            self._running = False
+        elif msgId == MessageIds.msgIdCameraWorkerStart:
+            index, gen = msg[1:3]
+            args = list(msg[3:])
+            args[0] = _rebuildConnection(args[0])
+            args[1] = _rebuildConnection(args[1])
+            heartbeatIndex = args.pop()
+            heartbeat = None
+            if heartbeatIndex is not None:
+                heartbeat = HeartbeatWriter(self._heartbeatSlots,
+                                            heartbeatIndex)
+            args.append(heartbeat)
+            self._pendingStarts.append((index, gen, args))
+        else:
+            self._logger.warn("Unknown message %s" % str(msgId))
+
+
+    ###########################################################
+    def _startPendingCameras(self):
+        """Start cameras, once any old thread of theirs has finished."""
+        if not self._pendingStarts:
+            return
+
+        self._lock.acquire()
+        try:
+            busy = set(location for (_, location) in self._threads.values())
+        finally:
+            self._lock.release()
+
+        for start in self._pendingStarts[:]:
+            index, gen, args = start
+            cameraLocation = args[3]
+            if cameraLocation in busy:
+                continue
+            self._pendingStarts.remove(start)
+            busy.add(cameraLocation)
+
+            thread = threading.Thread(target=self._runCamera,
+                                      args=(index, gen, args),
+                                      name=ensureUtf8(cameraLocation))
+            thread.setDaemon(True)
+            self._lock.acquire()
+            try:
+                self._threads[index] = (thread, cameraLocation)
+            finally:
+                self._lock.release()
+            thread.start()
+
+
+    ###########################################################
+    def _runCamera(self, index, gen, args):
+        """Run a camera; the body of its thread.
+
+        @param  index  The camera's slot.
+        @param  gen    The generation the camera was started with.
+        @param  args   The arguments for CameraCapture, minus the queue.
+        """
+        from CameraCapture import CameraCapture
+
+        camera = None
+        try:
+            try:
+                camera = CameraCapture(self._queue, *args, host=self)
+                self._lock.acquire()
+                try:
+                    self._cameras[index] = camera
+                finally:
+                    self._lock.release()
+                camera.run()
+            except Exception:
+                self._logger.error("Camera %s failed: %s" %
+                                   (ensureUtf8(args[3]),
+                                    traceback.format_exc()))
+                sys.exc_clear()
+        finally:
+            self._lock.acquire()
+            try:
+                self._cameras.pop(index, None)
+                self._threads.pop(index, None)
+            finally:
+                self._lock.release()
+
+            # Dropping the camera finishes it up, like it would when a camera
+            # process exits.
+            camera = None
+
+            if self._gens[index] == gen:
+                self._states[index] = kSlotFree
+
+
+    ###########################################################
+    def _stopCameras(self):
+        """Wait a bit for our cameras to finish, which the back end asked."""
+        endTime = time.time() + _kWorkerQuitSecs
+        while time.time() < endTime:
+            self._lock.acquire()
+            try:
+                threads = [thread for (thread, _) in self._threads.values()]
+            finally:
+                self._lock.release()
+            if not threads:
+                break
+            threads[0].join(max(0, endTime - time.time()))
+
+
+    ###########################################################
+    def _shutdown(self):
+        """Stop what's shared by our cameras."""
+        if self._wsgiServer is not None:
+            try:
+                self._wsgiServer.shutdown(5)
+            except Exception:
+                self._logger.info("WSGI server shutdown error (%s)" %
+                                  sys.exc_info()[1])
+            self._wsgiServer = None
+        self._queue.close(5)
+
+
+    ###########################################################
+    def _forcedQuit(self):
+        """Make sure everything is written when we're being forced to quit.
+        """
+        self._lock.acquire()
+        try:
+            cameras = self._cameras.values()
+        finally:
+            self._lock.release()
+        for camera in cameras:
+            try:
+                camera.cleanup()
+            except Exception:
+                self._logger.error(traceback.format_exc())
+        self._queue.close(1)
+
+
+    ###########################################################
+    def _checkMemory(self):
+        """Check our memory use every now and then.
+
+        If we're over the limit the cameras are told to quit; the back end
+        will restart them in another worker, and we'll be let go once they're
+        gone.
+        """
+        now = time.time()
+        if now - self._lastMemoryStats < _kMemoryStatsInterval:
+            return
+        self._lastMemoryStats = now
+
+        memoryUnderLimit, memStats = checkMemoryLimit(os.getpid())
+        if memoryUnderLimit:
+            self._logger.info(str(memStats))
+            return
+
+        self._logger.error("Draining camera worker due to excessive memory "
+                           "consumption:" + str(memStats))
+        self._states[self._numSlots] = 1
+        self._lock.acquire()
+        try:
+            cameras = self._cameras.values()
+        finally:
+            self._lock.release()
+        for camera in cameras:
+            camera.requestQuit()
+
+
+    ###########################################################
+    def allowTermination(self, camera):
+        """Note that a camera gave the back end permission to terminate it.
+
+        @param  camera  The CameraCapture.
+        """
+        self._lock.acquire()
+        try:
+            for index, hosted in self._cameras.iteritems():
+                if hosted is camera:
+                    self._states[index] = kSlotStopping
+                    break
+        finally:
+            self._lock.release()
+
+
+    ###########################################################
+    def addWsgiApp(self, name, app, notify):
+        """Have requests for a camera go to its WSGI app.
+
+        @param  name    The camera name, as used in request paths.
+        @param  app     The camera's WSGI application.
+        @param  notify  Called with the server address whenever it changes.
+        """
+        self._lock.acquire()
+        try:
+            self._wsgiApps[name] = (app, notify)
+            address = self._wsgiAddress
+        finally:
+            self._lock.release()
+        if address is not None:
+            notify(address)
+
+
+    ###########################################################
+    def removeWsgiApp(self, name):
+        """Stop sending requests to a camera.
+
+        @param  name  The camera name given to addWsgiApp().
+        """
+        self._lock.acquire()
+        try:
+            self._wsgiApps.pop(name, None)
+        finally:
+            self._lock.release()
+
+
+    ###########################################################
+    def _wsgiApp(self, environ, startResponse):
+        """WSGI application for all of our cameras; hands requests on.
+
+        @param  environ        The request information, CGI style.
+        @param  startResponse  The WSGI response sender.
+        """
+        path = environ.get('PATH_INFO', "")
+        self._lock.acquire()
+        try:
+            app, _ = self._wsgiApps.get(_getCameraName(path), (None, None))
+        finally:
+            self._lock.release()
+
+        if app is not None:
+            return app(environ, startResponse)
+
+        errorText = "unknown request path '%s'" % path
+        startResponse('404 WRONG PATH',
+           [('Content-Type' , 'text/plain'),
+            ('Content-Length', str(len(errorText)))])
+        return [errorText]
+
+
+    ###########################################################
+    def _wsgiServerNotify(self, currentAddress):
+        """Tell all of our cameras where the WSGI server is now.
+
+        @param  currentAddress  The server's (host, port).
+        """
+        self._lock.acquire()
+        try:
+            self._wsgiAddress = currentAddress
+            notifies = [notify for (_, notify) in self._wsgiApps.values()]
+        finally:
+            self._lock.release()
+        for notify in notifies:
+            notify(currentAddress)
+
+
+
+##############################################################################
+def _testBatchingQueue():
+    """Test batching of messages.
+
+    >>> from Queue import Queue
+    >>> queue = Queue()
+    >>> batcher = _BatchingQueue(queue, .1, 3)
+    >>> for i in xrange(4):
+    ...     batcher.put([i])
+    >>> time.sleep(.3)
+    >>> queue.get_nowait() == [MessageIds.msgIdCameraWorkerBatch,
+    ...                        [[0], [1], [2]]]
+    True
+
+    One message left over goes by itself:
+
+    >>> queue.get_nowait()
+    [3]
+
+    Whatever is left is sent on close:
+
+    >>> batcher.put([4]); batcher.put([5])
+    >>> batcher.close(1)
+    >>> queue.get_nowait() == [MessageIds.msgIdCameraWorkerBatch, [[4], [5]]]
+    True
+    >>> queue.empty()
+    True
+    """
+
+
+##############################################################################
+def _testCameraName():
+    """Test finding the camera for a request.
+
+    >>> [_getCameraName(path) for path in
+    ...  ("/0cc175b9.jpg", "/0cc175b9.m3u8", "/0cc175b9-2.m3u8", "/x", "/")]
+    ['0cc175b9', '0cc175b9', '0cc175b9', 'x', '']
+    """
+
+
+##############################################################################
+def _testWorkerSlots():
+    """Test what the back end knows about a worker's cameras.
+
+    >>> class FakeProc(object):
+    ...     pid = 1234
+    ...     alive = True
+    ...     exitcode = None
+    ...     def is_alive(self): return self.alive
+    ...     def terminate(self): self.alive = False
+    >>> class FakePipe(object):
+    ...     def __init__(self): self.sent = []
+    ...     def send(self, msg): self.sent.append(msg)
+    ...     def close(self): pass
+    >>> workers = []
+    >>> def startFn(*args):
+    ...     workers.append(args)
+    ...     return FakeProc()
+
+    >>> pool = CameraWorkerPool(None, 2, None, startFn)
+    >>> pool._startWorker = lambda q, d: _startFake(pool, q, d)
+    >>> def _startFake(pool, msgQueue, userDir):
+    ...     worker = _Worker(pool._nextWorkerId, 2*pool._camerasPerWorker)
+    ...     pool._nextWorkerId += 1
+    ...     worker.proc = FakeProc(); worker.ctlPipe = FakePipe()
+    ...     pool._workers.append(worker)
+    ...     return worker
+    >>> reduced = []
+    >>> globals()['_reduceConnection'], saved = reduced.append, _reduceConnection
+
+    Two cameras fit in a worker, the third gets a new one:
+
+    >>> a = pool.startCapture(None, 'p', 'd', 1, u'a', 'uri', u'', '', '', u'',
+    ...                       {})
+    >>> b = pool.startCapture(None, 'p', 'd', 2, u'b', 'uri', u'', '', '', u'',
+    ...                       {})
+    >>> c = pool.startCapture(None, 'p', 'd', 3, u'c', 'uri', u'', '', '', u'',
+    ...                       {})
+    >>> a._worker is b._worker, a._worker is c._worker, len(pool._workers)
+    (True, False, 2)
+    >>> a.is_alive(), a.pid
+    (True, 1234)
+
+    A camera that allowed termination isn't alive, and terminating it
+    doesn't touch its worker:
+
+    >>> a._worker.states[a._index] = kSlotStopping
+    >>> a.is_alive()
+    False
+    >>> a.terminate()
+    >>> b.is_alive()
+    True
+
+    Restarting it goes to the same worker, which now has the room:
+
+    >>> a2 = pool.startCapture(None, 'p', 'd', 4, u'a', 'uri', u'', '', '',
+    ...                        u'', {})
+    >>> a2._worker is a._worker, a2._index != a._index, a2.is_alive()
+    (True, True, True)
+
+    The worker is full now, so the next camera goes where there's room:
+
+    >>> a._worker.states[a._index] = kSlotFree
+    >>> d = pool.startCapture(None, 'p', 'd', 5, u'd', 'uri', u'', '', '',
+    ...                       u'', {})
+    >>> d._worker is c._worker, d.is_alive()
+    (True, True)
+
+    A slot that was reused doesn't bring the old handle back to life:
+
+    >>> a._worker.gens[a._index] = 99
+    >>> a._worker.states[a._index] = kSlotRunning
+    >>> a.is_alive()
+    False
+    >>> a._worker.states[a._index] = kSlotFree
+
+    Terminating a running camera takes its worker down with it:
+
+    >>> b.terminate()
+    >>> b.is_alive(), a2.is_alive(), c.is_alive()
+    (False, False, True)
+    >>> pool.update()
+    >>> len(pool._workers)
+    1
+
+    A draining worker takes no more cameras:
+
+    >>> pool.drain(1234)
+    >>> c._worker.isDraining(), c._worker in pool._workers
+    (True, True)
+
+    A worker with no cameras is let go after a while:
+
+    >>> worker = c._worker
+    >>> worker.states[c._index] = worker.states[d._index] = kSlotFree
+    >>> worker.idleSince -= _kIdleWorkerSecs + 1
+    >>> pool.update()
+    >>> len(pool._workers), worker.ctlPipe.sent[-1] == [MessageIds.msgIdQuit]
+    (0, True)
+
+    >>> globals()['_reduceConnection'] = saved
+    """
+
+
+##############################################################################
+def test_main():
+    """OB_REDACT
+    Our main function, which runs test code
+    """
+    import doctest
+    doctest.testmod(verbose=True)
+
+
+##############################################################################
+if __name__ == '__main__':
+    test_main()
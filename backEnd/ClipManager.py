@@ -72,6 +72,16 @@ kCacheStatusUnmanaged = -1  # This is 'unmanaged', neither cache nor noncache.
 _kRetryFirst = 10*1000
 _kRetryMax = 5*60*1000
 
+# Why a camera wasn't recording, as stored in the outages table.
+kOutageOpenFailed   = 'openFailed'    # Couldn't connect to the camera.
+kOutageDiskSpace    = 'diskSpace'     # Stopped because of low disk space.
+kOutageRestart      = 'cameraRestart' # Capture died or hung; restarted.
+kOutageOff          = 'off'           # Turned off by the user or schedule.
+kOutageNotRunning   = 'notRunning'    # The back end wasn't running.
+
+# Outages that somebody asked for, which don't count against uptime.
+kPlannedOutageReasons = (kOutageOff,)
+
 
 ###############################################################
 class ClipManager(object):
@@ -204,6 +214,55 @@ class ClipManager(object):
             pass
 
 
+    ###########################################################
+    def _createRelocationTables(self):
+        """Create the tables used while video moves to a new folder.
+
+        clipLocations: clips that haven't been moved to the new folder yet
+            filename    - text, primary key, name of the video
+            videoDir    - text, the video folder the file is still in
+
+        clipRelocation: state of the move; empty when no move is in progress
+            name        - text, primary key: 'fromDir', 'toDir' or 'total'
+            value       - text
+        """
+        for query in ('''CREATE TABLE clipLocations (filename TEXT '''
+                      '''PRIMARY KEY, videoDir TEXT)''',
+                      '''CREATE TABLE clipRelocation (name TEXT '''
+                      '''PRIMARY KEY, value TEXT)'''):
+            try:
+                self._cur.disableExecuteLogForNext()
+                self._cur.execute(query)
+            except sql.OperationalError:
+                # Ignore failures in creating the table, which can happen
+                # because it already exists or because of race conditions...
+                pass
+
+
+    ###########################################################
+    def _createOutagesTable(self):
+        """Create the table recording when cameras weren't recording.
+
+        outages:
+            uid         - int, primary key
+            camLoc      - text, name of the camera location
+            startMs     - int, absolute ms the outage started
+            endMs       - int, absolute ms the outage ended; NULL if ongoing
+            reason      - text, one of the kOutageXXX constants
+            attempts    - int, failed reconnect attempts during the outage
+        """
+        try:
+            self._cur.disableExecuteLogForNext()
+            self._cur.execute(
+                '''CREATE TABLE outages (uid INTEGER PRIMARY KEY, '''
+                '''camLoc TEXT, startMs INTEGER, endMs INTEGER, '''
+                '''reason TEXT, attempts INTEGER DEFAULT 0)''')
+        except sql.OperationalError:
+            # Ignore failures in creating the table, which can happen
+            # because it already exists or because of race conditions...
+            pass
+
+
     ###########################################################
     def _upgradeOldTablesIfNeeded(self):
         """Upgrade from older versions of tables."""
@@ -269,6 +328,13 @@ class ClipManager(object):
                           ''' IDX_CLIPS_ISCACHE_FIRSTMS on'''
                           ''' clips (isCache, firstMs)''')
 
+        self._cur.execute('''CREATE INDEX IF NOT EXISTS'''
+                          ''' IDX_OUTAGES_CAMLOC_STARTMS on'''
+                          ''' outages (camLoc, startMs)''')
+        self._cur.execute('''CREATE INDEX IF NOT EXISTS'''
+                          ''' IDX_OUTAGES_CAMLOC_ENDMS on'''
+                          ''' outages (camLoc, endMs)''')
+
 
     ###########################################################
     def open(self, filePath, timeout=15):
@@ -329,6 +395,9 @@ class ClipManager(object):
         if not hasProcSizeTable:
             self._createProcSizeTable()
 
+        self._createRelocationTables()
+        self._createOutagesTable()
+
         self._addIndices()
 
         self._connection.commit()
@@ -376,6 +445,9 @@ class ClipManager(object):
 
         self._connection.execute('''DROP TABLE clips''')
         self._connection.execute('''DROP TABLE clipPadding''')
+        self._connection.execute('''DELETE FROM clipLocations''')
+        self._connection.execute('''DELETE FROM clipRelocation''')
+        self._connection.execute('''DELETE FROM outages''')
 
         self._createClipsTable()
         self._createClipPaddingTable()
@@ -487,6 +559,8 @@ class ClipManager(object):
 
         # Remove the entry for the given file
         self._cur.execute('''DELETE FROM clips WHERE filename=?''', (filename,))
+        self._cur.execute('''DELETE FROM clipLocations WHERE filename=?''',
+                          (filename,))
 
         # Remove prev/next links
         self._cur.execute(
@@ -1213,7 +1287,7 @@ class ClipManager(object):
         for (uid, filename, loc, first, last, prev, next, tags, cache,
              procWidth, procHeight) in files:
             # Split the video files and remove the original.
-            origFilePath = os.path.join(videoFolder, filename)
+            origFilePath = self.getClipPath(videoFolder, filename)
             clipNameA = filename[:-4]+'a.mp4'
             clipNameB = filename[:-4]+'b.mp4'
             clipPathA = os.path.join(videoFolder, clipNameA)
@@ -1239,6 +1313,8 @@ class ClipManager(object):
             # print >> sys.stderr,  "first=%d, last=%d, change=%d, newFirstLeft=%d, newFirstRight=%d" % \
             #      (first, last, changeMs, newFirstLeft, newFirstRight)
             self._cur.execute('''DELETE FROM clips WHERE uid=?''', (uid,))
+            self._cur.execute('''DELETE FROM clipLocations WHERE filename=?''',
+                              (filename,))
 
             try:
                 os.remove(origFilePath)
@@ -1271,6 +1347,180 @@ class ClipManager(object):
         self._cur.execute('''UPDATE clips SET camLoc=? WHERE camLoc=? '''
                           '''AND firstMs>=?''', (newName, oldName, changeMs))
 
+        self._renameOutages(oldName, newName, changeMs)
+
+
+    ###########################################################
+    def _renameOutages(self, oldName, newName, changeMs):
+        """Move outages to a new camera name, splitting one in progress.
+
+        @param  oldName   The name of the camera location to change.
+        @param  newName   The new name for the camera location.
+        @param  changeMs  The absolute ms at which the change took place.
+        """
+        spanning = self._cur.execute(
+            '''SELECT uid, endMs, reason FROM outages WHERE camLoc=? AND '''
+            '''startMs<? AND (endMs IS NULL OR endMs>?)''',
+            (oldName, changeMs, changeMs)).fetchall()
+        for uid, endMs, reason in spanning:
+            self._cur.execute('''UPDATE outages SET endMs=? WHERE uid=?''',
+                              (changeMs, uid))
+            self._cur.execute('''INSERT INTO outages (camLoc, startMs, '''
+                              '''endMs, reason) VALUES (?, ?, ?, ?)''',
+                              (oldName, changeMs, endMs, reason))
+
+        self._cur.execute('''UPDATE outages SET camLoc=? WHERE camLoc=? '''
+                          '''AND startMs>=?''', (newName, oldName, changeMs))
+
+
+    ###########################################################
+    def setOutage(self, camLoc, ms, reason, isAttempt=False, save=True):
+        """Note that a camera isn't recording.
+
+        If the camera is already in an outage for the same reason, that one
+        continues; otherwise it ends and a new one starts.
+
+        @param  camLoc     The camera location.
+        @param  ms         The absolute ms that we learned of the outage.
+        @param  reason     Why the camera isn't recording; a kOutageXXX value.
+        @param  isAttempt  True if this follows a failed attempt to connect.
+        @param  save       True if the database shoud be saved.
+        """
+        assert self._connection is not None
+
+        row = self._cur.execute(
+            '''SELECT uid, reason FROM outages WHERE camLoc=? AND '''
+            '''endMs IS NULL ORDER BY startMs DESC LIMIT 1''',
+            (camLoc,)).fetchone()
+
+        if row is not None and row[1] == reason:
+            if isAttempt:
+                self._cur.execute('''UPDATE outages SET attempts=attempts+1 '''
+                                  '''WHERE uid=?''', (row[0],))
+        else:
+            self._endOutage(camLoc, ms)
+            self._cur.execute('''INSERT INTO outages (camLoc, startMs, '''
+                              '''reason, attempts) VALUES (?, ?, ?, ?)''',
+                              (camLoc, ms, reason, int(isAttempt)))
+
+        if save:
+            self.save()
+
+
+    ###########################################################
+    def endOutage(self, camLoc, ms, save=True):
+        """Note that a camera is recording again.
+
+        @param  camLoc  The camera location.
+        @param  ms      The absolute ms that recording started again.
+        @param  save    True if the database shoud be saved.
+        @return ended   True if the camera was in an outage.
+        """
+        assert self._connection is not None
+
+        ended = self._endOutage(camLoc, ms)
+        if ended and save:
+            self.save()
+        return ended
+
+
+    ###########################################################
+    def _endOutage(self, camLoc, ms):
+        """End any outage in progress for a camera, without saving.
+
+        @param  camLoc  The camera location.
+        @param  ms      The absolute ms the outage ended.
+        @return ended   True if the camera was in an outage.
+        """
+        self._cur.execute('''UPDATE outages SET endMs=MAX(startMs, ?) '''
+                          '''WHERE camLoc=? AND endMs IS NULL''', (ms, camLoc))
+        return self._cur.rowcount > 0
+
+
+    ###########################################################
+    def getOutagesBetween(self, camLoc, startMs, endMs):
+        """Return the outages of a camera that overlap a range of time.
+
+        This is what lets a timeline or search tell "no video" apart from
+        "nothing happened".
+
+        @param  camLoc   The camera location.
+        @param  startMs  The absolute ms to start at.
+        @param  endMs    The absolute ms to end at.
+        @return outages  A list of (startMs, endMs, reason, attempts), sorted
+                         by start time; endMs is None if still going on.
+        """
+        assert self._connection is not None
+
+        return [tuple(row) for row in self._cur.execute(
+            '''SELECT startMs, endMs, reason, attempts FROM outages WHERE '''
+            '''camLoc=? AND startMs<=? AND (endMs IS NULL OR endMs>=?) '''
+            '''ORDER BY startMs''', (camLoc, endMs, startMs))]
+
+
+    ###########################################################
+    def getUptimeReport(self, startMs, endMs, camLocs=None, nowMs=None):
+        """Summarize how much of a range of time each camera was recording.
+
+        Time the camera was turned off on purpose (kPlannedOutageReasons) is
+        reported, but doesn't count against uptime.
+
+        @param  startMs  The absolute ms to start at.
+        @param  endMs    The absolute ms to end at; clipped to nowMs.
+        @param  camLocs  The cameras to report on; None for all known ones.
+        @param  nowMs    The current time in ms; None to use the clock.
+        @return report   A dict keyed by camera location.  Values are dicts:
+                           periodMs   - ms in the range
+                           downMs     - ms not recording, unplanned
+                           plannedMs  - ms not recording, planned
+                           uptime     - fraction of unplanned time recording,
+                                        or None if all the time was planned
+                           outages    - number of outages, unplanned
+                           attempts   - failed reconnect attempts
+                           reasons    - dict of reason to ms not recording
+        """
+        assert self._connection is not None
+
+        if nowMs is None:
+            nowMs = int(time.time()*1000)
+        endMs = max(startMs, min(endMs, nowMs))
+
+        if camLocs is None:
+            camLocs = set(self.getCameraLocations())
+            camLocs.update(row[0] for row in self._cur.execute(
+                '''SELECT DISTINCT camLoc FROM outages'''))
+
+        report = {}
+        for camLoc in camLocs:
+            downMs = plannedMs = numOutages = attempts = 0
+            reasons = {}
+            for first, last, reason, tries in \
+                    self.getOutagesBetween(camLoc, startMs, endMs):
+                if last is None:
+                    last = endMs
+                overlapMs = max(0, min(last, endMs) - max(first, startMs))
+                reasons[reason] = reasons.get(reason, 0) + overlapMs
+                if reason in kPlannedOutageReasons:
+                    plannedMs += overlapMs
+                else:
+                    downMs += overlapMs
+                    numOutages += 1
+                attempts += tries
+
+            periodMs = endMs - startMs
+            expectedMs = periodMs - plannedMs
+            report[camLoc] = {
+                'periodMs': periodMs,
+                'downMs': downMs,
+                'plannedMs': plannedMs,
+                'uptime': (1 - float(downMs)/expectedMs) if expectedMs > 0
+                          else None,
+                'outages': numOutages,
+                'attempts': attempts,
+                'reasons': reasons,
+            }
+        return report
+
 
     ###########################################################
     def deleteLocation(self, location):
@@ -1279,8 +1529,12 @@ class ClipManager(object):
         @param  location  The name of the camera location to remove.
         """
         # Remove the entries for the given location
+        self._cur.execute('''DELETE FROM clipLocations WHERE filename IN '''
+                          '''(SELECT filename FROM clips WHERE camLoc=?)''',
+                          (location,))
         self._cur.execute('''DELETE FROM clips WHERE camLoc=?''', (location,))
         self._cur.execute('''DELETE FROM clipProcSizes WHERE camLoc=?''', (location,))
+        self._cur.execute('''DELETE FROM outages WHERE camLoc=?''', (location,))
         self.save()
 
 
@@ -1307,7 +1561,7 @@ class ClipManager(object):
         affectedClips = self.getFilesBetween(cameraLocation, startMs, stopMs)
 
         for clip, _, _ in affectedClips:
-            origFilePath = os.path.join(videoFolder, clip)
+            origFilePath = self.getClipPath(videoFolder, clip)
             msList = []
             uid, _, _, clipStart, clipStop, prev, next, tags, cache, w, h = \
                     self._cur.execute(
@@ -1431,6 +1685,8 @@ class ClipManager(object):
 
             # Remove the original file.
             self._cur.execute('''DELETE FROM clips WHERE uid=?''', (uid,))
+            self._cur.execute('''DELETE FROM clipLocations WHERE filename=?''',
+                              (clip,))
 
             # Save the database before doing anything else to try to avoid
             # slow SQL stuff...
@@ -1446,6 +1702,141 @@ class ClipManager(object):
         return failedDeletes
 
 
+    ###########################################################
+    def getClipPath(self, videoFolder, filename):
+        """Return the full path of a clip.
+
+        While video is being moved to a new folder, clips that haven't been
+        moved yet are still found in the old one.
+
+        @param  videoFolder  The directory where video files are stored.
+        @param  filename     Name of the clip, as stored in the database.
+        @return path         The full path of the clip.
+        """
+        # Use a fresh cursor; callers may be iterating over self._cur.
+        row = self._connection.execute(
+            '''SELECT videoDir FROM clipLocations WHERE filename=?''',
+            (filename.replace(os.sep, '/'),)).fetchone()
+        if row is not None:
+            videoFolder = row[0]
+        return os.path.join(videoFolder, filename)
+
+
+    ###########################################################
+    def beginRelocation(self, fromDir, toDir):
+        """Note that all existing clips are about to move to a new folder.
+
+        Until a clip is marked with setClipRelocated(), getClipPath() will
+        find it in fromDir.
+
+        @param  fromDir  The video folder the clips are in now.
+        @param  toDir    The video folder they're moving to.
+        """
+        self._cur.execute('''DELETE FROM clipLocations''')
+        self._cur.execute('''INSERT INTO clipLocations SELECT filename, ? '''
+                          '''FROM clips''', (fromDir,))
+        self._setRelocationInfo(fromDir, toDir)
+        self.save()
+
+
+    ###########################################################
+    def reverseRelocation(self):
+        """Turn a move in progress around, back to where it came from.
+
+        Clips that were already moved, and any recorded since the move
+        started, need to go back; the rest are already where they belong.
+
+        @return fromDir  The folder clips will now be moved from.
+        @return toDir    The folder clips will now be moved to, which is the
+                         one they were originally in.
+        """
+        oldFromDir, oldToDir, _, _ = self.getRelocationInfo()
+
+        movedClips = self._cur.execute(
+            '''SELECT filename FROM clips WHERE filename NOT IN '''
+            '''(SELECT filename FROM clipLocations)''').fetchall()
+        self._cur.execute('''DELETE FROM clipLocations''')
+        self._cur.executemany('''INSERT OR REPLACE INTO clipLocations '''
+                              '''VALUES (?, ?)''',
+                              [(filename, oldToDir) for
+                               (filename,) in movedClips])
+        self._setRelocationInfo(oldToDir, oldFromDir)
+        self.save()
+
+        return oldToDir, oldFromDir
+
+
+    ###########################################################
+    def _setRelocationInfo(self, fromDir, toDir):
+        """Store the state of a move, taking the clips left as the total.
+
+        @param  fromDir  The video folder clips are moving from.
+        @param  toDir    The video folder clips are moving to.
+        """
+        (total,) = self._cur.execute(
+            '''SELECT COUNT(*) FROM clipLocations''').fetchone()
+        self._cur.executemany('''INSERT OR REPLACE INTO clipRelocation '''
+                              '''VALUES (?, ?)''',
+                              (('fromDir', fromDir), ('toDir', toDir),
+                               ('total', str(total))))
+
+
+    ###########################################################
+    def getRelocationInfo(self):
+        """Return the state of a move of video to a new folder.
+
+        @return fromDir    The folder clips are moving from, or None if no
+                           move is in progress.
+        @return toDir      The folder clips are moving to, or None.
+        @return total      The number of clips there were to move.
+        @return remaining  The number of clips still left to move.
+        """
+        info = dict(self._cur.execute(
+            '''SELECT name, value FROM clipRelocation''').fetchall())
+        if 'fromDir' not in info:
+            return None, None, 0, 0
+
+        (remaining,) = self._cur.execute(
+            '''SELECT COUNT(*) FROM clipLocations''').fetchone()
+        return (info['fromDir'], info['toDir'], int(info.get('total', 0)),
+                remaining)
+
+
+    ###########################################################
+    def getClipsToRelocate(self, limit, exclude=()):
+        """Return the oldest clips that still have to be moved.
+
+        @param  limit    The most clips to return.
+        @param  exclude  Names of clips to skip, like ones already moving.
+        @return clips    A list of (filename, videoDir), oldest first.
+        """
+        exclude = set(exclude)
+        clips = self._cur.execute(
+            '''SELECT l.filename, l.videoDir FROM clipLocations l '''
+            '''LEFT JOIN clips c ON c.filename=l.filename '''
+            '''ORDER BY c.firstMs LIMIT ?''', (limit+len(exclude),)).fetchall()
+        return [clip for clip in clips if clip[0] not in exclude][:limit]
+
+
+    ###########################################################
+    def setClipRelocated(self, filename):
+        """Note that a clip is now in the current video folder.
+
+        @param  filename  Name of the clip.
+        """
+        self._cur.execute('''DELETE FROM clipLocations WHERE filename=?''',
+                          (filename,))
+        self.save()
+
+
+    ###########################################################
+    def endRelocation(self):
+        """Forget about a move of video to a new folder."""
+        self._cur.execute('''DELETE FROM clipLocations''')
+        self._cur.execute('''DELETE FROM clipRelocation''')
+        self.save()
+
+
     ###########################################################
     def getMostRecentTimeAt(self, camLoc):
         """Retrieve the most recent time for a location in the database.
@@ -1633,4 +2024,68 @@ class ClipManager(object):
         else:
             procSizesAndTimeRanges.append((procWidth, procHeight, firstMs, lastMs))
 
-        return procSizesAndTimeRanges
\ No newline at end of file
+        return procSizesAndTimeRanges
+
+
+##############################################################################
+def _testOutages():
+    """Test the outage ledger.
+
+    >>> import shutil, tempfile
+    >>> from vitaToolbox.loggingUtils.LoggingUtils import EmptyLogger
+    >>> tmpDir = tempfile.mkdtemp()
+    >>> mgr = ClipManager(EmptyLogger())
+    >>> mgr.open(os.path.join(tmpDir, u'clips.db'))
+
+    Repeated failures for the same reason count as attempts; a new reason
+    starts a new outage, and recording again ends it:
+
+    >>> mgr.setOutage('cam', 1000, kOutageRestart)
+    >>> mgr.setOutage('cam', 2000, kOutageOpenFailed, True)
+    >>> mgr.setOutage('cam', 3000, kOutageOpenFailed, True)
+    >>> mgr.getOutagesBetween('cam', 0, 10000)
+    [(1000, 2000, u'cameraRestart', 0), (2000, None, u'openFailed', 2)]
+    >>> mgr.endOutage('cam', 5000), mgr.endOutage('cam', 6000)
+    (True, False)
+    >>> mgr.setOutage('cam', 8000, kOutageOff)
+    >>> mgr.getOutagesBetween('cam', 4000, 7000)
+    [(2000, 5000, u'openFailed', 2)]
+
+    Turning the camera off doesn't count against uptime:
+
+    >>> report = mgr.getUptimeReport(0, 20000, nowMs=10000)['cam']
+    >>> report['periodMs'], report['downMs'], report['plannedMs']
+    (10000, 4000, 2000)
+    >>> report['uptime'], report['outages'], report['attempts']
+    (0.5, 2, 2)
+    >>> sorted(report['reasons'].items())
+    [(u'cameraRestart', 1000), (u'off', 2000), (u'openFailed', 3000)]
+
+    Renaming splits an outage in progress:
+
+    >>> mgr._renameOutages('cam', 'door', 9000)
+    >>> mgr.getOutagesBetween('cam', 7000, 20000)
+    [(8000, 9000, u'off', 0)]
+    >>> mgr.getOutagesBetween('door', 0, 20000)
+    [(9000, None, u'off', 0)]
+    >>> mgr.deleteLocation('door')
+    >>> mgr.getOutagesBetween('door', 0, 20000)
+    []
+
+    >>> mgr.close()
+    >>> shutil.rmtree(tmpDir)
+    """
+
+
+##############################################################################
+def test_main():
+    """OB_REDACT
+    Our main function, which runs test code
+    """
+    import doctest
+    doctest.testmod(verbose=True)
+
+
+##############################################################################
+if __name__ == '__main__':
+    test_main()
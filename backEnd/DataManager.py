@@ -47,7 +47,7 @@ import sqlite3 as sql
 import time
 import traceback
 import glob
-import shutil
+from cStringIO import StringIO
 from bisect import bisect_left
 
 # Common 3rd-party imports...
@@ -58,8 +58,12 @@ from vitaToolbox.sql.TimedConnection import TimedConnection
 from vitaToolbox.strUtils.EnsureUnicode import ensureUtf8
 from vitaToolbox.sysUtils.TimeUtils import getTimeAsMs
 from vitaToolbox.profiling.MarkTime import TimerLogger
+from vitaToolbox.profiling.ObjectCensus import registerCache
 
 # Local imports...
+from ThumbnailArchive import ThumbnailArchiveReader, getThumbArchivePath
+from TrackCompactor import expandMotionSpan
+from TrackCompactor import kMaxSpanMs
 from VideoMarkupModel import VideoMarkupModel
 from videoLib2.python.ClipReader import ClipReader
 
@@ -130,6 +134,10 @@ class DataManager(object):
         self._bboxCache = {}
         self._cacheKeys = {}
         self._thumbCache = {}
+        registerCache("dataManager.thumbCache", self, "_thumbCache",
+                      lambda cache: sum(len(times) for times in
+                                        cache.itervalues()))
+        self._thumbArchives = ThumbnailArchiveReader()
         self._videoDebugLines = []
         self._firstFile = None
         self._lastFile = None
@@ -176,6 +184,16 @@ class DataManager(object):
             x1, y1 - int, upper left coordinates of the object's bbox
             x2, y2 - int, bottom right coordinates of the object's bbox
 
+        Table motionSpans: (see TrackCompactor)
+            objUid - int, the object table uid of the motion object
+            time   - int, time of the motion row that ends the span
+            times  - blob, packed times of the frames that were dropped
+                     between the previous motion row and this one
+
+        Table trackCompaction:
+            name   - text, primary key
+            value  - int, progress and statistics of the track compactor
+
         Table actions:
             objUid     - int, the object table uid of the action object
             type       - text, the category, like "person"; this is a duplicate
@@ -221,6 +239,21 @@ class DataManager(object):
             # Happens if two processes try at same time...
             pass
 
+        # Added after the tables above, so create these separately so that
+        # older databases pick them up too...
+        for query in (
+                '''CREATE TABLE motionSpans (objUid INTEGER, time INTEGER, '''
+                '''times BLOB, PRIMARY KEY (objUid, time))''',
+
+                '''CREATE TABLE trackCompaction (name TEXT PRIMARY KEY, '''
+                '''value INTEGER)'''):
+            try:
+                self._cur.disableExecuteLogForNext()
+                self._cur.execute(query)
+            except sql.OperationalError:
+                # Already there, or another process beat us to it...
+                pass
+
 
     ###########################################################
     def _upgradeOldTablesIfNeeded(self):
@@ -405,6 +438,8 @@ class DataManager(object):
 
         self._connection.execute('''DROP TABLE objects''')
         self._connection.execute('''DROP TABLE motion''')
+        self._connection.execute('''DROP TABLE motionSpans''')
+        self._connection.execute('''DROP TABLE trackCompaction''')
 
         self._createTables()
         self._addIndices()
@@ -703,12 +738,15 @@ class DataManager(object):
             timeStr = " AND time >=%i AND time <=%i" % (startMs, stopMs)
 
             if len(idList) == 1:
-                searchStr = "DELETE FROM motion WHERE objUid=%i" % idList[0]
+                objStr = "objUid=%i" % idList[0]
             else:
-                searchStr = "DELETE FROM motion WHERE objUid in %s" % \
-                            (str(tuple(idList)))
+                objStr = "objUid in %s" % (str(tuple(idList)))
+            searchStr = "DELETE FROM motion WHERE " + objStr
 
+            self._expandMotionSpansAround(objStr, startMs, stopMs)
             self._cur.execute(searchStr + timeStr)
+            self._cur.execute(searchStr.replace("motion", "motionSpans", 1) +
+                              timeStr)
 
             # Remove objects that no longer have any motion data
             orphanedUids = []
@@ -747,6 +785,9 @@ class DataManager(object):
                         self._cur.execute('''UPDATE motion SET objUid=? WHERE'''
                                           ''' objUid=? AND time>?''',
                                           (newObjId, objId, stopMs))
+                        self._cur.execute('''UPDATE motionSpans SET objUid=? '''
+                                          '''WHERE objUid=? AND time>?''',
+                                          (newObjId, objId, stopMs))
                         # Set the min and max times on the new/old object.
                         self._cur.execute('''UPDATE objects SET timeStart='''
                             '''(SELECT MIN(time) FROM motion WHERE objUid=?) '''
@@ -772,6 +813,52 @@ class DataManager(object):
             self.save()
 
 
+    ###########################################################
+    def _expandMotionSpansAround(self, objStr, startMs, stopMs):
+        """Put back rows of compacted spans that overlap times being deleted
+
+        A span can only be expanded from the kept rows on both of its ends.
+        Once motion between startMs and stopMs is deleted, spans with either
+        end in there, or that reach across it, would lose their rows outside
+        of it, or bring back ones inside of it.  Their rows outside of the
+        times go back in the motion table, and the spans are removed.
+
+        @param  objStr   SQL restricting objUid, like "objUid = 12".
+        @param  startMs  The first ms that's being deleted.
+        @param  stopMs   The last ms that's being deleted.
+        """
+        spans = self._getMotionSpans(objStr, startMs-1, stopMs)
+        if not spans:
+            return
+
+        bboxes = self._cur.execute('''SELECT x1, y1, x2, y2, frame, time, '''
+                                   '''objUid FROM motion WHERE %s AND '''
+                                   '''time >= %i AND time <= %i '''
+                                   '''ORDER BY objUid ASC, time ASC''' %
+                                   (objStr, int(startMs)-kMaxSpanMs,
+                                    int(stopMs)+kMaxSpanMs)).fetchall()
+
+        keepBoxes = []
+        doneSpans = []
+        prevBox = None
+        for box in bboxes:
+            key = (box[6], box[5])
+            if key in spans and prevBox is not None and \
+               prevBox[6] == box[6] and prevBox[5] <= stopMs:
+                keepBoxes.extend(filledBox for filledBox in
+                                 expandMotionSpan(prevBox, box, spans[key])
+                                 if not startMs <= filledBox[5] <= stopMs)
+                doneSpans.append(key)
+            prevBox = box
+
+        self._cur.executemany('''INSERT OR REPLACE INTO motion '''
+                              '''Values (?, ?, ?, ?, ?, ?, ?)''',
+                              ((objId, frame, ms, x1, y1, x2, y2) for
+                               x1, y1, x2, y2, frame, ms, objId in keepBoxes))
+        self._cur.executemany('''DELETE FROM motionSpans WHERE objUid=? '''
+                              '''AND time=?''', doneSpans)
+
+
     ###########################################################
     def tidyObjectTable(self):
         """Tidy up the object table, removing orphaned objects.
@@ -872,14 +959,27 @@ class DataManager(object):
         # Create all the different pieces of our search string, which will
         # be combined with AND.
         if len(objIds) == 1:
-            filterPieces = ['objUid = %i' % list(objIds)[0]]
+            objStr = 'objUid = %i' % list(objIds)[0]
         else:
-            filterPieces = ['objUid in %s' % str(tuple(objIds))]
+            objStr = 'objUid in %s' % str(tuple(objIds))
+        filterPieces = [objStr]
         if startTime:
             filterPieces.append('time >= %i' % int(startTime))
         if endTime:
             filterPieces.append('time <= %i' % int(endTime))
 
+        # Old tracks may have been thinned out by the TrackCompactor; see if
+        # any of the rows we're after need to be put back...
+        spans = self._getMotionSpans(objStr, startTime, endTime)
+        if spans:
+            # Need the rows on both sides of each span too, which may be up to
+            # kMaxSpanMs outside of the requested times.
+            filterPieces = [objStr]
+            if startTime:
+                filterPieces.append('time >= %i' % (int(startTime)-kMaxSpanMs))
+            if endTime:
+                filterPieces.append('time <= %i' % (int(endTime)+kMaxSpanMs))
+
         searchStr = ' AND '.join(filterPieces)
 
         bboxes = self._cur.execute('''SELECT x1, y1, x2, y2, frame, time, '''
@@ -887,7 +987,218 @@ class DataManager(object):
                                    '''ORDER BY objUid ASC, time ASC'''
                                    % searchStr)
 
-        return bboxes.fetchall()
+        if not spans:
+            return bboxes.fetchall()
+
+        return self._expandMotionSpans(bboxes.fetchall(), spans, startTime,
+                                       endTime)
+
+
+    ###########################################################
+    def _getMotionSpans(self, objStr, startTime, endTime):
+        """Retrieve the compacted spans that may overlap the given times
+
+        @param  objStr     SQL restricting objUid, like "objUid = 12".
+        @param  startTime  The time to begin the search, None for the beginning
+        @param  endTime    The time to stop the search, None for most recent
+        @return spans      A dict; key = (objUid, time of the motion row that
+                           ends the span), value = packed times of the span.
+        """
+        filterPieces = [objStr]
+        if startTime:
+            filterPieces.append('time > %i' % int(startTime))
+        if endTime:
+            filterPieces.append('time < %i' % (int(endTime)+kMaxSpanMs))
+
+        spans = self._cur.execute('''SELECT objUid, time, times FROM '''
+                                  '''motionSpans WHERE %s'''
+                                  % ' AND '.join(filterPieces))
+
+        return dict(((objUid, time), times) for objUid, time, times in spans)
+
+
+    ###########################################################
+    def _expandMotionSpans(self, bboxes, spans, startTime, endTime):
+        """Put rows dropped by the TrackCompactor back into a list of bboxes
+
+        @param  bboxes     A list like getObjectBboxesBetweenTimes() returns,
+                           including the row before each span.
+        @param  spans      The spans, as returned by _getMotionSpans().
+        @param  startTime  The time to begin at, None for the beginning
+        @param  endTime    The time to stop at, None for most recent
+        @return bboxes     The list with the dropped rows filled back in, and
+                           anything outside the requested times removed.
+        """
+        if not startTime:
+            startTime = -1
+        if not endTime:
+            endTime = bboxes[-1][5] if bboxes else 0
+
+        result = []
+        prevBox = None
+        for box in bboxes:
+            times = spans.get((box[6], box[5]))
+            if times is not None and prevBox is not None and \
+               prevBox[6] == box[6]:
+                for filledBox in expandMotionSpan(prevBox, box, times):
+                    if startTime <= filledBox[5] <= endTime:
+                        result.append(filledBox)
+            if startTime <= box[5] <= endTime:
+                result.append(box)
+            prevBox = box
+
+        return result
+
+
+    ###########################################################
+    def getMotionForCameraBetweenTimes(self, camLoc, startTime, endTime):
+        """Retrieve all bounding boxes seen by a camera between the given times
+
+        Unlike most queries here, this ignores the current filter string.
+
+        @param  camLoc     The camera location to get motion for.
+        @param  startTime  The time to begin the search; inclusive.
+        @param  endTime    The time to stop the search; exclusive.
+        @return bboxes     An iterable of (time, x1, y1, x2, y2, type) tuples,
+                           ordered by time.
+        """
+        assert self._connection is not None
+
+        startTime, endTime = int(startTime), int(endTime)
+
+        # Old tracks may have been thinned out by the TrackCompactor; find the
+        # objects with spans that may reach into the requested times...
+        spanUids = [uid for uid, in self._cur.execute(
+            '''SELECT DISTINCT s.objUid '''
+            '''FROM objects o JOIN motionSpans s ON s.objUid = o.uid '''
+            '''WHERE o.timeStop >= ? AND o.timeStart < ? AND o.camLoc = ? '''
+            '''AND s.time > ? AND s.time < ?''',
+            (startTime, endTime, camLoc, startTime, endTime + kMaxSpanMs))]
+
+        # The objects time range goes first so that the timeStop index gets
+        # used; the motion rows are then found through their primary key.
+        searchStr = '''SELECT m.time, m.x1, m.y1, m.x2, m.y2, o.type ''' \
+                    '''FROM objects o JOIN motion m ON m.objUid = o.uid ''' \
+                    '''WHERE o.timeStop >= ? AND o.timeStart < ? AND ''' \
+                    '''o.camLoc = ? AND m.time >= ? AND m.time < ?'''
+        params = (startTime, endTime, camLoc, startTime, endTime)
+        if not spanUids:
+            return self._cur.execute(searchStr + ''' ORDER BY m.time ASC''',
+                                     params)
+
+        # ...and get those with their dropped rows put back.
+        uidStr = '(%s)' % ', '.join(str(uid) for uid in spanUids)
+        bboxes = self._cur.execute(searchStr + ''' AND m.objUid NOT IN %s'''
+                                   % uidStr, params).fetchall()
+        types = dict(self._cur.execute('''SELECT uid, type FROM objects '''
+                                       '''WHERE uid IN %s''' % uidStr))
+        for x1, y1, x2, y2, _, ms, objUid in \
+                self.getObjectBboxesBetweenTimes(spanUids, startTime,
+                                                 endTime-1):
+            bboxes.append((ms, x1, y1, x2, y2, types[objUid]))
+        bboxes.sort(key=operator.itemgetter(0))
+        return bboxes
+
+
+    ###########################################################
+    def getObjectsToCompact(self, afterStop, afterUid, beforeStop, limit):
+        """Retrieve objects that are old enough for track compaction.
+
+        Objects are returned in (timeStop, uid) order, so that the caller can
+        remember the last one handled and pick up from there.
+
+        @param  afterStop   Only objects that stopped at or after this time...
+        @param  afterUid    ...and, if they stopped exactly at afterStop, that
+                            have a higher uid than this.
+        @param  beforeStop  Only objects that stopped before this time.
+        @param  limit       The maximum number of objects to return.
+        @return objects     A list of (uid, camLoc, timeStop) tuples.
+        """
+        assert self._connection is not None
+
+        return self._cur.execute(
+            '''SELECT uid, camLoc, timeStop FROM objects WHERE '''
+            '''timeStop >= ? AND timeStop < ? AND '''
+            '''(timeStop > ? OR uid > ?) ORDER BY timeStop, uid LIMIT ?''',
+            (int(afterStop), int(beforeStop), int(afterStop), int(afterUid),
+             int(limit))).fetchall()
+
+
+    ###########################################################
+    def getRawObjectMotion(self, objId):
+        """Retrieve the motion rows stored for an object, without expansion.
+
+        @param  objId   The id of the object in the database.
+        @return bboxes  A list of (x1, y1, x2, y2, frame, time, objId), ordered
+                        by time; None if the object was compacted before.
+        """
+        assert self._connection is not None
+
+        if self._cur.execute('''SELECT objUid FROM motionSpans WHERE '''
+                             '''objUid=? LIMIT 1''', (objId,)).fetchone():
+            return None
+
+        return self._cur.execute('''SELECT x1, y1, x2, y2, frame, time, '''
+                                 '''objUid FROM motion WHERE objUid=? '''
+                                 '''ORDER BY time ASC''', (objId,)).fetchall()
+
+
+    ###########################################################
+    def compactObjectMotion(self, objId, dropTimes, spans):
+        """Replace motion rows of an object with compacted spans.
+
+        @param  objId      The id of the object in the database.
+        @param  dropTimes  The times of the motion rows to delete.
+        @param  spans      A list of (time, times) for the spans; time is the
+                           time of the kept row ending the span and times the
+                           packed times of the dropped rows before it.
+        """
+        assert self._connection is not None
+
+        self._cur.executemany('''DELETE FROM motion WHERE objUid=? AND '''
+                              '''time=?''',
+                              ((objId, ms) for ms in dropTimes))
+        self._cur.executemany('''INSERT OR REPLACE INTO motionSpans '''
+                              '''VALUES (?, ?, ?)''',
+                              ((objId, ms, sql.Binary(times))
+                               for ms, times in spans))
+
+
+    ###########################################################
+    def getTrackCompactionValue(self, name, default=0):
+        """Read a progress or statistics value of the track compactor.
+
+        @param  name     The name of the value.
+        @param  default  What to return if the value was never set.
+        @return value    The value.
+        """
+        row = self._cur.execute('''SELECT value FROM trackCompaction WHERE '''
+                                '''name=?''', (name,)).fetchone()
+        if row is None:
+            return default
+        return row[0]
+
+
+    ###########################################################
+    def setTrackCompactionValue(self, name, value):
+        """Write a progress or statistics value of the track compactor.
+
+        @param  name     The name of the value.
+        @param  value    The value.
+        """
+        self._cur.execute('''INSERT OR REPLACE INTO trackCompaction '''
+                          '''VALUES (?, ?)''', (name, value))
+
+
+    ###########################################################
+    def getFreeBytes(self):
+        """Return the space sitting unused inside of the database file.
+
+        @return freeBytes  Bytes on the free list, ready for reuse.
+        """
+        (pageSize,) = self._cur.execute('''PRAGMA page_size''').fetchone()
+        (freePages,) = self._cur.execute('''PRAGMA freelist_count''').fetchone()
+        return pageSize * freePages
 
 
     ###########################################################
@@ -976,8 +1287,9 @@ class DataManager(object):
     def getFrameAtTime(self, objId, time):
         """Retrieve the frame for the given time
 
-        For this function to return a value there must be an entry in the
-        motion table within 10 ms of the requested time
+        For this function to return a value the object must have been tracked
+        within 10 ms of the requested time, whether or not the TrackCompactor
+        dropped that row since
 
         @param  objId     An object that was tracked at the given time
         @param  time      The requested time
@@ -985,6 +1297,18 @@ class DataManager(object):
         @return distance  The abs ms distance from the requested time, or -1
         """
         variability = 10
+
+        # Rows dropped by the TrackCompactor may be closer than the ones still
+        # in the motion table; where it dropped any, look at all of them...
+        if self._getMotionSpans('objUid = %i' % int(objId),
+                                int(time)-variability, int(time)+variability):
+            bboxes = self.getObjectBboxesBetweenTimes(
+                [objId], int(time)-variability+1, int(time)+variability-1)
+            if bboxes:
+                box = min(bboxes, key=lambda box: abs(time-box[5]))
+                return box[4], abs(time-box[5])
+            return -1, -1
+
         # Find the closest time in the database
         results = self._cur.execute('''SELECT time FROM motion WHERE '''
                                     '''objUID=? AND time>? AND time<?''',
@@ -1027,8 +1351,22 @@ class DataManager(object):
         """
         result = self._cur.execute(
             '''SELECT x1, y1, x2, y2 FROM motion WHERE objUID=? AND frame=?''',
-            (objId, frame))
-        return result.fetchone()
+            (objId, frame)).fetchone()
+        if result is not None:
+            return result
+
+        # The row may have been compacted away; find the row ending the span
+        # that it would be in, and rebuild the span.
+        nextTime = self._cur.execute(
+            '''SELECT time FROM motion WHERE objUID=? AND frame>? '''
+            '''ORDER BY time LIMIT 1''', (objId, frame)).fetchone()
+        if nextTime is None:
+            return None
+        for box in self.getObjectBboxesBetweenTimes(
+                [objId], nextTime[0]-kMaxSpanMs, nextTime[0]):
+            if box[4] == frame:
+                return box[:4]
+        return None
 
 
     ###########################################################
@@ -1065,6 +1403,13 @@ class DataManager(object):
         if not result:
             return (-1, -1, -1, -1), -1, -1
 
+        if startTime:
+            # Rows just after startTime may have been compacted away.
+            bboxes = self.getObjectBboxesBetweenTimes([objId], startTime,
+                                                      result[5])
+            if bboxes:
+                result = bboxes[0][:6]
+
         x1, y1, x2, y2, frame, objTime = result
         return (x1, y1, x2, y2), frame, objTime
 
@@ -1313,6 +1658,8 @@ class DataManager(object):
                               idListStr)
             self._cur.execute('''DELETE FROM motion WHERE objUid IN (%s)''' %
                               idListStr)
+            self._cur.execute('''DELETE FROM motionSpans WHERE objUid '''
+                              '''IN (%s)''' % idListStr)
             self._cur.execute('''DELETE FROM actions WHERE objUid IN (%s)''' %
                               idListStr)
             self.save()
@@ -1434,6 +1781,9 @@ class DataManager(object):
             # Update the related entries in the motion table.
             self._cur.execute('''UPDATE motion SET objUid=? WHERE objUid=? '''
                               '''AND time>=?''', (newId, oldId, changeMs))
+            self._cur.execute('''UPDATE motionSpans SET objUid=? WHERE '''
+                              '''objUid=? AND time>=?''',
+                              (newId, oldId, changeMs))
 
             # Update the stop time of the old object.
             self._cur.execute('''UPDATE objects SET timeStop=? WHERE uid=?''',
@@ -1459,6 +1809,21 @@ class DataManager(object):
         return recentMs[0]
 
 
+    ###########################################################
+    def getOldestObjectTime(self, cameraLocation):
+        """Find the oldest ms an object was seen at a given location.
+
+        @param  cameraLocation  The camera to search.
+        @return oldestMs        The oldest ms seen or -1.
+        """
+        oldestMs = self._cur.execute('''SELECT MIN(timeStart) from objects '''
+                                     '''WHERE camLoc=?''', (cameraLocation,)
+                                     ).fetchone()
+        if not oldestMs or oldestMs[0] is None:
+            return -1
+        return oldestMs[0]
+
+
     ###########################################################
     def hasAudio(self):
         """Does the currently selected clip contain audio?
@@ -1719,18 +2084,69 @@ class DataManager(object):
         # Build the list of filenames and gaps from the first
         # file to the last.
         start, stop = self._clipManager.getFileTimeInformation(curFile)
-        fileList = [(os.path.join(self._vidStoragePath, curFile), start)]
+        fileList = [(self._getClipPath(curFile), start)]
         while stop < desiredLastMs:
             curFile = self._clipManager.getNextFile(curFile)
             if not curFile:
                 break
             start, stop = self._clipManager.getFileTimeInformation(curFile)
-            fileList.append((os.path.join(self._vidStoragePath, curFile),
-                             start))
+            fileList.append((self._getClipPath(curFile), start))
 
         return remuxClip(fileList, filePath, desiredFirstMs, desiredLastMs,
                            configDir, extras, self._logger.getCLogFn())>=0
 
+    ###########################################################
+    def getClipSegments(self, cameraLoc, firstMs, lastMs, segmentMs):
+        """Split the video between two times into pieces for streaming.
+
+        Pieces don't cross clip files, so each file's piece starts on a
+        keyframe; long files are cut into pieces of about segmentMs.
+
+        @param  cameraLoc  The name of the camera location.
+        @param  firstMs    The absolute ms to start at.
+        @param  lastMs     The absolute ms to stop at.
+        @param  segmentMs  About how long each piece should be.
+        @return segments   A list of (startMs, stopMs, fileList), where
+                           fileList is a remuxClip() style list of
+                           (path, fileStartMs); empty if there's no video.
+        """
+        segments = []
+        if not self._clipManager:
+            return segments
+
+        for filename, fileFirstMs, fileLastMs in \
+                self._clipManager.getFilesBetween(cameraLoc, firstMs, lastMs):
+            startMs = max(firstMs, fileFirstMs)
+            stopMs = min(lastMs, fileLastMs)
+            if stopMs <= startMs:
+                continue
+
+            fileList = [(self._getClipPath(filename), fileFirstMs)]
+            spanMs = stopMs - startMs
+            numPieces = max(1, int(round(float(spanMs) / segmentMs)))
+            for i in xrange(numPieces):
+                segments.append((startMs + spanMs*i/numPieces,
+                                 startMs + spanMs*(i+1)/numPieces, fileList))
+        return segments
+
+
+    ###########################################################
+    def getClipBoxList(self, cameraLoc, firstMs, lastMs, objList):
+        """Return the boxes to draw when saving video between two times.
+
+        @param  cameraLoc  The name of the camera location.
+        @param  firstMs    The absolute ms of the start of the video.
+        @param  lastMs     The absolute ms of the end of the video.
+        @param  objList    A list of object ids to draw boxes for.
+        @return boxList    A list to pass to remuxClip() as 'boxList'.
+        """
+        filename = self._clipManager.getFileAt(cameraLoc, firstMs,
+                                               lastMs-firstMs, 'after')
+        if not filename or not objList:
+            return []
+        return self._getBoundingBoxes(filename, objList, firstMs-10, lastMs+10)
+
+
     ###########################################################
     def getBoundingBoxesBetweenTimes(self, camLoc, firstMs, lastMs, procSize, format="videoLib"):
         ''' Get all bounding boxes between times.
@@ -1852,7 +2268,7 @@ class DataManager(object):
             return False
         # Open this file if it isn't already open
         if filePath != self._curVidPath or self._curFileAudioEnabled != self._audioEnabled:
-            fullPath = os.path.join(self._vidStoragePath, filePath)
+            fullPath = self._getClipPath(filePath)
             if not os.path.exists(fullPath):
                 self._logger.error("Failed to open %s" % (ensureUtf8(fullPath)))
                 return False
@@ -2131,7 +2547,7 @@ class DataManager(object):
         if not fileName:
             return defaultReturn
 
-        filePath = os.path.join(self._vidStoragePath, fileName)
+        filePath = self._getClipPath(fileName)
         if not filePath or not os.path.exists(filePath):
             return defaultReturn
 
@@ -2183,9 +2599,13 @@ class DataManager(object):
         """
         # TODO: may need to check the requested size, but for now
         #       pre-created thumbs should work for all existing clients
-        thumbFile, _ = self.getThumbFileFromCache(camLoc, ms)
-        if thumbFile is not None:
-            shutil.copy(thumbFile, outputFile)
+        thumbData, _ = self.getThumbFromCache(camLoc, ms)
+        if thumbData is not None:
+            f = open(outputFile, 'wb')
+            try:
+                f.write(thumbData)
+            finally:
+                f.close()
             return True
 
         # Find the file path.
@@ -2198,7 +2618,7 @@ class DataManager(object):
                 self._logger.warning("file for %d@%s not found" % (ms, camLoc))
             return False
 
-        fullPath = os.path.join(self._vidStoragePath, fileName)
+        fullPath = self._getClipPath(fileName)
         if not fullPath or not os.path.exists(fullPath):
             self._logger.error("no output path for %d@%s" % (ms, camLoc))
             return False
@@ -2234,7 +2654,7 @@ class DataManager(object):
             clipSize = self._clipReader.getInputSize()
         else:
             clipReader = ClipReader(self._logger.getCLogFn())
-            fullPath = os.path.join(self._vidStoragePath, filename)
+            fullPath = self._getClipPath(filename)
             if not os.path.exists(fullPath) or \
                not clipReader.open( fullPath, 0, 0, 0, {} ):
                 clipSize = (0,0)
@@ -2344,17 +2764,47 @@ class DataManager(object):
                 draw.rectangle( bbox, outline=labelColor)
 
     ###########################################################
-    def _populateThumbCache(self, camLoc, timeIndex):
-        dirname = os.path.join(self._vidStoragePath, camLoc, timeIndex, kThumbsSubfolder)
+    def _getClipPath(self, fileName):
+        """Return the full path of a clip.
+
+        @param  fileName  Name of the clip, as stored in the clip database.
+        @return path      The full path of the clip; may be in the folder video
+                          is being moved from.
+        """
+        if self._clipManager is None:
+            return os.path.join(self._vidStoragePath, fileName)
+        return self._clipManager.getClipPath(self._vidStoragePath, fileName)
+
+    ###########################################################
+    def _getThumbDirs(self, camLoc, timeIndex):
+        """Return the folders that may hold thumbnails for a time index.
 
+        @param  camLoc     The camera location.
+        @param  timeIndex  The first 5 digits of the thumbnail times.
+        @return dirs       The folder in the current video location, followed
+                           by the one in the folder video is being moved from,
+                           if any.
+        """
+        dirs = [os.path.join(self._vidStoragePath, camLoc, timeIndex,
+                             kThumbsSubfolder)]
+        if self._clipManager is not None:
+            fromDir = self._clipManager.getRelocationInfo()[0]
+            if fromDir:
+                dirs.append(os.path.join(fromDir, camLoc, timeIndex,
+                                         kThumbsSubfolder))
+        return dirs
+
+    ###########################################################
+    def _populateThumbCache(self, camLoc, timeIndex):
         resTimes = []
-        if os.path.isdir(dirname):
-            thumbmask = os.path.join(dirname, "*.jpg")
-            files = glob.glob(thumbmask)
-            for file in files:
-                fileMs = int(os.path.splitext(os.path.basename(file))[0])
-                resTimes.append(fileMs)
-            resTimes.sort()
+        for dirname in self._getThumbDirs(camLoc, timeIndex):
+            if os.path.isdir(dirname):
+                thumbmask = os.path.join(dirname, "*.jpg")
+                files = glob.glob(thumbmask)
+                for file in files:
+                    fileMs = int(os.path.splitext(os.path.basename(file))[0])
+                    resTimes.append(fileMs)
+        resTimes = sorted(set(resTimes))
         self._thumbCache[camLoc][timeIndex] = (getTimeAsMs(), resTimes)
 
     ###########################################################
@@ -2403,10 +2853,40 @@ class DataManager(object):
            return before
 
     ###########################################################
-    def getThumbFileFromCache(self, camLoc, ms, tolerance=3000):
+    def _getThumbArchivePaths(self, camLoc, ms, tolerance):
+        """Return the paths of archives that may hold the closest thumbnail.
+
+        @param  camLoc     The camera location.
+        @param  ms         The time of the thumbnail.
+        @param  tolerance  How far from ms to look.
+        @return paths      The archives' paths in the current video location,
+                           followed by the ones in the folder video is being
+                           moved from, if any.
+        """
+        videoDirs = [self._vidStoragePath]
+        if self._clipManager is not None:
+            fromDir = self._clipManager.getRelocationInfo()[0]
+            if fromDir:
+                videoDirs.append(fromDir)
+        paths = []
+        for videoDir in videoDirs:
+            for t in (ms-tolerance, ms, ms+tolerance):
+                path = getThumbArchivePath(videoDir, camLoc, t)
+                if path not in paths:
+                    paths.append(path)
+        return paths
+
+    ###########################################################
+    def getThumbFromCache(self, camLoc, ms, tolerance=3000):
         """ Retrieve best thumbnail image, caching file list for the folder
             This prevents repetitive glob operations when retrieving a sequential
-            list of thumbs, which is beneficial for slower file systems
+            list of thumbs, which is beneficial for slower file systems.
+
+            Thumbnails are looked for in the hourly archives, and as single
+            files in thumbs folders written by older versions.
+
+            @return data  The JPEG data of the thumbnail, or None.
+            @return ms    The time of the thumbnail, or None.
         """
         _kMaxCacheAge = 10*60*1000
         _kSafetyTimeBuffer = 10*000
@@ -2454,13 +2934,34 @@ class DataManager(object):
                         abs(closestTime-ms) > abs(closestTimeInFolder-ms):
                         closestTime = closestTimeInFolder
 
-            closestTimeAsStr = str(closestTime)
-            filename = os.path.join(self._vidStoragePath, camLoc, closestTimeAsStr[:5], kThumbsSubfolder, closestTimeAsStr + ".jpg")
+            # Archives keep their own index, and only read what's been
+            # appended since they were last looked at.
+            closestArchive = None
+            for path in self._getThumbArchivePaths(camLoc, ms, tolerance):
+                closestTimeInArchive = self._closestValue(
+                        self._thumbArchives.getTimes(path), ms)
+                if closestTimeInArchive is not None:
+                    if closestTime is None or \
+                        abs(closestTime-ms) > abs(closestTimeInArchive-ms):
+                        closestTime = closestTimeInArchive
+                        closestArchive = path
 
-            if os.path.isfile(filename):
-                res = filename, closestTime
-            else:
-                res = None, None
+            res = None, None
+            if closestArchive is not None:
+                data = self._thumbArchives.read(closestArchive, closestTime)
+                if data is not None:
+                    res = data, closestTime
+            elif closestTime is not None:
+                closestTimeAsStr = str(closestTime)
+                for dirname in self._getThumbDirs(camLoc, closestTimeAsStr[:5]):
+                    filename = os.path.join(dirname, closestTimeAsStr + ".jpg")
+                    if os.path.isfile(filename):
+                        f = open(filename, 'rb')
+                        try:
+                            res = f.read(), closestTime
+                        finally:
+                            f.close()
+                        break
         except:
             self._logger.error(traceback.format_exc())
             res = None, None
@@ -2474,11 +2975,11 @@ class DataManager(object):
 
         try:
             # Figure out the location of our thumbnail
-            thumbFile, fileMs = self.getThumbFileFromCache(camLoc, ms, tolerance)
+            thumbData, fileMs = self.getThumbFromCache(camLoc, ms, tolerance)
 
-            if thumbFile is not None:
+            if thumbData is not None:
                 # Resize and return the thumb if found
-                img = Image.open(thumbFile)
+                img = Image.open(StringIO(thumbData))
 
                 # Do not return pre-created thumb if a requested dimension
                 # greater than the actual thumb dimension
@@ -2654,4 +3155,131 @@ class DataManager(object):
 
         return self._clipManager.getUniqueProcSizesBetweenTimes(
             camLoc, startTime, endTime
-        )
\ No newline at end of file
+        )
+
+
+
+##############################################################################
+def _testDeleteStraddlingSpans():
+    """Test deleting times that compacted spans of motion reach across.
+
+    >>> import shutil, tempfile
+    >>> from vitaToolbox.loggingUtils.LoggingUtils import EmptyLogger
+    >>> from TrackCompactor import packMotionSpan
+    >>> tmpDir = tempfile.mkdtemp()
+    >>> dataMgr = DataManager(EmptyLogger())
+    >>> dataMgr.open(os.path.join(unicode(tmpDir), u"objdb2"))
+
+    An object moving steadily for 20 frames, compacted down to 4 rows, with
+    spans ending at 1900 and 2900:
+
+    >>> objId = dataMgr.addObject(1000, 'person', 'cam')
+    >>> rows = [(i*2, 0, i*2 + 10, 10, i, 1000 + i*100) for i in xrange(20)]
+    >>> for row in rows:
+    ...     dataMgr.addFrame(objId, row[4], row[5], row[:4], 'person', None)
+    >>> dataMgr.compactObjectMotion(objId,
+    ...     [row[5] for row in rows if row[4] not in (0, 9, 10, 19)],
+    ...     [packMotionSpan(rows, 0, 9), packMotionSpan(rows, 10, 19)])
+    >>> dataMgr.save()
+
+    >>> def getTimes():
+    ...     uids = [uid for uid, in dataMgr._cur.execute(
+    ...             'SELECT uid FROM objects ORDER BY timeStart')]
+    ...     boxes = dataMgr.getObjectBboxesBetweenTimes(uids)
+    ...     assert all(box[:6] == rows[box[4]] for box in boxes)
+    ...     return [box[5] for box in boxes]
+    >>> expected = [row[5] for row in rows]
+    >>> getTimes() == expected
+    True
+
+    Deleting times inside the first span, with both of its ends kept, splits
+    the object; rows after the deleted ones are still there:
+
+    >>> dataMgr.deleteCameraLocationDataBetween('cam', 1450, 1650)
+    >>> expected = [ms for ms in expected if not 1450 <= ms <= 1650]
+    >>> getTimes() == expected
+    True
+
+    Deleting the row ending the first span and the one before the second:
+
+    >>> dataMgr.deleteCameraLocationDataBetween('cam', 1850, 2050)
+    >>> expected = [ms for ms in expected if not 1850 <= ms <= 2050]
+    >>> getTimes() == expected
+    True
+
+    >>> dataMgr.close()
+    >>> shutil.rmtree(tmpDir, True)
+    """
+
+
+##############################################################################
+def _testCompactedMotion():
+    """Test that compacted motion reads back like it was before.
+
+    >>> import shutil, tempfile
+    >>> from vitaToolbox.loggingUtils.LoggingUtils import EmptyLogger
+    >>> from HeatmapManager import HeatmapManager
+    >>> from TrackCompactor import packMotionSpan
+    >>> class FakeClipManager(object):
+    ...     def getUniqueProcSizesBetweenTimes(self, *args):
+    ...         return [(320, 240, None, None)]
+    >>> tmpDir = tempfile.mkdtemp()
+    >>> dataMgr = DataManager(EmptyLogger(), FakeClipManager())
+    >>> dataMgr.open(os.path.join(unicode(tmpDir), u"objdb2"))
+
+    An object moving steadily for 20 frames, compacted down to 3 rows, and
+    one which wasn't compacted:
+
+    >>> objId = dataMgr.addObject(1000, 'person', 'cam')
+    >>> rows = [(i*2, 0, i*2 + 10, 10, i, 1000 + i*100) for i in xrange(20)]
+    >>> for row in rows:
+    ...     dataMgr.addFrame(objId, row[4], row[5], row[:4], 'person', None)
+    >>> otherId = dataMgr.addObject(1450, 'vehicle', 'cam')
+    >>> dataMgr.addFrame(otherId, 0, 1450, (0, 0, 5, 5), 'vehicle', None)
+    >>> dataMgr.compactObjectMotion(objId,
+    ...     [row[5] for row in rows if row[4] not in (0, 9, 19)],
+    ...     [packMotionSpan(rows, 0, 9), packMotionSpan(rows, 9, 19)])
+    >>> dataMgr.save()
+
+    The camera's motion has all rows again, in time order:
+
+    >>> motion = list(dataMgr.getMotionForCameraBetweenTimes('cam', 1200,
+    ...                                                      1700))
+    >>> [(ms, objType) for ms, _, _, _, _, objType in motion]
+    [(1200, u'person'), (1300, u'person'), (1400, u'person'), \
+(1450, u'vehicle'), (1500, u'person'), (1600, u'person')]
+    >>> motion[0][1:5] == rows[2][:4]
+    True
+
+    Frames are found at the closest time, dropped or not:
+
+    >>> dataMgr.getFrameAtTime(objId, 1504)
+    (5, 4)
+    >>> dataMgr.getFrameAtTime(objId, 1896)
+    (9, 4)
+
+    Heatmaps built after compaction count every row:
+
+    >>> heatmapMgr = HeatmapManager(EmptyLogger(), 4, 2)
+    >>> heatmapMgr.open(os.path.join(unicode(tmpDir), u"heatmaps"))
+    >>> heatmapMgr.buildFromDatabase(dataMgr, 'cam', 0, 3000)
+    21
+    >>> heatmapMgr.close()
+
+    >>> dataMgr.close()
+    >>> shutil.rmtree(tmpDir, True)
+    """
+
+
+##############################################################################
+def test_main():
+    """OB_REDACT
+    Our main function, which runs test code
+    """
+    import doctest
+    doctest.testmod(verbose=True)
+
+
+##############################################################################
+if __name__ == '__main__':
+    test_main()
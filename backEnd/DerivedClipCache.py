@@ -0,0 +1,391 @@
+#!/usr/bin/env python
+
+#*****************************************************************************
+#
+# DerivedClipCache.py
+#     Keeps clips exported for remote clients, to hand out again.
+#
+#
+#*****************************************************************************
+#
+#
+# Copyright 2013-2022 Sighthound, Inc.
+#
+# Licensed under the GNU GPLv3 license found at
+# https://www.gnu.org/licenses/gpl-3.0.txt
+#
+# Alternative licensing available from Sighthound, Inc.
+# by emailing opensource@sighthound.com
+#
+# This file is part of the Sighthound Video project which can be found at
+# https://github.com/sighthoundinc/SighthoundVideo
+#
+# This program is free software; you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation; using version 3 of the License.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program; if not, write to the Free Software
+# Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02111, USA.
+#
+#
+#*****************************************************************************
+
+"""
+## @file
+Contains the DerivedClipCache class.
+"""
+
+# Python imports...
+from collections import OrderedDict
+import hashlib
+import os
+import re
+import threading
+import time
+
+# Common 3rd-party imports...
+
+# Toolbox imports...
+
+# Local imports...
+
+# How much disk the cached clips may take up before the least recently used
+# ones are removed.
+_kMaxCacheBytes = 1024*1024*1024
+
+# Clips not used for this many seconds are removed.  Clips of video which
+# got deleted can't be asked for anymore (their keys have the source files),
+# so this is how long they stay around.
+_kMaxAgeSecs = 24*60*60
+
+# What clips being made are called, from the key and extension.  The
+# extension stays last, since it may tell what kind of file to make.
+_kTempFileFormat = "%s.tmp.%s"
+
+# What the files of cached clips are called: the key and an extension.
+_kCachedFileRe = re.compile(r'^([0-9a-f]{40})\.[a-z0-9]+$')
+
+
+###############################################################
+def makeClipKey(*params):
+    """Make the key of a clip from everything that goes into making it.
+
+    @param  params  Anything with a stable repr(), like strings, numbers and
+                    tuples.  Dicts are fine too, their items are sorted.
+    @return key     A hex string, safe to use in file names.
+    """
+    def _stable(value):
+        if isinstance(value, dict):
+            return sorted((k, _stable(v)) for k, v in value.iteritems())
+        if isinstance(value, (list, tuple)):
+            return [_stable(v) for v in value]
+        return value
+    return hashlib.sha1(repr(_stable(params))).hexdigest()
+
+
+###############################################################
+class DerivedClipCache(object):
+    """Keeps made clips on disk, keyed by everything that went into them, so
+    asking for the same clip again doesn't make it again.
+
+    The key should include the clip's source files, so that clips made from
+    files which changed since don't match anymore.  Clips are kept across
+    restarts; once they take up too much room, the least recently used ones
+    are removed, and so are those which weren't used for a while.  While a
+    clip is being made, others asking for it wait for it instead of making it
+    too.
+    """
+    ###########################################################
+    def __init__(self, cacheDir, logger, maxBytes=_kMaxCacheBytes,
+                 maxAgeSecs=_kMaxAgeSecs):
+        """Initializer for DerivedClipCache
+
+        @param  cacheDir    The directory to keep clips in.
+        @param  logger      The logger to use.
+        @param  maxBytes    How much disk the clips may take up.
+        @param  maxAgeSecs  Seconds after which unused clips are removed.
+        """
+        self._cacheDir = cacheDir
+        self._logger = logger
+        self._maxBytes = maxBytes
+        self._maxAgeSecs = maxAgeSecs
+
+        # Guards everything below.
+        self._lock = threading.Lock()
+
+        # Key = file name, value = (size, time last used); least recently
+        # used first.
+        self._cached = OrderedDict()
+        self._cachedBytes = 0
+
+        # Key = file name, value = Event set once the clip was made (or
+        # couldn't be).
+        self._pending = {}
+
+        try:
+            os.makedirs(self._cacheDir)
+        except OSError:
+            pass
+        self._loadExisting()
+
+
+    ###########################################################
+    def get(self, key, ext, make):
+        """Return a clip, making it if we don't have it.
+
+        @param  key       The key of the clip, from makeClipKey().
+        @param  ext       The extension of the clip's file, like "mp4".
+        @param  make      Function taking a path, making the clip there;
+                          returns True if it did.  Called without any locks
+                          held, at most once at a time for each key.
+        @return fileName  The name of the clip's file in the cache directory,
+                          or None if it couldn't be made.
+        """
+        fileName = "%s.%s" % (key, ext)
+        path = os.path.join(self._cacheDir, fileName)
+
+        while True:
+            self._lock.acquire()
+            try:
+                if fileName in self._cached:
+                    size, _ = self._cached.pop(fileName)
+                    if os.path.exists(path):
+                        self._cached[fileName] = (size, time.time())
+                        self._touch(path)
+                        return fileName
+                    # Somebody else removed it.
+                    self._cachedBytes -= size
+
+                event = self._pending.get(fileName)
+                if event is None:
+                    event = threading.Event()
+                    self._pending[fileName] = event
+                    break
+            finally:
+                self._lock.release()
+
+            # Somebody else is making it; see what came of that.
+            event.wait()
+            self._lock.acquire()
+            try:
+                if fileName not in self._cached:
+                    return None
+            finally:
+                self._lock.release()
+
+        startTime = time.time()
+        tempPath = os.path.join(self._cacheDir, _kTempFileFormat % (key, ext))
+        success = False
+        try:
+            success = make(tempPath) and os.path.exists(tempPath)
+            if success:
+                if os.path.exists(path):
+                    os.remove(path)
+                os.rename(tempPath, path)
+        except Exception:
+            self._logger.error("Couldn't make clip %s" % fileName,
+                               exc_info=True)
+            success = False
+
+        self._lock.acquire()
+        try:
+            if success:
+                size = os.path.getsize(path)
+                self._cached[fileName] = (size, time.time())
+                self._cachedBytes += size
+                self._evict(fileName)
+                self._logger.info("Made clip %s, %d bytes, in %.2fs" %
+                                  (fileName, size, time.time()-startTime))
+            else:
+                self._remove(tempPath)
+            del self._pending[fileName]
+            event.set()
+        finally:
+            self._lock.release()
+
+        return fileName if success else None
+
+
+    ###########################################################
+    def expire(self):
+        """Remove clips which weren't used for too long."""
+        self._lock.acquire()
+        try:
+            self._evict(None)
+        finally:
+            self._lock.release()
+
+
+    ###########################################################
+    def getCachedBytes(self):
+        """Return how much disk the cached clips take up.
+
+        @return numBytes  The size of all cached clips.
+        """
+        self._lock.acquire()
+        try:
+            return self._cachedBytes
+        finally:
+            self._lock.release()
+
+
+    ###########################################################
+    def _loadExisting(self):
+        """Pick up clips made before, oldest used first."""
+        found = []
+        for fileName in os.listdir(self._cacheDir):
+            path = os.path.join(self._cacheDir, fileName)
+            if _kCachedFileRe.match(fileName) is None:
+                # Left over from being made, or not ours at all.
+                self._remove(path)
+                continue
+            try:
+                found.append((os.path.getmtime(path), fileName,
+                              os.path.getsize(path)))
+            except OSError:
+                pass
+
+        for usedTime, fileName, size in sorted(found):
+            self._cached[fileName] = (size, usedTime)
+            self._cachedBytes += size
+        self._evict(None)
+
+
+    ###########################################################
+    def _evict(self, keep):
+        """Remove the least recently used clips, until we're within size and
+        none of them is too old.
+
+        Must be called with _lock held.
+
+        @param  keep  The file name of a clip not to remove.
+        """
+        expired = time.time() - self._maxAgeSecs
+        for fileName, (size, usedTime) in self._cached.items():
+            if self._cachedBytes <= self._maxBytes and usedTime >= expired:
+                break
+            if fileName != keep:
+                del self._cached[fileName]
+                self._cachedBytes -= size
+                self._remove(os.path.join(self._cacheDir, fileName))
+
+
+    ###########################################################
+    def _touch(self, path):
+        """Mark a clip as just used, also for after a restart.
+
+        @param  path  The path of the clip.
+        """
+        try:
+            os.utime(path, None)
+        except OSError:
+            pass
+
+
+    ###########################################################
+    def _remove(self, path):
+        """Remove a file, if it's there.
+
+        @param  path  The path of the file.
+        """
+        try:
+            os.remove(path)
+        except OSError:
+            pass
+
+
+
+##############################################################################
+def _testDerivedClipCache():
+    """Test caching clips.
+
+    >>> import shutil, tempfile
+    >>> from vitaToolbox.loggingUtils.LoggingUtils import EmptyLogger
+    >>> cacheDir = tempfile.mkdtemp()
+    >>> made = []
+    >>> def make(content):
+    ...     def _make(path):
+    ...         made.append(content)
+    ...         time.sleep(.1)
+    ...         open(path, 'wb').write(content)
+    ...         return True
+    ...     return _make
+    >>> cache = DerivedClipCache(cacheDir, EmptyLogger(), maxBytes=10)
+
+    Keys don't depend on the order of dict items:
+
+    >>> makeClipKey('cam', 1, {'a': 1, 'b': 2}) == \\
+    ...     makeClipKey('cam', 1, {'b': 2, 'a': 1})
+    True
+    >>> keyA, keyB, keyC = [makeClipKey(name) for name in 'abc']
+
+    A clip is made once, even when asked for by several at the same time:
+
+    >>> results = []
+    >>> def getThread():
+    ...     results.append(cache.get(keyA, 'mp4', make('aaaa')))
+    >>> threads = [threading.Thread(target=getThread) for _ in xrange(3)]
+    >>> for thread in threads: thread.start()
+    >>> for thread in threads: thread.join()
+    >>> made, len(set(results)), results[0] == keyA + '.mp4'
+    (['aaaa'], 1, True)
+    >>> cache.get(keyA, 'mp4', make('again')) == keyA + '.mp4', made
+    (True, ['aaaa'])
+
+    Too many bytes, and the least recently used clips go:
+
+    >>> _ = cache.get(keyB, 'mp4', make('bbbb'))
+    >>> _ = cache.get(keyA, 'mp4', make('again'))
+    >>> _ = cache.get(keyC, 'mp4', make('cccc'))
+    >>> sorted(os.listdir(cacheDir)) == sorted([keyA + '.mp4', keyC + '.mp4'])
+    True
+
+    Clips that couldn't be made aren't kept, and are tried again:
+
+    >>> cache.get(keyB, 'mp4', lambda path: False)
+    >>> cache.get(keyB, 'mp4', make('bb')) == keyB + '.mp4'
+    True
+
+    Clips are still there after a restart, except what was being made:
+
+    >>> open(os.path.join(cacheDir, keyB + '.tmp.mp4'), 'w').write('x')
+    >>> cache = DerivedClipCache(cacheDir, EmptyLogger(), maxBytes=10)
+    >>> cache.getCachedBytes(), len(os.listdir(cacheDir))
+    (10, 3)
+
+    Clips which weren't used for a while go too:
+
+    >>> cache = DerivedClipCache(cacheDir, EmptyLogger(), maxBytes=10,
+    ...                          maxAgeSecs=.2)
+    >>> _ = cache.get(keyA, 'mp4', make('again'))
+    >>> time.sleep(.3)
+    >>> _ = cache.get(keyC, 'mp4', make('again'))
+    >>> cache.expire()
+    >>> sorted(os.listdir(cacheDir)) == [keyC + '.mp4']
+    True
+    >>> time.sleep(.3)
+    >>> cache.expire()
+    >>> cache.getCachedBytes(), os.listdir(cacheDir)
+    (0, [])
+    >>> shutil.rmtree(cacheDir)
+    """
+
+
+##############################################################################
+def test_main():
+    """OB_REDACT
+    Our main function, which runs test code
+    """
+    import doctest
+    doctest.testmod(verbose=True)
+
+
+##############################################################################
+if __name__ == '__main__':
+    test_main()
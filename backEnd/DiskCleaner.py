@@ -63,14 +63,26 @@ from vitaToolbox.windows.winUtils import registerForForcedQuitEvents
 from vitaToolbox.process.ProcessUtils import setProcessPriority, kPriorityLow, checkMemoryLimit
 from vitaToolbox.strUtils.EnsureUnicode import ensureUtf8
 from vitaToolbox.profiling.MarkTime import TimerLogger
+from vitaToolbox.profiling.ObjectCensus import registerCache, CensusSampler
 
 # Local imports...
 from appCommon.CommonStrings import kCorruptDbErrorStrings, kMinFreeSysDriveSpaceMB, kThumbsSubfolder
+from appCommon.CommonStrings import kThumbArchiveExt
+from appCommon.CommonStrings import kRuleDir
+from appCommon.CommonStrings import kRemoteClipCacheFolder
+from appCommon.CommonStrings import kRemoteHlsFolder
+from appCommon.DebugPrefs import getDebugPrefAsInt
 from ClipManager import kCacheStatusNonCache
 from ClipManager import ClipManager
 from DataManager import DataManager
 from DebugLogManager import DebugLogManager
+from HeatmapManager import HeatmapManager
 import MessageIds
+from OverloadGovernor import kShedCleanerScans
+from TrackCompactor import TrackCompactor
+from TrackCompactor import kDefaultAgeHours, kDefaultTolerancePx
+from ThumbnailArchive import getThumbArchiveInfo, getThumbArchivePaths
+from ThumbnailArchive import removeThumbsBetween
 from videoLib2.python.ClipReader import ClipReader, getMsList, getDuration
 import videoLib2.python.ClipUtils as ClipUtils
 
@@ -150,7 +162,7 @@ _cleaner = None
 
 ###############################################################
 def runDiskCleaner(backEndQueue, cleanerQueue, clipMgrPath, dataMgrPath, #PYCHECKER OK: Too many arguments
-                   numCameras, maxStorage, videoDir, tmpDir, logDir, configDir,
+                   heatmapMgrPath, numCameras, maxStorage, videoDir, tmpDir, logDir, configDir,
                    remoteDir, infiniteMode, maxCache):
     """Create and start a DiskCleaner process.
 
@@ -158,6 +170,7 @@ def runDiskCleaner(backEndQueue, cleanerQueue, clipMgrPath, dataMgrPath, #PYCHEC
     @param  cleanerQueue  A queue to listen for control messages on.
     @param  clipMgrPath   A path to the clip manager database.
     @param  dataMgrPath   A path to the data manager database.
+    @param  heatmapMgrPath  A path to the heatmap database.
     @param  numCameras    The number of cameras being recorded.
     @param  maxStorage    The maximum GB to be used.
     @param  videoDir      The top level directory where videos are stored.
@@ -172,7 +185,7 @@ def runDiskCleaner(backEndQueue, cleanerQueue, clipMgrPath, dataMgrPath, #PYCHEC
     """
     global _cleaner
     _cleaner = DiskCleaner(backEndQueue, cleanerQueue, clipMgrPath, dataMgrPath,
-                           numCameras, maxStorage, videoDir, tmpDir, logDir,
+                           heatmapMgrPath, numCameras, maxStorage, videoDir, tmpDir, logDir,
                            configDir, remoteDir, infiniteMode, maxCache)
     _cleaner.run()
     _cleaner = None
@@ -183,7 +196,7 @@ class DiskCleaner(object):
     """A class for regulating disk space usage."""
     ###########################################################
     def __init__(self, backEndQueue, cleanerQueue, clipMgrPath, dataMgrPath, #PYCHECKER OK: Too many arguments
-                 numCameras, maxStorage, videoDir, tmpDir, logDir, configDir,
+                 heatmapMgrPath, numCameras, maxStorage, videoDir, tmpDir, logDir, configDir,
                  remoteDir, infiniteMode, maxCache):
         """Initialize CameraCapture.
 
@@ -191,6 +204,7 @@ class DiskCleaner(object):
         @param  cleanerQueue  A queue to listen for control messages on.
         @param  clipMgrPath   A path to the clip manager database.
         @param  dataMgrPath   A path to the data manager database.
+        @param  heatmapMgrPath  A path to the heatmap database.
         @param  numCameras    The number of cameras being recorded
         @param  maxStorage    The maximum GB to be used.
         @param  videoDir      The top level directory where videos are stored.
@@ -226,6 +240,7 @@ class DiskCleaner(object):
         self._pendingDeletes = []
         self._tmpFileDict = {}
         self._lastOrphanFileCleanup = 0
+        self._deferOrphanScans = False
         self._thumbsSize = 0
         self._thumbsCount = 0
         self._thumbsPartial = False
@@ -238,6 +253,12 @@ class DiskCleaner(object):
         # getsize calls. Key = file name relative to root storage dir,
         # Value = (filesize, cachedtime)
         self._fileSizeCache = {}
+        registerCache("diskCleaner.fileSizeCache", self, "_fileSizeCache")
+        registerCache("diskCleaner.tmpFiles", self, "_tmpFileDict")
+
+        # Logs what grows in this process every so many seconds, if asked.
+        self._censusSampler = CensusSampler(self._logger,
+                getDebugPrefAsInt("objectCensusSecs", 0, configDir))
 
         self._clipMgr = ClipManager(self._logger)
         self._clipMgr.open(clipMgrPath, _kDatabaseTimeoutSecs)
@@ -245,6 +266,20 @@ class DiskCleaner(object):
         self._dataMgr = DataManager(self._logger)
         self._dataMgr.open(dataMgrPath, _kDatabaseTimeoutSecs)
 
+        self._heatmapMgr = HeatmapManager(self._logger)
+        self._heatmapMgr.open(heatmapMgrPath, _kDatabaseTimeoutSecs)
+
+        # Thins out motion data of old tracks; an age of 0 turns it off.
+        self._trackCompactor = None
+        compactAgeHours = getDebugPrefAsInt("trackCompactionAgeHours",
+                                            kDefaultAgeHours, configDir)
+        if compactAgeHours > 0:
+            self._trackCompactor = TrackCompactor(self._logger, self._dataMgr,
+                self._clipMgr, os.path.join(configDir, kRuleDir),
+                getDebugPrefAsInt("trackCompactionTolerance",
+                                  kDefaultTolerancePx, configDir),
+                compactAgeHours)
+
         self._logger.info("DiskCleaner initialized, pid: %d" % os.getpid())
         assert type(self._videoDir) == unicode
         assert type(self._tmpDir) == unicode
@@ -298,6 +333,7 @@ class DiskCleaner(object):
                         self._processMessage([MessageIds.msgIdQuit])
                         continue
 
+                    self._censusSampler.update(time.time())
                     moreToDo = self._doCleanup()
                     if not moreToDo:
                         # Collect garbage if we're gonna sleep...
@@ -352,7 +388,7 @@ class DiskCleaner(object):
             # After this message finishes we'll immediately go into _doCleanup
             # which will delete files from _pendingDeletes
             indexPaths = self._clipMgr.getAllFilesFromLocation(location)
-            fullPaths = [os.path.join(self._videoDir, path)
+            fullPaths = [self._clipMgr.getClipPath(self._videoDir, path)
                          for path in indexPaths]
             self._pendingDeletes.extend(fullPaths)
             self._clipMgr.deleteLocation(location)
@@ -363,6 +399,10 @@ class DiskCleaner(object):
             self._maxCacheDuration = msg[1]*60*60*1000
         elif msgId == MessageIds.msgIdSetDebugConfig:
             self._debugLogManager.SetLogConfig(msg[1])
+        elif msgId == MessageIds.msgIdSetLoadShedding:
+            self._deferOrphanScans = kShedCleanerScans in msg[1]
+            self._logger.info("Orphan file scans %s" % ("deferred" if
+                              self._deferOrphanScans else "allowed"))
 
 
     ###########################################################
@@ -371,6 +411,11 @@ class DiskCleaner(object):
         now = time.time()
 
         for base, dirs, files in os.walk(self._remoteDir):
+            # Caches which manage their own size; files of theirs going away
+            # behind their backs would still be handed out.
+            if base == self._remoteDir:
+                dirs[:] = [d for d in dirs if d not in
+                           (kRemoteClipCacheFolder, kRemoteHlsFolder)]
             for f in files:
                 path = os.path.join(base, f)
                 age = now-os.path.getmtime(path)
@@ -397,6 +442,10 @@ class DiskCleaner(object):
         if now < self._lastOrphanFileCleanup+_kOrphanFileCleanupPeriod:
             return
 
+        # Wait for the back end to catch up; it's the scan's turn after.
+        if self._deferOrphanScans:
+            return
+
         # Only run orphan scan between 2am and 5am
         currentHour = datetime.datetime.now().hour
         kMinOrphanScanHour = 2
@@ -682,7 +731,7 @@ class DiskCleaner(object):
                         # thumbs with no corresponding videos ... delete all, and delete folder if empty
                         orphanedThumbs.remove(root)
                         deleted = 0
-                        for filename in fnmatch.filter(filenames, '*.jpg'):
+                        for filename in self._filterThumbFiles(filenames):
                             fullPath = os.path.join(root, filename)
                             try:
                                 os.remove(fullPath)
@@ -698,6 +747,14 @@ class DiskCleaner(object):
                         for filename in fnmatch.filter(filenames, '*.jpg'):
                             folderThumbsSize += os.path.getsize(os.path.join(root, filename))
                             folderThumbsCount += 1
+                        for filename in fnmatch.filter(filenames, '*' + kThumbArchiveExt):
+                            try:
+                                count, size = getThumbArchiveInfo(os.path.join(root, filename))
+                            except Exception:
+                                self._logger.warning("Couldn't read %s: %s" % (ensureUtf8(filename), traceback.format_exc()))
+                                continue
+                            folderThumbsSize += size
+                            folderThumbsCount += count
 
                     self._updateThumbsStats(camID, timeID, folderThumbsSize, folderThumbsCount)
                     thumbsDirsScanned += 1
@@ -719,7 +776,7 @@ class DiskCleaner(object):
 
     ###########################################################
     def _populateFileSizeCacheItem(self, filePath, deleteIfNotFound, currentTime):
-        fullPath = os.path.join(self._videoDir, filePath)
+        fullPath = self._clipMgr.getClipPath(self._videoDir, filePath)
         if os.path.exists(fullPath):
             fileSize = os.path.getsize(fullPath)
             self._fileSizeCache[filePath] = (fileSize, currentTime)
@@ -800,7 +857,7 @@ class DiskCleaner(object):
         fileSize = 0
         clipSizes = 0
         clipList = []
-        fullPath = os.path.join(self._videoDir, file)
+        fullPath = self._clipMgr.getClipPath(self._videoDir, file)
         timesToRemove = [(firstMs, lastMs)]
         clipsAdded = 0
 
@@ -955,6 +1012,7 @@ class DiskCleaner(object):
         for start, stop in timesToRemove:
             self._dataMgr.deleteCameraLocationDataBetween(camLoc, start, stop)
             self._deleteThumbs(camLoc, start, stop)
+        self._pruneHeatmaps(camLoc, lastMs)
 
         try:
             del self._fileSizeCache[file]
@@ -974,6 +1032,33 @@ class DiskCleaner(object):
 
         return fileSize, fileSize-clipSizes, clipList
 
+    ###########################################################
+    def _pruneHeatmaps(self, camLoc, deletedMs):
+        """Remove heatmaps of a camera older than any data left for it.
+
+        Heatmaps are kept per hour, so they can't follow every deletion;
+        hours before the oldest object left are removed.
+
+        @param  camLoc     The camera data was deleted for.
+        @param  deletedMs  The last ms data was deleted up to.
+        """
+        oldestMs = self._dataMgr.getOldestObjectTime(camLoc)
+        if oldestMs == -1:
+            oldestMs = deletedMs
+        count = self._heatmapMgr.deleteCameraLocationDataBefore(camLoc,
+                                                                oldestMs)
+        if count:
+            self._logger.info("Removed %d heatmaps of %s before %d" %
+                              (count, camLoc, oldestMs))
+
+
+    ###########################################################
+    def _filterThumbFiles(self, filenames):
+        """ Return the names of thumbnail files and archives among filenames
+        """
+        return fnmatch.filter(filenames, '*.jpg') + \
+               fnmatch.filter(filenames, '*' + kThumbArchiveExt)
+
     ###########################################################
     def _deleteThumbs(self, camLoc, start, stop):
         """ Removes thumbnail files for camera in a specific time range
@@ -986,8 +1071,39 @@ class DiskCleaner(object):
         for prefix in range(firstFolder, lastFolder+1):
             subfolders.append( str(prefix) )
         self._logger.debug("Removing thumbs between " + str(start) + " and " + str(stop) + "; folders=" + ensureUtf8(str(subfolders)))
-        for folder in subfolders:
-            thumbFolder = os.path.join(self._videoDir, camLoc, folder, kThumbsSubfolder )
+        # While video is moving to a new location, older thumbs may still be
+        # in the folder it's moving from.
+        videoDirs = [self._videoDir]
+        fromDir = self._clipMgr.getRelocationInfo()[0]
+        if fromDir:
+            videoDirs.append(fromDir)
+        # Hourly archives; whole hours go with a single unlink.  They live in
+        # the folder of the time their hour starts, which may come before
+        # the first folder above.
+        archivesDeleted = set()
+        for videoDir in videoDirs:
+            for hourStart, _, path in getThumbArchivePaths(videoDir, camLoc, start, stop):
+                if not os.path.isfile(path):
+                    continue
+                try:
+                    deletedCount, deletedSize = removeThumbsBetween(path, hourStart, start, stop)
+                except Exception:
+                    self._logger.error("Failed to delete thumbs from %s: %s" % (ensureUtf8(path), traceback.format_exc()))
+                    continue
+                if not os.path.exists(path):
+                    self._logger.debug("Deleted " + ensureUtf8(path))
+                    archivesDeleted.add(os.path.dirname(path))
+                totalFilesDeleted += deletedCount
+                if videoDir == self._videoDir:
+                    self._updateRemovedThumbsStats(camLoc, str(hourStart)[:5], deletedSize, deletedCount)
+
+        for thumbFolder in archivesDeleted:
+            if os.path.isdir(thumbFolder):
+                self._removeEmptyFolder(thumbFolder)
+
+        # Single files, written by older versions.
+        for videoDir, folder in ((d, f) for d in videoDirs for f in subfolders):
+            thumbFolder = os.path.join(videoDir, camLoc, folder, kThumbsSubfolder )
 
             # Thumbs folder may not exist, check for it first
             if not os.path.isdir(thumbFolder):
@@ -998,6 +1114,9 @@ class DiskCleaner(object):
             deletedCount = 0
 
             for file in os.listdir(thumbFolder):
+                if not file.endswith(".jpg"):
+                    keptFiles += 1
+                    continue
                 fileMs = int(os.path.splitext(os.path.basename(file))[0])
                 if fileMs >= start and fileMs <= stop:
                     fullFilePath = os.path.join(thumbFolder, file)
@@ -1016,7 +1135,8 @@ class DiskCleaner(object):
                 self._removeEmptyFolder(thumbFolder)
 
             totalFilesDeleted += deletedCount
-            self._updateRemovedThumbsStats(camLoc, folder, deletedSize, deletedCount)
+            if videoDir == self._videoDir:
+                self._updateRemovedThumbsStats(camLoc, folder, deletedSize, deletedCount)
 
         if totalFilesDeleted > 0:
             self._logger.debug("Deleted " + str(totalFilesDeleted) + " thumb files")
@@ -1173,8 +1293,10 @@ class DiskCleaner(object):
         if curFree > targetFreeSpace:
             self._logger.debug("No further work necessary")
             self._tidyObjectTable()
-            # if we have partial thumbs stats, run again immediately
-            return self._thumbsPartial
+            moreTracks = self._compactTracks()
+            # if we have partial thumbs stats or tracks left to compact, run
+            # again immediately
+            return self._thumbsPartial or moreTracks
 
         usableSpacePerCam = totalUsableSpace/self._numCameras
 
@@ -1275,6 +1397,41 @@ class DiskCleaner(object):
             self._lastTidyObjectTableTime = time.time()
 
 
+    ###########################################################
+    def _compactTracks(self):
+        """Compact the motion data of old tracks, until done or interrupted.
+
+        @return  moreToDo  If True, there are more tracks waiting.
+        """
+        if self._trackCompactor is None:
+            return False
+
+        self._trackCompactor.loadGuards()
+
+        totals = {'objects': 0, 'rowsRemoved': 0, 'spanBytes': 0,
+                  'freedBytes': 0}
+        moreToDo = True
+        while moreToDo:
+            moreToDo, stats = self._trackCompactor.compactSome()
+            for key in totals:
+                totals[key] += stats[key]
+
+            if self._checkForInterrupts("compacting tracks"):
+                break
+
+        if totals['rowsRemoved']:
+            rowsRemoved, savedBytes = self._trackCompactor.getTotals()
+            self._logger.info("Compacted %d objects: removed %d motion rows "
+                              "for %d bytes of spans, %.1fK freed in the "
+                              "database. %d rows, ~%.1fM saved overall" %
+                              (totals['objects'], totals['rowsRemoved'],
+                               totals['spanBytes'],
+                               totals['freedBytes'] / 1024.0, rowsRemoved,
+                               savedBytes / _kMbToBytesF))
+
+        return moreToDo
+
+
 ##############################################################################
 def _forcedQuitCallback():
     """A callback to notify the current app if a force quit ever happens.
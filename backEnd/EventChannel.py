@@ -0,0 +1,239 @@
+#!/usr/bin/env python
+
+#*****************************************************************************
+#
+# EventChannel.py
+#     Events from the back end, for the front end to wait on.
+#
+#
+#*****************************************************************************
+#
+#
+# Copyright 2013-2022 Sighthound, Inc.
+#
+# Licensed under the GNU GPLv3 license found at
+# https://www.gnu.org/licenses/gpl-3.0.txt
+#
+# Alternative licensing available from Sighthound, Inc.
+# by emailing opensource@sighthound.com
+#
+# This file is part of the Sighthound Video project which can be found at
+# https://github.com/sighthoundinc/SighthoundVideo
+#
+# This program is free software; you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation; using version 3 of the License.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program; if not, write to the Free Software
+# Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02111, USA.
+#
+#
+#*****************************************************************************
+
+"""
+## @file
+Contains the EventChannel class.
+"""
+
+# Python imports...
+import collections
+import random
+import threading
+import time
+
+# Common 3rd-party imports...
+
+# Toolbox imports...
+
+# Local imports...
+
+# Kinds of events.
+#   kEventMessage:       a message was queued for getMessage(); no data.
+#   kEventCameraStatus:  a camera's status changed; data is its location.
+#   kEventRules:         a rule was added, changed or removed; data is its
+#                        name.
+kEventMessage = "message"
+kEventCameraStatus = "cameraStatus"
+kEventRules = "rules"
+
+# How many events to remember.  Clients further behind than that are told
+# to start over.
+_kKeepEvents = 256
+
+
+###############################################################
+class EventChannel(object):
+    """Keeps the latest events, numbered in the order they happened, for
+    clients to wait on instead of polling.
+
+    Events only say what changed, not how; clients ask for the details the
+    way they would have when polling.  Clients start without a sequence
+    number, and are told to start over (look at everything again) when
+    they're too far behind, or when the channel is a new one, like after
+    the back end restarted.
+    """
+    ###########################################################
+    def __init__(self, longPoll, keep=_kKeepEvents):
+        """Initializer for EventChannel
+
+        @param  longPoll  The LongPoll limiting how many clients wait, and for
+                          how long.
+        @param  keep      How many events to remember.
+        """
+        self._longPoll = longPoll
+        self._keep = keep
+
+        # Tells this channel apart from ones of earlier back ends.
+        self._channelId = "%08x" % random.getrandbits(32)
+
+        # Guards everything below; waiters wait on it.
+        self._cond = threading.Condition()
+
+        # The latest events as (seq, kind, data), oldest first.
+        self._events = collections.deque()
+        self._seq = 0
+
+        self._running = True
+
+
+    ###########################################################
+    def shutdown(self):
+        """Release all waiters."""
+        self._cond.acquire()
+        try:
+            self._running = False
+            self._cond.notifyAll()
+        finally:
+            self._cond.release()
+
+
+    ###########################################################
+    def post(self, kind, data=None):
+        """Add an event, waking up waiters.
+
+        @param  kind  The kind of event, one of the kEvent constants.
+        @param  data  What the event is about; must be sendable over XML/RPC.
+        @return seq   The event's sequence number.
+        """
+        self._cond.acquire()
+        try:
+            self._seq += 1
+            self._events.append((self._seq, kind, data))
+            while len(self._events) > self._keep:
+                self._events.popleft()
+            self._cond.notifyAll()
+            return self._seq
+        finally:
+            self._cond.release()
+
+
+    ###########################################################
+    def wait(self, channelId, seq, timeout):
+        """Wait for events after the given one.
+
+        @param  channelId  The channel id the client got last time, or None.
+        @param  seq        The sequence number the client got last time.
+        @param  timeout    Most seconds to wait; capped by the LongPoll.
+        @return channelId  The id of this channel, to pass next time.
+        @return seq        The sequence number to pass next time.
+        @return events     A list of (kind, data), oldest first.
+        @return isReset    True if the client should start over, because it
+                           missed events; events is empty then.
+        """
+        self._cond.acquire()
+        try:
+            if self._isReset(channelId, seq):
+                return self._channelId, self._seq, [], True
+
+            self._longPoll.wait(self._cond, lambda: not self._running or
+                                self._seq != seq, timeout)
+
+            if self._isReset(channelId, seq):
+                return self._channelId, self._seq, [], True
+            events = [(kind, data) for eventSeq, kind, data in self._events
+                      if eventSeq > seq]
+            return self._channelId, self._seq, events, False
+        finally:
+            self._cond.release()
+
+
+    ###########################################################
+    def _isReset(self, channelId, seq):
+        """Tell whether a client missed events.
+
+        Must be called with _cond held.
+
+        @param  channelId  The channel id the client has.
+        @param  seq        The sequence number the client has.
+        @return isReset    True if the client needs to start over.
+        """
+        if channelId != self._channelId or seq > self._seq:
+            return True
+        if seq == self._seq:
+            return False
+        return not self._events or self._events[0][0] > seq + 1
+
+
+
+##############################################################################
+def _testEventChannel():
+    """Test waiting on events.
+
+    >>> from vitaToolbox.threading.LongPoll import LongPoll
+    >>> channel = EventChannel(LongPoll(2, 50), keep=2)
+
+    New clients start over right away:
+
+    >>> channelId, seq, events, isReset = channel.wait(None, 0, 5)
+    >>> seq, events, isReset
+    (0, [], True)
+
+    Clients get what happened since, in order:
+
+    >>> channel.post(kEventMessage)
+    1
+    >>> channel.post(kEventCameraStatus, 'Front door')
+    2
+    >>> channel.wait(channelId, 0, 5)[1:]
+    (2, [('message', None), ('cameraStatus', 'Front door')], False)
+
+    Waiters wake up on new events, or wait out the timeout:
+
+    >>> _ = threading.Timer(.1, channel.post, (kEventRules, 'Person')).start()
+    >>> start = time.time()
+    >>> channel.wait(channelId, 2, 5)[1:], time.time() - start < 1
+    ((3, [('rules', 'Person')], False), True)
+    >>> start = time.time()
+    >>> channel.wait(channelId, 3, .2)[1:], time.time() - start >= .15
+    ((3, [], False), True)
+
+    Clients too far behind, or from an earlier channel, start over:
+
+    >>> channel.wait(channelId, 0, 5)[1:]
+    (3, [], True)
+    >>> channel.wait('earlier', 3, 5)[1:]
+    (3, [], True)
+    >>> channel.wait(channelId, 7, 5)[1:]
+    (3, [], True)
+    >>> channel.shutdown()
+    """
+
+
+##############################################################################
+def test_main():
+    """OB_REDACT
+    Our main function, which runs test code
+    """
+    import doctest
+    doctest.testmod(verbose=True)
+
+
+##############################################################################
+if __name__ == '__main__':
+    test_main()
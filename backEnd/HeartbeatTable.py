@@ -0,0 +1,374 @@
+#!/usr/bin/env python
+
+#*****************************************************************************
+#
+# HeartbeatTable.py
+#    Shared memory heartbeats for telling whether child processes are alive
+#
+#
+#*****************************************************************************
+#
+#
+# Copyright 2013-2022 Sighthound, Inc.
+#
+# Licensed under the GNU GPLv3 license found at
+# https://www.gnu.org/licenses/gpl-3.0.txt
+#
+# Alternative licensing available from Sighthound, Inc.
+# by emailing opensource@sighthound.com
+#
+# This file is part of the Sighthound Video project which can be found at
+# https://github.com/sighthoundinc/SighthoundVideo
+#
+# This program is free software; you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation; using version 3 of the License.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program; if not, write to the Free Software
+# Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02111, USA.
+#
+#*****************************************************************************
+
+
+"""
+## @file
+Contains the HeartbeatTable class, a table in shared memory where each child
+process of the back end regularly stamps its own slot.
+
+Children used to prove they were alive by sending ping messages through the
+same queue as everything else, so when that queue backed up the back end had
+to dig through it to avoid killing healthy processes.  A slot here is written
+directly by the child, and reading it costs the back end the same no matter
+how much is queued.
+
+Each slot is one cache line, so children never share one, and holds:
+- beatTime: when the child last went through its main loop, on the monotonic
+  clock (see getMonotonicTime()).
+- progress: a counter the child bumps whenever it gets useful work done.
+- state: what the child says it's doing; see the kState constants.
+- pid: the process id of the child, once it has set its state.
+
+A child that stops beating is hung (or dead).  A child that keeps beating in
+kStateRunning without making progress is stalled.
+
+The table has to be created before the children are started, and each child
+gets a HeartbeatWriter for its slot as an argument to its process.
+"""
+
+# Python imports...
+import ctypes
+import os
+from multiprocessing.sharedctypes import RawArray
+
+# Common 3rd-party imports...
+
+# Toolbox imports...
+from vitaToolbox.sysUtils.TimeUtils import getMonotonicTime
+
+# Local imports...
+
+# Constants...
+
+# States a child can be in.  Progress is only expected while running.
+kStateStarting = 0
+kStateRunning = 1
+kStateIdle = 2
+kStateExiting = 3
+
+# Results of HeartbeatTable.check().
+kHeartbeatOk = 0
+kHeartbeatHung = 1
+kHeartbeatStalled = 2
+
+_kCacheLineSize = 64
+
+
+##############################################################################
+class _Slot(ctypes.Structure):
+    """One child's heartbeat; padded to fill a cache line."""
+    _fields_ = [
+        ('beatTime', ctypes.c_double),
+        ('progress', ctypes.c_uint64),
+        ('state', ctypes.c_int32),
+        ('pid', ctypes.c_int32),
+        ('_padding', ctypes.c_char * (_kCacheLineSize - 24)),
+    ]
+
+assert ctypes.sizeof(_Slot) == _kCacheLineSize
+
+
+##############################################################################
+class HeartbeatWriter(object):
+    """Writes one child's heartbeat; handed to the child process."""
+    ###########################################################
+    def __init__(self, slots, index):
+        """Initializer for HeartbeatWriter
+
+        @param  slots  The shared array of slots.
+        @param  index  The index of our slot.
+        """
+        self._slots = slots
+        self._index = index
+        self._slot = None
+
+
+    ###########################################################
+    def _getSlot(self):
+        """Return our slot, looked up lazily so that we can be pickled.
+
+        @return slot  Our _Slot.
+        """
+        if self._slot is None:
+            self._slot = self._slots[self._index]
+        return self._slot
+
+
+    ###########################################################
+    def __getstate__(self):
+        """Leave out the cached slot when pickling for a new process."""
+        return {'_slots': self._slots, '_index': self._index, '_slot': None}
+
+
+    ###########################################################
+    def getIndex(self):
+        """Return the index of our slot.
+
+        @return index  The slot index.
+        """
+        return self._index
+
+
+    ###########################################################
+    def beat(self, progress=0):
+        """Say that we're still alive; meant to be called every loop.
+
+        @param  progress  How much useful work was done since the last beat.
+        """
+        slot = self._getSlot()
+        if progress:
+            slot.progress += progress
+        slot.beatTime = getMonotonicTime()
+
+
+    ###########################################################
+    def setState(self, state):
+        """Say what we're doing; also counts as a beat.
+
+        @param  state  One of the kState constants.
+        """
+        slot = self._getSlot()
+        slot.pid = os.getpid()
+        slot.state = state
+        slot.beatTime = getMonotonicTime()
+
+
+##############################################################################
+class HeartbeatTable(object):
+    """A fixed number of heartbeat slots, owned by the supervising process."""
+    ###########################################################
+    def __init__(self, numSlots):
+        """Initializer for HeartbeatTable
+
+        @param  numSlots  The most children that can have a slot at once.
+        """
+        self._slots = RawArray(_Slot, numSlots)
+        self._freeSlots = range(numSlots-1, -1, -1)
+
+        # Key = slot index, value = (progress, time progress last changed).
+        self._lastProgress = {}
+
+        # Key = slot index, value = time before which no beat is needed.
+        self._graceTimes = {}
+
+
+    ###########################################################
+    def getSlots(self):
+        """Return the shared slots, for a process hosting several children.
+
+        The array can only be handed over when a process is started; after
+        that, a HeartbeatWriter can be made from it and a slot index.
+
+        @return slots  The shared array of slots.
+        """
+        return self._slots
+
+
+    ###########################################################
+    def allocSlot(self):
+        """Reserve a slot for a child that's about to start.
+
+        @return index   The slot index, or None if the table is full.
+        @return writer  A HeartbeatWriter to hand to the child, or None.
+        """
+        if not self._freeSlots:
+            return None, None
+
+        index = self._freeSlots.pop()
+        now = getMonotonicTime()
+        slot = self._slots[index]
+        slot.beatTime = now
+        slot.progress = 0
+        slot.state = kStateStarting
+        slot.pid = 0
+        self._lastProgress[index] = (0, now)
+        self._graceTimes[index] = now
+        return index, HeartbeatWriter(self._slots, index)
+
+
+    ###########################################################
+    def freeSlot(self, index):
+        """Give back a slot once we're done with its child.
+
+        The child might not be quite gone yet, so the slot goes to the back
+        of the line to keep its last few writes away from anybody else.
+
+        @param  index  The slot index from allocSlot(); None is ignored.
+        """
+        if index is None or index not in self._lastProgress:
+            return
+        del self._lastProgress[index]
+        del self._graceTimes[index]
+        self._freeSlots.insert(0, index)
+
+
+    ###########################################################
+    def extendGrace(self):
+        """Don't hold time that already passed against anybody.
+
+        Used when we couldn't check for a while (like after the machine
+        slept), so that children get a full timeout to be heard from again.
+        """
+        now = getMonotonicTime()
+        for index in self._graceTimes:
+            self._graceTimes[index] = now
+            self._lastProgress[index] = (self._slots[index].progress, now)
+
+
+    ###########################################################
+    def check(self, index, timeout, stallTimeout=None):
+        """Check on a child; never blocks.
+
+        @param  index         The slot index from allocSlot().
+        @param  timeout       Seconds without a beat before a child is hung.
+        @param  stallTimeout  Seconds running without progress before a child
+                              is stalled; None to not check for that.
+        @return status        kHeartbeatOk, kHeartbeatHung or
+                              kHeartbeatStalled.
+        @return secs          Seconds since the last beat, or since the last
+                              progress if stalled.
+        """
+        now = getMonotonicTime()
+        slot = self._slots[index]
+        graceTime = self._graceTimes[index]
+
+        beatSecs = now - max(slot.beatTime, graceTime)
+        if beatSecs > timeout:
+            return kHeartbeatHung, beatSecs
+
+        progress = slot.progress
+        lastProgress, changeTime = self._lastProgress[index]
+        if progress != lastProgress or slot.state != kStateRunning:
+            self._lastProgress[index] = (progress, now)
+            return kHeartbeatOk, beatSecs
+
+        stallSecs = now - max(changeTime, graceTime)
+        if stallTimeout is not None and stallSecs > stallTimeout:
+            return kHeartbeatStalled, stallSecs
+        return kHeartbeatOk, beatSecs
+
+
+    ###########################################################
+    def getInfo(self, index):
+        """Return what's in a slot, for logging.
+
+        @param  index     The slot index from allocSlot().
+        @return state     The child's state.
+        @return progress  The child's progress counter.
+        @return pid       The child's process id, or 0 if not known yet.
+        """
+        slot = self._slots[index]
+        return slot.state, slot.progress, slot.pid
+
+
+
+##############################################################################
+def _testHeartbeats():
+    """Test the table, with a real child process.
+
+    >>> import multiprocessing, time
+    >>> table = HeartbeatTable(2)
+    >>> index, writer = table.allocSlot()
+    >>> table.allocSlot()[0], table.allocSlot()
+    (1, (None, None))
+    >>> table.check(index, 10)[0] == kHeartbeatOk
+    True
+
+    No beat for longer than the timeout means hung:
+
+    >>> time.sleep(.2)
+    >>> table.check(index, .1)[0] == kHeartbeatHung
+    True
+
+    A child beating and making progress from another process:
+
+    >>> def _child(writer):
+    ...     writer.setState(kStateRunning)
+    ...     for _ in xrange(5):
+    ...         writer.beat(2)
+    >>> p = multiprocessing.Process(target=_child, args=(writer,))
+    >>> p.start(); p.join()
+    >>> table.getInfo(index)[:2] == (kStateRunning, 10)
+    True
+    >>> table.getInfo(index)[2] == p.pid
+    True
+    >>> table.check(index, .1, .1)[0] == kHeartbeatOk
+    True
+
+    Beating while running without progress means stalled:
+
+    >>> time.sleep(.2)
+    >>> writer.beat()
+    >>> table.check(index, .1, .1)[0] == kHeartbeatStalled
+    True
+    >>> writer.setState(kStateIdle)
+    >>> table.check(index, .1, .1)[0] == kHeartbeatOk
+    True
+
+    After a long gap, everybody gets a fresh start:
+
+    >>> time.sleep(.2)
+    >>> table.extendGrace()
+    >>> table.check(index, .1, .1)[0] == kHeartbeatOk
+    True
+
+    A writer can also be made again from the shared slots and its index:
+
+    >>> again = HeartbeatWriter(table.getSlots(), writer.getIndex())
+    >>> again.setState(kStateRunning)
+    >>> table.getInfo(index)[0] == kStateRunning
+    True
+
+    >>> table.freeSlot(index)
+    >>> table.allocSlot()[0] == index
+    True
+    """
+
+
+##############################################################################
+def test_main():
+    """OB_REDACT
+    Our main function, which runs test code
+    """
+    import doctest
+    doctest.testmod(verbose=True)
+
+
+##############################################################################
+if __name__ == '__main__':
+    test_main()
@@ -0,0 +1,830 @@
+#!/usr/bin/env python
+
+#*****************************************************************************
+#
+# HeatmapManager.py
+#    API for accessing and maintaining the activity heatmap database
+#
+#
+#*****************************************************************************
+#
+#
+# Copyright 2013-2022 Sighthound, Inc.
+#
+# Licensed under the GNU GPLv3 license found at
+# https://www.gnu.org/licenses/gpl-3.0.txt
+#
+# Alternative licensing available from Sighthound, Inc.
+# by emailing opensource@sighthound.com
+#
+# This file is part of the Sighthound Video project which can be found at
+# https://github.com/sighthoundinc/SighthoundVideo
+#
+# This program is free software; you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation; using version 3 of the License.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program; if not, write to the Free Software
+# Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02111, USA.
+#
+#*****************************************************************************
+
+
+"""
+## @file
+Contains the HeatmapManager class, which keeps spatial activity heatmaps for
+each camera.
+
+A heatmap is a coarse occupancy grid over the camera's field of view.  Every
+bounding box that goes into the motion table also bumps the count of each grid
+cell it covers.  Grids are stored per camera, per hour and per object type, so
+that any time window can be answered by summing a handful of rows instead of
+walking the motion table.
+"""
+
+# Python imports...
+from array import array
+import sqlite3 as sql
+import time
+import os
+
+# Common 3rd-party imports...
+
+# Toolbox imports...
+from vitaToolbox.sql.TimedConnection import TimedConnection
+
+# Local imports...
+from appCommon.CommonStrings import kSqlAlertThreshold
+
+# Constants...
+
+# Size of the occupancy grid.  This is independent of the processing size so
+# that hours recorded at different resolutions can be summed together.
+kGridWidth = 32
+kGridHeight = 24
+
+_kHourMs = 60 * 60 * 1000
+
+# Typecode used to store the grid counts; 32 bits unsigned.
+_kGridTypecode = 'I'
+
+# Value for the 'nextStopMs' backfill column once a camera is complete.
+_kBackfillDone = -1
+
+
+
+###############################################################
+def getHourStart(ms):
+    """Return the start of the hour that contains the given time.
+
+    >>> getHourStart(0)
+    0
+    >>> getHourStart(3600000-1)
+    0
+    >>> getHourStart(3600000)
+    3600000
+    >>> getHourStart(5000000)
+    3600000
+
+    @param  ms         An absolute time, in ms.
+    @return hourStart  The start of the (UTC) hour ms is in, in ms.
+    """
+    return int(ms) - (int(ms) % _kHourMs)
+
+
+###############################################################
+def makeEmptyGrid(gridW=kGridWidth, gridH=kGridHeight):
+    """Return a new, zeroed grid.
+
+    >>> len(makeEmptyGrid(4, 3))
+    12
+
+    @param  gridW  Width of the grid, in cells.
+    @param  gridH  Height of the grid, in cells.
+    @return grid   An array of gridW*gridH counts, row major.
+    """
+    return array(_kGridTypecode, [0]) * (gridW * gridH)
+
+
+###############################################################
+def rasterizeBbox(grid, bbox, procSize, gridW=kGridWidth, gridH=kGridHeight):
+    """Add one sample for a bounding box to a grid.
+
+    The bbox is given in processing coordinates; it is scaled to the grid and
+    every cell it touches is incremented once.
+
+    >>> g = makeEmptyGrid(4, 2)
+    >>> rasterizeBbox(g, (0, 0, 49, 49), (200, 100), 4, 2)
+    True
+    >>> map(int, g)
+    [1, 0, 0, 0, 0, 0, 0, 0]
+    >>> rasterizeBbox(g, (100, 50, 199, 99), (200, 100), 4, 2)
+    True
+    >>> map(int, g)
+    [1, 0, 0, 0, 0, 0, 1, 1]
+
+    Boxes partly off screen are clipped; boxes completely off screen and
+    unknown processing sizes are ignored:
+    >>> rasterizeBbox(g, (-10, -10, 500, 10), (200, 100), 4, 2)
+    True
+    >>> map(int, g)
+    [2, 1, 1, 1, 0, 0, 1, 1]
+    >>> rasterizeBbox(g, (300, 0, 400, 10), (200, 100), 4, 2)
+    False
+    >>> rasterizeBbox(g, (0, 0, 10, 10), (0, 0), 4, 2)
+    False
+
+    @param  grid      The grid to update, from makeEmptyGrid().
+    @param  bbox      The (x1, y1, x2, y2) bounding box; inclusive.
+    @param  procSize  The (width, height) the bbox coordinates are in.
+    @param  gridW     Width of the grid, in cells.
+    @param  gridH     Height of the grid, in cells.
+    @return added     True if the bbox touched the grid.
+    """
+    procW, procH = procSize
+    if procW <= 0 or procH <= 0:
+        return False
+
+    x1, y1, x2, y2 = bbox
+    if x2 < 0 or y2 < 0 or x1 >= procW or y1 >= procH:
+        return False
+
+    cx1 = max(0, int(x1) * gridW // procW)
+    cy1 = max(0, int(y1) * gridH // procH)
+    cx2 = min(gridW - 1, int(x2) * gridW // procW)
+    cy2 = min(gridH - 1, int(y2) * gridH // procH)
+
+    for cy in xrange(cy1, cy2 + 1):
+        rowStart = cy * gridW
+        for i in xrange(rowStart + cx1, rowStart + cx2 + 1):
+            grid[i] += 1
+
+    return True
+
+
+###############################################################
+def mergeGrids(dest, src):
+    """Add the counts of one grid to another.
+
+    >>> a = array('I', [1, 2, 3])
+    >>> mergeGrids(a, array('I', [10, 0, 1]))
+    >>> map(int, a)
+    [11, 2, 4]
+
+    @param  dest  The grid to add to; modified in place.
+    @param  src   The grid to add; must be the same size as dest.
+    """
+    for i, count in enumerate(src):
+        if count:
+            dest[i] += count
+
+
+###############################################################
+def normalizeGrid(grid):
+    """Scale grid counts to the range 0.0 - 1.0.
+
+    >>> normalizeGrid(array('I', [0, 2, 4]))
+    [0.0, 0.5, 1.0]
+    >>> normalizeGrid(array('I', [0, 0]))
+    [0.0, 0.0]
+
+    @param  grid        The grid to normalize.
+    @return normalized  A list of floats, with the busiest cell at 1.0.
+    """
+    maxCount = max(grid) if grid else 0
+    if not maxCount:
+        return [0.0] * len(grid)
+    scale = 1.0 / maxCount
+    return [count * scale for count in grid]
+
+
+###############################################################
+def findProcSize(procSizes, ms):
+    """Find the processing size that was in use at a given time.
+
+    >>> sizes = [(320, 240, 0, 999), (640, 480, 1000, 1999)]
+    >>> findProcSize(sizes, 500), findProcSize(sizes, 1500)
+    ((320, 240), (640, 480))
+    >>> findProcSize(sizes, 5000)
+    >>> findProcSize([(320, 240, None, None)], 5000)
+    (320, 240)
+    >>> findProcSize([], 5000)
+
+    @param  procSizes  A list as returned by getUniqueProcSizesBetweenTimes().
+    @param  ms         The time of interest.
+    @return procSize   The (width, height) at ms, or None if unknown.
+    """
+    if len(procSizes) == 1:
+        # A single entry means the size was unique; times may be None...
+        return tuple(procSizes[0][:2])
+
+    for w, h, firstMs, lastMs in procSizes:
+        if (firstMs is None or firstMs <= ms) and \
+           (lastMs is None or ms <= lastMs):
+            return (w, h)
+
+    return None
+
+
+###############################################################
+class HeatmapManager(object):
+    """A class for keeping track of where activity happens in each camera.
+
+    Incremental updates from the live addFrame stream are accumulated in
+    memory and written out by flush(); existing motion data can be folded in
+    by buildFromDatabase().
+    """
+    ###########################################################
+    def __init__(self, logger, gridW=kGridWidth, gridH=kGridHeight):
+        """Initializer for the HeatmapManager class
+
+        @param  logger  An instance of a VitaLogger to use.
+        @param  gridW   Width of the grids to keep, in cells.
+        @param  gridH   Height of the grids to keep, in cells.
+        """
+        self._logger = logger
+        self._connection = None
+        self._curDbPath = None
+
+        self._gridW = gridW
+        self._gridH = gridH
+
+        # Grids not yet written to the database.
+        # Key = (camLoc, hourStart, objType), value = [samples, grid]
+        self._pending = {}
+
+        # Frames older than this are already covered by a backfill.
+        self._liveSinceMs = None
+
+
+    ###########################################################
+    def _createTables(self):
+        """Create the necessary tables in the database
+
+        heatmaps:
+            camLoc    - text, req, name of the camera
+            hourStart - int, req, start of the hour covered by the grid (ms)
+            objType   - text, req, the object type counted in the grid
+            gridW     - int, req, width of the grid, in cells
+            gridH     - int, req, height of the grid, in cells
+            samples   - int, req, number of bounding boxes in the grid
+            grid      - blob, req, row major array of 32 bit cell counts
+
+        backfill: (one entry per camera that had data before heatmaps)
+            camLoc     - text, req, primary key
+            nextStopMs - int, req, the end of the next hour that still needs
+                         to be built from the motion table; -1 once done.
+
+        heatmapInfo:
+            name   - text, req, primary key
+            value  - int, req
+        """
+        self._cur.execute('''PRAGMA page_size = 4096''')
+
+        for query in (
+                '''CREATE TABLE heatmaps (camLoc TEXT, hourStart INTEGER, '''
+                '''objType TEXT, gridW INTEGER, gridH INTEGER, '''
+                '''samples INTEGER, grid BLOB, '''
+                '''PRIMARY KEY (camLoc, hourStart, objType))''',
+
+                '''CREATE TABLE backfill (camLoc TEXT PRIMARY KEY, '''
+                '''nextStopMs INTEGER)''',
+
+                '''CREATE TABLE heatmapInfo (name TEXT PRIMARY KEY, '''
+                '''value INTEGER)'''):
+            try:
+                self._cur.disableExecuteLogForNext()
+                self._cur.execute(query)
+                self._logger.info("executed: %s..." % query[0:32])
+            except sql.OperationalError:
+                # Ignore failures in creating the table, which can happen
+                # because of race conditions...
+                pass
+
+
+    ###########################################################
+    def _upgradeOldTablesIfNeeded(self):
+        """Upgrade from older versions of tables."""
+        pass
+
+
+    ###########################################################
+    def _addIndices(self):
+        """Add some indices to the database.
+
+        The primary key of the heatmaps table already covers our queries.
+        """
+        pass
+
+
+    ###########################################################
+    def open(self, filePath, timeout=15):
+        """Open the database, creating tables if necessary
+
+        @param  filePath  Path of the database file to open
+        @param  timeout   The time in seconds connections will wait for locks
+                          to free without throwing an exception.
+        """
+        assert type(filePath) == unicode
+
+        if self._connection:
+            self.close()
+
+        self._curDbPath = filePath
+
+        self._connection = self._getNewConnection(timeout)
+        self._cur = self._connection.cursor()
+
+        self._cur.execute("PRAGMA journal_mode=PERSIST").fetchall()
+
+        # Everything in here can be rebuilt from the objdb, so there's no
+        # need to pay for synchronous FULL.
+        self._cur.execute('''PRAGMA synchronous=NORMAL''').fetchall()
+
+        self._createTables()
+        self._upgradeOldTablesIfNeeded()
+        self._addIndices()
+
+        self._liveSinceMs = self._getInfo('liveSinceMs')
+
+        self._connection.commit()
+
+
+    ###########################################################
+    def _getNewConnection(self, timeout=15):
+        """Return a new connection to the current database
+
+        @return connection  A new database connection.
+        """
+        if not self._curDbPath:
+            return None
+
+        connection = sql.connect(self._curDbPath.encode('utf-8'), timeout,
+                factory=TimedConnection, check_same_thread=False)
+        connection.setParameters(self._logger, float(kSqlAlertThreshold),
+                                 os.path.exists(self._curDbPath+".debug"))
+
+        return connection
+
+
+    ###########################################################
+    def _getInfo(self, name):
+        """Read a value from the heatmapInfo table.
+
+        @param  name   The name of the value.
+        @return value  The value, or None if not set.
+        """
+        row = self._cur.execute('''SELECT value FROM heatmapInfo '''
+                                '''WHERE name=?''', (name,)).fetchone()
+        if row is None:
+            return None
+        return row[0]
+
+
+    ###########################################################
+    def _setInfo(self, name, value):
+        """Write a value to the heatmapInfo table.
+
+        @param  name   The name of the value.
+        @param  value  The value to store.
+        """
+        self._cur.execute('''INSERT OR REPLACE INTO heatmapInfo '''
+                          '''VALUES (?, ?)''', (name, value))
+
+
+    ###########################################################
+    def getPath(self):
+        """Retrieve the database path.
+
+        @return heatmapDbPath  Path to the database, or None.
+        """
+        return self._curDbPath
+
+
+    ###########################################################
+    def close(self):
+        """Close the database, writing out anything pending."""
+        if self._connection:
+            self.flush()
+            self._connection.close()
+
+        self._connection = None
+        self._curDbPath = None
+
+
+    ###########################################################
+    def reset(self):
+        """Reset the database"""
+        assert self._connection is not None
+
+        self._pending = {}
+        self._connection.execute('''DROP TABLE heatmaps''')
+        self._connection.execute('''DROP TABLE backfill''')
+        self._connection.execute('''DROP TABLE heatmapInfo''')
+
+        self._createTables()
+        self._addIndices()
+        self._liveSinceMs = None
+        self._connection.commit()
+
+
+    ###########################################################
+    def startBackfill(self, dataManager, nowMs=None):
+        """Queue up building of heatmaps for data that predates them.
+
+        Should be called once the database has been opened; does nothing if
+        the backfill was set up before.  From here on the live stream is the
+        source of truth, and everything older gets built by runBackfill().
+
+        @param  dataManager  The DataManager holding the motion data.
+        @param  nowMs        The time live updates start; None for now.
+        """
+        assert self._connection is not None
+
+        if self._liveSinceMs is not None:
+            return
+
+        if nowMs is None:
+            nowMs = int(time.time() * 1000)
+
+        for camLoc in dataManager.getCameraLocations():
+            self._cur.execute('''INSERT OR IGNORE INTO backfill '''
+                              '''VALUES (?, ?)''', (camLoc, nowMs))
+        self._setInfo('liveSinceMs', nowMs)
+        self._liveSinceMs = nowMs
+        self._connection.commit()
+
+
+    ###########################################################
+    def isBackfillPending(self):
+        """Check whether there is still old data to build heatmaps from.
+
+        @return pending  True if runBackfill() has more work to do.
+        """
+        assert self._connection is not None
+
+        row = self._cur.execute('''SELECT COUNT(*) FROM backfill '''
+                                '''WHERE nextStopMs<>?''',
+                                (_kBackfillDone,)).fetchone()
+        return bool(row[0])
+
+
+    ###########################################################
+    def runBackfill(self, dataManager, maxHours=1):
+        """Build a limited number of hours of heatmaps from old data.
+
+        Works backwards from the time live updates began, so that the most
+        relevant data shows up first.  Meant to be called repeatedly at idle
+        time until isBackfillPending() returns False.
+
+        @param  dataManager  The DataManager holding the motion data.
+        @param  maxHours     The maximum number of camera-hours to build.
+        @return hoursBuilt   The number of camera-hours built.
+        """
+        assert self._connection is not None
+
+        hoursBuilt = 0
+        rows = self._cur.execute('''SELECT camLoc, nextStopMs FROM backfill '''
+                                 '''WHERE nextStopMs<>?''',
+                                 (_kBackfillDone,)).fetchall()
+        for camLoc, stopMs in rows:
+            oldestMs = dataManager.getOldestObjectTime(camLoc)
+            while hoursBuilt < maxHours:
+                if oldestMs == -1 or stopMs <= oldestMs:
+                    stopMs = _kBackfillDone
+                    break
+
+                startMs = getHourStart(stopMs - 1)
+                self.buildFromDatabase(dataManager, camLoc, startMs, stopMs)
+                hoursBuilt += 1
+                stopMs = startMs
+
+            self._cur.execute('''UPDATE backfill SET nextStopMs=? '''
+                              '''WHERE camLoc=?''', (stopMs, camLoc))
+            self._connection.commit()
+
+            if hoursBuilt >= maxHours:
+                break
+
+        return hoursBuilt
+
+
+    ###########################################################
+    def addFrame(self, camLoc, objType, ms, bbox, procSize):
+        """Add a bounding box from the live stream.
+
+        The data is kept in memory until the next call to flush().
+
+        @param  camLoc    The camera the bbox came from.
+        @param  objType   The type of the object, like "person".
+        @param  ms        The absolute time of the bbox, in ms.
+        @param  bbox      The (x1, y1, x2, y2) bbox, in processing coordinates.
+        @param  procSize  The (width, height) the camera is processed at.
+        """
+        if self._liveSinceMs is not None and ms < self._liveSinceMs:
+            # Will be (or was) picked up by the backfill...
+            return
+
+        key = (camLoc, getHourStart(ms), objType)
+        entry = self._pending.get(key)
+        if entry is None:
+            entry = [0, makeEmptyGrid(self._gridW, self._gridH)]
+            self._pending[key] = entry
+
+        if rasterizeBbox(entry[1], bbox, procSize, self._gridW, self._gridH):
+            entry[0] += 1
+
+
+    ###########################################################
+    def flush(self):
+        """Write any pending grids out to the database."""
+        if not self._pending:
+            return
+
+        assert self._connection is not None
+
+        pending = self._pending
+        self._pending = {}
+
+        for (camLoc, hourStart, objType), (samples, grid) in \
+                pending.iteritems():
+            if samples:
+                self._mergeIntoDb(camLoc, hourStart, objType, samples, grid)
+
+        self._connection.commit()
+
+
+    ###########################################################
+    def _mergeIntoDb(self, camLoc, hourStart, objType, samples, grid):
+        """Add a grid to the stored one for the same camera, hour and type.
+
+        @param  camLoc     The camera the grid is for.
+        @param  hourStart  The hour the grid is for.
+        @param  objType    The object type the grid is for.
+        @param  samples    The number of bboxes that went into grid.
+        @param  grid       The grid to add.
+        """
+        row = self._cur.execute(
+            '''SELECT gridW, gridH, samples, grid FROM heatmaps WHERE '''
+            '''camLoc=? AND hourStart=? AND objType=?''',
+            (camLoc, hourStart, objType)).fetchone()
+
+        if row is not None:
+            gridW, gridH, oldSamples, blob = row
+            if (gridW, gridH) == (self._gridW, self._gridH):
+                oldGrid = array(_kGridTypecode)
+                oldGrid.fromstring(str(blob))
+                mergeGrids(grid, oldGrid)
+                samples += oldSamples
+            else:
+                self._logger.warning("Dropping %dx%d heatmap for %s at %d" %
+                                     (gridW, gridH, camLoc, hourStart))
+
+        self._cur.execute(
+            '''INSERT OR REPLACE INTO heatmaps VALUES (?, ?, ?, ?, ?, ?, ?)''',
+            (camLoc, hourStart, objType, self._gridW, self._gridH, samples,
+             sql.Binary(grid.tostring())))
+
+
+    ###########################################################
+    def buildFromDatabase(self, dataManager, camLoc, startMs, stopMs):
+        """Fold existing motion data into the heatmaps.
+
+        Processing size changes are honored by looking up the size that was in
+        effect at the time of each bbox.
+
+        @param  dataManager  The DataManager holding the motion data.
+        @param  camLoc       The camera to build heatmaps for.
+        @param  startMs      The start of the range to build; inclusive.
+        @param  stopMs       The end of the range to build; exclusive.
+        @return samples      The number of bboxes added.
+        """
+        assert self._connection is not None
+
+        buildStart = time.time()
+
+        procSizes = dataManager.getUniqueProcSizesBetweenTimes(camLoc,
+                                                               startMs, stopMs)
+        if not procSizes:
+            # No video means no way to scale the boxes.
+            return 0
+
+        grids = {}
+        total = 0
+        for ms, x1, y1, x2, y2, objType in \
+                dataManager.getMotionForCameraBetweenTimes(camLoc, startMs,
+                                                           stopMs):
+            procSize = findProcSize(procSizes, ms)
+            if procSize is None:
+                continue
+
+            key = (getHourStart(ms), objType)
+            entry = grids.get(key)
+            if entry is None:
+                entry = [0, makeEmptyGrid(self._gridW, self._gridH)]
+                grids[key] = entry
+
+            if rasterizeBbox(entry[1], (x1, y1, x2, y2), procSize,
+                             self._gridW, self._gridH):
+                entry[0] += 1
+                total += 1
+
+        for (hourStart, objType), (samples, grid) in grids.iteritems():
+            if samples:
+                self._mergeIntoDb(camLoc, hourStart, objType, samples, grid)
+        self._connection.commit()
+
+        self._logger.info("Built heatmaps for %s, %d-%d, %d samples, %.02fsec"
+                          % (camLoc, startMs, stopMs, total,
+                             time.time()-buildStart))
+        return total
+
+
+    ###########################################################
+    def getHeatmap(self, camLoc, startMs, stopMs, objTypes=None):
+        """Get the activity heatmap for a camera over a time window.
+
+        Only whole hours are stored, so the window is widened to the hours
+        that it touches.
+
+        @param  camLoc    The camera to get the heatmap for.
+        @param  startMs   The start of the time window, in ms.
+        @param  stopMs    The end of the time window, in ms.
+        @param  objTypes  A list of object types to include; None for all.
+        @return heatmap   A dictionary with keys 'width' and 'height' (the grid
+                          size), 'samples' (the number of bboxes counted),
+                          'startMs' and 'stopMs' (the hours covered) and
+                          'grid', a row major list of floats from 0.0 to 1.0.
+        """
+        assert self._connection is not None
+
+        queryStart = getHourStart(startMs)
+        queryStop = getHourStart(stopMs) + _kHourMs
+
+        params = [camLoc, queryStart, queryStop, self._gridW, self._gridH]
+        typeStr = ''
+        if objTypes is not None:
+            if not objTypes:
+                params = None
+            else:
+                typeStr = ' AND objType IN (%s)' % \
+                          ','.join('?' * len(objTypes))
+                params.extend(objTypes)
+
+        grid = makeEmptyGrid(self._gridW, self._gridH)
+        samples = 0
+        if params is not None:
+            rows = self._cur.execute(
+                '''SELECT samples, grid FROM heatmaps WHERE camLoc=? AND '''
+                '''hourStart>=? AND hourStart<? AND gridW=? AND gridH=?%s'''
+                % typeStr, params)
+            for rowSamples, blob in rows:
+                rowGrid = array(_kGridTypecode)
+                rowGrid.fromstring(str(blob))
+                mergeGrids(grid, rowGrid)
+                samples += rowSamples
+
+        return {
+            'width': self._gridW,
+            'height': self._gridH,
+            'samples': samples,
+            'startMs': queryStart,
+            'stopMs': queryStop,
+            'grid': normalizeGrid(grid),
+        }
+
+
+    ###########################################################
+    def updateLocationName(self, oldName, newName, changeMs):
+        """Change the name of a camera location.
+
+        Grids are per hour, so the hour containing the change goes to the new
+        name in its entirety.  Hours the new name has grids for already, like
+        the one of the change if frames came in under the new name first, get
+        the old grids added to them.
+
+        @param  oldName   The name of the camera location to change.
+        @param  newName   The new name for the camera location.
+        @param  changeMs  The absolute ms at which the change took place.
+
+        >>> import shutil, tempfile
+        >>> from vitaToolbox.loggingUtils.LoggingUtils import EmptyLogger
+        >>> tmpDir = tempfile.mkdtemp()
+        >>> heatmapMgr = HeatmapManager(EmptyLogger(), 4, 2)
+        >>> heatmapMgr.open(os.path.join(unicode(tmpDir), u"heatmapdb"))
+        >>> for hour in xrange(3):
+        ...     heatmapMgr.addFrame('old', 'person', hour*_kHourMs + 10,
+        ...                         (0, 0, 9, 9), (40, 20))
+        >>> heatmapMgr.addFrame('new', 'person', _kHourMs + 20,
+        ...                     (30, 10, 39, 19), (40, 20))
+        >>> heatmapMgr.updateLocationName('old', 'new', _kHourMs + 15)
+        >>> [heatmapMgr.getHeatmap(camLoc, 0, 3*_kHourMs-1)['samples']
+        ...  for camLoc in ('old', 'new')]
+        [1, 3]
+        >>> heatmapMgr.getHeatmap('new', _kHourMs, 2*_kHourMs-1)['grid']
+        [1.0, 0.0, 0.0, 0.0, 0.0, 0.0, 0.0, 1.0]
+        >>> heatmapMgr.close()
+        >>> shutil.rmtree(tmpDir, True)
+        """
+        assert self._connection is not None
+
+        self.flush()
+        hourStart = getHourStart(changeMs)
+        rows = self._cur.execute(
+            '''SELECT hourStart, objType, gridW, gridH, samples, grid '''
+            '''FROM heatmaps WHERE camLoc=? AND hourStart>=?''',
+            (oldName, hourStart)).fetchall()
+        for rowHourStart, objType, gridW, gridH, samples, blob in rows:
+            if (gridW, gridH) != (self._gridW, self._gridH):
+                self._logger.warning("Dropping %dx%d heatmap for %s at %d" %
+                                     (gridW, gridH, oldName, rowHourStart))
+                continue
+            grid = array(_kGridTypecode)
+            grid.fromstring(str(blob))
+            self._mergeIntoDb(newName, rowHourStart, objType, samples, grid)
+
+        self._cur.execute('''DELETE FROM heatmaps WHERE camLoc=? AND '''
+                          '''hourStart>=?''', (oldName, hourStart))
+        self._connection.commit()
+
+
+    ###########################################################
+    def deleteCameraLocationDataBefore(self, camLoc, stopMs):
+        """Remove heatmaps of a camera that end before a given time.
+
+        Grids are per hour, so only hours that end at or before stopMs go;
+        the one containing it is kept.
+
+        @param  camLoc  The camera to remove heatmaps of.
+        @param  stopMs  The time to remove heatmaps up to.
+        @return count   The number of grids removed.
+
+        >>> import shutil, tempfile
+        >>> from vitaToolbox.loggingUtils.LoggingUtils import EmptyLogger
+        >>> tmpDir = tempfile.mkdtemp()
+        >>> heatmapMgr = HeatmapManager(EmptyLogger(), 4, 2)
+        >>> heatmapMgr.open(os.path.join(unicode(tmpDir), u"heatmapdb"))
+        >>> for camLoc in ('cam', 'other'):
+        ...     for hour in xrange(3):
+        ...         heatmapMgr.addFrame(camLoc, 'person', hour*_kHourMs + 10,
+        ...                             (0, 0, 9, 9), (40, 20))
+        >>> heatmapMgr.flush()
+        >>> heatmapMgr.deleteCameraLocationDataBefore('cam', 2*_kHourMs + 10)
+        2
+        >>> [heatmapMgr.getHeatmap(camLoc, 0, 3*_kHourMs-1)['samples']
+        ...  for camLoc in ('cam', 'other')]
+        [1, 3]
+        >>> heatmapMgr.close()
+        >>> shutil.rmtree(tmpDir, True)
+        """
+        assert self._connection is not None
+
+        hourStop = getHourStart(stopMs)
+        for key in self._pending.keys():
+            if key[0] == camLoc and key[1] < hourStop:
+                del self._pending[key]
+
+        count = self._cur.execute('''DELETE FROM heatmaps WHERE camLoc=? '''
+                                  '''AND hourStart<?''',
+                                  (camLoc, hourStop)).rowcount
+        self._connection.commit()
+        return count
+
+
+    ###########################################################
+    def removeCameraLocation(self, location):
+        """Remove all heatmaps for a given camera location.
+
+        @param  location  The name of the location to remove.
+        """
+        assert self._connection is not None
+
+        for key in self._pending.keys():
+            if key[0] == location:
+                del self._pending[key]
+
+        self._cur.execute('''DELETE FROM heatmaps WHERE camLoc=?''',
+                          (location,))
+        self._cur.execute('''DELETE FROM backfill WHERE camLoc=?''',
+                          (location,))
+        self._connection.commit()
+
+
+##############################################################################
+def test_main():
+    """OB_REDACT
+    Our main function, which runs test code
+    """
+    import doctest
+    doctest.testmod(verbose=True)
+
+
+##############################################################################
+if __name__ == '__main__':
+    test_main()
@@ -0,0 +1,681 @@
+#!/usr/bin/env python
+
+#*****************************************************************************
+#
+# HlsClipCache.py
+#     Serves recorded clips as HLS, making segments only when they're asked for.
+#
+#
+#*****************************************************************************
+#
+#
+# Copyright 2013-2022 Sighthound, Inc.
+#
+# Licensed under the GNU GPLv3 license found at
+# https://www.gnu.org/licenses/gpl-3.0.txt
+#
+# Alternative licensing available from Sighthound, Inc.
+# by emailing opensource@sighthound.com
+#
+# This file is part of the Sighthound Video project which can be found at
+# https://github.com/sighthoundinc/SighthoundVideo
+#
+# This program is free software; you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation; using version 3 of the License.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program; if not, write to the Free Software
+# Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02111, USA.
+#
+#
+#*****************************************************************************
+
+"""
+## @file
+Contains the HlsClipCache class.
+"""
+
+# Python imports...
+from collections import OrderedDict
+import heapq
+import math
+import os
+import re
+import shutil
+import threading
+import time
+
+# Common 3rd-party imports...
+
+# Toolbox imports...
+
+# Local imports...
+
+# How long each segment should be, in ms.  Segments don't cross clip files,
+# so ones at the end of a file may be shorter.
+kSegmentMs = 6*1000
+
+# How many segments to make ahead of the one the player asked for.
+_kPrefetchSegments = 2
+
+# How much disk the made segments may take up before the least recently used
+# ones are removed.
+_kMaxCacheBytes = 256*1024*1024
+
+# How many segments to make at once.
+_kNumWorkers = 2
+
+# Sessions that nobody asked anything of for this many seconds are removed.
+_kSessionIdleSecs = 30*60
+
+# How long a request waits for its segment to be made, in seconds.
+_kSegmentWaitSecs = 60
+
+# Segments asked for by a player are made before ones we're prefetching.
+_kPriorityRequested = 0
+_kPriorityPrefetch = 1
+
+_kPlaylistName = "index.m3u8"
+_kSegmentExt = ".ts"
+_kSegmentRe = re.compile(r'^([0-9]+)\.ts$')
+_kSessionIdRe = re.compile(r'[^A-Za-z0-9_-]')
+
+
+###############################################################
+def makeSessionId(sessionId):
+    """Return a session id that is safe to use in file names and URIs.
+
+    @param  sessionId  The session id a client gave us.
+    @return sessionId  The id with anything unusual replaced.
+    """
+    return _kSessionIdRe.sub('_', unicode(sessionId)).encode('ascii')
+
+
+###############################################################
+class _Session(object):
+    """A clip that is being played."""
+    ###########################################################
+    def __init__(self, segments):
+        """Initializer for _Session
+
+        @param  segments  A list of (startMs, stopMs, data), see addSession().
+        """
+        self.segments = segments
+        self.lastUsed = time.time()
+
+
+###############################################################
+class HlsClipCache(object):
+    """Serves clips as HLS video on demand.
+
+    The playlist is written right away from the segment times; a segment is
+    only made when a player first asks for it (or for one just before it),
+    by a small pool of worker threads.  Made segments stay on disk until the
+    cache grows too big, least recently used going first.
+
+    wsgiApp() serves "/<sessionId>/index.m3u8" and "/<sessionId>/<n>.ts".
+    """
+    ###########################################################
+    def __init__(self, cacheDir, makeSegment, logger,
+                 maxBytes=_kMaxCacheBytes, numWorkers=_kNumWorkers,
+                 prefetch=_kPrefetchSegments, idleSecs=_kSessionIdleSecs):
+        """Initializer for HlsClipCache
+
+        @param  cacheDir     The directory to keep segments in.
+        @param  makeSegment  Function taking (data, startMs, stopMs, path),
+                             making a segment at path; returns True if it did.
+                             Called from worker threads.
+        @param  logger       The logger to use.
+        @param  maxBytes     How much disk made segments may take up.
+        @param  numWorkers   How many segments to make at once.
+        @param  prefetch     How many segments to make ahead of the player.
+        @param  idleSecs     Seconds after which unused sessions go away.
+        """
+        self._cacheDir = cacheDir
+        self._makeSegment = makeSegment
+        self._logger = logger
+        self._maxBytes = maxBytes
+        self._prefetch = prefetch
+        self._idleSecs = idleSecs
+
+        # Guards everything below.
+        self._cond = threading.Condition()
+
+        # Key = session id, value = _Session.
+        self._sessions = {}
+
+        # Key = (sessionId, index), value = size of the made segment; least
+        # recently used first.
+        self._cached = OrderedDict()
+        self._cachedBytes = 0
+
+        # Key = (sessionId, index), value = Event set once the segment was
+        # made (or couldn't be).  Has everything queued or being made.
+        self._pending = {}
+
+        # Keys of the segments being made right now.
+        self._making = set()
+
+        # A heap of (priority, sequence, key) of segments to make; the same key
+        # may be in here more than once, if its priority went up.
+        self._queue = []
+        self._sequence = 0
+
+        # Anything left from before can't be matched to sessions anymore.
+        shutil.rmtree(self._cacheDir, True)
+
+        self._running = True
+        self._workers = []
+        for i in xrange(numWorkers):
+            worker = threading.Thread(target=self._workerRun,
+                                      name="hlsclip-%d" % i)
+            worker.setDaemon(True)
+            worker.start()
+            self._workers.append(worker)
+
+
+    ###########################################################
+    def shutdown(self):
+        """Stop the workers; segments being made are left to finish."""
+        self._cond.acquire()
+        try:
+            self._running = False
+            for event in self._pending.itervalues():
+                event.set()
+            self._cond.notifyAll()
+        finally:
+            self._cond.release()
+
+
+    ###########################################################
+    def addSession(self, sessionId, segments):
+        """Start serving a clip.
+
+        @param  sessionId  The id of the session, from makeSessionId().  If
+                           it was used before for other segments, the old
+                           clip is replaced; for the same ones, the segments
+                           made already are kept.
+        @param  segments   A list of (startMs, stopMs, data) for each segment
+                           of the clip, in order.  data is passed on to the
+                           makeSegment function.
+        @return uri        The path of the playlist, relative to wsgiApp().
+        """
+        self.expireSessions()
+
+        self._cond.acquire()
+        try:
+            session = self._sessions.get(sessionId)
+            if session is not None and session.segments == segments:
+                session.lastUsed = time.time()
+            else:
+                self._removeSession(sessionId)
+                self._sessions[sessionId] = _Session(segments)
+        finally:
+            self._cond.release()
+
+        return "/%s/%s" % (sessionId, _kPlaylistName)
+
+
+    ###########################################################
+    def expireSessions(self, now=None):
+        """Remove sessions that weren't used for a while.
+
+        @param  now  The current time, or None to use time.time().
+        """
+        if now is None:
+            now = time.time()
+
+        self._cond.acquire()
+        try:
+            for sessionId, session in self._sessions.items():
+                if not 0 <= now - session.lastUsed < self._idleSecs:
+                    self._removeSession(sessionId)
+        finally:
+            self._cond.release()
+
+
+    ###########################################################
+    def getPlaylist(self, sessionId):
+        """Return the playlist of a session.
+
+        Clip files are cut separately, so each segment gets timestamps of
+        its own; the playlist marks every boundary as a discontinuity.
+
+        @param  sessionId  The id of the session.
+        @return playlist   The m3u8 playlist, or None if no such session.
+        """
+        self._cond.acquire()
+        try:
+            session = self._sessions.get(sessionId)
+            if session is None:
+                return None
+            session.lastUsed = time.time()
+            segments = session.segments
+        finally:
+            self._cond.release()
+
+        maxSecs = max([0] + [(stopMs - startMs)/1000.
+                             for startMs, stopMs, _ in segments])
+        lines = [
+            "#EXTM3U",
+            "#EXT-X-VERSION:3",
+            "#EXT-X-PLAYLIST-TYPE:VOD",
+            "#EXT-X-TARGETDURATION:%d" % max(1, int(math.ceil(maxSecs))),
+            "#EXT-X-MEDIA-SEQUENCE:0",
+        ]
+        for i, (startMs, stopMs, _) in enumerate(segments):
+            if i:
+                lines.append("#EXT-X-DISCONTINUITY")
+            lines.append("#EXTINF:%.3f," % ((stopMs - startMs)/1000.))
+            lines.append("%d%s" % (i, _kSegmentExt))
+        lines.append("#EXT-X-ENDLIST")
+        return "\n".join(lines) + "\n"
+
+
+    ###########################################################
+    def getSegment(self, sessionId, index, timeout=_kSegmentWaitSecs):
+        """Return the path of a segment, making it if needed.
+
+        Also starts making the next few segments.
+
+        @param  sessionId  The id of the session.
+        @param  index      The index of the segment.
+        @param  timeout    How long to wait for the segment, in seconds.
+        @return path       The path of the segment, or None if there's no such
+                           segment or it couldn't be made in time.
+        """
+        key = (sessionId, index)
+        path = self._getSegmentPath(key)
+
+        self._cond.acquire()
+        try:
+            session = self._sessions.get(sessionId)
+            if session is None or not 0 <= index < len(session.segments):
+                return None
+            session.lastUsed = time.time()
+
+            for i in xrange(index+1, min(index+1+self._prefetch,
+                                         len(session.segments))):
+                self._schedule((sessionId, i), _kPriorityPrefetch)
+
+            if key in self._cached and os.path.exists(path):
+                # Most recently used goes last.
+                self._cached[key] = self._cached.pop(key)
+                return path
+            self._uncache(key)
+            event = self._schedule(key, _kPriorityRequested)
+        finally:
+            self._cond.release()
+
+        event.wait(timeout)
+
+        self._cond.acquire()
+        try:
+            if key in self._cached:
+                return path
+            return None
+        finally:
+            self._cond.release()
+
+
+    ###########################################################
+    def wsgiApp(self, environ, start_response):
+        """WSGI application serving playlists and segments.
+
+        @param  environ         WSGI environment.
+        @param  start_response  WSGI response function.
+        @return                 The response body.
+        """
+        parts = environ.get('PATH_INFO', '').strip('/').split('/')
+        if len(parts) == 2 and parts[0] == makeSessionId(parts[0]):
+            sessionId, name = parts
+            if name == _kPlaylistName:
+                playlist = self.getPlaylist(sessionId)
+                if playlist is not None:
+                    start_response('200 OK', [
+                        ('Content-Type', 'application/x-mpegurl'),
+                        ('Content-Length', str(len(playlist))),
+                        ('Cache-Control', 'no-cache')])
+                    return [playlist]
+            else:
+                match = _kSegmentRe.match(name)
+                path = None
+                if match is not None:
+                    path = self.getSegment(sessionId, int(match.group(1)))
+                data = None
+                if path is not None:
+                    try:
+                        f = open(path, 'rb')
+                        try:
+                            data = f.read()
+                        finally:
+                            f.close()
+                    except (IOError, OSError):
+                        # Removed by the disk cleaner or to make room.
+                        pass
+                if data is not None:
+                    start_response('200 OK', [
+                        ('Content-Type', 'video/MP2T'),
+                        ('Content-Length', str(len(data)))])
+                    return [data]
+
+        start_response('404 Not Found', [('Content-Type', 'text/plain')])
+        return ['not found']
+
+
+    ###########################################################
+    def _getSegmentPath(self, key):
+        """Return where a segment goes.
+
+        @param  key   The (sessionId, index) of the segment.
+        @return path  The path of the segment file.
+        """
+        sessionId, index = key
+        return os.path.join(self._cacheDir, sessionId,
+                            "%d%s" % (index, _kSegmentExt))
+
+
+    ###########################################################
+    def _schedule(self, key, priority):
+        """Queue a segment to be made; must hold the lock.
+
+        @param  key       The (sessionId, index) of the segment.
+        @param  priority  One of the _kPriorityXXX values.
+        @return event     An Event set once the segment is done.
+        """
+        event = self._pending.get(key)
+        if event is None:
+            if key in self._cached:
+                event = threading.Event()
+                event.set()
+                return event
+            event = threading.Event()
+            if not self._running:
+                event.set()
+                return event
+            self._pending[key] = event
+        elif priority != _kPriorityRequested:
+            return event
+
+        self._sequence += 1
+        heapq.heappush(self._queue, (priority, self._sequence, key))
+        self._cond.notify()
+        return event
+
+
+    ###########################################################
+    def _uncache(self, key):
+        """Forget about a made segment and remove it; must hold the lock.
+
+        @param  key  The (sessionId, index) of the segment.
+        """
+        size = self._cached.pop(key, None)
+        if size is None:
+            return
+        self._cachedBytes -= size
+        try:
+            os.remove(self._getSegmentPath(key))
+        except OSError:
+            pass
+
+
+    ###########################################################
+    def _removeSession(self, sessionId):
+        """Remove a session and its segments; must hold the lock.
+
+        @param  sessionId  The id of the session.
+        """
+        self._sessions.pop(sessionId, None)
+        for key in [key for key in self._cached if key[0] == sessionId]:
+            self._uncache(key)
+        shutil.rmtree(os.path.join(self._cacheDir, sessionId), True)
+
+
+    ###########################################################
+    def _evict(self, keep):
+        """Remove least recently used segments until we're small enough;
+        must hold the lock.
+
+        @param  keep  The key of a segment not to remove.
+        """
+        for key in self._cached.keys():
+            if self._cachedBytes <= self._maxBytes:
+                break
+            if key != keep:
+                self._uncache(key)
+
+
+    ###########################################################
+    def _workerRun(self):
+        """Make segments, until we're shut down."""
+        while True:
+            self._cond.acquire()
+            try:
+                while self._running and not self._queue:
+                    self._cond.wait()
+                if not self._running:
+                    return
+                _, _, key = heapq.heappop(self._queue)
+                event = self._pending.get(key)
+                session = self._sessions.get(key[0])
+                if event is None or key in self._making:
+                    # Already made or being made; was queued twice.
+                    continue
+                if session is None:
+                    del self._pending[key]
+                    event.set()
+                    continue
+                self._making.add(key)
+                startMs, stopMs, data = session.segments[key[1]]
+            finally:
+                self._cond.release()
+
+            path = self._getSegmentPath(key)
+            tmpPath = path + ".tmp"
+            success = False
+            try:
+                if not os.path.isdir(os.path.dirname(path)):
+                    os.makedirs(os.path.dirname(path))
+                startTime = time.time()
+                success = self._makeSegment(data, startMs, stopMs, tmpPath) \
+                          and os.path.isfile(tmpPath)
+                if success:
+                    if os.path.exists(path):
+                        os.remove(path)
+                    os.rename(tmpPath, path)
+                    self._logger.info("made segment %d of %s in %.2fs" %
+                                      (key[1], key[0], time.time()-startTime))
+                else:
+                    self._logger.warning("couldn't make segment %d of %s" %
+                                         (key[1], key[0]))
+            except Exception:
+                self._logger.error("error making segment %d of %s" %
+                                   (key[1], key[0]), exc_info=True)
+                success = False
+
+            self._cond.acquire()
+            try:
+                if success and key[0] in self._sessions:
+                    size = os.path.getsize(path)
+                    self._cached[key] = size
+                    self._cachedBytes += size
+                    self._evict(key)
+                elif os.path.exists(tmpPath):
+                    os.remove(tmpPath)
+                self._making.discard(key)
+                self._pending.pop(key, None)
+                event.set()
+            finally:
+                self._cond.release()
+
+
+###############################################################
+def remuxSegment(fileList, startMs, stopMs, path, configDir, extras, logger):
+    """Make one MPEG-TS segment from recorded clip files.
+
+    The clip is exported as HLS into a scratch folder and the pieces glued
+    together, since transport streams may simply be concatenated.  Whether
+    that remuxes or transcodes depends on the extras, like for any export.
+
+    @param  fileList   A list of (path, startMs) of the clip files to use.
+    @param  startMs    The absolute ms the segment starts at.
+    @param  stopMs     The absolute ms the segment stops at.
+    @param  path       Where to put the segment.
+    @param  configDir  Directory to search for config files.
+    @param  extras     Dict of extras for remuxClip(); not changed.
+    @param  logger     The logger to use.
+    @return success    True if the segment was made.
+    """
+    from videoLib2.python.ClipUtils import remuxClip  # Lazy--loaded on first need
+
+    workDir = path + ".parts"
+    shutil.rmtree(workDir, True)
+    os.makedirs(workDir)
+    try:
+        extras = dict(extras)
+        extras["format"] = "hls"
+        playlistPath = os.path.join(workDir, "segment.m3u8")
+        if remuxClip(fileList, playlistPath, startMs, stopMs, configDir,
+                     extras, logger.getCLogFn()) < 0:
+            return False
+
+        parts = []
+        for line in open(playlistPath).read().splitlines():
+            line = line.strip()
+            if line.endswith(_kSegmentExt):
+                parts.append(os.path.join(workDir, os.path.basename(line)))
+        if not parts:
+            return False
+
+        out = open(path, 'wb')
+        try:
+            for part in parts:
+                f = open(part, 'rb')
+                try:
+                    shutil.copyfileobj(f, out)
+                finally:
+                    f.close()
+        finally:
+            out.close()
+        return True
+    finally:
+        shutil.rmtree(workDir, True)
+
+
+
+##############################################################################
+def _testHlsClipCache():
+    """Test serving segments.
+
+    >>> import tempfile
+    >>> from vitaToolbox.loggingUtils.LoggingUtils import EmptyLogger
+    >>> tmpDir = tempfile.mkdtemp()
+    >>> made = []
+    >>> def makeSegment(data, startMs, stopMs, path):
+    ...     made.append(data)
+    ...     open(path, 'wb').write('x' * 10)
+    ...     return data != 'bad'
+    >>> cache = HlsClipCache(os.path.join(tmpDir, 'hls'), makeSegment,
+    ...                      EmptyLogger(), maxBytes=25, numWorkers=1,
+    ...                      prefetch=1)
+    >>> cache.addSession(makeSessionId(u'a/b'), [(0, 6000, 's0'),
+    ...     (6000, 12000, 's1'), (12000, 14500, 'bad'), (14500, 20000, 's3')])
+    '/a_b/index.m3u8'
+
+    The playlist doesn't need any segments to be made:
+
+    >>> print cache.getPlaylist('a_b'),
+    #EXTM3U
+    #EXT-X-VERSION:3
+    #EXT-X-PLAYLIST-TYPE:VOD
+    #EXT-X-TARGETDURATION:6
+    #EXT-X-MEDIA-SEQUENCE:0
+    #EXTINF:6.000,
+    0.ts
+    #EXT-X-DISCONTINUITY
+    #EXTINF:6.000,
+    1.ts
+    #EXT-X-DISCONTINUITY
+    #EXTINF:2.500,
+    2.ts
+    #EXT-X-DISCONTINUITY
+    #EXTINF:5.500,
+    3.ts
+    #EXT-X-ENDLIST
+    >>> made
+    []
+
+    Asking for a segment makes it, plus the next one:
+
+    >>> os.path.basename(cache.getSegment('a_b', 0))
+    '0.ts'
+    >>> time.sleep(.2); sorted(made)
+    ['s0', 's1']
+    >>> os.path.basename(cache.getSegment('a_b', 1))
+    '1.ts'
+
+    One that couldn't be made is tried again when asked for:
+
+    >>> time.sleep(.2); made
+    ['s0', 's1', 'bad']
+    >>> cache.getSegment('a_b', 2) is None, cache.getSegment('a_b', 9) is None
+    (True, True)
+
+    Only two segments fit, so making the third removed the least recently
+    used one:
+
+    >>> time.sleep(.2); made
+    ['s0', 's1', 'bad', 'bad', 's3']
+    >>> os.path.basename(cache.getSegment('a_b', 3)), sorted(cache._cached)
+    ('3.ts', [('a_b', 1), ('a_b', 3)])
+    >>> made = []; cache.getSegment('a_b', 0) is not None
+    True
+    >>> time.sleep(.2); made, sorted(cache._cached)
+    (['s0'], [('a_b', 0), ('a_b', 3)])
+
+    Adding the same clip again keeps what was made:
+
+    >>> cache.addSession('a_b', [(0, 6000, 's0'), (6000, 12000, 's1'),
+    ...     (12000, 14500, 'bad'), (14500, 20000, 's3')])
+    '/a_b/index.m3u8'
+    >>> sorted(cache._cached)
+    [('a_b', 0), ('a_b', 3)]
+
+    The WSGI app serves it all:
+
+    >>> def get(path):
+    ...     status = []
+    ...     body = cache.wsgiApp({'PATH_INFO': path},
+    ...                          lambda s, headers: status.append(s))
+    ...     return status[0], len(''.join(body))
+    >>> get('/a_b/index.m3u8'), get('/a_b/1.ts'), get('/a_b/../x.ts')
+    (('200 OK', 256), ('200 OK', 10), ('404 Not Found', 9))
+
+    Idle sessions go away, with their segments:
+
+    >>> cache.expireSessions(time.time() + 2*_kSessionIdleSecs)
+    >>> cache.getPlaylist('a_b'), os.listdir(os.path.join(tmpDir, 'hls'))
+    (None, [])
+    >>> cache.shutdown()
+    >>> shutil.rmtree(tmpDir)
+    """
+
+
+##############################################################################
+def test_main():
+    """OB_REDACT
+    Our main function, which runs test code
+    """
+    import doctest
+    doctest.testmod(verbose=True)
+
+
+##############################################################################
+if __name__ == '__main__':
+    test_main()
@@ -0,0 +1,208 @@
+#!/usr/bin/env python
+
+#*****************************************************************************
+#
+# MemoryWatchdog.py
+#     Decides when camera processes have grown enough to be recycled.
+#
+#
+#*****************************************************************************
+#
+#
+# Copyright 2013-2022 Sighthound, Inc.
+#
+# Licensed under the GNU GPLv3 license found at
+# https://www.gnu.org/licenses/gpl-3.0.txt
+#
+# Alternative licensing available from Sighthound, Inc.
+# by emailing opensource@sighthound.com
+#
+# This file is part of the Sighthound Video project which can be found at
+# https://github.com/sighthoundinc/SighthoundVideo
+#
+# This program is free software; you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation; using version 3 of the License.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program; if not, write to the Free Software
+# Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02111, USA.
+#
+#
+#*****************************************************************************
+
+"""
+## @file
+Contains the MemoryWatchdog class.
+"""
+
+# Python imports...
+
+# Common 3rd-party imports...
+
+# Toolbox imports...
+
+# Local imports...
+
+# What to do about a process.
+#   kMemoryOk:            nothing.
+#   kMemoryRecycleQuiet:  recycle its cameras gracefully, each once it's
+#                         between clips.
+#   kMemoryRecycleNow:    recycle its cameras gracefully right away; they
+#                         were over the soft limit for too long.
+#   kMemoryRestart:       restart its cameras right away, without waiting
+#                         for replacements; it's over the hard limit.
+kMemoryOk = 0
+kMemoryRecycleQuiet = 1
+kMemoryRecycleNow = 2
+kMemoryRestart = 3
+
+# Memory a camera may use, in KB, before being recycled when convenient and
+# before being restarted no matter what.  Cameras normally stay well below
+# 500MB; ProcessUtils kills processes at a few GB.
+kSoftLimitKB = 1000*1024
+kHardLimitKB = 2000*1024
+
+# How long a process may stay over the soft limit, waiting for its cameras to
+# be between clips, in seconds.
+_kMaxQuietWaitSecs = 30*60
+
+
+###############################################################
+class MemoryWatchdog(object):
+    """Tells what to do about camera processes from samples of their memory.
+
+    Processes holding several cameras, like camera workers, get limits that
+    many times as high.
+    """
+    ###########################################################
+    def __init__(self, logger, softLimitKB=kSoftLimitKB,
+                 hardLimitKB=kHardLimitKB,
+                 maxQuietWaitSecs=_kMaxQuietWaitSecs):
+        """Initializer for MemoryWatchdog
+
+        @param  logger            The logger to use.
+        @param  softLimitKB       KB per camera before recycling when quiet.
+        @param  hardLimitKB       KB per camera before restarting right away.
+        @param  maxQuietWaitSecs  Seconds to wait for quiet before recycling
+                                  anyway.
+        """
+        self._logger = logger
+        self._softLimitKB = softLimitKB
+        self._hardLimitKB = hardLimitKB
+        self._maxQuietWaitSecs = maxQuietWaitSecs
+
+        # Process ID to when it went over the soft limit.
+        self._overSince = {}
+
+        # How many times we said to recycle or restart.
+        self._numRecycles = 0
+        self._numRestarts = 0
+
+
+    ###########################################################
+    def check(self, now, processId, usedKB, numCameras=1):
+        """Take a sample of a process's memory, and tell what to do about it.
+
+        @param  now         The current time, in seconds.
+        @param  processId   The process ID.
+        @param  usedKB      The memory it uses, in KB.
+        @param  numCameras  How many cameras it runs.
+        @return action      One of the kMemory constants.
+        """
+        if usedKB >= self._hardLimitKB*numCameras:
+            self._overSince.pop(processId, None)
+            self._numRestarts += 1
+            self._logger.error("Process %d uses %d KB for %d camera(s), "
+                               "restarting" % (processId, usedKB, numCameras))
+            return kMemoryRestart
+
+        if usedKB < self._softLimitKB*numCameras:
+            self._overSince.pop(processId, None)
+            return kMemoryOk
+
+        if processId not in self._overSince:
+            self._overSince[processId] = now
+            self._numRecycles += 1
+            self._logger.warn("Process %d uses %d KB for %d camera(s), "
+                              "recycling" % (processId, usedKB, numCameras))
+        if now - self._overSince[processId] >= self._maxQuietWaitSecs:
+            return kMemoryRecycleNow
+        return kMemoryRecycleQuiet
+
+
+    ###########################################################
+    def forget(self, processIds):
+        """Forget processes that are gone.
+
+        @param  processIds  The IDs of processes still around; others are
+                            forgotten.
+        """
+        for processId in self._overSince.keys():
+            if processId not in processIds:
+                del self._overSince[processId]
+
+
+    ###########################################################
+    def getStats(self):
+        """Return how often processes were recycled and restarted.
+
+        @return numRecycles  Times processes went over the soft limit.
+        @return numRestarts  Times processes went over the hard limit.
+        """
+        return self._numRecycles, self._numRestarts
+
+
+
+##############################################################################
+def _testMemoryWatchdog():
+    """Test deciding what to do about processes.
+
+    >>> from vitaToolbox.loggingUtils.LoggingUtils import EmptyLogger
+    >>> watchdog = MemoryWatchdog(EmptyLogger(), 100, 200, maxQuietWaitSecs=60)
+
+    Processes below the soft limit are fine; limits go up with the number
+    of cameras:
+
+    >>> watchdog.check(0, 1, 99), watchdog.check(0, 2, 150, numCameras=2)
+    (0, 0)
+
+    Over the soft limit, cameras are recycled when quiet, then right away
+    if that takes too long:
+
+    >>> watchdog.check(0, 1, 100), watchdog.check(30, 1, 150)
+    (1, 1)
+    >>> watchdog.check(60, 1, 150)
+    2
+
+    Going back below the limit starts the wait over:
+
+    >>> watchdog.check(70, 1, 50), watchdog.check(80, 1, 150)
+    (0, 1)
+    >>> watchdog.forget([2]); watchdog.check(140, 1, 150)
+    1
+
+    Over the hard limit, cameras are restarted:
+
+    >>> watchdog.check(150, 2, 400, numCameras=2), watchdog.getStats()
+    (3, (3, 1))
+    """
+
+
+##############################################################################
+def test_main():
+    """OB_REDACT
+    Our main function, which runs test code
+    """
+    import doctest
+    doctest.testmod(verbose=True)
+
+
+##############################################################################
+if __name__ == '__main__':
+    test_main()
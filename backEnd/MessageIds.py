@@ -63,6 +63,10 @@ msgIdUpdateOnvif = 10002
 # UPNP devices had changed
 msgIdUpdateUpnp = 10003
 
+# Followed by a list of what to shed while the back end is overloaded; see
+# OverloadGovernor.kShedActions.
+msgIdSetLoadShedding = 10004
+
 ###############################################################
 # XMLRPC Messages
 
@@ -174,6 +178,25 @@ msgIdStreamOpenSucceeded = 13010
 # Followed by the camera location and frame size
 msgIdStreamUpdateFrameSize = 13011
 
+# Followed by a list of messages, from the cameras of one worker process.
+msgIdCameraWorkerBatch = 13012
+
+# Followed by a slot index, a generation and the arguments of the camera to
+# start; sent to a camera worker process.
+msgIdCameraWorkerStart = 13013
+
+# Followed by nothing; sent to a camera process whose replacement is ready,
+# to quit, leaving live view files to the replacement.
+msgIdCameraHandOver = 13014
+
+# Followed by nothing; sent to a replacement waiting on standby, to take over.
+msgIdCameraTakeOver = 13015
+
+# Followed by the camera location; from a replacement on standby, once it
+# has the stream open, or once it gave up.
+msgIdCameraStandbyReady = 13016
+msgIdCameraStandbyFailed = 13017
+
 # Followed by a camera location and the current port number of its WSGI server.
 msgIdWsgiPortChanged = 13100
 
@@ -246,6 +269,9 @@ msgIdSetVideoSetting = 16010
 # Followed by a boolean
 msgIdSetRecordInMemory = 16011
 
+# No params; moves video back to where a video location change started from
+msgIdCancelVideoRelocation = 16012
+
 
 ###############################################################
 # Rule Messages
@@ -297,6 +323,9 @@ msgIdSendIftttState = 18007
 # Followed by ruleName, camLoc, list of (objId, time) tuples
 msgIdSendWebhook = 18008
 
+# Followed by the uid of a push notification that was just stored
+msgIdPushNotificationAdded = 18009
+
 
 ###############################################################
 # Messages for the front end
@@ -0,0 +1,854 @@
+#!/usr/bin/env python
+
+#*****************************************************************************
+#
+# MultiCameraPlayback.py
+#     Synchronized playback of recorded video from several cameras.
+#
+#
+#*****************************************************************************
+#
+#
+# Copyright 2013-2022 Sighthound, Inc.
+#
+# Licensed under the GNU GPLv3 license found at
+# https://www.gnu.org/licenses/gpl-3.0.txt
+#
+# Alternative licensing available from Sighthound, Inc.
+# by emailing opensource@sighthound.com
+#
+# This file is part of the Sighthound Video project which can be found at
+# https://github.com/sighthoundinc/SighthoundVideo
+#
+# This program is free software; you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation; using version 3 of the License.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program; if not, write to the Free Software
+# Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02111, USA.
+#
+#
+#*****************************************************************************
+
+
+"""
+## @file
+Contains the MultiCameraPlayback class, which plays recorded video from a
+number of cameras in lockstep against a single master clock.
+
+Each camera gets its own frame source (normally a DataManager/ClipReader pair
+of its own, since a DataManager can only have one video open at a time).  The
+sources are advanced in parallel on a shared thread pool; for every tick of the
+master clock each stream either delivers a new frame, drops frames it is
+behind on, or holds its last frame if the next one is still in the future.
+"""
+
+# Python imports...
+import multiprocessing
+import sys
+import threading
+import time
+
+# Common 3rd-party imports...
+
+# Toolbox imports...
+from vitaToolbox.loggingUtils.LoggingUtils import EmptyLogger
+from vitaToolbox.threading.ThreadPool import ThreadPool
+
+# Local imports...
+
+# Constants...
+
+# Status values reported per stream for each delivered tick.
+kFrameNew = 'new'       # A frame that hasn't been delivered before.
+kFrameHeld = 'held'     # The previous frame, repeated; next one is not due yet.
+kFrameNone = 'none'     # No video for this camera at the requested time.
+
+# A stream's frame is considered in sync if it is at most this many ms away
+# from the clock.  Frames further in the past than this are treated as "no
+# video" (i.e. we've hit a recording gap).
+_kDefaultMaxHoldMs = 2000
+
+# Default number of decoder threads; decoding is mostly native code which
+# releases the GIL, so scaling with the cores pays off.
+_kDefaultPoolSize = multiprocessing.cpu_count()
+
+# How long to wait for the decoders of a single tick before giving up on the
+# stragglers (they'll be held and picked up on the next tick).
+_kDecodeTimeout = 5.0
+
+
+##############################################################################
+class PlaybackClock(object):
+    """The master clock all streams are aligned against.
+
+    Maps wall clock time to absolute media ms, honoring pause and playback
+    speed.
+
+    >>> now = [100.0]
+    >>> clock = PlaybackClock(lambda: now[0])
+    >>> clock.start(5000)
+    >>> now[0] += .5
+    >>> clock.getMs()
+    5500
+    >>> clock.setSpeed(2.0)
+    >>> now[0] += 1
+    >>> clock.getMs()
+    7500
+    >>> clock.pause()
+    >>> now[0] += 10
+    >>> clock.getMs()
+    7500
+    >>> clock.seek(1000)
+    >>> clock.getMs()
+    1000
+    """
+    ###########################################################
+    def __init__(self, timeFn=time.time):
+        """PlaybackClock constructor.
+
+        @param  timeFn  Function returning the current wall time in seconds;
+                        replaceable for testing.
+        """
+        super(PlaybackClock, self).__init__()
+
+        self._timeFn = timeFn
+        self._speed = 1.0
+        self._baseMs = 0
+        self._baseTime = None
+
+
+    ###########################################################
+    def start(self, ms=None):
+        """Start (or resume) the clock.
+
+        @param  ms  The media ms to start at; None to resume where we are.
+        """
+        if ms is not None:
+            self._baseMs = ms
+        else:
+            self._baseMs = self.getMs()
+        self._baseTime = self._timeFn()
+
+
+    ###########################################################
+    def pause(self):
+        """Stop the clock at the current media time."""
+        self._baseMs = self.getMs()
+        self._baseTime = None
+
+
+    ###########################################################
+    def isRunning(self):
+        """Return True if the clock is running."""
+        return self._baseTime is not None
+
+
+    ###########################################################
+    def seek(self, ms):
+        """Move the clock to the given media time, keeping the run state.
+
+        @param  ms  The absolute ms to move to.
+        """
+        self._baseMs = ms
+        if self._baseTime is not None:
+            self._baseTime = self._timeFn()
+
+
+    ###########################################################
+    def setSpeed(self, speed):
+        """Set the playback speed.
+
+        @param  speed  The playback speed; 1.0 is realtime.
+        """
+        self._baseMs = self.getMs()
+        if self._baseTime is not None:
+            self._baseTime = self._timeFn()
+        self._speed = float(speed)
+
+
+    ###########################################################
+    def getMs(self):
+        """Return the current media time.
+
+        @return ms  The current absolute media ms.
+        """
+        if self._baseTime is None:
+            return self._baseMs
+        elapsed = self._timeFn() - self._baseTime
+        return self._baseMs + int(round(elapsed * 1000 * self._speed))
+
+
+##############################################################################
+class ClipFrameSource(object):
+    """Frame source reading recorded video for a single camera.
+
+    This owns a private DataManager, since a DataManager can only ever have
+    a single clip reader open.
+    """
+    ###########################################################
+    def __init__(self, logger, clipManager, videoDir, cameraLoc,
+                 displaySize=(320, 240), markupModel=None, objDbPath=None):
+        """ClipFrameSource constructor.
+
+        @param  logger       The logger to use.
+        @param  clipManager  A ClipManager; may be shared among sources.
+        @param  videoDir     The video storage directory.
+        @param  cameraLoc    The camera location to play.
+        @param  displaySize  The (w, h) of the frames to produce.
+        @param  markupModel  A VideoMarkupModel, or None for no markup.
+        @param  objDbPath    Path to the object database; only needed if the
+                             markup model wants bounding boxes.
+        """
+        super(ClipFrameSource, self).__init__()
+
+        # Lazy--loaded on first need; keeps this module usable without video.
+        from DataManager import DataManager
+        from VideoMarkupModel import VideoMarkupModel
+
+        self._cameraLoc = cameraLoc
+        self._displaySize = displaySize
+        self._dataMgr = DataManager(logger, clipManager, videoDir)
+        if objDbPath is not None:
+            self._dataMgr.open(objDbPath)
+        if markupModel is None:
+            markupModel = VideoMarkupModel(False, False, False, False, False,
+                                           False)
+        self._dataMgr.setMarkupModel(markupModel)
+
+
+    ###########################################################
+    def open(self, firstMs, lastMs):
+        """Open the range of video to play.
+
+        @param  firstMs  The first absolute ms wanted.
+        @param  lastMs   The last absolute ms wanted.
+        @return firstMs  The first ms actually available, or -1.
+        @return lastMs   The last ms actually available, or -1.
+        """
+        return self._dataMgr.openMarkedVideo(self._cameraLoc, firstMs, lastMs,
+                                             firstMs, [], self._displaySize,
+                                             False, False)
+
+
+    ###########################################################
+    def seek(self, ms):
+        """Seek to the frame at or just before the given time.
+
+        @param  ms     The absolute ms to seek to.
+        @return ms     The absolute ms of the frame found, or -1.
+        @return frame  The frame, or None.
+        """
+        frame = self._dataMgr.getFrameAt(ms)
+        if frame is None:
+            return -1, None
+        return self._dataMgr.getFileStartMs() + frame.ms, frame
+
+
+    ###########################################################
+    def next(self):
+        """Decode the next frame.
+
+        @return ms     The absolute ms of the next frame, or -1 at the end.
+        @return frame  The frame, or None.
+        """
+        frame = self._dataMgr.getNextFrame()
+        if frame is None:
+            return -1, None
+        return self._dataMgr.getFileStartMs() + frame.ms, frame
+
+
+    ###########################################################
+    def close(self):
+        """Release the video and database."""
+        self._dataMgr.forceCloseVideo()
+        self._dataMgr.close()
+
+
+##############################################################################
+class SyntheticFrameSource(object):
+    """A frame source producing frames at given times, for headless testing.
+
+    Frames are just their own absolute ms.
+    """
+    ###########################################################
+    def __init__(self, frameTimes, decodeDelay=0):
+        """SyntheticFrameSource constructor.
+
+        @param  frameTimes   A sorted list of absolute ms to produce frames at.
+        @param  decodeDelay  Seconds to sleep per decoded frame.
+        """
+        super(SyntheticFrameSource, self).__init__()
+
+        self._frameTimes = list(frameTimes)
+        self.decodeDelay = decodeDelay
+        self._index = -1
+        self._lastMs = -1
+        self.decodeCount = 0
+
+
+    ###########################################################
+    def open(self, firstMs, lastMs):
+        """See ClipFrameSource.open()."""
+        inRange = [ms for ms in self._frameTimes if firstMs <= ms <= lastMs]
+        if not inRange:
+            return -1, -1
+        self._lastMs = lastMs
+        self._index = -1
+        return inRange[0], inRange[-1]
+
+
+    ###########################################################
+    def seek(self, ms):
+        """See ClipFrameSource.seek()."""
+        self._index = -1
+        for i, frameMs in enumerate(self._frameTimes):
+            if frameMs > ms:
+                break
+            self._index = i
+        if self._index == -1:
+            self._index = 0
+        return self._produce()
+
+
+    ###########################################################
+    def next(self):
+        """See ClipFrameSource.next()."""
+        self._index += 1
+        return self._produce()
+
+
+    ###########################################################
+    def close(self):
+        """See ClipFrameSource.close()."""
+        pass
+
+
+    ###########################################################
+    def _produce(self):
+        """Return the frame at the current index."""
+        if self._index >= len(self._frameTimes) or \
+           self._frameTimes[self._index] > self._lastMs:
+            return -1, None
+        if self.decodeDelay:
+            time.sleep(self.decodeDelay)
+        self.decodeCount += 1
+        ms = self._frameTimes[self._index]
+        return ms, ms
+
+
+##############################################################################
+class _StreamState(object):
+    """Per camera playback state; only touched by one decoder at a time."""
+    ###########################################################
+    def __init__(self, cameraLoc, source):
+        self.cameraLoc = cameraLoc
+        self.source = source
+
+        # The frame currently being shown and its absolute ms...
+        self.curMs = -1
+        self.curFrame = None
+
+        # The next decoded (but not yet due) frame...
+        self.nextMs = -1
+        self.nextFrame = None
+
+        # Whether the source has no more frames in the opened range...
+        self.atEnd = False
+
+        # Whether the current frame has been handed out yet...
+        self.delivered = False
+
+        # Statistics...
+        self.framesNew = 0
+        self.framesDropped = 0
+        self.framesHeld = 0
+
+
+    ###########################################################
+    def seek(self, ms):
+        """Seek the stream so that the current frame is the one at ms.
+
+        @param  ms  The absolute ms to seek to.
+        """
+        self.curMs, self.curFrame = self.source.seek(ms)
+        self.atEnd = (self.curMs == -1)
+        self.delivered = False
+        self.nextMs, self.nextFrame = -1, None
+        if not self.atEnd:
+            self._decodeNext()
+
+
+    ###########################################################
+    def advanceTo(self, ms):
+        """Decode forward until the current frame is the last one <= ms.
+
+        Frames that are passed over without being delivered are dropped.
+
+        @param  ms  The absolute ms of the master clock.
+        """
+        while (not self.atEnd) and (self.nextMs != -1) and \
+              (self.nextMs <= ms):
+            if not self.delivered and self.curMs != -1:
+                self.framesDropped += 1
+            self.curMs, self.curFrame = self.nextMs, self.nextFrame
+            self.delivered = False
+            self._decodeNext()
+
+
+    ###########################################################
+    def _decodeNext(self):
+        """Decode the frame following the current one."""
+        self.nextMs, self.nextFrame = self.source.next()
+        if self.nextMs == -1:
+            self.nextFrame = None
+            self.atEnd = True
+
+
+##############################################################################
+class _DecodeRunnable(object):
+    """Thread pool runnable to advance a single stream."""
+    ###########################################################
+    def __init__(self, batch, stream, ms, isSeek):
+        self._batch = batch
+        self._stream = stream
+        self._ms = ms
+        self._isSeek = isSeek
+
+    ###########################################################
+    def run(self):
+        try:
+            if self._isSeek:
+                self._stream.seek(self._ms)
+            else:
+                self._stream.advanceTo(self._ms)
+        except Exception:
+            self._batch.logger.error("Decoding %s failed: %s" %
+                    (self._stream.cameraLoc, sys.exc_info()[1]))
+            self._stream.atEnd = True
+        finally:
+            self._batch.done(self._stream)
+
+
+##############################################################################
+class _DecodeBatch(object):
+    """Tracks completion of a set of decoder runnables."""
+    ###########################################################
+    def __init__(self, count, logger):
+        self.logger = logger
+        self._pending = count
+        self._cond = threading.Condition()
+        self._busy = set()
+
+    ###########################################################
+    def started(self, stream):
+        with self._cond:
+            self._busy.add(stream)
+
+    ###########################################################
+    def done(self, stream):
+        with self._cond:
+            self._busy.discard(stream)
+            self._pending -= 1
+            self._cond.notifyAll()
+
+    ###########################################################
+    def wait(self, timeout):
+        """Wait for all runnables to finish.
+
+        @param  timeout  Max seconds to wait.
+        @return busy     The set of streams that didn't finish in time.
+        """
+        endTime = time.time() + timeout
+        with self._cond:
+            while self._pending > 0:
+                remaining = endTime - time.time()
+                if remaining <= 0:
+                    break
+                self._cond.wait(remaining)
+            return set(self._busy)
+
+    ###########################################################
+    def getBusy(self):
+        """Return the set of streams whose runnable is still going."""
+        with self._cond:
+            return set(self._busy)
+
+
+##############################################################################
+class MultiCameraPlayback(object):
+    """Plays video from several cameras in lockstep with a master clock.
+
+    >>> sources = {
+    ...     'front': SyntheticFrameSource(range(0, 1000, 100)),
+    ...     'back':  SyntheticFrameSource(range(0, 1000, 250)),
+    ...     'side':  SyntheticFrameSource(range(500, 1000, 50)),
+    ... }
+    >>> playback = MultiCameraPlayback(sources, poolSize=2)
+    >>> playback.open(0, 999)
+    (0, 950)
+    >>> for cam, (ms, _, status) in sorted(playback.seek(300).iteritems()):
+    ...     print cam, ms, status
+    back 250 new
+    front 300 new
+    side -1 none
+    >>> for cam, (ms, _, status) in sorted(playback.getFramesAt(600).iteritems()):
+    ...     print cam, ms, status
+    back 500 new
+    front 600 new
+    side 600 new
+    >>> for cam, (ms, _, status) in sorted(playback.getFramesAt(620).iteritems()):
+    ...     print cam, ms, status
+    back 500 held
+    front 600 held
+    side 600 held
+    >>> sorted(playback.getStats()['front'].items())
+    [('dropped', 2), ('held', 1), ('new', 2)]
+    >>> playback.close()
+
+    A decoder that outlives its tick is left alone until it is done, and then
+    catches up with any seek it missed:
+
+    >>> sources = {
+    ...     'fast': SyntheticFrameSource(range(0, 1000, 100)),
+    ...     'slow': SyntheticFrameSource(range(0, 1000, 100), decodeDelay=.3),
+    ... }
+    >>> playback = MultiCameraPlayback(sources, poolSize=2, decodeTimeout=.05)
+    >>> playback.open(0, 999)
+    (0, 900)
+    >>> def show(frames):
+    ...     for cam, (ms, _, status) in sorted(frames.iteritems()):
+    ...         print cam, ms, status
+    >>> show(playback.seek(0))
+    fast 0 new
+    slow -1 none
+    >>> show(playback.getFramesAt(100))
+    fast 100 new
+    slow -1 none
+    >>> show(playback.seek(500))
+    fast 500 new
+    slow -1 none
+    >>> show(playback.getFramesAt(500))
+    fast 500 held
+    slow -1 none
+    >>> sources['slow'].decodeDelay = 0
+    >>> time.sleep(1)
+    >>> show(playback.getFramesAt(600))
+    fast 600 new
+    slow 600 new
+    >>> sources['slow'].decodeCount
+    4
+    >>> playback.close()
+    """
+    ###########################################################
+    def __init__(self, sources, logger=None, threadPool=None,
+                 poolSize=_kDefaultPoolSize, clock=None,
+                 maxHoldMs=_kDefaultMaxHoldMs, decodeTimeout=_kDecodeTimeout):
+        """MultiCameraPlayback constructor.
+
+        @param  sources     A dict of cameraLoc -> frame source; see
+                            ClipFrameSource for the interface.
+        @param  logger      A logger, or None.
+        @param  threadPool  A ThreadPool to decode on; None to create our own.
+        @param  poolSize    The size of the thread pool to create if none was
+                            given; 0 to decode on the calling thread.
+        @param  clock       A PlaybackClock; None to create one.
+        @param  maxHoldMs   Frames older than this relative to the clock are
+                            reported as kFrameNone (gap in the recording).
+        @param  decodeTimeout  Max seconds to wait for the decoders each tick.
+        """
+        super(MultiCameraPlayback, self).__init__()
+
+        self._logger = EmptyLogger() if logger is None else logger
+        self._streams = [_StreamState(cam, src)
+                         for cam, src in sorted(sources.iteritems())]
+        self._clock = PlaybackClock() if clock is None else clock
+        self._maxHoldMs = maxHoldMs
+        self._decodeTimeout = decodeTimeout
+
+        self._ownThreadPool = False
+        self._threadPool = threadPool
+        if threadPool is None and poolSize > 0:
+            self._threadPool = ThreadPool(min(poolSize, len(self._streams)),
+                                          threadNamePrefix="mcplayback",
+                                          logger=self._logger)
+            self._ownThreadPool = True
+
+        # Batches that timed out with decoders still running, and the union
+        # of their busy streams.  We won't touch those streams again until
+        # they are done.
+        self._slowBatches = []
+        self._busyStreams = set()
+
+        # Busy streams that missed a seek; they get seeked to the clock as
+        # soon as their decoder finishes.
+        self._missedSeek = set()
+
+        self._firstMs = -1
+        self._lastMs = -1
+
+
+    ###########################################################
+    def getClock(self):
+        """Return the master clock."""
+        return self._clock
+
+
+    ###########################################################
+    def getCameraLocations(self):
+        """Return the cameras being played, sorted."""
+        return [stream.cameraLoc for stream in self._streams]
+
+
+    ###########################################################
+    def open(self, firstMs, lastMs):
+        """Open the given time range in all sources.
+
+        @param  firstMs  The first absolute ms to play.
+        @param  lastMs   The last absolute ms to play.
+        @return firstMs  The first ms any camera has video for, or -1.
+        @return lastMs   The last ms any camera has video for, or -1.
+        """
+        realFirst, realLast = -1, -1
+        for stream in self._streams:
+            first, last = stream.source.open(firstMs, lastMs)
+            stream.atEnd = (first == -1)
+            if first == -1:
+                continue
+            if realFirst == -1 or first < realFirst:
+                realFirst = first
+            realLast = max(realLast, last)
+
+        self._firstMs, self._lastMs = realFirst, realLast
+        return realFirst, realLast
+
+
+    ###########################################################
+    def seek(self, ms):
+        """Seek all streams to a common time.
+
+        @param  ms      The absolute ms to seek to.
+        @return frames  See getFramesAt().
+        """
+        self._clock.seek(ms)
+        self._runDecoders(ms, True)
+        return self._collect(ms)
+
+
+    ###########################################################
+    def getFramesAt(self, ms):
+        """Return the frames of all streams aligned to the given time.
+
+        Streams are only ever moved forward here; use seek() to go back.
+
+        @param  ms      The absolute ms of the master clock.
+        @return frames  A dict of cameraLoc -> (frameMs, frame, status); status
+                        is one of kFrameNew, kFrameHeld, kFrameNone.
+        """
+        self._runDecoders(ms, False)
+        return self._collect(ms)
+
+
+    ###########################################################
+    def tick(self):
+        """Return the frames for the current time of the master clock.
+
+        @return ms      The clock ms the frames were aligned to.
+        @return frames  See getFramesAt().
+        """
+        ms = self._clock.getMs()
+        return ms, self.getFramesAt(ms)
+
+
+    ###########################################################
+    def isFinished(self):
+        """Return True once the clock has run past all of the video."""
+        return self._lastMs == -1 or self._clock.getMs() > self._lastMs
+
+
+    ###########################################################
+    def getStats(self):
+        """Return per stream frame statistics.
+
+        @return stats  A dict of cameraLoc -> {'new', 'dropped', 'held'}.
+        """
+        return dict((stream.cameraLoc, {'new': stream.framesNew,
+                                        'dropped': stream.framesDropped,
+                                        'held': stream.framesHeld})
+                    for stream in self._streams)
+
+
+    ###########################################################
+    def close(self):
+        """Close all sources and the thread pool, if we own it."""
+        if self._ownThreadPool:
+            self._threadPool.shutdown(True)
+            self._threadPool = None
+        for stream in self._streams:
+            try:
+                stream.source.close()
+            except Exception:
+                self._logger.warning("Couldn't close %s" % stream.cameraLoc)
+
+
+    ###########################################################
+    def _runDecoders(self, ms, isSeek):
+        """Move all streams to the given time, in parallel if possible.
+
+        @param  ms      The absolute ms to move to.
+        @param  isSeek  True to seek, False to decode forward.
+        """
+        # Anything still running from an earlier tick is held until it
+        # finishes; we detect that by it dropping out of its batch's busy set.
+        busy = set()
+        slowBatches = []
+        for batch in self._slowBatches:
+            batchBusy = batch.getBusy()
+            if batchBusy:
+                busy |= batchBusy
+                slowBatches.append(batch)
+        self._slowBatches = slowBatches
+        self._busyStreams = busy
+
+        if isSeek:
+            self._missedSeek |= busy
+
+        streams = [stream for stream in self._streams
+                   if stream not in busy and
+                      (isSeek or stream in self._missedSeek or
+                       not stream.atEnd)]
+        if not streams:
+            return
+
+        batch = _DecodeBatch(len(streams), self._logger)
+        for stream in streams:
+            runnable = _DecodeRunnable(batch, stream, ms,
+                                       isSeek or stream in self._missedSeek)
+            batch.started(stream)
+            if self._threadPool is None or \
+               not self._threadPool.schedule(runnable, False):
+                runnable.run()
+        self._missedSeek.difference_update(streams)
+
+        stragglers = batch.wait(self._decodeTimeout)
+        if stragglers:
+            self._logger.warning("Decoders too slow for %s" %
+                    ", ".join(stream.cameraLoc for stream in stragglers))
+            self._slowBatches.append(batch)
+            self._busyStreams |= stragglers
+
+
+    ###########################################################
+    def _collect(self, ms):
+        """Build the result for the given clock time.
+
+        @param  ms      The clock ms.
+        @return frames  See getFramesAt().
+        """
+        frames = {}
+        for stream in self._streams:
+            if stream in self._busyStreams or stream.curMs == -1 or \
+               stream.curMs > ms or ms - stream.curMs > self._maxHoldMs:
+                if stream in self._busyStreams and stream.curMs != -1:
+                    stream.framesHeld += 1
+                    frames[stream.cameraLoc] = (stream.curMs, stream.curFrame,
+                                                kFrameHeld)
+                else:
+                    frames[stream.cameraLoc] = (-1, None, kFrameNone)
+                continue
+
+            if stream.delivered:
+                stream.framesHeld += 1
+                status = kFrameHeld
+            else:
+                stream.framesNew += 1
+                stream.delivered = True
+                status = kFrameNew
+            frames[stream.cameraLoc] = (stream.curMs, stream.curFrame, status)
+        return frames
+
+
+##############################################################################
+def openRecordedPlayback(logger, clipManager, videoDir, cameraLocs, firstMs,
+                         lastMs, displaySize=(320, 240), markupModel=None,
+                         objDbPath=None, threadPool=None):
+    """Create a MultiCameraPlayback on recorded video.
+
+    @param  logger       The logger to use.
+    @param  clipManager  An open ClipManager.
+    @param  videoDir     The video storage directory.
+    @param  cameraLocs   A list of camera locations to play.
+    @param  firstMs      The first absolute ms to play.
+    @param  lastMs       The last absolute ms to play.
+    @param  displaySize  The (w, h) of the frames to produce.
+    @param  markupModel  A VideoMarkupModel, or None for no markup.
+    @param  objDbPath    Path to the object database if markup needs it.
+    @param  threadPool   A ThreadPool to share, or None to make one.
+    @return playback     The playback engine, already opened.
+    """
+    sources = {}
+    for cameraLoc in cameraLocs:
+        sources[cameraLoc] = ClipFrameSource(logger, clipManager, videoDir,
+                                             cameraLoc, displaySize,
+                                             markupModel, objDbPath)
+    playback = MultiCameraPlayback(sources, logger, threadPool)
+    playback.open(firstMs, lastMs)
+    return playback
+
+
+##############################################################################
+def dumpFrameTimestamps(playback, firstMs, lastMs, stepMs, out=None):
+    """Headless playback, writing one line of frame times per clock step.
+
+    >>> sources = {
+    ...     'a': SyntheticFrameSource(range(0, 200, 40)),
+    ...     'b': SyntheticFrameSource(range(10, 200, 60)),
+    ... }
+    >>> playback = MultiCameraPlayback(sources, poolSize=0)
+    >>> playback.open(0, 199)
+    (0, 190)
+    >>> dumpFrameTimestamps(playback, 0, 199, 50)
+    0 a=0 b=-1
+    50 a=40 b=10
+    100 a=80 b=70
+    150 a=120 b=130
+    >>> playback.close()
+
+    @param  playback  An opened MultiCameraPlayback.
+    @param  firstMs   The first clock ms.
+    @param  lastMs    The last clock ms.
+    @param  stepMs    The clock increment.
+    @param  out       A file object to write to; None for stdout.
+    """
+    if out is None:
+        out = sys.stdout
+    cams = playback.getCameraLocations()
+    ms = firstMs
+    frames = playback.seek(ms)
+    while True:
+        out.write("%d %s\n" % (ms, " ".join("%s=%d" % (cam, frames[cam][0])
+                                              for cam in cams)))
+        ms += stepMs
+        if ms > lastMs:
+            break
+        frames = playback.getFramesAt(ms)
+
+
+##############################################################################
+def test_main():
+    """OB_REDACT
+    Our main function, which runs test code
+    """
+    import doctest
+    doctest.testmod(verbose=True)
+
+
+##############################################################################
+if __name__ == '__main__':
+    test_main()
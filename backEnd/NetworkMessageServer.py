@@ -49,6 +49,8 @@ import logging
 import shutil
 import operator
 import os
+import select
+import socket
 import time
 from SocketServer import TCPServer, BaseRequestHandler
 import urllib
@@ -64,6 +66,7 @@ from vitaToolbox.loggingUtils.LoggingUtils import getLogger
 from vitaToolbox.networking.HttpClient import HttpClient
 from vitaToolbox.path.PathUtils import normalizePath
 from vitaToolbox.dictUtils.MemStore import MemStore
+from vitaToolbox.profiling.ObjectCensus import registerCache, reportCensus
 from vitaToolbox.windows.winUtils import registerForForcedQuitEvents
 from vitaToolbox.strUtils.EnsureUnicode import ensureUtf8, ensureUnicode, simplifyString
 from vitaToolbox.sysUtils.FileUtils import writeObjectToFile, writeStringToFile
@@ -74,6 +77,7 @@ from appCommon.CommonStrings import kImportSuffix
 from appCommon.CommonStrings import kPortFileName
 from appCommon.CommonStrings import kRuleDir, kRuleExt, kQueryExt, kBackupExt
 from appCommon.CommonStrings import kPrefsFile, kCamDbFile
+from appCommon.CommonStrings import kHeatmapDbFile
 from appCommon.CommonStrings import kAnyCameraStr
 from appCommon.CommonStrings import kCameraUndefined, kCameraOn, kCameraOff
 from appCommon.CommonStrings import kCameraConnecting, kCameraFailed
@@ -84,6 +88,8 @@ from appCommon.CommonStrings import kInactiveSuffix
 from appCommon.CommonStrings import kIftttResponse
 from appCommon.CommonStrings import kVideoFolder
 from appCommon.CommonStrings import kRemoteFolder
+from appCommon.CommonStrings import kRemoteClipCacheFolder
+from appCommon.CommonStrings import kRemoteHlsFolder
 from appCommon.CommonStrings import kGatewayHost
 from appCommon.CommonStrings import kGatewayPath
 from appCommon.CommonStrings import kGatewayTimeoutSecs
@@ -106,6 +112,7 @@ from BackEndPrefs import BackEndPrefs, kClipQualityProfile, kClipResolution, kCl
 from CameraManager import CameraManager
 from ClipManager import ClipManager
 from DataManager import DataManager
+from HeatmapManager import HeatmapManager
 import MessageIds
 from RealTimeRule import RealTimeRule
 from ResponseDbManager import ResponseDbManager
@@ -115,6 +122,16 @@ from triggers.TargetTrigger import getQueryForDefaultRule
 from WebServer import make_auth, user_from_auth, REALM
 from vitaToolbox.threading.ThreadPoolMixIn import ThreadPoolMixIn
 from vitaToolbox.threading.PriorityLock import PriorityLock
+from vitaToolbox.threading.AdmissionControl import AdmissionControl
+from vitaToolbox.threading.LongPoll import LongPoll
+from vitaToolbox.networking.WsgiServer import WsgiServer
+from vitaToolbox.networking.WsgiServer import makeServerAddressInfos
+from HlsClipCache import HlsClipCache, kSegmentMs, remuxSegment
+from NotificationWatermark import NotificationWatermark
+from DerivedClipCache import DerivedClipCache, makeClipKey
+from CameraStateSnapshot import CameraStateSnapshot
+from EventChannel import EventChannel
+from EventChannel import kEventMessage, kEventCameraStatus, kEventRules
 
 
 def OB_ASID(a): return a
@@ -146,6 +163,7 @@ _kRemoteInvalidRule = "The requested rule could not be loaded."
 _kRemoteGenericError = "The requested operation could not be performed."
 _kRemoteExceptionError = "An exception occurred during the requested operation."
 _kCouldNotLoadClip = "The requested clip could not be loaded."
+_kRemoteBusyError = "The server is busy; retry in %d seconds."
 
 # MIME types for media requests
 _kMimeTypeVideoH264 = "video/h264"
@@ -168,8 +186,86 @@ _kMethodTimeLimit = 5
 _kNotifClipRewindMs = 2*60*1000
 _kNotifClipExtendMs = 15*60*1000
 
+# Clips played over HLS are served by a WSGI server of ours; nginx reaches it
+# through this path, followed by the port.
+_kHlsClipPathFormat = "/clip/%d%s"
+
+# Number of request threads of the HLS clip server.  Requests for segments
+# that are still being made wait, so have a few.
+_kHlsServerThreads = 8
+
+# How often the camera state given to remote clients gets made from scratch,
+# in seconds, to pick up what changed without us being told (license changes,
+# new recordings, time preferences, ...).
+_kCameraStateReconcileSecs = 5*60
+
+# Remote clients waiting for push notifications or camera state changes
+# share this many threads of the remote server's pool; see LongPoll.  Their
+# waits end after this many seconds, below the time nginx waits for a
+# proxied request.
+_kRemoteLongPolls = 8
+_kRemoteLongPollSecs = 50
+
+# The front end waiting for events gets this many threads of the local
+# server's pool, which has them on top of its own.  Two, so a front end
+# starting up while the old one goes away doesn't have to poll.  The front
+# end asks again right away, so the length of a wait matters little.
+_kLocalLongPolls = 2
+_kLocalLongPollSecs = 50
+
+# Remote calls which are expensive, and which class of expensive they are.
+# Only so many of each class run or wait at once, and each client can make
+# only so many; see AdmissionControl.
+_kAdmissionClasses = {
+    'remoteGetClipUri': 'clip',
+    'remoteGetClipUriForDownload': 'clip',
+    'remoteGetNotificationClip': 'clip',
+    'remoteGetThumbnailUris': 'thumbnail',
+    'remoteGetClipsBetweenTimes': 'search',
+    'remoteGetClipsBetweenTimes2': 'search',
+    'remoteGetClipsForRule': 'search',
+    'remoteGetClipsForRule2': 'search',
+    'remoteGetClipInfo': 'search',
+    'remoteGetActivityHeatmap': 'search',
+}
+
+# For each class: how many run at once, and how many tokens one costs.
+_kAdmissionCosts = {
+    'clip': (2, 4),
+    'thumbnail': (2, 1),
+    'search': (2, 2),
+}
+
+# Threads of the remote server's pool we keep for cheap calls.  Expensive
+# calls, running or waiting, get what long-polls and these leave, so
+# waiting never starves the pool.
+_kCheapCallThreads = 3
+_kAdmissionThreads = _kThreadPoolSize - _kRemoteLongPolls - _kCheapCallThreads
+
+# For each class: how many run at once, how many may wait, and how many
+# tokens one costs.  The threads left after the running ones are shared out
+# evenly as places to wait.
+_kAdmissionWaiting = max(0, _kAdmissionThreads -
+        sum(running for running, _ in _kAdmissionCosts.itervalues())) // \
+        len(_kAdmissionCosts)
+_kAdmissionLimits = dict((name, (running, _kAdmissionWaiting, cost))
+        for name, (running, cost) in _kAdmissionCosts.iteritems())
+
+# Tokens each client gets per second, and most it can save up.
+_kAdmissionRate = 1
+_kAdmissionBurst = 20
+
+# Most seconds an expensive call waits before we tell the client to retry.
+_kAdmissionMaxWaitSecs = 15
+
+# Where nginx connects to us from; only it may tell us a client's address.
+_kLocalProxyAddress = '127.0.0.1'
+
+# What we know about the remote request handled by the current thread.
+_requestInfo = threading.local()
+
 # Functions for which calling and timing information will not be logged.
-_kUnloggedFunctions = ["getMessage", "updateCameraProgress"]
+_kUnloggedFunctions = ["getMessage", "updateCameraProgress", "waitForEvents"]
 
 # Functions which can be executed on demand and do not need to be serialized.
 _kThreadSafeFunctions = [
@@ -184,7 +280,9 @@ _kThreadSafeFunctions = [
     "memstorePut", "memstoreGet", "memstoreRemove",
     "userLogin", "refreshLicenseList", "acquireLicense", "getLicenseSettings",
     "getVersion", "getTimePreferences", "setTimePreferences",
-    "sendIftttMessage", "launchedByService", "remoteSubmitClipToSighthound"
+    "sendIftttMessage", "launchedByService", "remoteSubmitClipToSighthound",
+    "notePushNotification", "remoteWaitForNotifications",
+    "remoteWaitForCameraStateChanges", "getAdmissionStats", "waitForEvents"
 ]
 
 _kRemoteWhitelist = [
@@ -209,15 +307,19 @@ _kRemoteWhitelist = [
     'remoteGetClipUri',
     'remoteGetClipUriForDownload',
     'remoteGetLastNotificationUID',
+    'remoteWaitForNotifications',
     'remoteGetCameraNames',
     'remoteGetCameraDetailsAndRules',
     'remoteGetAllCamerasDetailsAndRules',
+    'remoteGetCameraStateChanges',
+    'remoteWaitForCameraStateChanges',
     'remoteEnableRule',
     'remoteGetClipsForRule',
     'remoteGetClipsForRule2',
     'remoteUnregisterDevice',
     'remoteUnregisterDevice2',
     'remoteGetClipInfo',
+    'remoteGetActivityHeatmap',
     'enableNotifications',
     'remoteSubmitClipToSighthound'
 ]
@@ -269,12 +371,16 @@ class XMLPRCServer(ThreadPoolMixIn, XMLRPCServerWithClientId):
         @param  logger    The shared logger to use.
         """
         pfx = "xmlrpc-%d" % priority
-        threadPoolSize = _kThreadPoolSize if 0 == priority else 2
+        # Locally, the front end's event waits get threads of their own.
+        threadPoolSize = _kThreadPoolSize if 0 == priority else \
+                         2 + _kLocalLongPolls
         self._logger = logger
         ThreadPoolMixIn.__init__(self, threadPoolSize, threadNamePrefix=pfx,
                                  logger=logger)
         self._priority = priority
         self._lock = PriorityLock()
+        self._admissionControl = AdmissionControl(_kAdmissionLimits,
+            _kAdmissionRate, _kAdmissionBurst, _kAdmissionMaxWaitSecs)
         self._logger = logger
         XMLRPCServerWithClientId.__init__(self, *args, **kwargs)
 
@@ -304,6 +410,20 @@ class XMLPRCServer(ThreadPoolMixIn, XMLRPCServerWithClientId):
         needsLock = method not in _kThreadSafeFunctions
         timeStart = time.time()
 
+        # Expensive remote calls may have to wait, or come back later, so they
+        # don't starve everybody else of the lock.
+        admissionClass = None
+        if priority == 0:
+            admissionClass = _kAdmissionClasses.get(method)
+        if admissionClass is not None:
+            client = getattr(_requestInfo, 'client', None)
+            retrySecs = self._admissionControl.admit(admissionClass, client,
+                                                     _isClientGone)
+            if retrySecs is not None:
+                self._logger.info("(%s) %s from %s turned away, retry in %ds"
+                                  % (threadName, method, client, retrySecs))
+                return False, _kRemoteBusyError % retrySecs
+
         if needsLock:
             lockToken = self._lock.acquire(priority)
 
@@ -330,10 +450,60 @@ class XMLPRCServer(ThreadPoolMixIn, XMLRPCServerWithClientId):
         finally:
             if needsLock:
                 self._lock.release(lockToken)
+            if admissionClass is not None:
+                self._admissionControl.release(admissionClass)
             methodTime = time.time() - timeStart
             self._logger.debug("(%s) mtm:%d" % (threadName, methodTime))
 
 
+    ###########################################################
+    def getAdmissionStats(self):
+        """Return what happened to expensive remote calls.
+
+        @return stats  See AdmissionControl.getStats().
+        """
+        return self._admissionControl.getStats()
+
+
+##############################################################################
+class RemoteRequestHandler(CrossDomainXMLRPCRequestHandler):
+    """Request handler for remote clients, which notes who the client is
+    while the request is being handled.
+    """
+    def do_POST(self):
+        """Handle a request."""
+        # Remote clients come to us through nginx, which tells their address.
+        # Only believe that when it really is nginx, on this machine, telling.
+        client = self.client_address[0]
+        if client == _kLocalProxyAddress:
+            client = self.headers.get('X-Real-IP', client)
+        _requestInfo.client = client
+        _requestInfo.connection = self.connection
+        try:
+            CrossDomainXMLRPCRequestHandler.do_POST(self)
+        finally:
+            _requestInfo.client = None
+            _requestInfo.connection = None
+
+
+###############################################################
+def _isClientGone():
+    """Check whether the client of the current request hung up.
+
+    @return isGone  True if the client closed the connection.
+    """
+    connection = getattr(_requestInfo, 'connection', None)
+    if connection is None:
+        return False
+    try:
+        if not select.select([connection], [], [], 0)[0]:
+            return False
+        # Readable with nothing to read means closed.
+        return not connection.recv(1, socket.MSG_PEEK)
+    except (select.error, socket.error):
+        return True
+
+
 ##############################################################################
 class XMLPRCServerThread(threading.Thread):
     """Thread to drive an XMLRPC server. We use it to run the secondary, low
@@ -393,6 +563,7 @@ class NetworkMessageServer(object):
         self._logger.info("service-launched: %s" % self._foundServiceMarkerArg)
 
         self._memstore = MemStore()
+        registerCache("nms.memStore", self._memstore, "_data")
         self._memstore.put(kMemStoreRulesLock, False)
         self._memstore.put(kMemStoreLicenseData, licenseData)
 
@@ -414,6 +585,41 @@ class NetworkMessageServer(object):
         self._responseDb = ResponseDbManager(self._logger)
         self._responseDb.open(responseDbPath)
 
+        # Clips exported for remote clients, to hand out again to whoever asks
+        # for the same one.
+        self._derivedClipCache = DerivedClipCache(os.path.join(localDataDir,
+                kRemoteFolder, kRemoteClipCacheFolder), self._logger)
+
+        # Remote clients waiting for push notifications are answered from
+        # here, which has a database connection of its own so it doesn't need
+        # to wait for the request lock.
+        self._notificationDb = ResponseDbManager(self._logger)
+        self._notificationDb.open(responseDbPath)
+        remoteLongPoll = LongPoll(_kRemoteLongPolls, _kRemoteLongPollSecs)
+        self._notificationWatermark = NotificationWatermark(
+            self._notificationDb.getPushNotifications,
+            self._notificationDb.getLastPushNotificationUID(), self._logger,
+            remoteLongPoll)
+
+        # The state of cameras and their rules given to remote clients, kept
+        # up to date as cameras and rules change.  Made on first request;
+        # until then the rule info below is None.
+        #   _cameraStateRules: rule name to (lowercase location, rule dict)
+        #   _cameraStateClipCams: locations that have recorded video
+        self._cameraState = CameraStateSnapshot(remoteLongPoll)
+        self._cameraStateRules = None
+        self._cameraStateClipCams = set()
+        self._cameraStateTime = 0
+
+        # Events the front end waits on, instead of polling for messages and
+        # camera status.
+        self._events = EventChannel(LongPoll(_kLocalLongPolls,
+                                             _kLocalLongPollSecs))
+
+        self._heatmapMgr = HeatmapManager(self._logger)
+        self._heatmapMgr.open(os.path.join(os.path.dirname(dataMgrPath),
+                                           kHeatmapDbFile))
+
         # A dictionary tracking the current status of configured cameras.
         # key = camera name
         # value in [kCameraOn, kCameraOff, kCameraConnecting, kCameraFailed]
@@ -468,6 +674,12 @@ class NetworkMessageServer(object):
         # Devices available for decoding
         self._hardwareDevices = hardwareDevices
 
+        # Serves clips over HLS, making segments as they're asked for.  The
+        # port is None until the server is up.
+        self._hlsClipCache = None
+        self._hlsServer = None
+        self._hlsPort = None
+
 
     ###########################################################
     def __del__(self):
@@ -506,7 +718,7 @@ class NetworkMessageServer(object):
                 if 0 == len(ports):
                     requestHandlerClass = SimpleXMLRPCRequestHandler
                 else:
-                    requestHandlerClass = CrossDomainXMLRPCRequestHandler
+                    requestHandlerClass = RemoteRequestHandler
                 newXmlrpcServer = XMLPRCServer(1 - len(ports), self._logger,
                     ("0.0.0.0", port), logRequests=False, allow_none=True,
                     requestHandler=requestHandlerClass
@@ -568,6 +780,8 @@ class NetworkMessageServer(object):
         camDb = os.path.join(self._localDataDir, kCamDbFile)
         self._camMgr = CameraManager(self._logger, camDb)
 
+        self._startHlsServer()
+
         # Register functions
         rpcMethods = [
             # General
@@ -639,6 +853,8 @@ class NetworkMessageServer(object):
             (self._setVideoLocation, "setVideoLocation"),
             (self._setVideoLocationChangeStatus, "setVideoLocationChangeStatus"),
             (self._getVideoLocationChangeStatus, "getVideoLocationChangeStatus"),
+            (self._cancelVideoRelocation, "cancelVideoRelocation"),
+            (self._getVideoRelocationStatus, "getVideoRelocationStatus"),
             (self._getVideoLocation, "getVideoLocation"),
             (self._setCacheDuration, "setCacheDuration"),
             (self._getCacheDuration, "getCacheDuration"),
@@ -687,6 +903,7 @@ class NetworkMessageServer(object):
             (self._remoteGetNotificationClip, "remoteGetNotificationClip"),
             (self._remoteGetThumbnailUris, "remoteGetThumbnailUris"),
             (self._remoteGetClipInfo, "remoteGetClipInfo"),
+            (self._remoteGetActivityHeatmap, "remoteGetActivityHeatmap"),
             (self._remoteGetLiveCameras, "remoteGetLiveCameras"),
             (self._remoteGetClipUri, "remoteGetClipUri"),
             (self._remoteGetClipUriForDownload, "remoteGetClipUriForDownload"),
@@ -697,6 +914,11 @@ class NetworkMessageServer(object):
             (self._remoteUnregisterDevice2, "remoteUnregisterDevice2"),
             (self._remoteGetNotifications, "remoteGetNotifications"),
             (self._remoteGetLastNotificationUID, "remoteGetLastNotificationUID"),
+            (self._remoteWaitForNotifications, "remoteWaitForNotifications"),
+            (self._notePushNotification, "notePushNotification"),
+            (self._remoteGetCameraStateChanges, "remoteGetCameraStateChanges"),
+            (self._remoteWaitForCameraStateChanges,
+             "remoteWaitForCameraStateChanges"),
 
             # Notifications
             (self._enableNotifications, "enableNotifications"),
@@ -705,9 +927,11 @@ class NetworkMessageServer(object):
             # Back end to front end communication
             (self._addMessage, "addMessage"),
             (self._getMessage, "getMessage"),
+            (self._waitForEvents, "waitForEvents"),
 
             # Web server settings
             (self._getWebPort, "getWebPort"),
+            (self._getAdmissionStats, "getAdmissionStats"),
             (self._setWebPort, "setWebPort"),
             (self._getVideoSetting, "getVideoSetting"),
             (self._setVideoSetting, "setVideoSetting"),
@@ -746,6 +970,9 @@ class NetworkMessageServer(object):
 
             # Service things
             (self._launchedByService, "launchedByService"),
+
+            # Diagnostics
+            (self._getObjectCensus, "getObjectCensus"),
         ] # rpcMethods
 
         for f in rpcMethods:
@@ -769,9 +996,15 @@ class NetworkMessageServer(object):
         while self._running:
             self._xmlrpcServer.handle_request()
             self._expireMemstoreItems()
+            self._derivedClipCache.expire()
 
         # Shut down the XML/RPC servers.
         self._logger.info("Shutting down...")
+        self._hlsServer.shutdown(0)
+        self._hlsClipCache.shutdown()
+        self._notificationWatermark.shutdown()
+        self._cameraState.shutdown()
+        self._events.shutdown()
         self._xmlrpcServer.shutdown(True)
         self._xmlrpcServerLowPrio.shutdown(True)
         try:
@@ -781,6 +1014,78 @@ class NetworkMessageServer(object):
         self._logger.info("Shutdown done.")
 
 
+    ###########################################################
+    def _startHlsServer(self):
+        """Start the server for clips played over HLS."""
+        self._hlsClipCache = HlsClipCache(
+            os.path.join(self._localDataDir, kRemoteFolder, kRemoteHlsFolder),
+            self._makeHlsSegment, self._logger)
+        self._hlsServer = WsgiServer(makeServerAddressInfos([0], .5, 30),
+                                     self._hlsClipCache.wsgiApp,
+                                     self._hlsServerNotify,
+                                     sharedLogger=self._logger,
+                                     threadPoolSize=_kHlsServerThreads,
+                                     serverName="localhost")
+        self._hlsServer.setDaemon(True)
+        self._hlsServer.start()
+
+
+    ###########################################################
+    def _hlsServerNotify(self, address):
+        """Called by the HLS clip server once it's listening.
+
+        @param  address  The (host, port) it's listening on.
+        """
+        self._hlsPort = address[1]
+
+
+    ###########################################################
+    def _makeHlsSegment(self, data, startMs, stopMs, path):
+        """Make a segment of a clip played over HLS; runs on worker threads.
+
+        @param  data     The (fileList, extras) of the segment's session.
+        @param  startMs  The absolute ms the segment starts at.
+        @param  stopMs   The absolute ms the segment stops at.
+        @param  path     Where to put the segment.
+        @return success  True if the segment was made.
+        """
+        fileList, extras = data
+        return remuxSegment(fileList, startMs, stopMs, path,
+                            self._localDataDir, extras, self._logger)
+
+
+    ###########################################################
+    def _addHlsClipSession(self, cameraName, startMs, stopMs, extras):
+        """Start serving a clip over HLS, without making any of it yet.
+
+        @param  cameraName  The name of the camera to play a clip from.
+        @param  startMs     The absolute ms the clip starts at.
+        @param  stopMs      The absolute ms the clip stops at.
+        @param  extras      Extras for remuxClip(), as for saveCurrentClip().
+        @return clipUri     The URI of the clip's playlist.
+        """
+        segments = self._dataMgr.getClipSegments(cameraName, startMs, stopMs,
+                                                 kSegmentMs)
+        if not segments:
+            raise Exception("Clip could not be created.")
+
+        # Everybody asking for the same clip shares the session, and so the
+        # segments made for it.  The segments list the source files, so a
+        # clip whose files changed is a new one.
+        sessionId = makeClipKey(cameraName, startMs, stopMs, extras, segments)
+
+        extras = dict(extras)
+        extras["boxList"] = []
+        if extras.get("drawBoxes"):
+            extras["boxList"] = self._dataMgr.getClipBoxList(cameraName,
+                    startMs, stopMs, extras.get("objectIds", []))
+
+        uri = self._hlsClipCache.addSession(sessionId,
+                [(first, last, (fileList, extras))
+                 for first, last, fileList in segments])
+        return _kHlsClipPathFormat % (self._hlsPort, uri)
+
+
     ###########################################################
     def _expireMemstoreItems(self):
         """Expires memstore items.
@@ -954,6 +1259,9 @@ class NetworkMessageServer(object):
             # turned on again, this will switch to the connecting screen in
             # BackEndApp _openCamera.
             self._setCameraStatus(camLocation, kCameraOff)
+            self._refreshCameraState(origLocation)
+        else:
+            self._refreshCameraState(camLocation)
 
         # If the location changed we need to update queries and rules, as well
         # as mark old videos with the new name.  Otherwise we're done already.
@@ -995,6 +1303,7 @@ class NetworkMessageServer(object):
         self._queue.put([MessageIds.msgIdCameraDeleted, camName, removeData])
         if camName in self._cameraStatus:
             del self._cameraStatus[camName]
+        self._refreshCameraState(camName)
 
         # Unfreeze 1+ cameras, if there are any actually
         maxCameras = self._maxCameras()
@@ -1004,6 +1313,7 @@ class NetworkMessageServer(object):
             _, uri, _, extra = self._camMgr.getCameraSettings(camLoc)
             self._queue.put([MessageIds.msgIdCameraEdited,
                              camLoc, camLoc, uri, extra, -1])
+            self._refreshCameraState(camLoc)
 
         # Remove or disable rules and queries for the removed location
         for name, _, _, _, _ in self._getRuleInfoForLocation(camName):
@@ -1263,11 +1573,10 @@ class NetworkMessageServer(object):
             success = True
 
         if success:
-            if camLoc != kAnyCameraStr:
-                if isEdit and postDeleteMessage:
-                    self._queue.put([MessageIds.msgIdRuleDeleted, origName])
-                self._queue.put([MessageIds.msgIdRuleAdded, name, pickledRule,
-                                 pickledQuery])
+            if isEdit and postDeleteMessage:
+                self._queue.put([MessageIds.msgIdRuleDeleted, origName])
+            self._queue.put([MessageIds.msgIdRuleAdded, name, pickledRule,
+                             pickledQuery])
 
             self._sendIftttRulesAndCameras([],[])
             if isEdit:
@@ -1286,6 +1595,10 @@ class NetworkMessageServer(object):
                     self._logger.error("Failed to restore rule and query files for '" + ensureUtf8(origName) +
                                         ": " + ": " + traceback.format_exc() )
 
+        self._ruleStateChanged(name)
+        if isEdit and origName != name:
+            self._ruleStateChanged(origName)
+
         return success
 
     ###########################################################
@@ -1307,6 +1620,8 @@ class NetworkMessageServer(object):
         except Exception:
             self._logger.warning("Delete rule exception", exc_info=True)
 
+        self._ruleStateChanged(ruleName)
+
         if postMessage:
             self._queue.put([MessageIds.msgIdRuleDeleted, ruleName])
 
@@ -1390,6 +1705,7 @@ class NetworkMessageServer(object):
         rule.setSchedule(schedule)
         cPickle.dump(rule, ruleFile)
         ruleFile.close()
+        self._ruleStateChanged(ruleName)
 
         self._queue.put([MessageIds.msgIdRuleScheduleUpdated, ruleName,
                          schedule])
@@ -1418,6 +1734,7 @@ class NetworkMessageServer(object):
         rule.setEnabled(enable)
         cPickle.dump(rule, ruleFile)
         ruleFile.close()
+        self._ruleStateChanged(ruleName)
 
         self._queue.put([MessageIds.msgIdRuleEnabled, ruleName, enable])
 
@@ -1434,28 +1751,44 @@ class NetworkMessageServer(object):
         infoList = []
 
         for name in self._getRuleNames():
-            try:
-                rule = cPickle.loads(self._getRule(name))
-            except Exception:
-                self._logger.error("Rule %s could not be loaded" % name)
+            ruleLocation, info = self._loadRuleInfo(name)
+            if info is None:
                 continue
 
             if (location is not None) and \
-               (rule.getCameraLocation().lower() != location.lower()):
+               (ruleLocation.lower() != location.lower()):
                 continue
 
-            responseTypes = self._getActiveResponseTypes(name)
-            if responseTypes:
-                scheduleSummary = rule.getScheduleSummary(
-                        self._prefs.getPref('timePref12'))
-            else:
-                scheduleSummary = "No Responses."
-            infoList.append((name, rule.getQueryName(), scheduleSummary,
-                             rule.isEnabled(), responseTypes))
+            infoList.append(info)
 
         return infoList
 
 
+    ###########################################################
+    def _loadRuleInfo(self, ruleName):
+        """Load information about a single rule.
+
+        @param  ruleName  The name of the rule.
+        @return location  The location of the rule's camera, or None.
+        @return info      (ruleName, queryName, scheduleString, isEnabled,
+                          responseNames), or None if it couldn't be loaded.
+        """
+        try:
+            rule = cPickle.loads(self._getRule(ruleName))
+        except Exception:
+            self._logger.error("Rule %s could not be loaded" % ruleName)
+            return None, None
+
+        responseTypes = self._getActiveResponseTypes(ruleName)
+        if responseTypes:
+            scheduleSummary = rule.getScheduleSummary(
+                    self._prefs.getPref('timePref12'))
+        else:
+            scheduleSummary = "No Responses."
+        return rule.getCameraLocation(), (ruleName, rule.getQueryName(),
+                scheduleSummary, rule.isEnabled(), responseTypes)
+
+
     ###########################################################
     def _getRuleInfo(self, ruleName):
         """Retrieve a list of information about a rule.
@@ -1624,6 +1957,31 @@ class NetworkMessageServer(object):
         self._locationChangeStatus = (True, success)
 
 
+    ###########################################################
+    def _cancelVideoRelocation(self):
+        """Move video back to where a background location change started.
+
+        Completion is reported through _getVideoLocationChangeStatus(), same
+        as for _setVideoLocation().
+        """
+        self._locationChangeStatus = (False, False)
+        self._queue.put([MessageIds.msgIdCancelVideoRelocation])
+
+
+    ###########################################################
+    def _getVideoRelocationStatus(self):
+        """Get the progress of moving existing video to a new location.
+
+        @return fromDir    The video folder clips are moving from, or "" if
+                           no move is in progress.
+        @return toDir      The video folder clips are moving to, or "".
+        @return total      The number of clips there were to move.
+        @return remaining  The number of clips left to move.
+        """
+        fromDir, toDir, total, remaining = self._clipMgr.getRelocationInfo()
+        return fromDir or "", toDir or "", total, remaining
+
+
     ###########################################################
     def _getVideoLocationChangeStatus(self):
         """Get the status of a video location change operation.
@@ -1817,6 +2175,7 @@ class NetworkMessageServer(object):
                 self._logger.info("camera '%s' WSGI now on port %d" %
                                   (cameraLocation, wsgiPort))
                 self._cameraWsgiPort[cameraLocation] = wsgiPort
+                self._refreshCameraState(cameraLocation)
             return
 
         if status == kCameraOff:
@@ -1825,7 +2184,11 @@ class NetworkMessageServer(object):
         assert status in [kCameraOn, kCameraOff,
                           kCameraConnecting, kCameraFailed]
 
+        oldStatus = self._cameraStatus.get(cameraLocation)
         self._cameraStatus[cameraLocation] = ( status, reason )
+        self._refreshCameraState(cameraLocation)
+        if oldStatus != (status, reason):
+            self._events.post(kEventCameraStatus, cameraLocation)
 
     ###########################################################
     def _getCameraStatus(self, cameraLocation):
@@ -2180,6 +2543,8 @@ class NetworkMessageServer(object):
         dup = not self._frontEndMessageQueue.enqueue(message)
         self._logger.info("enqueued message (type=%d, dup=%s, qlen=%d)" %
                           (message[0], dup, len(self._frontEndMessageQueue)))
+        if not dup:
+            self._events.post(kEventMessage)
 
 
     ###########################################################
@@ -2199,6 +2564,27 @@ class NetworkMessageServer(object):
         return self._frontEndMessageQueue.dequeue()
 
 
+    ###########################################################
+    def _waitForEvents(self, channelId, seq, timeout):
+        """Wait for something the front end should know about.
+
+        Events say a message is waiting for getMessage(), or that a camera's
+        status or a rule changed; see EventChannel.
+
+        NOTE: This function is thread safe. Ensure any changes preserve that.
+
+        @param  channelId  The channel id from the last call, or None.
+        @param  seq        The sequence number from the last call.
+        @param  timeout    Most seconds to wait; capped at 50.
+        @return channelId  The channel id to pass next time.
+        @return seq        The sequence number to pass next time.
+        @return events     A list of (kind, data), oldest first.
+        @return isReset    True if events were missed, and the front end
+                           should look at everything again.
+        """
+        return self._events.wait(channelId, seq, timeout)
+
+
     ###########################################################
     def _remoteGetCameraNames(self):
         """Retrieve a list of all searchable camera names.
@@ -2288,66 +2674,195 @@ class NetworkMessageServer(object):
     def _remoteGetAllCamerasDetailsAndRules(self, sessionId):
         """Retrieve a list of details and rules for all cameras.
 
+        Clients which ask for this regularly should rather use
+        remoteGetCameraStateChanges() and remoteWaitForCameraStateChanges().
+
         @return success   True if the operation was successful.  If not
                           successful, the only additional return will be a
                           string explaining the error.
         @return cameras  A list of dicts contains camera details and rules
         """
         try:
-            # Cameras that are currently setup; may or may not have recorded
-            # video. Some might be frozen though.
-            camLocs = self._camMgr.getCameraLocations()
-
-            # A list of cameras that have recorded video; may or may not be
-            # currently setup...
-            clipCams = self._clipMgr.getCameraLocations()
+            self._updateCameraState()
+            return True, self._cameraState.getSnapshot()[1]
+        except Exception:
+            self._logger.error("Remote exception", exc_info=True)
+            return False, _kRemoteExceptionError
 
-            camerasDict = {};
 
-            for camLoc in camLocs:
-                statusAndEnabled = self._getCameraStatusAndEnabled(camLoc)
-                liveJpegUri = self._remoteGetCameraUri(camLoc, sessionId, None, _kMimeTypeJpeg)[1]
-                liveH264Uri = self._remoteGetCameraUri(camLoc, sessionId, None, _kMimeTypeVideoH264)[1]
-                allRules = self._getRuleInfoForLocation(camLoc)
-                cameraRules = []
-                if len(allRules):
-                    for rule in allRules:
-                        cameraRules.append({'name': rule[0], 'schedule': rule[2], 'enabled': rule[3]})
-
-                camerasDict[camLoc] = {
-                    'name': camLoc,
-                    'active': True,
-                    'enabled': statusAndEnabled[1],
-                    'status': statusAndEnabled[0],
-                    'rules': cameraRules,
-                    'liveH264Uri': liveH264Uri,
-                    'liveJpegUri': liveJpegUri
-                }
+    ###########################################################
+    def _remoteGetCameraStateChanges(self, version):
+        """Retrieve what changed about cameras and their rules.
 
-                if self._camMgr.isCameraFrozen(camLoc):
-                    camerasDict[camLoc]['name'] = camLoc + kInactiveSuffix
-                    camerasDict[camLoc]['frozen'] = True
+        Clients start with a version of -1, which gets them all cameras, like
+        remoteGetAllCamerasDetailsAndRules() does.  After that they pass the
+        version they got, to get just the cameras that changed.  Versions are
+        strings which only mean something to the back end that gave them
+        out; after it restarts, clients get all cameras again.
 
-            # Get inactive cameras out, ignoring imported ones...
-            for camName in clipCams:
-                if not camName.endswith(kImportSuffix) and camName not in camerasDict.keys():
-                    allClipCamRules = self._getRuleInfoForLocation(camName)
-                    clipCamRules = []
-                    if len(allClipCamRules):
-                        for clipRule in allClipCamRules:
-                            clipCamRules.append({'name': clipRule[0], 'schedule': clipRule[2], 'enabled': clipRule[3]})
-
-                    camerasDict[camName] = {
-                        'name': camName + kInactiveSuffix,
-                        'active': False,
-                        'rules': clipCamRules
-                    }
-
-            return True, camerasDict.values();
+        @param  version  The version the client has, or -1.
+        @return success  True if the operation was successful.  If not
+                         successful, the only additional return will be a
+                         string explaining the error.
+        @return version  The current version, to pass next time.
+        @return changed  A list of camera dicts, as returned by
+                         remoteGetAllCamerasDetailsAndRules(), which are new
+                         or changed.
+        @return removed  A list of names of cameras which are gone.  A camera
+                         which changes its name is removed under the old one.
+        @return isFull   True if changed has all cameras and the client should
+                         forget what it had, because its version was too old
+                         or from before a restart.
+        """
+        try:
+            self._updateCameraState()
+            return (True,) + self._cameraState.getChanges(version)
         except Exception:
             self._logger.error("Remote exception", exc_info=True)
             return False, _kRemoteExceptionError
 
+
+    ###########################################################
+    def _remoteWaitForCameraStateChanges(self, version, timeout):
+        """Wait for cameras or their rules to change.
+
+        Like remoteGetCameraStateChanges(), but returns only once something
+        changed after the given version, or the timeout passed.  Clients
+        should get a version from remoteGetCameraStateChanges() first.
+
+        NOTE: This function is thread safe. Ensure any changes preserve that.
+
+        @param  version  The version the client has.
+        @param  timeout  Most seconds to wait; capped at 50.
+        @return changes  As for remoteGetCameraStateChanges(); nothing
+                         changed if the version is the same.
+        """
+        return (True,) + self._cameraState.wait(version, timeout)
+
+
+    ###########################################################
+    def _updateCameraState(self):
+        """Make the camera state from scratch, if it's been a while."""
+        if self._cameraStateRules is not None and \
+           0 <= time.time() - self._cameraStateTime < \
+           _kCameraStateReconcileSecs:
+            return
+        self._cameraStateTime = time.time()
+
+        rules = {}
+        for name in self._getRuleNames():
+            location, info = self._loadRuleInfo(name)
+            if info is not None:
+                rules[name] = (location.lower(), self._makeRuleState(info))
+        self._cameraStateRules = rules
+
+        # Imported video has no camera to show.
+        self._cameraStateClipCams = set(camLoc for camLoc in
+                                        self._clipMgr.getCameraLocations()
+                                        if not camLoc.endswith(kImportSuffix))
+
+        camLocs = set(self._camMgr.getCameraLocations()) | \
+                  self._cameraStateClipCams
+        for camLoc in set(self._cameraState.getKeys()) | camLocs:
+            self._refreshCameraState(camLoc)
+
+
+    ###########################################################
+    def _refreshCameraState(self, camLoc):
+        """Update the camera state of a camera after it changed.
+
+        @param  camLoc  The location of the camera.
+        """
+        if self._cameraStateRules is None:
+            # Nobody asked yet.
+            return
+
+        try:
+            self._cameraState.update(camLoc, self._makeCameraState(camLoc))
+        except Exception:
+            self._logger.error("Couldn't update state of camera %s" %
+                               ensureUtf8(camLoc), exc_info=True)
+
+
+    ###########################################################
+    def _ruleStateChanged(self, ruleName):
+        """Update the camera state of a rule's camera after the rule changed.
+
+        @param  ruleName  The name of the rule, which may be gone.
+        """
+        self._events.post(kEventRules, ruleName)
+
+        if self._cameraStateRules is None:
+            return
+
+        locations = set()
+        oldLocation, _ = self._cameraStateRules.pop(ruleName, (None, None))
+        if oldLocation is not None:
+            locations.add(oldLocation)
+
+        if os.path.isfile(os.path.join(self._ruleDir, ruleName+kRuleExt)):
+            location, info = self._loadRuleInfo(ruleName)
+            if info is not None:
+                self._cameraStateRules[ruleName] = \
+                    (location.lower(), self._makeRuleState(info))
+                locations.add(location.lower())
+
+        for camLoc in self._cameraState.getKeys():
+            if camLoc.lower() in locations:
+                self._refreshCameraState(camLoc)
+
+
+    ###########################################################
+    def _makeRuleState(self, info):
+        """Make the dict of a rule for the camera state.
+
+        @param  info   The rule's information, from _loadRuleInfo().
+        @return state  A dict with the rule's name, schedule and whether it's
+                       enabled.
+        """
+        return {'name': info[0], 'schedule': info[2], 'enabled': info[3]}
+
+
+    ###########################################################
+    def _makeCameraState(self, camLoc):
+        """Make the dict of a camera for the camera state.
+
+        @param  camLoc  The location of the camera.
+        @return state   The dict, or None if the camera is neither set up nor
+                        has recorded video.
+        """
+        lowerLoc = camLoc.lower()
+        cameraRules = sorted((ruleState for location, ruleState in
+                              self._cameraStateRules.itervalues()
+                              if location == lowerLoc),
+                             key=operator.itemgetter('name'))
+
+        if camLoc not in self._camMgr.getCameraLocations():
+            if camLoc not in self._cameraStateClipCams:
+                return None
+            return {
+                'name': camLoc + kInactiveSuffix,
+                'active': False,
+                'rules': cameraRules
+            }
+
+        status, enabled = self._getCameraStatusAndEnabled(camLoc)
+        state = {
+            'name': camLoc,
+            'active': True,
+            'enabled': enabled,
+            'status': status,
+            'rules': cameraRules,
+            'liveH264Uri': self._remoteGetCameraUri(camLoc, None, None,
+                                                    _kMimeTypeVideoH264)[1],
+            'liveJpegUri': self._remoteGetCameraUri(camLoc, None, None,
+                                                    _kMimeTypeJpeg)[1]
+        }
+        if self._camMgr.isCameraFrozen(camLoc):
+            state['name'] = camLoc + kInactiveSuffix
+            state['frozen'] = True
+        return state
+
     ###########################################################
     def _remoteGetBuiltInRules(self, version=None):
         """ Get built-in rules for specific version of SV
@@ -2697,7 +3212,7 @@ class NetworkMessageServer(object):
 
             videoDir = os.path.join(self._getVideoLocation(), kVideoFolder)
 
-            fileList = [(os.path.join(videoDir, curFile), 0)]
+            fileList = [(self._clipMgr.getClipPath(videoDir, curFile), 0)]
 
             firstStart, lastStop = self._clipMgr.getFileTimeInformation(curFile)
             curStart = firstStart
@@ -2710,7 +3225,7 @@ class NetworkMessageServer(object):
                     break
 
                 lastStop = curStop
-                fileList.append((os.path.join(videoDir, curFile),
+                fileList.append((self._clipMgr.getClipPath(videoDir, curFile),
                                  curStart-firstStart))
 
             stopTime = min(stopTime, lastStop)
@@ -2725,6 +3240,39 @@ class NetworkMessageServer(object):
             return False, _kRemoteExceptionError
 
 
+    ###########################################################
+    def _remoteGetActivityHeatmap(self, cameraName, startTime, stopTime,
+                                  objTypes=None):
+        """Retrieve a heatmap of where activity happened in a camera.
+
+        @param  cameraName  The name of the camera to retrieve a heatmap for.
+        @param  startTime   A (startSecond, startMs) of the absolute ms the
+                            time window begins at.
+        @param  stopTime    A (stopSecond, stopMs) of the absolute ms the
+                            time window ends at.
+        @param  objTypes    A list of object types to count, like "person";
+                            None for all of them.
+        @return success     True if the operation was successful.  If not
+                            successful, the only additional return will be a
+                            string explaining the error.
+        @return heatmap     A dictionary, see HeatmapManager.getHeatmap().  The
+                            'startMs' and 'stopMs' are returned as (sec, ms).
+        """
+        try:
+            startTime = startTime[0]*1000+startTime[1]
+            stopTime = stopTime[0]*1000+stopTime[1]
+
+            heatmap = self._heatmapMgr.getHeatmap(cameraName, startTime,
+                                                  stopTime, objTypes)
+            heatmap['startMs'] = divmod(heatmap['startMs'], 1000)
+            heatmap['stopMs'] = divmod(heatmap['stopMs'], 1000)
+
+            return True, heatmap #PYCHECKER OK: Function return types are inconsistent
+        except Exception:
+            self._logger.error("Remote exception", exc_info=True)
+            return False, _kRemoteExceptionError
+
+
     ###########################################################
     def _remoteGetLiveCameras(self):
         """Retrieve currently configured cameras.
@@ -2964,16 +3512,37 @@ class NetworkMessageServer(object):
                 extras["enableTimestamps"] = enableTimestamps
 
 
-            ext = "m3u8" if useHls else "mp4"
-            filename = str(sessionId) + "." + ext
-            savePath = os.path.join(saveDir, filename)
-            success = self._dataMgr.saveCurrentClip(savePath, realStart,
-                    realStop, self._localDataDir, extras)
-            if not success:
-                raise Exception("Clip could not be created.")
+            if useHls and self._hlsPort is not None:
+                # Segments get made as the player asks for them, so we can
+                # answer right away no matter how long the clip is.
+                clipUri = self._addHlsClipSession(cameraName, realStart,
+                        realStop, extras)
+            elif not useHls:
+                # The same clip may well be asked for again, e.g. from
+                # several phones getting the same notification.
+                sourceFiles = self._clipMgr.getFilesBetween(cameraName,
+                                                            realStart, realStop)
+                key = makeClipKey(cameraName, realStart, realStop, extras,
+                                  sourceFiles)
+                def makeClip(path):
+                    return self._dataMgr.saveCurrentClip(path, realStart,
+                            realStop, self._localDataDir, extras)
+                filename = self._derivedClipCache.get(key, "mp4", makeClip)
+                if filename is None:
+                    raise Exception("Clip could not be created.")
+                clipUri = "/%s/%s/%s" % (kRemoteFolder, kRemoteClipCacheFolder,
+                                         filename)
+            else:
+                ext = "m3u8" if useHls else "mp4"
+                filename = str(sessionId) + "." + ext
+                savePath = os.path.join(saveDir, filename)
+                success = self._dataMgr.saveCurrentClip(savePath, realStart,
+                        realStop, self._localDataDir, extras)
+                if not success:
+                    raise Exception("Clip could not be created.")
 
-            # Construct a URI for the clip.
-            clipUri = "/%s/%s" % (kRemoteFolder, filename)
+                # Construct a URI for the clip.
+                clipUri = "/%s/%s" % (kRemoteFolder, filename)
 
         except Exception, e:
             self._logger.error("Remote exception", exc_info=True)
@@ -3276,6 +3845,36 @@ class NetworkMessageServer(object):
         return result
 
 
+    ###########################################################
+    def _remoteWaitForNotifications(self, lastUID, limit, timeout):
+        """To wait for push notifications, instead of polling for them.
+
+        Returns as soon as there are notifications newer than lastUID, or
+        once the timeout passes.  Unlike remoteGetNotifications(), lastUID is
+        the last notification the client has, which is not returned again.
+
+        NOTE: This function is thread safe. Ensure any changes preserve that.
+
+        @param  lastUID  The identifier of the last push notification seen by
+                         the client, or -1 if it hasn't seen any.
+        @param  limit    Maximum number of items to return, lowest UID first.
+        @param  timeout  Most seconds to wait; capped at 50.
+        @return          List of notifications (uid,content,data), as for
+                         remoteGetNotifications(); empty if none came.
+        """
+        return self._notificationWatermark.wait(lastUID, limit, timeout)
+
+    ###########################################################
+    def _notePushNotification(self, uid):
+        """Tell waiting clients that a push notification was stored.
+
+        NOTE: This function is thread safe. Ensure any changes preserve that.
+
+        @param  uid  The identifier of the new notification.
+        """
+        self._notificationWatermark.announce(uid)
+
+
     ###########################################################
     def _sendCorruptDbMessage(self):
         """Notify the back end of a corrupt database.
@@ -3296,6 +3895,21 @@ class NetworkMessageServer(object):
         self._queue.put([MessageIds.msgIdWebServerSetPort, newPort])
 
 
+    ###########################################################
+    def _getAdmissionStats(self):
+        """Get what happened to expensive remote calls, like clips and
+        searches, which may have had to wait or were turned away.
+
+        NOTE: This function is thread safe. Ensure any changes preserve that.
+
+        @return stats  A dict of class ('clip', 'thumbnail' or 'search') to a
+                       dict with counts of 'admitted', 'queued', 'rejected'
+                       and 'cancelled' calls, and how many are 'running' and
+                       'waiting' now.
+        """
+        return self._xmlrpcServer.getAdmissionStats()
+
+
     ###########################################################
     def _getWebPort(self):
         """Gets the currently configured port number for the web server.
@@ -3648,6 +4262,18 @@ class NetworkMessageServer(object):
         return self._foundServiceMarkerArg
 
 
+    ###########################################################
+    def _getObjectCensus(self, sampleStride):
+        """ Tells what this process holds on to, to find leaks.  Camera
+        processes answer the same at "/<camera>.census" on their web server;
+        others log it with the "objectCensusSecs" debug pref.
+
+        @param  sampleStride  Count every this many objects; 1 counts all.
+        @return report        See ObjectCensus.reportCensus().
+        """
+        return reportCensus(sampleStride)
+
+
 ###############################################################################
 class FrontEndMessageQueue:
     """ Threadsafe queue for our messages, with the possibility to have certain
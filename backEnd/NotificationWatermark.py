@@ -0,0 +1,313 @@
+#!/usr/bin/env python
+
+#*****************************************************************************
+#
+# NotificationWatermark.py
+#     Lets remote clients wait for push notifications without polling.
+#
+#
+#*****************************************************************************
+#
+#
+# Copyright 2013-2022 Sighthound, Inc.
+#
+# Licensed under the GNU GPLv3 license found at
+# https://www.gnu.org/licenses/gpl-3.0.txt
+#
+# Alternative licensing available from Sighthound, Inc.
+# by emailing opensource@sighthound.com
+#
+# This file is part of the Sighthound Video project which can be found at
+# https://github.com/sighthoundinc/SighthoundVideo
+#
+# This program is free software; you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation; using version 3 of the License.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program; if not, write to the Free Software
+# Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02111, USA.
+#
+#
+#*****************************************************************************
+
+"""
+## @file
+Contains the NotificationWatermark class.
+"""
+
+# Python imports...
+import collections
+import threading
+import time
+
+# Common 3rd-party imports...
+
+# Toolbox imports...
+
+# Local imports...
+
+# Notifications announced within this many seconds of the first are loaded
+# and handed to waiters together.
+_kBatchSecs = .2
+
+# How many of the latest notifications to keep in memory.
+_kKeepRecent = 256
+
+
+###############################################################
+class NotificationWatermark(object):
+    """Keeps the latest push notifications in memory, so clients can wait
+    for new ones without each of them querying the database.
+
+    Whoever stores a notification calls announce() with its UID.  A thread
+    of ours then loads everything new with one query and wakes all waiters
+    together.
+    """
+    ###########################################################
+    def __init__(self, fetch, lastUID, logger, longPoll,
+                 batchSecs=_kBatchSecs, keep=_kKeepRecent):
+        """Initializer for NotificationWatermark
+
+        @param  fetch       Function taking (lowestUID, limit) and returning a
+                            list of (uid, content, data) with uid >= lowestUID
+                            in ascending order, like getPushNotifications().
+                            Only ever called by one thread at a time.
+        @param  lastUID     The UID of the latest stored notification, or -1.
+        @param  logger      The logger to use.
+        @param  longPoll    The LongPoll limiting how many clients wait, and
+                            for how long.
+        @param  batchSecs   How long to gather announcements before loading.
+        @param  keep        How many notifications to keep in memory.
+        """
+        self._fetch = fetch
+        self._logger = logger
+        self._longPoll = longPoll
+        self._batchSecs = batchSecs
+        self._keep = keep
+
+        # Guards everything below; waiters wait on it.
+        self._cond = threading.Condition()
+
+        # The UID of the latest notification we loaded.
+        self._lastUID = lastUID
+
+        # The UID of the latest notification somebody told us about.
+        self._announcedUID = lastUID
+
+        # The latest notifications, oldest first, as (uid, content, data).  We
+        # have everything with a UID above _floorUID.
+        self._recent = collections.deque()
+        self._floorUID = lastUID
+
+        self._running = True
+
+        self._loadLock = threading.Lock()
+        self._announceEvent = threading.Event()
+        self._thread = threading.Thread(target=self._run,
+                                        name="notificationWatermark")
+        self._thread.setDaemon(True)
+        self._thread.start()
+
+
+    ###########################################################
+    def shutdown(self):
+        """Stop loading notifications, and release all waiters."""
+        self._cond.acquire()
+        try:
+            self._running = False
+            self._cond.notifyAll()
+        finally:
+            self._cond.release()
+        self._announceEvent.set()
+
+
+    ###########################################################
+    def announce(self, uid):
+        """Note that a notification was stored; may be called from any thread.
+
+        @param  uid  The UID of the notification.
+        """
+        self._cond.acquire()
+        try:
+            if uid <= self._announcedUID:
+                return
+            self._announcedUID = uid
+        finally:
+            self._cond.release()
+        self._announceEvent.set()
+
+
+    ###########################################################
+    def getLastUID(self):
+        """Return the UID of the latest notification, without a query.
+
+        @return lastUID  The UID, or -1 if there have never been any.
+        """
+        self._cond.acquire()
+        try:
+            return self._lastUID
+        finally:
+            self._cond.release()
+
+
+    ###########################################################
+    def wait(self, lastUID, limit, timeout):
+        """Wait for notifications newer than the given one.
+
+        @param  lastUID        The UID of the latest notification the client
+                               has; only ones above it are returned.
+        @param  limit          Most notifications to return.
+        @param  timeout        Most seconds to wait; capped by the LongPoll.
+        @return notifications  A list of (uid, content, data) in ascending
+                               order; empty if nothing came in time.
+        """
+        self._cond.acquire()
+        try:
+            self._longPoll.wait(self._cond, lambda: not self._running or
+                                self._lastUID > lastUID, timeout)
+
+            if self._lastUID <= lastUID:
+                return []
+            if lastUID >= self._floorUID:
+                return [item for item in self._recent
+                        if item[0] > lastUID][:limit]
+        finally:
+            self._cond.release()
+
+        # Further behind than what we keep; rare, so just query.
+        self._loadLock.acquire()
+        try:
+            return self._fetch(lastUID+1, limit)
+        finally:
+            self._loadLock.release()
+
+
+    ###########################################################
+    def _run(self):
+        """Load announced notifications, until shut down."""
+        while True:
+            self._announceEvent.wait()
+            if not self._running:
+                return
+
+            # Let a burst of notifications gather, so waiters wake just once.
+            time.sleep(self._batchSecs)
+            self._announceEvent.clear()
+
+            try:
+                self._load()
+            except Exception:
+                self._logger.error("couldn't load notifications",
+                                   exc_info=True)
+
+
+    ###########################################################
+    def _load(self):
+        """Load notifications we haven't seen yet and wake waiters."""
+        self._cond.acquire()
+        try:
+            lastUID = self._lastUID
+            announcedUID = self._announcedUID
+        finally:
+            self._cond.release()
+        if announcedUID <= lastUID:
+            return
+
+        self._loadLock.acquire()
+        try:
+            items = self._fetch(lastUID+1, self._keep)
+        finally:
+            self._loadLock.release()
+
+        self._cond.acquire()
+        try:
+            for item in items:
+                if item[0] > self._lastUID:
+                    self._recent.append(item)
+                    self._lastUID = item[0]
+            # Anything announced but not found was purged already.
+            if len(items) < self._keep:
+                self._lastUID = max(self._lastUID, announcedUID)
+            else:
+                # More came in than we keep; go around again for the rest.
+                self._announceEvent.set()
+            while len(self._recent) > self._keep:
+                self._floorUID = self._recent.popleft()[0]
+            self._cond.notifyAll()
+        finally:
+            self._cond.release()
+
+
+
+##############################################################################
+def _testNotificationWatermark():
+    """Test waiting for notifications.
+
+    >>> from vitaToolbox.threading.LongPoll import LongPoll
+    >>> from vitaToolbox.loggingUtils.LoggingUtils import EmptyLogger
+    >>> stored = [(1, 'a', '{}'), (2, 'b', '{}')]
+    >>> queries = []
+    >>> def fetch(lowestUID, limit):
+    ...     queries.append(lowestUID)
+    ...     return [item for item in stored if item[0] >= lowestUID][:limit]
+    >>> watermark = NotificationWatermark(fetch, 2, EmptyLogger(),
+    ...                                   LongPoll(4, 50), .05, keep=2)
+
+    Nothing new means waiting out the timeout, without any queries:
+
+    >>> start = time.time()
+    >>> watermark.wait(2, 10, .2), time.time() - start >= .15, queries
+    ([], True, [])
+
+    Several waiters all get what comes in, with one query:
+
+    >>> results = []
+    >>> def waitThread():
+    ...     results.append(watermark.wait(2, 10, 5))
+    >>> threads = [threading.Thread(target=waitThread) for _ in xrange(3)]
+    >>> for thread in threads: thread.start()
+    >>> time.sleep(.1)
+    >>> stored += [(3, 'c', '{}'), (4, 'd', '{}')]
+    >>> watermark.announce(3); watermark.announce(4)
+    >>> for thread in threads: thread.join()
+    >>> results, queries, watermark.getLastUID()
+    ([[(3, 'c', '{}'), (4, 'd', '{}')], [(3, 'c', '{}'), (4, 'd', '{}')], \
+[(3, 'c', '{}'), (4, 'd', '{}')]], [3], 4)
+
+    Clients that are behind get answers right away; ones behind what we keep
+    make a query:
+
+    >>> watermark.wait(3, 10, 5), queries
+    ([(4, 'd', '{}')], [3])
+    >>> watermark.wait(1, 2, 5), queries
+    ([(2, 'b', '{}'), (3, 'c', '{}')], [3, 2])
+
+    Too many waiters, and the rest return right away:
+
+    >>> watermark = NotificationWatermark(fetch, 4, EmptyLogger(),
+    ...                                   LongPoll(0, 50))
+    >>> start = time.time()
+    >>> watermark.wait(4, 10, 5), time.time() - start < 1
+    ([], True)
+    >>> watermark.shutdown()
+    """
+
+
+##############################################################################
+def test_main():
+    """OB_REDACT
+    Our main function, which runs test code
+    """
+    import doctest
+    doctest.testmod(verbose=True)
+
+
+##############################################################################
+if __name__ == '__main__':
+    test_main()
@@ -0,0 +1,291 @@
+#!/usr/bin/env python
+
+#*****************************************************************************
+#
+# OverloadGovernor.py
+#     Sheds optional work while the back end can't keep up.
+#
+#
+#*****************************************************************************
+#
+#
+# Copyright 2013-2022 Sighthound, Inc.
+#
+# Licensed under the GNU GPLv3 license found at
+# https://www.gnu.org/licenses/gpl-3.0.txt
+#
+# Alternative licensing available from Sighthound, Inc.
+# by emailing opensource@sighthound.com
+#
+# This file is part of the Sighthound Video project which can be found at
+# https://github.com/sighthoundinc/SighthoundVideo
+#
+# This program is free software; you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation; using version 3 of the License.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program; if not, write to the Free Software
+# Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02111, USA.
+#
+#
+#*****************************************************************************
+
+"""
+## @file
+Contains the OverloadGovernor class.
+"""
+
+# Python imports...
+import os
+
+# Common 3rd-party imports...
+
+# Toolbox imports...
+
+# Local imports...
+
+# What can be shed, in the order it is; it's restored the other way around.
+#   kShedSearchInterval:  search less often for rules that only record.
+#   kShedSampling:        give cameras' analytics fewer frames.
+#   kShedBackground:      pause thumbnails, clip exports and heatmap backfill.
+#   kShedCleanerScans:    put off the disk cleaner's orphan file scans.
+kShedSearchInterval = "searchInterval"
+kShedSampling = "sampling"
+kShedBackground = "background"
+kShedCleanerScans = "cleanerScans"
+kShedActions = [kShedSearchInterval, kShedSampling, kShedBackground,
+                kShedCleanerScans]
+
+# What we watch, and the limits of each as (overloaded above, recovered
+# below); in between, nothing changes.
+#   queue:       messages from child processes waiting to be processed.
+#   addFrames:   frames waiting to be added to the database.
+#   messageAge:  longest a message waited, in seconds.
+#   searchLag:   most video not searched yet for any camera, in seconds.
+#   cpu:         how much of one CPU the back end used.
+_kLimits = {
+    'queue': (500, 100),
+    'addFrames': (2000, 500),
+    'messageAge': (5, 1),
+    'searchLag': (30, 15),
+    'cpu': (.9, .6),
+}
+
+# How long we must be overloaded before shedding one more thing, and
+# recovered before restoring one, in seconds.
+_kShedSecs = 10
+_kRestoreSecs = 60
+
+
+###############################################################
+class OverloadGovernor(object):
+    """Decides what optional work to shed, from samples of how loaded we are.
+
+    Whenever any sample stays above its limit for a while, the next action
+    in kShedActions is taken; whenever all samples stay below their lower
+    limit for longer, the last action taken is undone.  The gap between the
+    limits, and the longer wait for restoring, keep us from going back and
+    forth.  Whoever feeds us samples carries out the actions.
+    """
+    ###########################################################
+    def __init__(self, logger, limits=_kLimits, shedSecs=_kShedSecs,
+                 restoreSecs=_kRestoreSecs):
+        """Initializer for OverloadGovernor
+
+        @param  logger       The logger to use.
+        @param  limits       A dict of sample name to (overloaded above,
+                             recovered below).
+        @param  shedSecs     Seconds overloaded before shedding.
+        @param  restoreSecs  Seconds recovered before restoring.
+        """
+        self._logger = logger
+        self._limits = limits
+        self._shedSecs = shedSecs
+        self._restoreSecs = restoreSecs
+
+        # How many of kShedActions are taken.
+        self._level = 0
+
+        # Since when we're overloaded or recovered, or None.
+        self._overloadedSince = None
+        self._recoveredSince = None
+
+        # Action to the number of times it was taken and undone.
+        self._shedCounts = dict((action, 0) for action in kShedActions)
+        self._restoreCounts = dict((action, 0) for action in kShedActions)
+
+
+    ###########################################################
+    def update(self, now, samples):
+        """Take new samples, and shed or restore if it's time.
+
+        @param  now      The current time, in seconds.
+        @param  samples  A dict of sample name to value; names without
+                         limits are ignored.
+        @return changed  True if the actions to take changed.
+        """
+        overloaded = sorted(name for name, value in samples.iteritems()
+                            if name in self._limits and
+                            value > self._limits[name][0])
+        recovered = all(value < self._limits[name][1]
+                        for name, value in samples.iteritems()
+                        if name in self._limits)
+
+        if overloaded:
+            self._recoveredSince = None
+            if self._overloadedSince is None:
+                self._overloadedSince = now
+            elif now - self._overloadedSince >= self._shedSecs and \
+                 self._level < len(kShedActions):
+                self._overloadedSince = now
+                action = kShedActions[self._level]
+                self._level += 1
+                self._shedCounts[action] += 1
+                self._logger.warn("Overloaded (%s), shedding %s" %
+                                  (self._formatSamples(samples, overloaded),
+                                   action))
+                return True
+        elif recovered:
+            self._overloadedSince = None
+            if self._recoveredSince is None:
+                self._recoveredSince = now
+            elif now - self._recoveredSince >= self._restoreSecs and \
+                 self._level > 0:
+                self._recoveredSince = now
+                self._level -= 1
+                action = kShedActions[self._level]
+                self._restoreCounts[action] += 1
+                self._logger.info("Recovered (%s), restoring %s" %
+                                  (self._formatSamples(samples, samples),
+                                   action))
+                return True
+        else:
+            self._overloadedSince = None
+            self._recoveredSince = None
+
+        return False
+
+
+    ###########################################################
+    def getActions(self):
+        """Return what's shed right now.
+
+        @return actions  A list of actions from kShedActions.
+        """
+        return kShedActions[:self._level]
+
+
+    ###########################################################
+    def getStats(self):
+        """Return how often each action was taken and undone.
+
+        @return stats  A dict of action to (times shed, times restored).
+        """
+        return dict((action, (self._shedCounts[action],
+                              self._restoreCounts[action]))
+                    for action in kShedActions)
+
+
+    ###########################################################
+    def _formatSamples(self, samples, names):
+        """Make samples readable for the log.
+
+        @param  samples  A dict of sample name to value.
+        @param  names    The names of the samples to show.
+        @return text     Something like "cpu=0.95, queue=600".
+        """
+        return ", ".join("%s=%.3g" % (name, samples[name])
+                         for name in sorted(names))
+
+
+
+###############################################################
+class CpuMeter(object):
+    """Tells how much CPU this process used between calls."""
+    ###########################################################
+    def __init__(self):
+        """Initializer for CpuMeter"""
+        self._lastTime = None
+        self._lastCpu = None
+
+
+    ###########################################################
+    def sample(self, now):
+        """Return how much of one CPU we used since the last call.
+
+        @param  now    The current time, in seconds.
+        @return usage  The share of one CPU, like .5; 0 on the first call.
+        """
+        times = os.times()
+        cpu = times[0] + times[1]
+        usage = 0
+        if self._lastTime is not None and now > self._lastTime:
+            usage = (cpu - self._lastCpu) / (now - self._lastTime)
+        self._lastTime = now
+        self._lastCpu = cpu
+        return usage
+
+
+
+##############################################################################
+def _testOverloadGovernor():
+    """Test shedding and restoring.
+
+    >>> from vitaToolbox.loggingUtils.LoggingUtils import EmptyLogger
+    >>> governor = OverloadGovernor(EmptyLogger(), {'queue': (100, 10)},
+    ...                             shedSecs=10, restoreSecs=60)
+    >>> calm, busy, middling = {'queue': 0}, {'queue': 500}, {'queue': 50}
+
+    Nothing is shed until we're overloaded for a while, then one thing at a
+    time:
+
+    >>> governor.update(0, busy), governor.update(5, busy)
+    (False, False)
+    >>> governor.update(10, busy), governor.getActions()
+    (True, ['searchInterval'])
+    >>> governor.update(15, busy), governor.update(20, busy)
+    (False, True)
+    >>> governor.getActions()
+    ['searchInterval', 'sampling']
+
+    Between the limits nothing changes, and the waits start over:
+
+    >>> governor.update(25, middling), governor.update(100, middling)
+    (False, False)
+    >>> governor.update(105, busy), governor.update(110, busy)
+    (False, False)
+
+    Things are restored the other way around, only after a longer while:
+
+    >>> governor.update(120, calm), governor.update(170, calm)
+    (False, False)
+    >>> governor.update(180, calm), governor.getActions()
+    (True, ['searchInterval'])
+    >>> governor.update(240, calm), governor.getActions()
+    (True, [])
+    >>> governor.update(300, calm)
+    False
+    >>> sorted(governor.getStats().items())
+    [('background', (0, 0)), ('cleanerScans', (0, 0)), \
+('sampling', (1, 1)), ('searchInterval', (1, 1))]
+    """
+
+
+##############################################################################
+def test_main():
+    """OB_REDACT
+    Our main function, which runs test code
+    """
+    import doctest
+    doctest.testmod(verbose=True)
+
+
+##############################################################################
+if __name__ == '__main__':
+    test_main()
@@ -42,25 +42,22 @@
 # Python imports...
 import sys
 import time
-import os
 import traceback
-from PIL import Image
 from collections import deque, defaultdict
 
 from ObjectDetectorClient import ObjectDetectorClientLocal, ObjectDetectorClientInProcess
+from ThumbnailArchive import ThumbnailWriter
 
 # Common 3rd-party imports...
 
 # Local imports...
 import MessageIds
-from appCommon.CommonStrings import kThumbsSubfolder
 
 from svsentry.Sentry import ObjectCollector, loadSentry
 
 # Globals...
-from vitaToolbox.image.ImageConversion import convertProcFrameToPIL
 from vitaToolbox.ctypesUtils.LoadLibrary import LoadLibrary
-from vitaToolbox.strUtils.EnsureUnicode import ensureUtf8
+from vitaToolbox.profiling.ObjectCensus import registerCache
 
 loadSentry(LoadLibrary, None)
 
@@ -163,6 +160,8 @@ class QueuedDataManagerCloud(ObjectCollector):
         self._lastFrameSavedTime = 0
         self._archiveDir = archiveDir
         self._thumbRes = thumbRes
+        self._thumbsPaused = False
+        self._thumbWriter = ThumbnailWriter(archiveDir, logger)
         self._lastAnalyzedFrameMs = None
         # Last frame to flush out of here and into the backEnd
         self._lastFrameCompletedMs = 0
@@ -172,6 +171,17 @@ class QueuedDataManagerCloud(ObjectCollector):
         # Number of objects processed in the last frame
         self._objectsInLastFrame = 0
 
+        # Objects by the id we gave Sentry for them, and the last id given.
+        # They're ours alone: a camera worker runs several managers in one
+        # process, on threads of their own.
+        self._idToQueuedObj = {}
+        self._lastIdNum = -1
+        self._lastIdPurgeTime = 0
+
+        registerCache("cloud.frames", self, "_frames")
+        registerCache("cloud.trackedObjects", self, "_trackedObjects")
+        registerCache("cloud.queuedObjIds", self, "_idToQueuedObj")
+
         self._outstandingDetectionRequests = 0
         self._lastDetectionRequestTimestamp = None
         self._lastDetectionResponseTimestamp = None
@@ -220,6 +230,10 @@ class QueuedDataManagerCloud(ObjectCollector):
                 self._logger.debug("Destroying HTTP client - done")
             self._httpClient = None
 
+        if self._thumbWriter is not None:
+            self._thumbWriter.shutdown()
+            self._thumbWriter = None
+
     ###########################################################
     def setDebugFolder(self, folder):
         self._httpClient.setDebugFolder(folder)
@@ -251,6 +265,15 @@ class QueuedDataManagerCloud(ObjectCollector):
     def setThumbnailResolution(self, res):
         self._thumbRes = res
 
+    ###########################################################
+    def setThumbnailsPaused(self, paused):
+        """Stop or resume making thumbnails, like while the back end is
+        overloaded.  Search results get their thumbnails from the video then.
+
+        @param  paused  True to stop making thumbnails.
+        """
+        self._thumbsPaused = paused
+
     ###########################################################
     def reset(self):
         """ Reset our state entirely, before new video stream starts fresh
@@ -272,7 +295,16 @@ class QueuedDataManagerCloud(ObjectCollector):
         # all the objects had been labeled.
         # This may change in the future: when/if it will, most of the code here
         # and interpolation in particular will have to change
-        assert time >= self._currentFrameTime
+        if time < self._currentFrameTime:
+            # Frames are stamped by a TimeBase, so this shouldn't happen;
+            # don't interpolate across it if it does.
+            self._logger.error("Frame time went back from %d to %d" %
+                               (self._currentFrameTime, time))
+            self._flushSavedObjects()
+            self._initInterpolationState()
+            self._currentFrameTime = time
+            self._currentFrameId = frameId
+            return
 
         if self._currentFrameTime == time:
             # Time hasn't changed yet
@@ -324,7 +356,10 @@ class QueuedDataManagerCloud(ObjectCollector):
         self._objectsAdded += 1
         self._logger.debug( "addObject: " + str(timeStart) + " type=" + objType + " id=" + str(camObjId))
 
-        queuedObjId = _QueuedObjId(self._id, camObjId, timeStart, objType)
+        self._lastIdNum += 1
+        queuedObjId = _QueuedObjId(self._lastIdNum, self._id, camObjId,
+                                   timeStart, objType)
+        self._idToQueuedObj[queuedObjId.sentryId] = queuedObjId
         self._temporaryIdList.append(queuedObjId)
 
         # Always save a thumbnail of the first frame of each object
@@ -378,11 +413,13 @@ class QueuedDataManagerCloud(ObjectCollector):
             # rely on locally defined interval to determine when to run detections
             kMinAnalyticsInterval = 500
             if self._lastAnalyzedFrameMs is not None and \
-                frame.ms - self._lastAnalyzedFrameMs < kMinAnalyticsInterval:
+                timestamp - self._lastAnalyzedFrameMs < kMinAnalyticsInterval:
                 return
             frameForAnalyzing = frame
 
-        self._lastAnalyzedFrameMs = frameForAnalyzing.ms
+        # Frames are keyed by the time they were stamped with, which may not
+        # be the one they came with.
+        self._lastAnalyzedFrameMs = timestamp
 
 
         sizeRatio = frame.width / float(frameForAnalyzing.width)
@@ -507,7 +544,33 @@ class QueuedDataManagerCloud(ObjectCollector):
                 del self._frames[timestamp]
 
         # Purge old objects
-        _QueuedObjId.purgeOldIds(self._lastSentryFrameTimeMs)
+        self._purgeOldIds(self._lastSentryFrameTimeMs)
+
+    ###########################################################
+    def _purgeOldIds(self, ms):
+        """ Remove objects not tracked any longer
+        @param  ms      ms of the current frame being processed
+        """
+        if self._lastIdPurgeTime + _QueuedObjId.idPurgeInterval > ms:
+            return
+        # delete info about objects we haven't seen in awhile
+        for idNum in self._idToQueuedObj.keys():
+            if self._idToQueuedObj[idNum].lastSeenBySentry + \
+               _QueuedObjId.idPurgeTimeout < ms:
+                del self._idToQueuedObj[idNum]
+        self._lastIdPurgeTime = ms
+
+    ###########################################################
+    def _getQueuedObjId(self, theId):
+        """ Return one of our objects by the id Sentry knows it by
+
+        @param  theId       The id we gave Sentry for the object.
+        @return queuedObjId The object's _QueuedObjId.
+        """
+        qObjId = self._idToQueuedObj.get(theId, None)
+        if qObjId is not None:
+            return qObjId
+        raise RuntimeError("Id '%s' does not exist." % theId)
 
     ###########################################################
     def flush(self, timeout):
@@ -548,33 +611,15 @@ class QueuedDataManagerCloud(ObjectCollector):
 
     ###########################################################
     def _saveFrameThumbnail(self, ms):
-        if self._thumbRes == 0:
+        if self._thumbRes == 0 or self._thumbsPaused:
             return
         frame = self._frames.get(ms, None)
         if frame is None:
             self._logger.error("Requested timestamp " + str(ms) + " is not available for thumb")
             return
-        pilFrame = convertProcFrameToPIL(frame)
-        filename = os.path.basename(frame.filename)
-        dirname = os.path.join(self._archiveDir, self.cameraLocation.lower(), filename[:5], kThumbsSubfolder)
-
-        saveTo = os.path.join(dirname, str(ms)+".jpg")
-        self._logger.debug("Saving jpg to " + saveTo)
-        # Resize the frame, if requested thumb size is less than what we have
-        if self._thumbRes < pilFrame.width:
-            # This ensures the image gets scaled down to the requested size on smaller dimension
-            kVeryLargeFactor = 20
-            if pilFrame.width > pilFrame.height:
-                size = (self._thumbRes*kVeryLargeFactor, self._thumbRes)
-            else:
-                size = (self._thumbRes, self._thumbRes*kVeryLargeFactor)
-            pilFrame.thumbnail(size, Image.ANTIALIAS)
-        try:
-            if not os.path.isdir(dirname):
-                os.makedirs(dirname)
-            pilFrame.save(saveTo, "JPEG")
-        except:
-            self._logger.warning("Failed to save thumbnail to " + ensureUtf8(saveTo))
+        # Resizing, encoding and writing happen on the writer's thread; it
+        # holds on to the frame until then.
+        self._thumbWriter.put(self.cameraLocation, ms, frame, self._thumbRes)
 
         # Even if we've failed to create a thumb, there's no reason to retry immediately
         self._lastFrameSavedTime = ms
@@ -646,7 +691,7 @@ class QueuedDataManagerCloud(ObjectCollector):
         #       `addFrame()` used to have `action` as a parameter before we
         #       started using Sentry. So we just mention this here as a note
         #       for documentation pursposes.
-        idObj = _QueuedObjId.getQueuedObjId(objId)
+        idObj = self._getQueuedObjId(objId)
         idObj.reportSeen(time, self._logger)
         # save the object for this ms
         self._trackedObjects.setdefault(time,[]).append((idObj, frameId, bbox))
@@ -773,56 +818,28 @@ class _QueuedObjId(object):
     ...once we get a real ID, it will just be the dbId returned by the data mgr.
     """
 
-    _idToQueuedObj = {}
-    _idNum = -1
-    _idLastPurgeTime = time.time()
-    _idPurgeInterval = 30       # purge old IDs every 30s
-    _idPurgeTimeout = 5*60      # ID is old after it hasn't been seen for 5 minutes
+    idPurgeInterval = 30*1000       # purge old IDs every 30s
+    idPurgeTimeout = 5*60*1000      # ID is old after it hasn't been seen for 5 minutes
     _minDetectionEvents = 3
     _maxDetectionEvents = 8
 
     ###########################################################
     def __str__(self):
-        return str(self._idNum) if self._idNum >= 0 else str(self._idToQueuedObj)
+        return str(self.sentryId)
     __repr__ = __str__
 
     ###########################################################
-    @classmethod
-    def purgeOldIds(cls, ms):
-        """ Remove objects not tracked any longer
-        @param  ms      ms of the current frame being processed
-        """
-        if cls._idLastPurgeTime + cls._idPurgeInterval > ms:
-            return
-        # delete info about objects we haven't seen in awhile
-        for idNum in cls._idToQueuedObj.keys():
-            if cls._idToQueuedObj[idNum].lastSeenBySentry + cls._idPurgeTimeout < ms:
-                del cls._idToQueuedObj[idNum]
-        cls._idLastPurgeTime = ms
-
-
-    ###########################################################
-    @classmethod
-    def getQueuedObjId(cls, theId):
-        qObjId = cls._idToQueuedObj.get(theId, None)
-        if qObjId is not None:
-            return qObjId
-        raise RuntimeError("Id '%s' does not exist." % theId)
-
-
-    ###########################################################
-    def __init__(self, camId, camObjId, ms, objType):
+    def __init__(self, idNum, camId, camObjId, ms, objType):
         """_QueuedObjId constructor.
 
+        @param  idNum     The id given to Sentry for the object; unique
+                          within its QueuedDataManagerCloud.
         @param  camId     The ID number of the queue.
         @param  camObjId  The number of objects that have been created
                           by the queue so far.
         """
         super(_QueuedObjId, self).__init__()
 
-        _QueuedObjId._idNum += 1
-        idNum = _QueuedObjId._idNum
-
         self.dbId = (camId, camObjId)
         self.sentryId = idNum
         self.firstSeenBySentry = ms   # first time this object had been seen by Sentry
@@ -838,8 +855,6 @@ class _QueuedObjId(object):
         self.reported = False          # whether the object was reported
         self.sentryFramesSeen = 0     # number of times this object was seen by sentry
 
-        _QueuedObjId._idToQueuedObj[idNum] = self
-
     ###########################################################
     def needsDetection(self):
         return not self.reported and \
@@ -1029,3 +1044,68 @@ class _QueuedObjId(object):
                             (str(trackLost), self.detectionEventsCount, str(self.externalDetections), traceback.format_exc()))
 
         return self.detectorDecision is not None
+
+
+
+##############################################################################
+def _testQueuedObjIds():
+    """Test that managers running on threads of one process keep their own
+    object ids.
+
+    >>> import Queue, tempfile, threading
+    >>> from vitaToolbox.loggingUtils.LoggingUtils import EmptyLogger
+    >>> managers = [QueuedDataManagerCloud(Queue.Queue(), None, camId,
+    ...                                    u'cam%d' % camId,
+    ...                                    tempfile.mkdtemp(), 0,
+    ...                                    EmptyLogger())
+    ...             for camId in (1, 2)]
+
+    The first camera sees objects long ago; the second sees some now and
+    purges what's old while the first is still adding:
+
+    >>> ids = {}
+    >>> def run(mgr, ms):
+    ...     ids[mgr] = [mgr.addObject(ms + i, 'person') for i in xrange(500)]
+    ...     mgr._purgeOldIds(ms + 500)
+    >>> threads = [threading.Thread(target=run, args=(managers[0], 1000)),
+    ...            threading.Thread(target=run, args=(managers[1], 10**9))]
+    >>> for thread in threads: thread.start()
+    >>> for thread in threads: thread.join()
+
+    Each has ids of its own, and none of the other's objects:
+
+    >>> [ids[mgr] == range(500) for mgr in managers]
+    [True, True]
+    >>> [len(mgr._idToQueuedObj) for mgr in managers]
+    [500, 500]
+    >>> sorted(set(managers[0]._getQueuedObjId(i).dbId[0] for i in xrange(500)))
+    [1]
+    >>> managers[1]._getQueuedObjId(499).dbId
+    (2, 499)
+
+    Purging only drops the manager's own old objects:
+
+    >>> managers[0]._purgeOldIds(10**9); len(managers[0]._idToQueuedObj)
+    0
+    >>> len(managers[1]._idToQueuedObj)
+    500
+    >>> managers[0]._getQueuedObjId(0)
+    Traceback (most recent call last):
+    ...
+    RuntimeError: Id '0' does not exist.
+    >>> for mgr in managers: mgr.terminate()
+    """
+
+
+##############################################################################
+def test_main():
+    """OB_REDACT
+    Our main function, which runs test code
+    """
+    import doctest
+    doctest.testmod(verbose=True)
+
+
+##############################################################################
+if __name__ == '__main__':
+    test_main()
@@ -74,6 +74,8 @@ from DataManager import DataManager
 from ResponseDbManager import ResponseDbManager
 from appCommon.hostedServices.IftttClient import IftttClient
 from DebugLogManager import DebugLogManager
+from HeartbeatTable import kStateIdle, kStateExiting
+from OverloadGovernor import kShedBackground
 
 import MessageIds
 
@@ -192,7 +194,7 @@ _kExecutorMaxAllocAttempts = 1 / _kExecutorPollTime # do not stall the main loop
 def runResponseRunner(backEndQueue, responseQueue, clipMgrPath, dataMgrPath,
                       responseDbMgrPath, videoDir, tmpDir, logDir, configDir,
                       ftpSettings, localSettings, notificationSettings,
-                      servicesToken):
+                      servicesToken, heartbeat=None):
     """Create and start a ResponseRunner process.
 
     @param  backEndQueue         A queue to add back end messages to.
@@ -208,10 +210,13 @@ def runResponseRunner(backEndQueue, responseQueue, clipMgrPath, dataMgrPath,
     @param  localSettings        Dictionary of local export settings.
     @param  notificationSettings Dictionary for notification settings.
     @param  servicesToken        The current services token or None.
+    @param  heartbeat            A HeartbeatWriter to show we're alive with,
+                                 or None to send pings instead.
     """
     responseRunner = ResponseRunner(backEndQueue, responseQueue, clipMgrPath,
             dataMgrPath, responseDbMgrPath, videoDir, tmpDir, logDir, configDir,
-            ftpSettings, localSettings, notificationSettings, servicesToken)
+            ftpSettings, localSettings, notificationSettings, servicesToken,
+            heartbeat)
     responseRunner.run()
 
 
@@ -400,6 +405,9 @@ class ClipSender(threading.Thread):
         self._settings = initialSettings
         self.shutdown = threading.Event()
 
+        # Set while the back end is overloaded; clips wait until it's not.
+        self.paused = False
+
     ###########################################################
     def updateSettings(self, newSettings):
         """ Update settings. The settings will be access get-only, hence in a
@@ -504,7 +512,8 @@ class ClipSender(threading.Thread):
         self._logger.info("sender '%s' ready" % self.protocol)
         while not self.shutdown.isSet():
             # check if there are any responses, if not wait
-            if not self._responseDbMgr.areResponsesPending(self.protocol):
+            if self.paused or \
+               not self._responseDbMgr.areResponsesPending(self.protocol):
                 self.shutdown.wait(_kClipSenderPollInterval)
                 continue
             # get the next response, wait in the unlikely case of nothingness
@@ -810,7 +819,7 @@ class ResponseRunner(object):
     def __init__(self, backEndQueue, responseQueue, clipMgrPath, dataMgrPath,
                  responseDbMgrPath, videoDir, tmpDir, logDir, configDir,
                  ftpSettings, localSettings, notificationSettings,
-                 servicesToken):
+                 servicesToken, heartbeat=None):
         """Initialize ResponseRunner.
 
         @param  backEndQueue         A queue to add back end messages to.
@@ -826,6 +835,8 @@ class ResponseRunner(object):
         @param  localSettings        Dictionary of local export settings.
         @param  notificationSettings Dictionary for notification settings.
         @param  servicesToken        The current services token or None.
+        @param  heartbeat            A HeartbeatWriter to show we're alive
+                                     with, or None to send pings instead.
         """
         # Call the superclass constructor.
         super(ResponseRunner, self).__init__()
@@ -877,6 +888,7 @@ class ResponseRunner(object):
             MessageIds.msgIdSetServicesAuthToken:       ( 0,  self._setAuthToken),
             MessageIds.msgIdSendWebhook:                ( 32, self._processWebhook),
             MessageIds.msgIdSetDebugConfig:             ( 0,  self._setDebugConfig),
+            MessageIds.msgIdSetLoadShedding:            ( 0,  self._setLoadShedding),
         }
 
         self._executorCounts = {}
@@ -897,8 +909,10 @@ class ResponseRunner(object):
             sender.setName("sender_%s" % sender.protocol)
             sender.start()
 
-        # Track the we last pinged the back end
+        # Track the we last pinged the back end; only needed if we have no
+        # heartbeat slot.
         self._lastPingTime = 0
+        self._heartbeat = heartbeat
 
         self._workerThreads = []
 
@@ -919,13 +933,19 @@ class ResponseRunner(object):
         """Run a response manager process."""
         self.__callbackFunc = registerForForcedQuitEvents()
 
+        # We mostly wait for work, so we're never expected to make progress.
+        if self._heartbeat is not None:
+            self._heartbeat.setState(kStateIdle)
+
         # Enter the main loop
         self._running = True
         while(self._running):
 
             # Ping the back end if necessary
             now = time.time()
-            if now > self._lastPingTime+_kPingSecInterval:
+            if self._heartbeat is not None:
+                self._heartbeat.beat()
+            elif now > self._lastPingTime+_kPingSecInterval:
                 self._lastPingTime = now
                 self._backEndQueue.put([MessageIds.msgIdResponseRunnerPing])
 
@@ -948,6 +968,8 @@ class ResponseRunner(object):
                         self._processMessage(self._executionContext, msg, 1, True)
                     except Exception:
                         self._logger.error("Response exception:" + traceback.format_exc())
+                    if self._heartbeat is not None:
+                        self._heartbeat.beat(1)
 
             # See if there's anything in our retry list that needs to be
             # tried again...
@@ -975,6 +997,9 @@ class ResponseRunner(object):
             self._purgePushNotifications()
 
 
+        if self._heartbeat is not None:
+            self._heartbeat.setState(kStateExiting)
+
         # Bring down the senders
         for _, sender in self._senders.iteritems():
             sender.shutdown.set()
@@ -1188,6 +1213,18 @@ class ResponseRunner(object):
         """
         self._debugLogManager.SetLogConfig(debugConfig)
 
+    ###########################################################
+    def _setLoadShedding(self, actionCtx, tryNum, actions):
+        """Pause or resume sending clips, as the back end's load asks.
+
+        @param  actions  A list of OverloadGovernor.kShedActions to take.
+        """
+        paused = kShedBackground in actions
+        for sender in self._senders.itervalues():
+            sender.paused = paused
+        self._logger.info("Clip exports %s" %
+                          ("paused" if paused else "resumed"))
+
     ###########################################################
     def _processIfttt(self, actionCtx, tryNum, camLoc, ruleName, triggerTime):
         """Send an ifttt response for the given rule.
@@ -1305,6 +1342,9 @@ class ResponseRunner(object):
                                sys.exc_info()[1])
             return None
 
+        # Wake up remote clients waiting for notifications.
+        self._backEndQueue.put([MessageIds.msgIdPushNotificationAdded, uid])
+
         # send the pointer (UID) along, since the actual JSON data could exceed
         # the maximum notification limit (on iOS around 255 chars), what gets
         # send to the client (full set or just the UID) is decided at the
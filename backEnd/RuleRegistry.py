@@ -0,0 +1,404 @@
+#!/usr/bin/env python
+
+#*****************************************************************************
+#
+# RuleRegistry.py
+#    Keeps the rules from the rule directory loaded, reloading what changes
+#
+#
+#*****************************************************************************
+#
+#
+# Copyright 2013-2022 Sighthound, Inc.
+#
+# Licensed under the GNU GPLv3 license found at
+# https://www.gnu.org/licenses/gpl-3.0.txt
+#
+# Alternative licensing available from Sighthound, Inc.
+# by emailing opensource@sighthound.com
+#
+# This file is part of the Sighthound Video project which can be found at
+# https://github.com/sighthoundinc/SighthoundVideo
+#
+# This program is free software; you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation; using version 3 of the License.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program; if not, write to the Free Software
+# Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02111, USA.
+#
+#*****************************************************************************
+
+
+"""
+## @file
+Contains the RuleRegistry class, which keeps every rule in the rule directory
+loaded and tells the back end which ones changed.
+
+Each rule is a .rule file (a pickled RealTimeRule) plus a .query file (a
+pickled SavedQueryDataModel).  We remember a hash of the contents of each, so:
+- Files that are rewritten with the same contents aren't reported.
+- A change to only the .rule file (schedule, enabled) is reported as such, so
+  the back end can keep the compiled query and the state of its triggers.
+
+The directory is watched with a DirWatcher, so looking for changes is cheap
+enough to do every time through the back end's main loop.
+"""
+
+# Python imports...
+import cPickle
+import hashlib
+import os
+
+# Common 3rd-party imports...
+
+# Toolbox imports...
+from vitaToolbox.path.PathUtils import normalizePath
+from vitaToolbox.sysUtils.DirWatcher import DirWatcher
+
+# Local imports...
+from appCommon.CommonStrings import kRuleExt, kQueryExt
+from SavedQueryDataModel import convertOld2NewSavedQueryDataModel
+
+# Constants...
+
+# How often to look at the rule directory when we can't get notified.
+_kPollInterval = 2.0
+
+
+##############################################################################
+def hashRuleData(data):
+    """Hash the contents of a rule or query file.
+
+    @param  data  The contents of the file, as a string.
+    @return hash  A hash of the contents.
+    """
+    return hashlib.sha1(data).hexdigest()
+
+
+##############################################################################
+class RuleEntry(object):
+    """One loaded rule."""
+    ###########################################################
+    def __init__(self, fileBase, rule, queryModel, ruleHash, queryHash):
+        """Initializer for RuleEntry
+
+        @param  fileBase    The file name of the rule, without extension.
+        @param  rule        The RealTimeRule.
+        @param  queryModel  The SavedQueryDataModel of the rule.
+        @param  ruleHash    The hash of the .rule file.
+        @param  queryHash   The hash of the .query file.
+        """
+        self.fileBase = fileBase
+        self.name = fileBase.lower()
+        self.rule = rule
+        self.queryModel = queryModel
+        self.ruleHash = ruleHash
+        self.queryHash = queryHash
+
+
+##############################################################################
+class RuleRegistry(object):
+    """The rules in the rule directory, kept up to date."""
+    ###########################################################
+    def __init__(self, logger, ruleDir, dataMgr, pollInterval=_kPollInterval):
+        """Initializer for RuleRegistry
+
+        @param  logger        A logger instance.
+        @param  ruleDir       The directory with the rules.
+        @param  dataMgr       A data manager, for converting old queries.
+        @param  pollInterval  Seconds between looks at the directory when we
+                              can't get notified of changes.
+        """
+        self._logger = logger
+        self._ruleDir = ruleDir
+        self._dataMgr = dataMgr
+
+        self._watcher = DirWatcher(ruleDir, pollInterval)
+
+        # Key = lowercase rule name, value = RuleEntry.
+        self._entries = {}
+
+
+    ###########################################################
+    def close(self):
+        """Stop watching the rule directory."""
+        self._watcher.close()
+
+
+    ###########################################################
+    def getRules(self):
+        """Return all loaded rules.
+
+        @return entries  A list of RuleEntry objects.
+        """
+        return self._entries.values()
+
+
+    ###########################################################
+    def getRule(self, name):
+        """Return one loaded rule.
+
+        @param  name   The name of the rule.
+        @return entry  The RuleEntry, or None if it isn't loaded.
+        """
+        return self._entries.get(name.lower())
+
+
+    ###########################################################
+    def update(self, rescan=False):
+        """Reload rules whose files changed.
+
+        @param  rescan   True to look at every rule, not just the ones we were
+                         told changed.
+        @return changed  A list of (entry, queryChanged) for rules that were
+                         added or changed; queryChanged is False if only the
+                         .rule file changed.
+        @return removed  A list of lowercase names of rules that went away.
+        """
+        fileNames = self._watcher.getChanges()
+        if fileNames is None or rescan:
+            try:
+                fileNames = os.listdir(self._ruleDir)
+            except OSError:
+                fileNames = []
+            baseNames = set(entry.fileBase for entry in self._entries.values())
+        else:
+            baseNames = set()
+
+        for fileName in fileNames:
+            fileName = normalizePath(fileName)
+            baseName, ext = os.path.splitext(fileName)
+            if ext in (kRuleExt, kQueryExt):
+                baseNames.add(baseName)
+
+        changed = []
+        removed = []
+        for baseName in baseNames:
+            name = baseName.lower()
+            if not os.path.isfile(os.path.join(self._ruleDir,
+                                               baseName+kRuleExt)):
+                if self._entries.pop(name, None) is not None:
+                    removed.append(name)
+                continue
+
+            result = self._loadRule(baseName)
+            if result is not None:
+                changed.append(result)
+
+        return changed, removed
+
+
+    ###########################################################
+    def noteRule(self, name, pickledRule, pickledQuery, rule, queryModel):
+        """Take a rule that somebody else already loaded.
+
+        This is for rules we're told about along with their contents, so we
+        don't load them again when we see their files change.
+
+        @param  name          The name of the rule.
+        @param  pickledRule   The contents of the .rule file.
+        @param  pickledQuery  The contents of the .query file.
+        @param  rule          The unpickled RealTimeRule.
+        @param  queryModel    The unpickled SavedQueryDataModel.
+        @return entry         The RuleEntry.
+        @return queryChanged  True if the query isn't the one we had.
+        """
+        queryHash = hashRuleData(pickledQuery)
+        oldEntry = self._entries.get(name.lower())
+        queryChanged = oldEntry is None or oldEntry.queryHash != queryHash
+
+        entry = RuleEntry(name, rule, queryModel, hashRuleData(pickledRule),
+                          queryHash)
+        self._entries[entry.name] = entry
+        return entry, queryChanged
+
+
+    ###########################################################
+    def forgetRule(self, name):
+        """Forget a rule that somebody else already unloaded.
+
+        @param  name  The name of the rule.
+        """
+        self._entries.pop(name.lower(), None)
+
+
+    ###########################################################
+    def _loadRule(self, baseName):
+        """Load a rule if its files changed.
+
+        @param  baseName      The rule's file name, without extension.
+        @return entry         The new RuleEntry, or None if nothing changed or
+                              it couldn't be loaded.
+        @return queryChanged  True if the query changed too; only returned if
+                              entry isn't None.
+        """
+        name = baseName.lower()
+        oldEntry = self._entries.get(name)
+
+        ruleFilePath = os.path.join(self._ruleDir, baseName+kRuleExt)
+        try:
+            ruleData = self._readFile(ruleFilePath)
+            ruleHash = hashRuleData(ruleData)
+            if oldEntry is not None and oldEntry.ruleHash == ruleHash:
+                rule = oldEntry.rule
+            else:
+                rule = cPickle.loads(ruleData)
+
+            queryFilePath = os.path.join(self._ruleDir,
+                                         rule.getQueryName()+kQueryExt)
+            queryData = self._readFile(queryFilePath)
+            queryHash = hashRuleData(queryData)
+            if oldEntry is not None and oldEntry.queryHash == queryHash:
+                if oldEntry.ruleHash == ruleHash:
+                    return None
+                queryModel = oldEntry.queryModel
+            else:
+                queryModel = cPickle.loads(queryData)
+
+                # Remove rules created prior to the addition of responses
+                # in the saved query data model.
+                if not hasattr(queryModel, '_responses'):
+                    self._logger.warn("Removing old rule %s" % ruleFilePath)
+                    os.remove(queryFilePath)
+                    os.remove(ruleFilePath)
+                    return None
+
+                # Convert old queries to have coordinate spaces.
+                convertOld2NewSavedQueryDataModel(self._dataMgr, queryModel)
+        except Exception:
+            # Files are written in place, so we can see one half written or
+            # the .rule before its .query.  We'll be told again once they're
+            # done, so just keep what we had.
+            self._logger.warn("Couldn't load rule %s" % ruleFilePath,
+                              exc_info=True)
+            return None
+
+        entry = RuleEntry(baseName, rule, queryModel, ruleHash, queryHash)
+        self._entries[name] = entry
+
+        queryChanged = oldEntry is None or oldEntry.queryHash != queryHash
+        return entry, queryChanged
+
+
+    ###########################################################
+    def _readFile(self, path):
+        """Read a whole file.
+
+        @param  path  The path to the file.
+        @return data  The contents of the file.
+        """
+        f = open(path, 'rb')
+        try:
+            return f.read()
+        finally:
+            f.close()
+
+
+
+##############################################################################
+class _TestQuery(object):
+    """Stands in for a SavedQueryDataModel in the test; must be picklable."""
+    def __init__(self, value):
+        self.value = value
+        self._responses = []
+
+
+##############################################################################
+def _testRuleRegistry():
+    """Test loading and reloading rules, with stand-ins for the pickles.
+
+    >>> import shutil, tempfile
+    >>> from vitaToolbox.loggingUtils.LoggingUtils import EmptyLogger
+    >>> from RealTimeRule import RealTimeRule
+    >>> FakeQuery = _TestQuery
+    >>> ruleDir = tempfile.mkdtemp()
+    >>> def write(name, rule, query):
+    ...     for ext, obj in ((kRuleExt, rule), (kQueryExt, query)):
+    ...         if obj is not None:
+    ...             f = open(os.path.join(ruleDir, name+ext), 'wb')
+    ...             f.write(cPickle.dumps(obj)); f.close()
+    >>> def summary((changed, removed)):
+    ...     return sorted((e.name, qc) for e, qc in changed), sorted(removed)
+
+    >>> registry = RuleRegistry(EmptyLogger(), ruleDir, None, 0)
+    >>> write('Door', RealTimeRule('Door', 'Front'), FakeQuery(1))
+    >>> write('Yard', RealTimeRule('Yard', 'Back'), FakeQuery(2))
+    >>> summary(registry.update())
+    ([(u'door', True), (u'yard', True)], [])
+    >>> summary(registry.update())
+    ([], [])
+
+    Rewriting a file with the same contents doesn't count as a change:
+
+    >>> write('Door', RealTimeRule('Door', 'Front'), FakeQuery(1))
+    >>> summary(registry.update(True))
+    ([], [])
+
+    Changing only the rule keeps the query:
+
+    >>> oldQuery = registry.getRule('Door').queryModel
+    >>> rule = RealTimeRule('Door', 'Front'); rule.setEnabled(False)
+    >>> write('Door', rule, None)
+    >>> summary(registry.update(True))
+    ([(u'door', False)], [])
+    >>> registry.getRule('door').queryModel is oldQuery
+    True
+    >>> registry.getRule('door').rule.isEnabled()
+    False
+
+    Changing the query:
+
+    >>> write('Door', rule, FakeQuery(3))
+    >>> summary(registry.update(True))
+    ([(u'door', True)], [])
+
+    A rule we were told about isn't loaded again:
+
+    >>> rule = RealTimeRule('Yard', 'Back')
+    >>> pickledRule, pickledQuery = cPickle.dumps(rule), cPickle.dumps(FakeQuery(4))
+    >>> write('Yard', rule, FakeQuery(4))
+    >>> registry.noteRule('Yard', pickledRule, pickledQuery, rule, None)[1]
+    True
+    >>> summary(registry.update(True))
+    ([], [])
+
+    A half written file is skipped until it's done:
+
+    >>> f = open(os.path.join(ruleDir, 'Door'+kQueryExt), 'wb'); f.write('(i'); f.close()
+    >>> summary(registry.update(True))
+    ([], [])
+    >>> registry.getRule('door').queryModel.value
+    3
+
+    Removing a rule:
+
+    >>> os.remove(os.path.join(ruleDir, 'Door'+kRuleExt))
+    >>> summary(registry.update(True))
+    ([], [u'door'])
+    >>> registry.getRule('door') is None
+    True
+
+    >>> registry.close()
+    >>> shutil.rmtree(ruleDir)
+    """
+
+
+##############################################################################
+def test_main():
+    """OB_REDACT
+    Our main function, which runs test code
+    """
+    import doctest
+    doctest.testmod(verbose=True)
+
+
+##############################################################################
+if __name__ == '__main__':
+    test_main()
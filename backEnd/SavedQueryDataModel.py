@@ -470,37 +470,7 @@ class SavedQueryDataModel(AbstractModel):
             else:
                 durationModel = model
 
-        # Create the where trigger
-        if whereModel.getTriggerType() == 'regionTrigger':
-            # Region Trigger
-            regionType = whereModel.getRegionType()
-            region = whereModel.getRegion()
-            trackPt = 'center'
-            if regionType == 'ground':
-                regionType = 'inside'
-                trackPt = 'bottom'
-
-            # Get points in the same coordinate space as our processing size.
-            whereTrigger = RegionTrigger(dataManager, region, trackPt,
-                                         regionType)
-        elif whereModel.getTriggerType() == 'doorTrigger':
-            # Door Trigger
-            doorType = whereModel.getDoorType()
-            region = whereModel.getRegion()
-            # Get points in the same coordinate space as our processing size.
-            whereTrigger = DoorTrigger(dataManager, region, 'center', doorType)
-        elif whereModel.getTriggerType() == 'lineTrigger':
-            segment = whereModel.getLineSegment()
-            # Get points in the same coordinate space as our processing size.
-            whereTrigger = LineTrigger(dataManager, segment, 'center')
-        else:
-            assert whereModel.getTriggerType() == 'blankTrigger'
-            whereTrigger = RegionTrigger(dataManager,
-                                         TriggerRegion(
-                                             [(0,0),(319,0),(319,239),(0,239)],
-                                             _kDefaultCoordSpace
-                                         ),
-                                         'center', 'inside')
+        whereTrigger = self.getWhereTrigger(dataManager)
 
         # Create the duration trigger(s)
         if durationModel.getWantMoreThan():
@@ -556,6 +526,53 @@ class SavedQueryDataModel(AbstractModel):
             return preTargetTrigger
 
 
+    ###########################################################
+    def getWhereTrigger(self, dataManager):
+        """Return the spatial part of the query built from the current settings
+
+        @param  dataManager   The database to give the created trigger
+        @return whereTrigger  The trigger for the where block of the query
+        """
+        whereModel = None
+        for model in self.getTriggers():
+            if isinstance(model, WhereBlockDataModel):
+                whereModel = model
+
+        # Create the where trigger
+        if whereModel.getTriggerType() == 'regionTrigger':
+            # Region Trigger
+            regionType = whereModel.getRegionType()
+            region = whereModel.getRegion()
+            trackPt = 'center'
+            if regionType == 'ground':
+                regionType = 'inside'
+                trackPt = 'bottom'
+
+            # Get points in the same coordinate space as our processing size.
+            whereTrigger = RegionTrigger(dataManager, region, trackPt,
+                                         regionType)
+        elif whereModel.getTriggerType() == 'doorTrigger':
+            # Door Trigger
+            doorType = whereModel.getDoorType()
+            region = whereModel.getRegion()
+            # Get points in the same coordinate space as our processing size.
+            whereTrigger = DoorTrigger(dataManager, region, 'center', doorType)
+        elif whereModel.getTriggerType() == 'lineTrigger':
+            segment = whereModel.getLineSegment()
+            # Get points in the same coordinate space as our processing size.
+            whereTrigger = LineTrigger(dataManager, segment, 'center')
+        else:
+            assert whereModel.getTriggerType() == 'blankTrigger'
+            whereTrigger = RegionTrigger(dataManager,
+                                         TriggerRegion(
+                                             [(0,0),(319,0),(319,239),(0,239)],
+                                             _kDefaultCoordSpace
+                                         ),
+                                         'center', 'inside')
+
+        return whereTrigger
+
+
     ###########################################################
     def _unitsValuesToMsecs(self, units, value):
         """Convert a value and unit type to a value in milliseconds
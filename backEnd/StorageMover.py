@@ -0,0 +1,480 @@
+#!/usr/bin/env python
+
+#*****************************************************************************
+#
+# StorageMover.py
+#    Moves recorded video between storage locations off the main loop
+#
+#
+#*****************************************************************************
+#
+#
+# Copyright 2013-2022 Sighthound, Inc.
+#
+# Licensed under the GNU GPLv3 license found at
+# https://www.gnu.org/licenses/gpl-3.0.txt
+#
+# Alternative licensing available from Sighthound, Inc.
+# by emailing opensource@sighthound.com
+#
+# This file is part of the Sighthound Video project which can be found at
+# https://github.com/sighthoundinc/SighthoundVideo
+#
+# This program is free software; you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation; using version 3 of the License.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program; if not, write to the Free Software
+# Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02111, USA.
+#
+#*****************************************************************************
+
+
+"""
+## @file
+Contains the StorageMover class, which moves files (normally recorded video
+that couldn't go straight to the archive) on a few worker threads.
+
+The archive may well live on a slow network share, so a move can take
+seconds.  The owner submits moves and later collects the results, so nothing
+ever waits on the disk.  Moves are done as copy, fsync, then rename into
+place, so a file only ever shows up at its destination complete; the source
+is removed last.  Files can optionally be verified by checksum, and copies to
+a given volume can be limited to some bandwidth.
+
+Moving older video on to slower tiers (local disk, then a share) isn't done.
+The DiskCleaner makes room on the video folder's volume by deleting the
+oldest clips first; once those live on other tiers, deleting them frees
+nothing there.  Tiers need the cleaner to keep a budget per volume first.
+"""
+
+# Python imports...
+import hashlib
+import os
+import Queue
+import shutil
+import sys
+import threading
+import time
+
+# Common 3rd-party imports...
+
+# Toolbox imports...
+from vitaToolbox.loggingUtils.LoggingUtils import EmptyLogger
+from vitaToolbox.threading.ThreadPool import ThreadPool
+
+# Local imports...
+
+# Constants...
+
+# Suffix for files while they're being copied to their destination.
+kPartialSuffix = '.moving'
+
+_kDefaultWorkers = 2
+_kChunkSize = 1024 * 1024
+
+
+##############################################################################
+class BandwidthLimiter(object):
+    """A token bucket shared by all copies to one volume."""
+    ###########################################################
+    def __init__(self, bytesPerSec, burstSecs=1.0):
+        """Initializer for BandwidthLimiter
+
+        @param  bytesPerSec  The average rate to allow.
+        @param  burstSecs    How many seconds worth of bytes may be used at
+                             once after being idle.
+        """
+        self._bytesPerSec = float(bytesPerSec)
+        self._maxTokens = self._bytesPerSec * burstSecs
+        self._tokens = self._maxTokens
+        self._lastTime = time.time()
+        self._lock = threading.Lock()
+
+
+    ###########################################################
+    def getDelay(self, numBytes, now=None):
+        """Take tokens for some bytes; return how long to wait to pay for them.
+
+        @param  numBytes  The number of bytes about to be (or just) written.
+        @param  now       The current time; None for time.time().
+        @return delay     Seconds to sleep before writing more.
+
+        >>> limiter = BandwidthLimiter(1000)
+        >>> limiter.getDelay(500, limiter._lastTime)
+        0.0
+        >>> limiter.getDelay(1000, limiter._lastTime)
+        0.5
+        >>> limiter.getDelay(0, limiter._lastTime + 1.5)
+        0.0
+        """
+        if now is None:
+            now = time.time()
+
+        self._lock.acquire()
+        try:
+            self._tokens = min(self._maxTokens, self._tokens +
+                               (now - self._lastTime) * self._bytesPerSec)
+            self._lastTime = now
+            self._tokens -= numBytes
+            if self._tokens >= 0:
+                return 0.0
+            return -self._tokens / self._bytesPerSec
+        finally:
+            self._lock.release()
+
+
+    ###########################################################
+    def throttle(self, numBytes):
+        """Take tokens for some bytes, sleeping if we're over the limit.
+
+        @param  numBytes  The number of bytes just written.
+        """
+        delay = self.getDelay(numBytes)
+        if delay:
+            time.sleep(delay)
+
+
+##############################################################################
+def moveFile(src, dst, verify=False, limiter=None, shouldStop=None):
+    """Move a file, making sure that dst only ever appears complete.
+
+    If both are on the same volume this is just a rename.  Otherwise the file
+    is copied with copyFile() and only then removed from src.
+
+    @param  src         The file to move.
+    @param  dst         Where to move it; the directory is made if needed.
+    @param  verify      If True, read back the copy and compare checksums.
+    @param  limiter     A BandwidthLimiter for the destination, or None.
+    @param  shouldStop  A function returning True to abandon the copy; or
+                        None.
+    @return numBytes    The number of bytes copied, 0 if renamed.
+
+    >>> import tempfile
+    >>> tmpDir = tempfile.mkdtemp()
+    >>> src = os.path.join(tmpDir, 'a.mp4')
+    >>> open(src, 'wb').write('x' * 1000)
+    >>> dst = os.path.join(tmpDir, 'sub', 'b.mp4')
+    >>> moveFile(src, dst, True)
+    0
+    >>> os.path.exists(src), open(dst, 'rb').read() == 'x' * 1000
+    (False, True)
+    >>> shutil.rmtree(tmpDir)
+    """
+    dstDir = os.path.dirname(dst)
+    if not os.path.isdir(dstDir):
+        os.makedirs(dstDir)
+
+    if os.stat(src).st_dev == os.stat(dstDir).st_dev:
+        _replaceFile(src, dst)
+        return 0
+
+    numBytes = copyFile(src, dst, verify, limiter, shouldStop)
+    os.remove(src)
+    return numBytes
+
+
+##############################################################################
+def copyFile(src, dst, verify=False, limiter=None, shouldStop=None):
+    """Copy a file, making sure that dst only ever appears complete.
+
+    @param  src         The file to copy.
+    @param  dst         Where to copy it; the directory must exist.
+    @param  verify      If True, read back the copy and compare checksums.
+    @param  limiter     A BandwidthLimiter for the destination, or None.
+    @param  shouldStop  A function returning True to abandon the copy; or
+                        None.
+    @return numBytes    The number of bytes copied.
+
+    >>> import tempfile
+    >>> tmpDir = tempfile.mkdtemp()
+    >>> src = os.path.join(tmpDir, 'a.mp4')
+    >>> open(src, 'wb').write('x' * (_kChunkSize + 10))
+    >>> dst = os.path.join(tmpDir, 'b.mp4')
+    >>> copyFile(src, dst, True) == _kChunkSize + 10
+    True
+    >>> _getFileHash(src) == _getFileHash(dst)
+    True
+    >>> copyFile(src, dst, shouldStop=lambda: True)
+    Traceback (most recent call last):
+    ...
+    IOError: Copy of a.mp4 abandoned
+    >>> sorted(os.listdir(tmpDir))
+    ['a.mp4', 'b.mp4']
+    >>> shutil.rmtree(tmpDir)
+    """
+    partialPath = dst + kPartialSuffix
+    numBytes = 0
+    srcHash = hashlib.md5() if verify else None
+    try:
+        inFile = open(src, 'rb')
+        try:
+            outFile = open(partialPath, 'wb')
+            try:
+                while True:
+                    chunk = inFile.read(_kChunkSize)
+                    if not chunk:
+                        break
+                    outFile.write(chunk)
+                    numBytes += len(chunk)
+                    if srcHash is not None:
+                        srcHash.update(chunk)
+                    if limiter is not None:
+                        limiter.throttle(len(chunk))
+                    if shouldStop is not None and shouldStop():
+                        raise IOError("Copy of %s abandoned" %
+                                      os.path.basename(src))
+                outFile.flush()
+                os.fsync(outFile.fileno())
+            finally:
+                outFile.close()
+        finally:
+            inFile.close()
+
+        if srcHash is not None and \
+           _getFileHash(partialPath) != srcHash.digest():
+            raise IOError("Checksum mismatch copying %s" % src)
+
+        try:
+            shutil.copystat(src, partialPath)
+        except Exception:
+            pass
+
+        _replaceFile(partialPath, dst)
+    except:
+        try:
+            os.remove(partialPath)
+        except Exception:
+            pass
+        raise
+
+    return numBytes
+
+
+##############################################################################
+def _replaceFile(src, dst):
+    """Rename a file over another one, which may or may not exist.
+
+    @param  src  The file to rename.
+    @param  dst  The new name.
+    """
+    if sys.platform == 'win32' and os.path.exists(dst):
+        # Windows won't rename over an existing file.
+        os.remove(dst)
+    os.rename(src, dst)
+
+
+##############################################################################
+def _getFileHash(path):
+    """Return the md5 digest of a file.
+
+    @param  path    The file to read.
+    @return digest  The digest, as a string of bytes.
+    """
+    fileHash = hashlib.md5()
+    f = open(path, 'rb')
+    try:
+        while True:
+            chunk = f.read(_kChunkSize)
+            if not chunk:
+                break
+            fileHash.update(chunk)
+    finally:
+        f.close()
+    return fileHash.digest()
+
+
+##############################################################################
+class _MoveRunnable(object):
+    """One move, as run on the mover's thread pool."""
+    ###########################################################
+    def __init__(self, mover, key, src, dst, keepSource):
+        """Initializer for _MoveRunnable
+
+        @param  mover       The StorageMover that owns us.
+        @param  key         The key the move was submitted with.
+        @param  src         The file to move.
+        @param  dst         Where to move it.
+        @param  keepSource  If True, copy the file instead.
+        """
+        self._mover = mover
+        self._key = key
+        self._src = src
+        self._dst = dst
+        self._keepSource = keepSource
+
+
+    ###########################################################
+    def run(self):
+        """Do the move and report the result to the mover."""
+        self._mover._runMove(self._key, self._src, self._dst,
+                             self._keepSource)
+
+
+##############################################################################
+class StorageMover(object):
+    """Moves files on worker threads; results are collected by the owner."""
+    ###########################################################
+    def __init__(self, logger=None, numWorkers=_kDefaultWorkers, verify=False):
+        """Initializer for StorageMover
+
+        @param  logger      Logger to use, or None.
+        @param  numWorkers  The most moves to run at once.
+        @param  verify      If True, copies are checked by checksum.
+        """
+        self._logger = EmptyLogger() if logger is None else logger
+        self._verify = verify
+
+        # Key = root directory, value = BandwidthLimiter for copies there.
+        self._limiters = {}
+
+        # Keys of submitted moves that haven't been collected yet.
+        self._pending = set()
+
+        # Results waiting to be collected; (key, success, numBytes, seconds,
+        # error string).
+        self._results = Queue.Queue()
+
+        self._stopping = False
+        self._threadPool = ThreadPool(max(1, numWorkers),
+                                      threadNamePrefix="storagemover",
+                                      logger=self._logger)
+
+
+    ###########################################################
+    def setBandwidthLimit(self, rootDir, bytesPerSec):
+        """Limit the speed of copies into a directory.
+
+        @param  rootDir      Copies to anywhere under this are limited.
+        @param  bytesPerSec  The limit; 0 or None for none.
+        """
+        rootDir = os.path.normcase(os.path.abspath(rootDir))
+        if bytesPerSec:
+            self._limiters[rootDir] = BandwidthLimiter(bytesPerSec)
+        else:
+            self._limiters.pop(rootDir, None)
+
+
+    ###########################################################
+    def submit(self, key, src, dst, keepSource=False):
+        """Start moving a file.
+
+        @param  key         Identifies the move in the results; must be
+                            hashable.
+        @param  src         The file to move.
+        @param  dst         Where to move it.
+        @param  keepSource  If True, copy the file and leave src alone, so the
+                            owner can decide when to remove it.
+        @return started     False if a move with this key is still
+                            outstanding, or we couldn't queue it.
+        """
+        if key in self._pending or self._stopping:
+            return False
+
+        self._pending.add(key)
+        if not self._threadPool.schedule(
+                _MoveRunnable(self, key, src, dst, keepSource), False):
+            self._pending.discard(key)
+            return False
+        return True
+
+
+    ###########################################################
+    def isPending(self, key):
+        """Return whether a move is outstanding.
+
+        @param  key        The key the move was submitted with.
+        @return isPending  True if the move hasn't been collected yet.
+        """
+        return key in self._pending
+
+
+    ###########################################################
+    def getResults(self):
+        """Collect the results of finished moves; never blocks.
+
+        @return results  A list of (key, success, numBytes, seconds, error);
+                         error is None on success.
+        """
+        results = []
+        while True:
+            try:
+                result = self._results.get(False)
+            except Queue.Empty:
+                break
+            self._pending.discard(result[0])
+            results.append(result)
+        return results
+
+
+    ###########################################################
+    def shutdown(self):
+        """Stop the workers; copies in progress are abandoned.
+
+        @return  False if some thread is still alive.
+        """
+        self._stopping = True
+        return self._threadPool.shutdown()
+
+
+    ###########################################################
+    def _getLimiter(self, dst):
+        """Find the bandwidth limiter for a destination.
+
+        @param  dst      The destination path.
+        @return limiter  The BandwidthLimiter, or None.
+        """
+        dst = os.path.normcase(os.path.abspath(dst))
+        for rootDir, limiter in self._limiters.iteritems():
+            if dst.startswith(rootDir + os.sep):
+                return limiter
+        return None
+
+
+    ###########################################################
+    def _runMove(self, key, src, dst, keepSource=False):
+        """Do a move; called on a worker thread.
+
+        @param  key         The key the move was submitted with.
+        @param  src         The file to move.
+        @param  dst         Where to move it.
+        @param  keepSource  If True, copy the file instead.
+        """
+        startTime = time.time()
+        try:
+            if keepSource:
+                dstDir = os.path.dirname(dst)
+                if not os.path.isdir(dstDir):
+                    os.makedirs(dstDir)
+                numBytes = copyFile(src, dst, self._verify,
+                                    self._getLimiter(dst),
+                                    lambda: self._stopping)
+            else:
+                numBytes = moveFile(src, dst, self._verify,
+                                    self._getLimiter(dst),
+                                    lambda: self._stopping)
+            result = (key, True, numBytes, time.time()-startTime, None)
+        except Exception, e:
+            result = (key, False, 0, time.time()-startTime, str(e))
+        self._results.put(result)
+
+
+
+##############################################################################
+def test_main():
+    """OB_REDACT
+    Our main function, which runs test code
+    """
+    import doctest
+    doctest.testmod(verbose=True)
+
+
+##############################################################################
+if __name__ == '__main__':
+    test_main()
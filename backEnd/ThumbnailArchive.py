@@ -0,0 +1,729 @@
+#!/usr/bin/env python
+
+#*****************************************************************************
+#
+# ThumbnailArchive.py
+#     Writes and reads thumbnails packed into one file per camera and hour.
+#
+#
+#*****************************************************************************
+#
+#
+# Copyright 2013-2022 Sighthound, Inc.
+#
+# Licensed under the GNU GPLv3 license found at
+# https://www.gnu.org/licenses/gpl-3.0.txt
+#
+# Alternative licensing available from Sighthound, Inc.
+# by emailing opensource@sighthound.com
+#
+# This file is part of the Sighthound Video project which can be found at
+# https://github.com/sighthoundinc/SighthoundVideo
+#
+# This program is free software; you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation; using version 3 of the License.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program; if not, write to the Free Software
+# Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02111, USA.
+#
+#
+#*****************************************************************************
+
+"""
+## @file
+Contains the ThumbnailWriter and ThumbnailArchiveReader classes.
+
+An archive is a sequence of records, each a header followed by its data:
+- thumbnails, holding a JPEG;
+- deleted ranges, appended by whoever removes part of an hour;
+- an index of all records before it, written once the hour is over and
+  followed by a trailer pointing back at it.
+
+Records are only ever appended, so readers can look at an archive while
+it's being written; a record that isn't all there yet is ignored.
+"""
+
+# Python imports...
+from collections import OrderedDict, deque
+from cStringIO import StringIO
+import os
+import struct
+import threading
+
+# Common 3rd-party imports...
+from PIL import Image
+
+# Toolbox imports...
+from vitaToolbox.image.ImageConversion import convertProcFrameToPIL
+from vitaToolbox.strUtils.EnsureUnicode import ensureUtf8
+
+# Local imports...
+from appCommon.CommonStrings import kThumbArchiveExt, kThumbsSubfolder
+
+# How much time each archive covers.
+_kArchiveMs = 60*60*1000
+
+# Record headers: kind, ms and length of the data.  For indexes, ms is the
+# number of thumbnails in it.
+_kHeader = struct.Struct('<4sqI')
+_kKindThumb = 'SVT1'
+_kKindDeleted = 'SVTD'
+_kKindIndex = 'SVTX'
+
+# Data of a deleted range record: the last ms of the range; the first one is
+# in the header.
+_kDeletedData = struct.Struct('<q')
+
+# Index entries: thumbnails as (ms, offset of the data, length of the data),
+# followed by deleted ranges as (first ms, last ms).
+_kIndexThumb = struct.Struct('<qQI')
+_kIndexDeleted = struct.Struct('<qq')
+
+# Follows an index: kind and offset of the index's header.
+_kTrailer = struct.Struct('<4sQ')
+_kKindTrailer = 'SVTE'
+
+# How many thumbnails may wait to be written.  Each holds on to a frame.
+_kMaxQueued = 16
+
+# How many archive indexes a reader keeps in memory.
+_kMaxCachedArchives = 64
+
+
+###############################################################
+def getThumbArchivePath(videoDir, camLoc, ms):
+    """Return the path of the archive holding thumbnails of a given time.
+
+    Archives go into the thumbs folder of the time their hour starts.
+
+    @param  videoDir  The video folder.
+    @param  camLoc    The camera location.
+    @param  ms        The time of the thumbnail.
+    @return path      The path of the archive.
+    """
+    hourStart = ms - ms % _kArchiveMs
+    return os.path.join(videoDir, camLoc.lower(), str(hourStart)[:5],
+                        kThumbsSubfolder, str(hourStart) + kThumbArchiveExt)
+
+
+###############################################################
+def getThumbArchivePaths(videoDir, camLoc, start, stop):
+    """Return the paths of archives which may hold thumbnails in a range.
+
+    @param  videoDir  The video folder.
+    @param  camLoc    The camera location.
+    @param  start     The first ms of the range.
+    @param  stop      The last ms of the range.
+    @return archives  A list of (first ms, last ms, path) of each hour
+                      overlapping the range, whether there's an archive or not.
+    """
+    archives = []
+    hourStart = start - start % _kArchiveMs
+    while hourStart <= stop:
+        archives.append((hourStart, hourStart + _kArchiveMs - 1,
+                         getThumbArchivePath(videoDir, camLoc, hourStart)))
+        hourStart += _kArchiveMs
+    return archives
+
+
+###############################################################
+def encodeThumbnail(frame, thumbRes):
+    """Make a JPEG thumbnail of a frame.
+
+    @param  frame     The RGB frame.
+    @param  thumbRes  The size of the smaller dimension of the thumbnail.
+    @return data      The JPEG data.
+    """
+    pilFrame = convertProcFrameToPIL(frame)
+    # Resize the frame, if requested thumb size is less than what we have
+    if thumbRes < pilFrame.width:
+        # This ensures the image gets scaled down to the requested size on smaller dimension
+        kVeryLargeFactor = 20
+        if pilFrame.width > pilFrame.height:
+            size = (thumbRes*kVeryLargeFactor, thumbRes)
+        else:
+            size = (thumbRes, thumbRes*kVeryLargeFactor)
+        pilFrame.thumbnail(size, Image.ANTIALIAS)
+    data = StringIO()
+    pilFrame.save(data, "JPEG")
+    return data.getvalue()
+
+
+###############################################################
+def removeThumbsBetween(path, hourStart, start, stop):
+    """Remove thumbnails of a range from an archive.
+
+    An archive whose thumbnails are all in the range is removed; otherwise
+    the range is marked as deleted in it.
+
+    @param  path       The path of the archive.
+    @param  hourStart  The first ms the archive covers.
+    @param  start      The first ms of the range.
+    @param  stop       The last ms of the range.
+    @return removed    The number of thumbnails removed.
+    @return freed      The number of bytes freed.
+    """
+    index = _readIndex(path)
+    times = index.getTimes()
+    removed = len([ms for ms in times if start <= ms <= stop])
+
+    if removed == len(times) or \
+       (start <= hourStart and stop >= hourStart + _kArchiveMs - 1):
+        os.remove(path)
+        return removed, index.size
+
+    if removed:
+        f = open(path, 'ab')
+        try:
+            f.write(_kHeader.pack(_kKindDeleted, start, _kDeletedData.size) +
+                    _kDeletedData.pack(stop))
+        finally:
+            f.close()
+    return removed, 0
+
+
+###############################################################
+def getThumbArchiveInfo(path):
+    """Return how many thumbnails an archive holds.
+
+    @param  path       The path of the archive.
+    @return numThumbs  The number of thumbnails not deleted.
+    @return numBytes   The size of the archive.
+    """
+    index = _readIndex(path)
+    return len(index.getTimes()), index.size
+
+
+###############################################################
+class ThumbnailWriter(object):
+    """Turns frames into thumbnails and appends them to archives, on a thread
+    of its own so that the capture loop doesn't wait for it.
+
+    If thumbnails come faster than they can be written, new ones are
+    dropped.  Once thumbnails for a new hour come in, the index of the
+    previous hour's archive is written.
+    """
+    ###########################################################
+    def __init__(self, videoDir, logger, encode=encodeThumbnail,
+                 maxQueued=_kMaxQueued):
+        """Initializer for ThumbnailWriter
+
+        @param  videoDir   The video folder.
+        @param  logger     The logger to use.
+        @param  encode     Function taking (frame, thumbRes), returning JPEG
+                           data; called on our thread.
+        @param  maxQueued  How many thumbnails may wait to be written.
+        """
+        self._videoDir = videoDir
+        self._logger = logger
+        self._encode = encode
+        self._maxQueued = maxQueued
+
+        # Guards everything below; our thread waits on it.
+        self._cond = threading.Condition()
+        self._queue = deque()
+        self._numDropped = 0
+        self._running = True
+
+        # Only used by our thread: the archive we last appended to.
+        self._path = None
+
+        self._thread = threading.Thread(target=self._run,
+                                        name="thumbnailWriter")
+        self._thread.setDaemon(True)
+        self._thread.start()
+
+
+    ###########################################################
+    def put(self, camLoc, ms, frame, thumbRes):
+        """Queue a thumbnail to be written.
+
+        @param  camLoc    The camera location.
+        @param  ms        The time of the frame.
+        @param  frame     The frame; kept until the thumbnail was made, so
+                          it must not change in the meantime.
+        @param  thumbRes  The size of the smaller dimension of the thumbnail.
+        @return queued    False if the thumbnail was dropped.
+        """
+        self._cond.acquire()
+        try:
+            if not self._running:
+                return False
+            if len(self._queue) >= self._maxQueued:
+                self._numDropped += 1
+                return False
+            self._queue.append((camLoc, ms, frame, thumbRes))
+            self._cond.notify()
+            return True
+        finally:
+            self._cond.release()
+
+
+    ###########################################################
+    def shutdown(self):
+        """Write what's queued, then stop."""
+        self._cond.acquire()
+        try:
+            self._running = False
+            self._cond.notify()
+        finally:
+            self._cond.release()
+        self._thread.join()
+
+
+    ###########################################################
+    def _run(self):
+        """Write queued thumbnails, until shut down."""
+        while True:
+            self._cond.acquire()
+            try:
+                while self._running and not self._queue:
+                    self._cond.wait()
+                if not self._queue:
+                    return
+                items = list(self._queue)
+                self._queue.clear()
+                numDropped = self._numDropped
+                self._numDropped = 0
+            finally:
+                self._cond.release()
+
+            if numDropped:
+                self._logger.warning("Dropped %d thumbnails, writing them "
+                                     "fell behind" % numDropped)
+
+            try:
+                self._write(items)
+            except Exception:
+                self._logger.error("Failed to write thumbnails",
+                                   exc_info=True)
+
+
+    ###########################################################
+    def _write(self, items):
+        """Make thumbnails and append them to their archives.
+
+        @param  items  A list of (camLoc, ms, frame, thumbRes).
+        """
+        archives = OrderedDict()
+        while items:
+            camLoc, ms, frame, thumbRes = items.pop(0)
+            try:
+                data = self._encode(frame, thumbRes)
+            except Exception:
+                self._logger.warning("Failed to make thumbnail for %d" % ms,
+                                     exc_info=True)
+                continue
+            finally:
+                # Don't hold on to frames longer than needed.
+                del frame
+            path = getThumbArchivePath(self._videoDir, camLoc, ms)
+            archives.setdefault(path, []).append((ms, data))
+
+        for path, thumbs in archives.iteritems():
+            try:
+                self._append(path, thumbs)
+            except Exception:
+                self._logger.warning("Failed to save thumbnails to " +
+                                     ensureUtf8(path), exc_info=True)
+
+
+    ###########################################################
+    def _append(self, path, thumbs):
+        """Append thumbnails to an archive.
+
+        @param  path    The path of the archive.
+        @param  thumbs  A list of (ms, data).
+        """
+        if path != self._path:
+            if self._path is not None and os.path.exists(self._path):
+                _writeIndex(self._path)
+            self._path = path
+
+            if os.path.exists(path):
+                # Drop whatever didn't get written all the way last time.
+                index = _readIndex(path)
+                if index.scannedTo < index.size:
+                    f = open(path, 'r+b')
+                    try:
+                        f.truncate(index.scannedTo)
+                    finally:
+                        f.close()
+
+        dirname = os.path.dirname(path)
+        if not os.path.isdir(dirname):
+            os.makedirs(dirname)
+
+        f = open(path, 'ab')
+        try:
+            for ms, data in thumbs:
+                f.write(_kHeader.pack(_kKindThumb, ms, len(data)) + data)
+        finally:
+            f.close()
+
+
+
+###############################################################
+class ThumbnailArchiveReader(object):
+    """Finds and reads thumbnails in archives.
+
+    Keeps the indexes of recently used archives, reading just what was
+    appended since when an archive grows.
+    """
+    ###########################################################
+    def __init__(self, maxArchives=_kMaxCachedArchives):
+        """Initializer for ThumbnailArchiveReader
+
+        @param  maxArchives  How many archive indexes to keep in memory.
+        """
+        self._maxArchives = maxArchives
+
+        # Guards everything below.
+        self._lock = threading.Lock()
+
+        # Path to _ArchiveIndex; least recently used first.
+        self._indexes = OrderedDict()
+
+
+    ###########################################################
+    def getTimes(self, path):
+        """Return the times of the thumbnails in an archive.
+
+        @param  path   The path of the archive.
+        @return times  A sorted list of times; empty if there's no archive.
+        """
+        self._lock.acquire()
+        try:
+            index = self._getIndex(path)
+            if index is None:
+                return []
+            return index.getTimes()
+        finally:
+            self._lock.release()
+
+
+    ###########################################################
+    def read(self, path, ms):
+        """Read a thumbnail from an archive.
+
+        @param  path  The path of the archive.
+        @param  ms    The time of the thumbnail, from getTimes().
+        @return data  The JPEG data, or None if there's no such thumbnail.
+        """
+        self._lock.acquire()
+        try:
+            for _ in xrange(2):
+                index = self._getIndex(path)
+                if index is None or not index.isThumb(ms):
+                    return None
+                offset, length = index.thumbs[ms]
+                data = _readThumb(path, offset, ms, length)
+                if data is not None:
+                    return data
+                # The archive was replaced by a new one; start over.
+                del self._indexes[path]
+            return None
+        finally:
+            self._lock.release()
+
+
+    ###########################################################
+    def _getIndex(self, path):
+        """Return the index of an archive, reading what's new in it.
+
+        Must be called with _lock held.
+
+        @param  path   The path of the archive.
+        @return index  The _ArchiveIndex, or None if there's no archive.
+        """
+        index = self._indexes.pop(path, None)
+        try:
+            size = os.path.getsize(path)
+        except OSError:
+            return None
+
+        if index is None or size < index.size:
+            index = _readIndex(path)
+        elif size > index.size:
+            _scanArchive(path, index)
+
+        self._indexes[path] = index
+        while len(self._indexes) > self._maxArchives:
+            self._indexes.popitem(last=False)
+        return index
+
+
+
+###############################################################
+class _ArchiveIndex(object):
+    """What's in an archive."""
+    def __init__(self):
+        # Time to (offset, length) of each thumbnail's data.
+        self.thumbs = {}
+        # Deleted ranges, as (first ms, last ms).
+        self.deleted = []
+        # How much of the archive we read, and how big it was.
+        self.scannedTo = 0
+        self.size = 0
+        # Sorted times of thumbnails not deleted; made when first asked for.
+        self._times = None
+
+    def isThumb(self, ms):
+        """Return True if there's a thumbnail at the given time."""
+        if ms not in self.thumbs:
+            return False
+        for start, stop in self.deleted:
+            if start <= ms <= stop:
+                return False
+        return True
+
+    def getTimes(self):
+        """Return the sorted times of thumbnails not deleted."""
+        if self._times is None:
+            self._times = sorted(ms for ms in self.thumbs
+                                 if self.isThumb(ms))
+        return self._times
+
+
+###############################################################
+def _readIndex(path):
+    """Read the index of an archive.
+
+    @param  path   The path of the archive.
+    @return index  A new _ArchiveIndex.
+    """
+    index = _ArchiveIndex()
+    _scanArchive(path, index)
+    return index
+
+
+###############################################################
+def _scanArchive(path, index):
+    """Read records of an archive past what an index has seen.
+
+    @param  path   The path of the archive.
+    @param  index  The _ArchiveIndex to add to.
+    """
+    f = open(path, 'rb')
+    try:
+        f.seek(0, os.SEEK_END)
+        size = f.tell()
+        pos = index.scannedTo
+
+        if pos == 0:
+            pos = _readTrailingIndex(f, size, index)
+
+        while pos + _kHeader.size <= size:
+            f.seek(pos)
+            kind, ms, length = _kHeader.unpack(f.read(_kHeader.size))
+            end = pos + _kHeader.size + length
+            if kind == _kKindIndex:
+                end += _kTrailer.size
+            elif kind not in (_kKindThumb, _kKindDeleted):
+                # Garbage; nothing past here can be trusted.
+                break
+            if end > size:
+                # Not all written yet.
+                break
+
+            if kind == _kKindThumb:
+                index.thumbs[ms] = (pos + _kHeader.size, length)
+            elif kind == _kKindDeleted:
+                stop, = _kDeletedData.unpack(f.read(_kDeletedData.size))
+                index.deleted.append((ms, stop))
+            pos = end
+
+        index.scannedTo = pos
+        index.size = size
+        index._times = None
+    finally:
+        f.close()
+
+
+###############################################################
+def _readTrailingIndex(f, size, index):
+    """Read the index at the end of an archive, if there is one.
+
+    @param  f      The open archive.
+    @param  size   The size of the archive.
+    @param  index  The _ArchiveIndex to add to.
+    @return pos    Where to continue reading records.
+    """
+    if size < _kHeader.size + _kTrailer.size:
+        return 0
+    f.seek(size - _kTrailer.size)
+    kind, indexPos = _kTrailer.unpack(f.read(_kTrailer.size))
+    if kind != _kKindTrailer or indexPos > size - _kTrailer.size - _kHeader.size:
+        return 0
+
+    f.seek(indexPos)
+    kind, numThumbs, length = _kHeader.unpack(f.read(_kHeader.size))
+    numDeleted, extra = divmod(length - numThumbs*_kIndexThumb.size,
+                               _kIndexDeleted.size)
+    if kind != _kKindIndex or numDeleted < 0 or extra or \
+       indexPos + _kHeader.size + length + _kTrailer.size != size:
+        return 0
+
+    data = f.read(length)
+    pos = 0
+    for _ in xrange(numThumbs):
+        ms, offset, thumbLength = _kIndexThumb.unpack_from(data, pos)
+        index.thumbs[ms] = (offset, thumbLength)
+        pos += _kIndexThumb.size
+    for _ in xrange(numDeleted):
+        index.deleted.append(_kIndexDeleted.unpack_from(data, pos))
+        pos += _kIndexDeleted.size
+    return size
+
+
+###############################################################
+def _writeIndex(path):
+    """Append an index of everything in an archive to it.
+
+    @param  path  The path of the archive.
+    """
+    index = _readIndex(path)
+    if index.scannedTo != index.size:
+        # Something went wrong writing it; readers will have to cope.
+        return
+
+    data = []
+    for ms, (offset, length) in sorted(index.thumbs.iteritems()):
+        data.append(_kIndexThumb.pack(ms, offset, length))
+    for start, stop in index.deleted:
+        data.append(_kIndexDeleted.pack(start, stop))
+    data = ''.join(data)
+
+    f = open(path, 'ab')
+    try:
+        f.write(_kHeader.pack(_kKindIndex, len(index.thumbs), len(data)) +
+                data + _kTrailer.pack(_kKindTrailer, index.size))
+    finally:
+        f.close()
+
+
+###############################################################
+def _readThumb(path, offset, ms, length):
+    """Read the data of a thumbnail, checking it's the one we expect.
+
+    @param  path    The path of the archive.
+    @param  offset  Where the data starts.
+    @param  ms      The time of the thumbnail.
+    @param  length  The length of the data.
+    @return data    The data, or None if it's not there.
+    """
+    f = open(path, 'rb')
+    try:
+        f.seek(offset - _kHeader.size)
+        header = f.read(_kHeader.size)
+        if len(header) != _kHeader.size or \
+           _kHeader.unpack(header) != (_kKindThumb, ms, length):
+            return None
+        data = f.read(length)
+        if len(data) != length:
+            return None
+        return data
+    finally:
+        f.close()
+
+
+
+##############################################################################
+def _testThumbnailArchive():
+    """Test writing and reading thumbnails.
+
+    >>> import shutil, tempfile, time
+    >>> from vitaToolbox.loggingUtils.LoggingUtils import EmptyLogger
+    >>> videoDir = tempfile.mkdtemp()
+    >>> hour = 1600002000000
+    >>> writer = ThumbnailWriter(videoDir, EmptyLogger(),
+    ...                          lambda frame, res: frame * res)
+    >>> reader = ThumbnailArchiveReader()
+
+    Thumbnails of an hour go into one archive, readable while being written:
+
+    >>> path = getThumbArchivePath(videoDir, 'Cam', hour + 1000)
+    >>> path[len(videoDir):] == os.path.join(os.sep + 'cam', '16000',
+    ...                                      'thumbs', '1600002000000.thb')
+    True
+    >>> for ms in (1000, 2000, 3000):
+    ...     writer.put('Cam', hour + ms, 'x', ms / 1000)
+    True
+    True
+    True
+    >>> time.sleep(.2)
+    >>> [ms - hour for ms in reader.getTimes(path)]
+    [1000, 2000, 3000]
+    >>> reader.read(path, hour + 2000), reader.read(path, hour + 2500)
+    ('xx', None)
+
+    Half written thumbnails are ignored, and dropped once writing goes on:
+
+    >>> open(path, 'ab').write(_kHeader.pack(_kKindThumb, hour + 4000, 100))
+    >>> [ms - hour for ms in reader.getTimes(path)]
+    [1000, 2000, 3000]
+    >>> writer.shutdown()
+    >>> writer = ThumbnailWriter(videoDir, EmptyLogger(),
+    ...                          lambda frame, res: frame * res)
+    >>> writer.put('cam', hour + 5000, 'y', 1)
+    True
+    >>> time.sleep(.2)
+    >>> [ms - hour for ms in reader.getTimes(path)]
+    [1000, 2000, 3000, 5000]
+
+    Thumbnails of the next hour end the archive with an index, which is
+    all a new reader needs:
+
+    >>> writer.put('cam', hour + _kArchiveMs, 'z', 1)
+    True
+    >>> writer.shutdown()
+    >>> index = _ArchiveIndex()
+    >>> f = open(path, 'rb')
+    >>> _readTrailingIndex(f, os.path.getsize(path), index) == \\
+    ...     os.path.getsize(path)
+    True
+    >>> f.close()
+    >>> sorted(index.thumbs) == [hour + ms for ms in (1000, 2000, 3000, 5000)]
+    True
+    >>> ThumbnailArchiveReader().read(path, hour + 5000)
+    'y'
+
+    Part of an hour is marked as deleted; the rest of it, the archive goes:
+
+    >>> removeThumbsBetween(path, hour, 0, hour + 2000)
+    (2, 0)
+    >>> reader.getTimes(path) == [hour + 3000, hour + 5000]
+    True
+    >>> reader.read(path, hour + 1000), getThumbArchiveInfo(path)[0]
+    (None, 2)
+    >>> removeThumbsBetween(path, hour, hour + 2001, hour + 6000)[0]
+    2
+    >>> os.path.exists(path), reader.getTimes(path)
+    (False, [])
+    >>> nextPath = getThumbArchivePath(videoDir, 'cam', hour + _kArchiveMs)
+    >>> [p for _, _, p in getThumbArchivePaths(videoDir, 'cam', hour,
+    ...     hour + _kArchiveMs)] == [path, nextPath]
+    True
+    >>> shutil.rmtree(videoDir)
+    """
+
+
+##############################################################################
+def test_main():
+    """OB_REDACT
+    Our main function, which runs test code
+    """
+    import doctest
+    doctest.testmod(verbose=True)
+
+
+##############################################################################
+if __name__ == '__main__':
+    test_main()
@@ -0,0 +1,356 @@
+#!/usr/bin/env python
+
+#*****************************************************************************
+#
+# TimeBase.py
+#     Stamps frames so their times never go back when the clock is changed.
+#
+#
+#*****************************************************************************
+#
+#
+# Copyright 2013-2022 Sighthound, Inc.
+#
+# Licensed under the GNU GPLv3 license found at
+# https://www.gnu.org/licenses/gpl-3.0.txt
+#
+# Alternative licensing available from Sighthound, Inc.
+# by emailing opensource@sighthound.com
+#
+# This file is part of the Sighthound Video project which can be found at
+# https://github.com/sighthoundinc/SighthoundVideo
+#
+# This program is free software; you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation; using version 3 of the License.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program; if not, write to the Free Software
+# Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02111, USA.
+#
+#
+#*****************************************************************************
+
+"""
+## @file
+Contains the TimeBase class.
+"""
+
+# Python imports...
+import collections
+import time
+
+# Common 3rd-party imports...
+
+# Toolbox imports...
+from vitaToolbox.sysUtils.TimeUtils import getMonotonicTime
+
+# Local imports...
+
+# How far the wall clock may move against the monotonic one between checks
+# before we call it a step, in ms.  NTP slews the clock much slower than
+# that; it only steps it when it's far off.
+_kStepThresholdMs = 2000
+
+# How many steps to remember.
+_kKeepSteps = 20
+
+
+###############################################################
+class TimeBase(object):
+    """Stamps a camera's frames, keeping their times going forward.
+
+    Frames come stamped with the wall clock, which can step forward or back,
+    like when NTP corrects it or the time zone is set wrong.  We find steps
+    by watching the wall clock against a monotonic one.  Data is cut into
+    segments around steps: whoever uses us finishes the clip it's recording
+    and calls newSegment().  Each segment has one offset added to its frame
+    times and clip times, the smallest one that keeps it after everything
+    stamped before, so clips and objects never overlap.
+
+    After a step back, times run ahead of the wall clock by about the size
+    of the step.  Each new segment pays that back by the time nothing was
+    stamped, like while the stream was reopened or the camera restarted.
+    """
+    ###########################################################
+    def __init__(self, logger, floorMs=None,
+                 stepThresholdMs=_kStepThresholdMs,
+                 wallClock=time.time, monotonicClock=getMonotonicTime):
+        """Initializer for TimeBase
+
+        @param  logger           The logger to use.
+        @param  floorMs          Times must be after this, like the end of
+                                 the newest clip already recorded; or None.
+        @param  stepThresholdMs  How far the clock must move to be a step.
+        @param  wallClock        Function returning the wall clock, in
+                                 seconds.
+        @param  monotonicClock   Function returning the monotonic clock, in
+                                 seconds.
+        """
+        self._logger = logger
+        self._stepThresholdMs = stepThresholdMs
+        self._wallClock = wallClock
+        self._monotonicClock = monotonicClock
+
+        # The wall clock less the monotonic one at the last check, in ms.
+        self._skewMs = None
+
+        # What's added to frame times in this segment, and the last time we
+        # gave out.
+        self._offsetMs = 0
+        self._lastMs = floorMs
+        self._segmentPending = True
+
+        # The latest steps as (wall clock ms after, step ms), oldest first.
+        self._steps = collections.deque(maxlen=_kKeepSteps)
+        self._numSteps = 0
+        self._numClamped = 0
+
+
+    ###########################################################
+    def checkStep(self):
+        """Check whether the wall clock stepped since the last call.
+
+        A new segment starts when it did.
+
+        @return stepMs  How far it stepped, or 0 if it didn't.
+        """
+        wallMs = self._wallClock()*1000
+        skewMs = wallMs - self._monotonicClock()*1000
+
+        stepMs = 0
+        if self._skewMs is not None and \
+           abs(skewMs - self._skewMs) > self._stepThresholdMs:
+            stepMs = int(skewMs - self._skewMs)
+            self._steps.append((int(wallMs), stepMs))
+            self._numSteps += 1
+            self._segmentPending = True
+            self._logger.warning("Clock stepped %+d ms, now %d" %
+                                 (stepMs, int(wallMs)))
+
+        # Follow slewing, so that it doesn't add up to a step.
+        self._skewMs = skewMs
+        return stepMs
+
+
+    ###########################################################
+    def newSegment(self):
+        """Start a new segment with the next frame, like after reopening the
+        stream; nothing from the last one may be stamped after this.
+        """
+        self._segmentPending = True
+
+
+    ###########################################################
+    def stamp(self, rawMs):
+        """Return the time to use for a frame.
+
+        Times only go forward, even if frames in a segment don't.
+
+        @param  rawMs  The frame's time from the wall clock, in ms.
+        @return ms     The time to use, in ms.
+        """
+        if self._segmentPending:
+            self._segmentPending = False
+            offsetMs = 0
+            if self._lastMs is not None:
+                offsetMs = max(0, self._lastMs + 1 - rawMs)
+            if offsetMs != self._offsetMs:
+                self._logger.info("Stamping frames %+d ms from the clock" %
+                                  offsetMs)
+                self._offsetMs = offsetMs
+
+        ms = rawMs + self._offsetMs
+        if self._lastMs is not None and ms <= self._lastMs:
+            ms = self._lastMs + 1
+            self._numClamped += 1
+        self._lastMs = ms
+        return ms
+
+
+    ###########################################################
+    def remapClip(self, firstMs, lastMs):
+        """Return the times to use for a clip of this segment.
+
+        @param  firstMs  The clip's first time from the wall clock, in ms.
+        @param  lastMs   The clip's last time from the wall clock, in ms.
+        @return firstMs  The first time to use, in ms.
+        @return lastMs   The last time to use, in ms.
+        """
+        return firstMs + self._offsetMs, lastMs + self._offsetMs
+
+
+    ###########################################################
+    def getOffset(self):
+        """Return what's added to frame times in this segment.
+
+        @return offsetMs  The offset, in ms.
+        """
+        return self._offsetMs
+
+
+    ###########################################################
+    def getSteps(self):
+        """Return the latest clock steps.
+
+        @return steps  A list of (wall clock ms after, step ms), oldest first.
+        """
+        return list(self._steps)
+
+
+    ###########################################################
+    def getStats(self):
+        """Return how often the clock stepped and frames went back.
+
+        @return numSteps    Times the clock stepped.
+        @return numClamped  Frames stamped later than their time, because
+                            they went back within a segment.
+        """
+        return self._numSteps, self._numClamped
+
+
+
+###############################################################
+class StampedClipManager(object):
+    """Adds clips to a ClipManager at the times of a TimeBase.
+
+    Clips are added as they're finished, before frames of the next segment
+    are stamped; they get the offset of the segment they were recorded in.
+    Everything else goes to the ClipManager as is.
+    """
+    ###########################################################
+    def __init__(self, clipMgr, timeBase):
+        """Initializer for StampedClipManager
+
+        @param  clipMgr   The ClipManager to add clips to.
+        @param  timeBase  The TimeBase stamping the clips' frames.
+        """
+        self._clipMgr = clipMgr
+        self._timeBase = timeBase
+
+
+    ###########################################################
+    def __getattr__(self, name):
+        return getattr(self._clipMgr, name)
+
+
+    ###########################################################
+    def addClip(self, filename, camLoc, firstMs, lastMs, *args, **kwargs):
+        """Insert a clip into the database; see ClipManager.addClip().
+
+        @param  filename  Name of the file to add
+        @param  camLoc    The location of the camera the clip was recorded at
+        @param  firstMs   The wall clock ms of the first frame
+        @param  lastMs    The wall clock ms of the final frame
+        """
+        firstMs, lastMs = self._timeBase.remapClip(firstMs, lastMs)
+        return self._clipMgr.addClip(filename, camLoc, firstMs, lastMs,
+                                     *args, **kwargs)
+
+
+
+##############################################################################
+def _testTimeBase():
+    """Test stamping a replayed stream while the clock steps.
+
+    >>> from vitaToolbox.loggingUtils.LoggingUtils import EmptyLogger
+    >>> class _Clock(object):
+    ...     mono, step = 0, 0
+    ...     def wall(self): return 1000000 + self.mono + self.step
+    >>> class _ClipManager(object):
+    ...     clips = []
+    ...     def addClip(self, filename, camLoc, firstMs, lastMs, prevFile):
+    ...         self.clips.append((firstMs, lastMs))
+    ...     def getMostRecentTimeAt(self, camLoc):
+    ...         return self.clips[-1][1]
+    >>> clock = _Clock()
+    >>> timeBase = TimeBase(EmptyLogger(), wallClock=clock.wall,
+    ...                     monotonicClock=lambda: clock.mono)
+    >>> clipMgr = StampedClipManager(_ClipManager(), timeBase)
+
+    Replay 5 frames a second, the way a camera does: each is stamped from
+    the wall clock, and ends up in the clip being recorded.  A step ends the
+    clip and starts a new segment.
+
+    >>> def replay(numFrames):
+    ...     times, raw = [], []
+    ...     for _ in xrange(numFrames):
+    ...         clock.mono += .2
+    ...         if timeBase.checkStep() and raw:
+    ...             clipMgr.addClip('cam', 'cam', raw[0], raw[-1], '')
+    ...             timeBase.newSegment(); raw = []
+    ...         raw.append(int(clock.wall()*1000))
+    ...         times.append(timeBase.stamp(raw[-1]))
+    ...     clipMgr.addClip('cam', 'cam', raw[0], raw[-1], '')
+    ...     return times
+    >>> def inOrder(times):
+    ...     return all(a < b for a, b in zip(times, times[1:]))
+    >>> def noOverlap(clips):
+    ...     return all(a[1] < b[0] for a, b in zip(clips, clips[1:]))
+
+    Without steps, frames keep the times of the clock:
+
+    >>> times = replay(10)
+    >>> times[0], times[-1], timeBase.getOffset()
+    (1000000200, 1000002000, 0)
+
+    A step forward just leaves a gap:
+
+    >>> clock.step = 3600
+    >>> times += replay(10)
+    >>> times[10] - times[9], timeBase.getOffset(), inOrder(times)
+    (3600200, 0, True)
+
+    A step back, even a small one, is stamped right after what came before,
+    and clips don't overlap:
+
+    >>> clock.step = 3597
+    >>> times += replay(10)
+    >>> timeBase.getOffset(), inOrder(times)
+    (2801, True)
+    >>> clock.step = 0
+    >>> times += replay(10)
+    >>> timeBase.getOffset(), inOrder(times)
+    (3599602, True)
+    >>> noOverlap(_ClipManager.clips)
+    True
+
+    A new process picks up after the newest clip; the time it was down pays
+    back the offset:
+
+    >>> clock.mono += 600
+    >>> timeBase = TimeBase(EmptyLogger(), clipMgr.getMostRecentTimeAt('cam'),
+    ...                     wallClock=clock.wall,
+    ...                     monotonicClock=lambda: clock.mono)
+    >>> clipMgr = StampedClipManager(_ClipManager(), timeBase)
+    >>> times += replay(10)
+    >>> timeBase.getOffset(), inOrder(times), noOverlap(_ClipManager.clips)
+    (2999403, True, True)
+
+    Small changes, like NTP slewing the clock, are not steps; frames going
+    back within a segment are stamped after the one before:
+
+    >>> clock.step = -1
+    >>> times += replay(2)
+    >>> inOrder(times), timeBase.getSteps(), timeBase.getStats()
+    (True, [], (0, 2))
+    """
+
+
+##############################################################################
+def test_main():
+    """OB_REDACT
+    Our main function, which runs test code
+    """
+    import doctest
+    doctest.testmod(verbose=True)
+
+
+##############################################################################
+if __name__ == '__main__':
+    test_main()
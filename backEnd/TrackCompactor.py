@@ -0,0 +1,696 @@
+#!/usr/bin/env python
+
+#*****************************************************************************
+#
+# TrackCompactor.py
+#    Error-bounded thinning of old motion data
+#
+#
+#*****************************************************************************
+#
+#
+# Copyright 2013-2022 Sighthound, Inc.
+#
+# Licensed under the GNU GPLv3 license found at
+# https://www.gnu.org/licenses/gpl-3.0.txt
+#
+# Alternative licensing available from Sighthound, Inc.
+# by emailing opensource@sighthound.com
+#
+# This file is part of the Sighthound Video project which can be found at
+# https://github.com/sighthoundinc/SighthoundVideo
+#
+# This program is free software; you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation; using version 3 of the License.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program; if not, write to the Free Software
+# Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02111, USA.
+#
+#*****************************************************************************
+
+
+"""
+## @file
+Contains the TrackCompactor class, which thins out the motion table once
+tracks are old enough that nobody is watching them live anymore.
+
+Most of an object's track is boxes moving smoothly from one frame to the
+next.  The compactor runs a Douglas-Peucker style simplification over each
+track (x1, y1, x2, y2 against time) and drops every row that linear
+interpolation between the rows it keeps can rebuild to within a few pixels.
+
+Dropped rows aren't forgotten: for each kept row that ends a run of dropped
+ones, the exact times of the dropped frames go in the motionSpans table.  The
+DataManager uses that to put the rows back when reading motion, so triggers
+still see one row per frame with the original frame numbers and times.
+
+On top of the pixel tolerance, rows are pinned whenever rebuilding them would
+change the answer of any saved query for the camera (region containment or
+line / edge crossings), so searching those queries gives the same results
+before and after compaction.
+
+This module is imported by the DataManager, so it must not import it back;
+trigger and query modules are only pulled in when guards are built.
+"""
+
+# Python imports...
+from array import array
+import cPickle
+import os
+import time
+
+# Common 3rd-party imports...
+
+# Toolbox imports...
+
+# Local imports...
+from appCommon.CommonStrings import kAnyCameraStr, kQueryExt
+
+# Constants...
+
+# The longest a single span of dropped rows may cover.  Readers widen their
+# queries by this much to find the rows on both sides of a span, so keep it
+# modest.  Must also fit the 16-bit deltas we pack times into.
+kMaxSpanMs = 10000
+
+# Defaults; may be overridden by debug prefs (see DiskCleaner).
+kDefaultTolerancePx = 2
+kDefaultAgeHours = 24
+
+# Typecode for the packed times of a span; ms offsets from the row before it.
+_kSpanTypecode = 'H'
+
+# Number of objects to look at per batch, between commits.
+_kBatchSize = 50
+
+# Names of the values in the trackCompaction table.
+_kLastStopName = 'lastStop'
+_kLastUidName = 'lastUid'
+_kRowsRemovedName = 'rowsRemoved'
+_kSpanBytesName = 'spanBytes'
+
+# Rough size of a motion row plus its index entry, in bytes.  Only used to
+# report an estimate of the space saved.
+_kApproxMotionRowBytes = 60
+
+_kHourMs = 60 * 60 * 1000
+
+
+##############################################################################
+def interpolateBbox(prevBbox, prevMs, bbox, ms, atMs):
+    """Linearly interpolate a bounding box at a time between two others.
+
+    @param  prevBbox  The earlier box, as (x1, y1, x2, y2).
+    @param  prevMs    The time of prevBbox.
+    @param  bbox      The later box, as (x1, y1, x2, y2).
+    @param  ms        The time of bbox; must be > prevMs.
+    @param  atMs      The time to interpolate at.
+    @return bbox      The interpolated box, as ints.
+
+    >>> interpolateBbox((0, 0, 10, 10), 0, (10, 20, 30, 40), 100, 50)
+    (5, 10, 20, 25)
+    >>> interpolateBbox((0, 0, 10, 10), 0, (10, 20, 30, 40), 100, 0)
+    (0, 0, 10, 10)
+    >>> interpolateBbox((0, 0, 10, 10), 0, (1, 1, 11, 11), 100, 33)
+    (0, 0, 10, 10)
+    """
+    frac = float(atMs - prevMs) / (ms - prevMs)
+    return tuple([int(round(a + (b - a) * frac))
+                  for a, b in zip(prevBbox, bbox)])
+
+
+##############################################################################
+def packMotionSpan(rows, first, last):
+    """Build the motionSpans entry for the rows dropped between two kept ones.
+
+    @param  rows   The rows of the track; each starts (x1, y1, x2, y2, frame,
+                   time).
+    @param  first  The index of the kept row before the span.
+    @param  last   The index of the kept row after the span.
+    @return time   The time of the row ending the span.
+    @return times  The packed times of the dropped rows.
+
+    >>> rows = [(0, 0, 1, 1, i, 1000 + i * 33) for i in range(4)]
+    >>> ms, times = packMotionSpan(rows, 0, 3)
+    >>> ms, list(array('H', times))
+    (1099, [33, 66])
+    """
+    firstMs = rows[first][5]
+    times = array(_kSpanTypecode, [rows[i][5] - firstMs
+                                   for i in xrange(first+1, last)])
+    return rows[last][5], times.tostring()
+
+
+##############################################################################
+def expandMotionSpan(prevBox, box, times):
+    """Rebuild the rows dropped between two kept motion rows.
+
+    @param  prevBox  The kept row before the span, as returned by the
+                     DataManager: (x1, y1, x2, y2, frame, time, objUid).
+    @param  box      The kept row ending the span, same format.
+    @param  times    The packed times of the span, from packMotionSpan().
+    @return boxes    The rebuilt rows, in the same format; empty if the span
+                     doesn't fit between the two rows (part of the track was
+                     deleted).
+
+    >>> rows = [(i*2, 0, i*2 + 10, 10, 5 + i, 1000 + i * 33, 7)
+    ...         for i in range(4)]
+    >>> _, times = packMotionSpan(rows, 0, 3)
+    >>> expandMotionSpan(rows[0], rows[3], times) == rows[1:3]
+    True
+    >>> expandMotionSpan(rows[1], rows[3], times)
+    []
+    """
+    deltas = array(_kSpanTypecode)
+    deltas.fromstring(str(times))
+
+    prevFrame, prevMs = prevBox[4], prevBox[5]
+    if len(deltas) != box[4] - prevFrame - 1:
+        return []
+
+    prevBbox = prevBox[:4]
+    bbox = box[:4]
+    ms = box[5]
+    objId = box[6]
+    return [interpolateBbox(prevBbox, prevMs, bbox, ms, prevMs + delta) +
+            (prevFrame + i + 1, prevMs + delta, objId)
+            for i, delta in enumerate(deltas)]
+
+
+##############################################################################
+def rebuildTrack(rows, keep):
+    """Return what a track looks like after compaction and expansion.
+
+    @param  rows   The rows of the track; each starts (x1, y1, x2, y2, frame,
+                   time).
+    @param  keep   The sorted indices of the kept rows.
+    @return rows   A row for each row given, with dropped ones interpolated.
+    """
+    rebuilt = list(rows)
+    for first, last in zip(keep, keep[1:]):
+        a = rows[first]
+        b = rows[last]
+        for i in xrange(first+1, last):
+            rebuilt[i] = interpolateBbox(a[:4], a[5], b[:4], b[5],
+                                         rows[i][5]) + tuple(rows[i][4:])
+    return rebuilt
+
+
+##############################################################################
+def _getInterpolationError(prevRow, row, midRow):
+    """Return how far off interpolating midRow from its neighbors would be.
+
+    @param  prevRow  The kept row before.
+    @param  row      The kept row after.
+    @param  midRow   The row to check.
+    @return error    The largest difference of any coordinate, in pixels.
+    """
+    bbox = interpolateBbox(prevRow[:4], prevRow[5], row[:4], row[5],
+                           midRow[5])
+    return max([abs(a - b) for a, b in zip(bbox, midRow[:4])])
+
+
+##############################################################################
+def simplifyTrack(rows, tolerance, maxSpanMs=kMaxSpanMs, pinned=()):
+    """Pick which rows of a track need to be kept.
+
+    The first and last row are always kept, as are rows on both sides of a
+    break in frame numbers, plus anything in pinned.  Between those, the row
+    that interpolation gets most wrong is kept until every other row can be
+    rebuilt within the tolerance.
+
+    @param  rows       The rows of the track, ordered by time; each starts
+                       (x1, y1, x2, y2, frame, time).
+    @param  tolerance  The most any coordinate of a dropped row may be off by
+                       when rebuilt, in pixels.
+    @param  maxSpanMs  The longest time allowed between two kept rows.
+    @param  pinned     Indices of extra rows that must be kept.
+    @return keep       The sorted list of indices of rows to keep.
+
+    >>> line = [(i, 0, i+10, 10, i, i*100) for i in range(10)]
+    >>> simplifyTrack(line, 0)
+    [0, 9]
+    >>> simplifyTrack(line, 0, 450)
+    [0, 4, 6, 9]
+    >>> simplifyTrack(line, 0, pinned=[3])
+    [0, 3, 9]
+    >>> bend = [(0, 0, 10, 10, 0, 0), (5, 0, 15, 10, 1, 100),
+    ...         (10, 0, 20, 10, 2, 200), (10, 5, 20, 15, 3, 300),
+    ...         (10, 10, 20, 20, 4, 400)]
+    >>> simplifyTrack(bend, 1)
+    [0, 2, 4]
+    >>> simplifyTrack(bend, 5)
+    [0, 4]
+    >>> gap = [(0, 0, 10, 10, f, f*100) for f in (0, 1, 2, 5, 6, 7)]
+    >>> simplifyTrack(gap, 1)
+    [0, 2, 3, 5]
+    """
+    numRows = len(rows)
+    if numRows < 3:
+        return range(numRows)
+
+    keep = set([0, numRows-1])
+    keep.update(pinned)
+
+    # Never interpolate over a break in the frames; there's no way to know
+    # what happened there, and triggers treat the break as meaningful.
+    for i in xrange(1, numRows):
+        if rows[i][4] != rows[i-1][4] + 1 or rows[i][5] <= rows[i-1][5]:
+            keep.add(i-1)
+            keep.add(i)
+
+    anchors = sorted(keep)
+    pending = zip(anchors, anchors[1:])
+    while pending:
+        first, last = pending.pop()
+        if last - first < 2:
+            continue
+
+        if rows[last][5] - rows[first][5] > maxSpanMs:
+            split = (first + last) // 2
+        else:
+            split = None
+            worstError = tolerance
+            for i in xrange(first+1, last):
+                error = _getInterpolationError(rows[first], rows[last],
+                                               rows[i])
+                if error > worstError:
+                    split = i
+                    worstError = error
+
+        if split is not None:
+            keep.add(split)
+            pending.append((first, split))
+            pending.append((split, last))
+
+    return sorted(keep)
+
+
+##############################################################################
+def findProcSize(procSizesMsRange, ms):
+    """Find the size a camera was processed at, at a given time.
+
+    @param  procSizesMsRange  As returned by the ClipManager's
+                              getUniqueProcSizesBetweenTimes().
+    @param  ms                The time of interest.
+    @return procSize          (width, height), or None if not known.
+
+    >>> findProcSize([(320, 240, None, None)], 5)
+    (320, 240)
+    >>> findProcSize([(320, 240, 0, 9), (640, 480, 10, 99)], 10)
+    (640, 480)
+    >>> findProcSize([(320, 240, 0, 9), (640, 480, 10, 99)], 100)
+    >>> findProcSize([], 100)
+    """
+    if len(procSizesMsRange) == 1:
+        return tuple(procSizesMsRange[0][:2])
+    for procWidth, procHeight, firstMs, lastMs in procSizesMsRange:
+        if firstMs <= ms <= lastMs:
+            return (procWidth, procHeight)
+    return None
+
+
+##############################################################################
+class _TrackGuard(object):
+    """The spatial tests of one saved query, in the form compaction needs."""
+    ###########################################################
+    def __init__(self, whereTrigger):
+        """Initializer for _TrackGuard
+
+        @param  whereTrigger  The where trigger of the query.  Region and line
+                              triggers are guarded; door triggers only look at
+                              the first and last rows, which are always kept.
+        """
+        self._trigger = whereTrigger
+        self._coordSpace = None
+
+        if hasattr(whereTrigger, 'getLineTriggers'):
+            self._regionTrigger = whereTrigger
+            self._lineTriggers = list(whereTrigger.getLineTriggers())
+        elif hasattr(whereTrigger, 'optimizedDidObjCrossLine'):
+            self._regionTrigger = None
+            self._lineTriggers = [whereTrigger]
+        else:
+            self._regionTrigger = None
+            self._lineTriggers = []
+
+
+    ###########################################################
+    def isNeeded(self):
+        """Return whether this guard checks anything at all.
+
+        @return isNeeded  True if rows must be checked against this guard.
+        """
+        return bool(self._regionTrigger or self._lineTriggers)
+
+
+    ###########################################################
+    def getState(self, prevBox, box, coordSpace):
+        """Return everything a trigger of the query would decide about a row.
+
+        @param  prevBox     The row before box for the same object, or None.
+        @param  box         The row; starts (x1, y1, x2, y2).
+        @param  coordSpace  The processing size at the time of box.
+        @return state       A tuple that must not change for the row.
+        """
+        if coordSpace != self._coordSpace:
+            self._coordSpace = coordSpace
+            if self._regionTrigger is not None:
+                self._regionTrigger.setProcessingCoordSpace(coordSpace)
+            for lineTrigger in self._lineTriggers:
+                lineTrigger.setProcessingCoordSpace(coordSpace)
+
+        state = []
+        if self._regionTrigger is not None:
+            state.append(self._regionTrigger.optimizedIsPointInside(*box[:4]))
+        if prevBox is not None:
+            state.extend([lineTrigger.optimizedDidObjCrossLine(prevBox, box)
+                          for lineTrigger in self._lineTriggers])
+        return tuple(state)
+
+
+##############################################################################
+class TrackCompactor(object):
+    """Thins out old motion data in the object database."""
+    ###########################################################
+    def __init__(self, logger, dataMgr, clipMgr, ruleDir,
+                 tolerance=kDefaultTolerancePx, ageHours=kDefaultAgeHours,
+                 maxSpanMs=kMaxSpanMs):
+        """Initializer for TrackCompactor
+
+        @param  logger     An instance of a VitaLogger to use.
+        @param  dataMgr    The DataManager of the database to compact.
+        @param  clipMgr    A ClipManager, to look up processing sizes.
+        @param  ruleDir    Directory with the saved queries to guard.
+        @param  tolerance  The most a coordinate of a dropped row may be off
+                           by when rebuilt, in pixels.
+        @param  ageHours   Only tracks that ended at least this long ago are
+                           compacted.
+        @param  maxSpanMs  The longest time allowed between two kept rows; no
+                           more than kMaxSpanMs.
+        """
+        assert 0 < maxSpanMs <= kMaxSpanMs
+
+        self._logger = logger
+        self._dataMgr = dataMgr
+        self._clipMgr = clipMgr
+        self._ruleDir = ruleDir
+        self._tolerance = tolerance
+        self._ageMs = int(ageHours * _kHourMs)
+        self._maxSpanMs = maxSpanMs
+
+        # Guards, keyed by camera location; kAnyCameraStr applies to all.
+        self._guards = {}
+        self._ruleDirMtime = None
+
+
+    ###########################################################
+    def loadGuards(self):
+        """Build guards from the saved queries, if they changed since last time.
+
+        Any query that can't be loaded is logged and skipped; its camera will
+        still be compacted within the pixel tolerance.
+        """
+        try:
+            mtime = os.path.getmtime(self._ruleDir)
+        except OSError:
+            mtime = None
+        if mtime == self._ruleDirMtime and mtime is not None:
+            return
+        self._ruleDirMtime = mtime
+
+        # Only needed here, and pull in the search library...
+        from SavedQueryDataModel import convertOld2NewSavedQueryDataModel
+
+        self._guards = {}
+        if mtime is None:
+            return
+
+        for fileName in os.listdir(self._ruleDir):
+            if os.path.splitext(fileName)[1] != kQueryExt:
+                continue
+            try:
+                queryFile = file(os.path.join(self._ruleDir, fileName), 'r')
+                try:
+                    queryModel = cPickle.load(queryFile)
+                finally:
+                    queryFile.close()
+
+                convertOld2NewSavedQueryDataModel(self._dataMgr, queryModel)
+                guard = _TrackGuard(queryModel.getWhereTrigger(self._dataMgr))
+                if guard.isNeeded():
+                    camLoc = queryModel.getVideoSource().getLocationName()
+                    self._guards.setdefault(camLoc, []).append(guard)
+            except Exception:
+                self._logger.warning("Couldn't load query %s for track "
+                                     "compaction" % fileName, exc_info=True)
+
+
+    ###########################################################
+    def setGuards(self, camLoc, whereTriggers):
+        """Set the guards for a camera directly, instead of from saved queries.
+
+        @param  camLoc         The camera location, or kAnyCameraStr.
+        @param  whereTriggers  A list of where triggers to guard.
+        """
+        self._guards[camLoc] = [_TrackGuard(trigger)
+                                for trigger in whereTriggers]
+        self._ruleDirMtime = None
+
+
+    ###########################################################
+    def compactSome(self, nowMs=None, maxObjects=_kBatchSize):
+        """Compact the next batch of old objects.
+
+        @param  nowMs       The current time, in ms; None for now.
+        @param  maxObjects  The most objects to look at.
+        @return moreToDo    True if there are more objects waiting.
+        @return stats       A dict with the work done by this batch: objects,
+                            rowsRemoved, spanBytes and freedBytes (bytes that
+                            went onto SQLite's free list).
+        """
+        if nowMs is None:
+            nowMs = int(time.time() * 1000)
+
+        dataMgr = self._dataMgr
+        lastStop = dataMgr.getTrackCompactionValue(_kLastStopName)
+        lastUid = dataMgr.getTrackCompactionValue(_kLastUidName)
+
+        objects = dataMgr.getObjectsToCompact(lastStop, lastUid,
+                                              nowMs - self._ageMs, maxObjects)
+
+        stats = {'objects': len(objects), 'rowsRemoved': 0, 'spanBytes': 0,
+                 'freedBytes': 0}
+        if not objects:
+            return False, stats
+
+        freeBefore = dataMgr.getFreeBytes()
+
+        for objId, camLoc, timeStop in objects:
+            rows = dataMgr.getRawObjectMotion(objId)
+            keep = None
+            if rows:
+                keep = self._pickRowsToKeep(rows, camLoc)
+
+            if keep is not None and len(keep) < len(rows):
+                keepSet = set(keep)
+                dropTimes = [rows[i][5] for i in xrange(len(rows))
+                             if i not in keepSet]
+                spans = [packMotionSpan(rows, first, last)
+                         for first, last in zip(keep, keep[1:])
+                         if last - first > 1]
+                dataMgr.compactObjectMotion(objId, dropTimes, spans)
+
+                stats['rowsRemoved'] += len(dropTimes)
+                stats['spanBytes'] += sum([len(times) for _, times in spans])
+
+            lastStop, lastUid = timeStop, objId
+
+        dataMgr.setTrackCompactionValue(_kLastStopName, lastStop)
+        dataMgr.setTrackCompactionValue(_kLastUidName, lastUid)
+        for key, name in (('rowsRemoved', _kRowsRemovedName),
+                          ('spanBytes', _kSpanBytesName)):
+            dataMgr.setTrackCompactionValue(name, stats[key] +
+                dataMgr.getTrackCompactionValue(name))
+        dataMgr.save()
+
+        stats['freedBytes'] = max(0, dataMgr.getFreeBytes() - freeBefore)
+
+        return len(objects) == maxObjects, stats
+
+
+    ###########################################################
+    def getTotals(self):
+        """Return the work done by the compactor over the life of the database.
+
+        @return rowsRemoved  The number of motion rows removed.
+        @return savedBytes   An estimate of the bytes saved, after paying for
+                             the spans.
+        """
+        rowsRemoved = self._dataMgr.getTrackCompactionValue(_kRowsRemovedName)
+        spanBytes = self._dataMgr.getTrackCompactionValue(_kSpanBytesName)
+        return rowsRemoved, rowsRemoved * _kApproxMotionRowBytes - spanBytes
+
+
+    ###########################################################
+    def _pickRowsToKeep(self, rows, camLoc):
+        """Decide which rows of one object's track to keep.
+
+        @param  rows    The motion rows of the object, ordered by time.
+        @param  camLoc  The camera location of the object.
+        @return keep    Sorted indices of the rows to keep, or None to leave
+                        the object alone.
+        """
+        guards = self._guards.get(camLoc, []) + \
+                 self._guards.get(kAnyCameraStr, [])
+
+        if guards:
+            # The triggers work in processing coordinates, so we have to know
+            # what those were for every row, or we can't check anything.
+            procSizesMsRange = self._clipMgr.getUniqueProcSizesBetweenTimes(
+                camLoc, rows[0][5], rows[-1][5])
+            coordSpaces = [findProcSize(procSizesMsRange, row[5])
+                           for row in rows]
+            if None in coordSpaces:
+                return None
+            expected = self._getGuardStates(guards, rows, coordSpaces)
+
+        pinned = set()
+        while True:
+            keep = simplifyTrack(rows, self._tolerance, self._maxSpanMs,
+                                 pinned)
+            if not guards or len(keep) == len(rows):
+                return keep
+
+            actual = self._getGuardStates(guards, rebuildTrack(rows, keep),
+                                          coordSpaces)
+            wrong = [i for i in xrange(len(rows)) if actual[i] != expected[i]]
+            if not wrong:
+                return keep
+
+            # Keep the real rows there; a crossing depends on the row before
+            # too, so keep that as well.
+            pinned.update(wrong)
+            pinned.update([i-1 for i in wrong if i > 0])
+
+
+    ###########################################################
+    def _getGuardStates(self, guards, rows, coordSpaces):
+        """Return the guard states of each row of a track.
+
+        @param  guards       The guards to check.
+        @param  rows         The rows of the track.
+        @param  coordSpaces  The processing size at each row.
+        @return states       A list with a tuple of states for each row.
+        """
+        states = []
+        prevBox = None
+        for box, coordSpace in zip(rows, coordSpaces):
+            states.append(tuple([guard.getState(prevBox, box, coordSpace)
+                                 for guard in guards]))
+            prevBox = box
+        return states
+
+
+
+##############################################################################
+def _testTriggerResults():
+    """Compact a database of made up tracks; check that searches don't change.
+
+    Needs the search library; returns the number of rows removed.
+    """
+    import shutil
+    import tempfile
+
+    from vitaToolbox.loggingUtils.LoggingUtils import getLogger
+    from vitaToolbox.math.LineSegment import LineSegment
+    from DataManager import DataManager
+    from triggers.LineTrigger import LineTrigger
+    from triggers.RegionTrigger import RegionTrigger
+    from triggers.TriggerLineSegment import TriggerLineSegment
+    from triggers.TriggerRegion import TriggerRegion
+
+    class _FakeClipMgr(object):
+        def getUniqueProcSizesBetweenTimes(self, camLoc, startTime=None,
+                                           endTime=None):
+            return [(320, 240, None, None)]
+
+    tmpDir = tempfile.mkdtemp()
+    try:
+        logger = getLogger('TrackCompactorTest.log', tmpDir)
+        dataMgr = DataManager(logger)
+        dataMgr.open(os.path.join(unicode(tmpDir), u"objdb2"))
+
+        # Objects drifting across the frame, with a gap and a wobble that's
+        # under the tolerance but crosses one of the lines.
+        for n in xrange(6):
+            objId = dataMgr.addObject(1000, 'person', 'cam')
+            for frame in xrange(200):
+                if n == 3 and 90 <= frame < 95:
+                    continue
+                x = (frame * (n + 1)) % 300
+                y = 100 + (frame % 7) + n * 10
+                dataMgr.addFrame(objId, frame, 1000 + frame * 100,
+                                 (x, y, x + 20, y + 40), 'person', None)
+        dataMgr.save()
+
+        coordSpace = (320, 240)
+        region = TriggerRegion([(100, 50), (200, 50), (200, 200), (100, 200)],
+                               coordSpace)
+        lines = [TriggerLineSegment(LineSegment(150, 0, 150, 239), 'any',
+                                    coordSpace),
+                 TriggerLineSegment(LineSegment(0, 123, 319, 123), 'left',
+                                    coordSpace)]
+        triggers = [RegionTrigger(dataMgr, region, 'center', regionType)
+                    for regionType in ('inside', 'outside', 'entering',
+                                       'exiting', 'crosses')]
+        triggers.append(RegionTrigger(dataMgr, region, 'bottom', 'inside'))
+        triggers.extend([LineTrigger(dataMgr, line, 'center')
+                         for line in lines])
+
+        procSizes = [(320, 240, None, None)]
+        def search():
+            results = []
+            for trigger in triggers:
+                for start, stop in ((None, None), (5000, 9050)):
+                    trigger.reset()
+                    results.append(sorted(trigger.search(start, stop,
+                                          'single', procSizes)))
+            return results
+
+        before = search()
+
+        compactor = TrackCompactor(logger, dataMgr, _FakeClipMgr(), tmpDir,
+                                   tolerance=8, ageHours=0)
+        compactor.setGuards('cam', triggers)
+        moreToDo, stats = compactor.compactSome(nowMs=10**12)
+        assert not moreToDo
+        assert stats['rowsRemoved'] > 0
+
+        assert search() == before
+        dataMgr.close()
+        return stats['rowsRemoved']
+    finally:
+        shutil.rmtree(tmpDir, True)
+
+
+##############################################################################
+def test_main():
+    """OB_REDACT
+    Our main function, which runs test code
+    """
+    import doctest
+    doctest.testmod(verbose=True)
+    print "Trigger results unchanged; %d rows removed" % _testTriggerResults()
+
+
+##############################################################################
+if __name__ == '__main__':
+    test_main()
@@ -0,0 +1,493 @@
+#!/usr/bin/env python
+
+#*****************************************************************************
+#
+# VideoRelocator.py
+#    Moves the video archive to a new location while cameras keep recording
+#
+#
+#*****************************************************************************
+#
+#
+# Copyright 2013-2022 Sighthound, Inc.
+#
+# Licensed under the GNU GPLv3 license found at
+# https://www.gnu.org/licenses/gpl-3.0.txt
+#
+# Alternative licensing available from Sighthound, Inc.
+# by emailing opensource@sighthound.com
+#
+# This file is part of the Sighthound Video project which can be found at
+# https://github.com/sighthoundinc/SighthoundVideo
+#
+# This program is free software; you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation; using version 3 of the License.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program; if not, write to the Free Software
+# Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02111, USA.
+#
+#*****************************************************************************
+
+
+"""
+## @file
+Contains the VideoRelocator class, which moves an existing video archive to a
+new folder in the background.
+
+Moving the archive used to mean stopping everything until every file was
+moved, which can take hours for a big archive on another drive.  Instead, new
+video is recorded straight into the new folder, and the ClipManager keeps a
+map of the clips that are still in the old one (see
+ClipManager.beginRelocation()), so everybody can keep finding them.
+
+The relocator copies those clips over, oldest first, a few at a time.  Each
+copy is verified before the clip is marked as moved, and only then is the old
+copy deleted.  Once all clips are over, whatever is left in the old folder
+(thumbnails, mostly) is moved and the old folder is removed.  Since the state
+lives in the clip database, a move picks up where it left off after a
+restart, and it can be turned around with reverse().
+"""
+
+# Python imports...
+import os
+import time
+
+# Common 3rd-party imports...
+
+# Toolbox imports...
+from vitaToolbox.loggingUtils.LoggingUtils import EmptyLogger
+
+# Local imports...
+from StorageMover import StorageMover, kPartialSuffix
+
+# Constants...
+
+_kDefaultWorkers = 2
+_kDefaultMaxInFlight = 4
+
+# How often to look for more clips to copy, in seconds.
+_kRefillSecs = 1
+
+# How long to wait before trying a failed copy again, in seconds.
+_kRetrySecs = 60
+
+# Key prefix for moves of leftover files during the final sweep.
+_kSweepKey = 'sweep'
+
+
+##############################################################################
+class VideoRelocator(object):
+    """Copies clips to the current video folder; driven by update()."""
+    ###########################################################
+    def __init__(self, logger, clipMgr, deleteFn, numWorkers=_kDefaultWorkers,
+                 maxInFlight=_kDefaultMaxInFlight, bytesPerSec=0):
+        """Initializer for VideoRelocator
+
+        @param  logger       Logger to use, or None.
+        @param  clipMgr      The ClipManager with a relocation in progress.
+        @param  deleteFn     Called with the path of an old copy once it's no
+                             longer needed; normally hands it to the disk
+                             cleaner.
+        @param  numWorkers   The most copies to run at once.
+        @param  maxInFlight  The most copies to have queued at once.
+        @param  bytesPerSec  The most bytes per second to copy; 0 for no
+                             limit.
+        """
+        self._logger = EmptyLogger() if logger is None else logger
+        self._clipMgr = clipMgr
+        self._deleteFn = deleteFn
+        self._numWorkers = numWorkers
+        self._maxInFlight = max(1, maxInFlight)
+        self._bytesPerSec = bytesPerSec
+
+        self._fromDir, self._toDir, _, _ = clipMgr.getRelocationInfo()
+        assert self._fromDir is not None, "No relocation in progress"
+
+        self._mover = None
+        self._startMover()
+
+        # Key = move key, value = (source path, destination path).
+        self._inFlight = {}
+
+        # Key = filename, value = time after which to try it again.
+        self._retryTimes = {}
+
+        self._lastRefill = None
+        self._bytesCopied = 0
+        self._numFailures = 0
+
+        # Walks the old folder during the final sweep; None until then.
+        self._sweepWalk = None
+        self._done = False
+
+
+    ###########################################################
+    def _startMover(self):
+        """Create the mover used for copies, limited to our bandwidth."""
+        self._mover = StorageMover(self._logger, self._numWorkers, True)
+        self._mover.setBandwidthLimit(self._toDir, self._bytesPerSec)
+
+
+    ###########################################################
+    def isDone(self):
+        """Return whether the move has finished.
+
+        @return isDone  True once everything is in the new folder.
+        """
+        return self._done
+
+
+    ###########################################################
+    def getProgress(self):
+        """Return how far along the move is.
+
+        @return progress  A dict with 'fromDir', 'toDir', 'total' and
+                          'remaining' clips, 'inFlight' copies, 'bytesCopied',
+                          'failures' and whether we're in the final 'sweep'.
+        """
+        fromDir, toDir, total, remaining = self._clipMgr.getRelocationInfo()
+        return {
+            'fromDir': fromDir,
+            'toDir': toDir,
+            'total': total,
+            'remaining': remaining,
+            'inFlight': len(self._inFlight),
+            'bytesCopied': self._bytesCopied,
+            'failures': self._numFailures,
+            'sweep': self._sweepWalk is not None,
+        }
+
+
+    ###########################################################
+    def update(self, now=None):
+        """Collect finished copies and start new ones; never blocks on I/O.
+
+        Meant to be called from the owner's main loop.
+
+        @param  now     The current time; None to use time.time().
+        @return isDone  True once everything is in the new folder.
+        """
+        if self._done:
+            return True
+        if now is None:
+            now = time.time()
+
+        for key, success, numBytes, _, error in self._mover.getResults():
+            src, dst = self._inFlight.pop(key)
+            if key[0] == _kSweepKey:
+                self._handleSweepResult(src, success, numBytes, error)
+            else:
+                self._handleClipResult(key[1], src, dst, success, numBytes,
+                                       error, now)
+
+        if len(self._inFlight) >= self._maxInFlight or \
+           (self._lastRefill is not None and
+            now < self._lastRefill + _kRefillSecs):
+            return False
+        self._lastRefill = now
+
+        if self._sweepWalk is None:
+            if self._startClipCopies(now) or self._inFlight or \
+               self._retryTimes:
+                return False
+            self._logger.info("All clips moved to %s, moving what's left" %
+                              self._toDir)
+            self._sweepWalk = self._walkLeftovers()
+
+        if not self._startSweepMoves() and not self._inFlight:
+            self._finish()
+
+        return self._done
+
+
+    ###########################################################
+    def reverse(self):
+        """Turn the move around, back to where it came from.
+
+        Copies in progress are abandoned.
+
+        @return toDir  The folder video is now being moved to.
+        """
+        self._mover.shutdown()
+        self._inFlight = {}
+        self._retryTimes = {}
+        self._sweepWalk = None
+        self._fromDir, self._toDir = self._clipMgr.reverseRelocation()
+        self._startMover()
+        self._logger.info("Reversed video move; now from %s to %s" %
+                          (self._fromDir, self._toDir))
+        return self._toDir
+
+
+    ###########################################################
+    def shutdown(self):
+        """Stop copying; the move resumes when we're created again."""
+        self._mover.shutdown()
+
+
+    ###########################################################
+    def _startClipCopies(self, now):
+        """Queue copies of the oldest clips that still need moving.
+
+        @param  now      The current time.
+        @return started  True if there were clips left to queue.
+        """
+        busy = set(key[1] for key in self._inFlight)
+        busy.update(filename for filename, retryTime in
+                    self._retryTimes.iteritems() if retryTime > now)
+        clips = self._clipMgr.getClipsToRelocate(
+            self._maxInFlight-len(self._inFlight), busy)
+
+        for filename, videoDir in clips:
+            self._retryTimes.pop(filename, None)
+            src = os.path.join(videoDir, filename)
+            dst = os.path.join(self._toDir, filename)
+            if not os.path.isfile(src):
+                # Nothing to copy; most likely removed by the disk cleaner.
+                self._logger.warning("Clip to move is missing: %s" % src)
+                self._clipMgr.setClipRelocated(filename)
+                continue
+            key = ('clip', filename)
+            if self._mover.submit(key, src, dst, True):
+                self._inFlight[key] = (src, dst)
+
+        return bool(clips)
+
+
+    ###########################################################
+    def _handleClipResult(self, filename, src, dst, success, numBytes, error,
+                          now):
+        """Deal with a finished copy of a clip.
+
+        @param  filename  Name of the clip.
+        @param  src       The path copied from.
+        @param  dst       The path copied to.
+        @param  success   True if the copy was made and verified.
+        @param  numBytes  The number of bytes copied.
+        @param  error     A description of what went wrong, or None.
+        @param  now       The current time.
+        """
+        if not success:
+            self._numFailures += 1
+            self._retryTimes[filename] = now + _kRetrySecs
+            self._logger.warning("Couldn't move %s: %s" % (src, error))
+            return
+
+        self._bytesCopied += numBytes
+        if self._clipMgr.isFileInDatabase(filename):
+            self._clipMgr.setClipRelocated(filename)
+        else:
+            # Deleted while we were copying it; the copy isn't needed either.
+            self._deleteFn(dst)
+        self._deleteFn(src)
+
+
+    ###########################################################
+    def _walkLeftovers(self):
+        """Yield (src, dst) for each file still in the old folder."""
+        for root, _, filenames in os.walk(self._fromDir):
+            for filename in filenames:
+                if filename.endswith(kPartialSuffix):
+                    continue
+                src = os.path.join(root, filename)
+                yield src, os.path.join(self._toDir,
+                                        os.path.relpath(src, self._fromDir))
+
+
+    ###########################################################
+    def _startSweepMoves(self):
+        """Queue moves of files left in the old folder.
+
+        @return more  False once the whole folder has been walked.
+        """
+        while len(self._inFlight) < self._maxInFlight:
+            try:
+                src, dst = self._sweepWalk.next()
+            except StopIteration:
+                return False
+            key = (_kSweepKey, src)
+            if self._mover.submit(key, src, dst):
+                self._inFlight[key] = (src, dst)
+        return True
+
+
+    ###########################################################
+    def _handleSweepResult(self, src, success, numBytes, error):
+        """Deal with a finished move of a leftover file.
+
+        @param  src       The path moved from.
+        @param  success   True if the file was moved.
+        @param  numBytes  The number of bytes copied.
+        @param  error     A description of what went wrong, or None.
+        """
+        if success:
+            self._bytesCopied += numBytes
+        else:
+            # Not worth holding up the move for; it's left behind.
+            self._numFailures += 1
+            self._logger.warning("Couldn't move %s: %s" % (src, error))
+
+
+    ###########################################################
+    def _finish(self):
+        """Remove the old folder and forget about the move."""
+        for root, _, _ in os.walk(self._fromDir, topdown=False):
+            try:
+                os.rmdir(root)
+            except OSError:
+                pass
+        if os.path.isdir(self._fromDir):
+            self._logger.warning("Not everything could be removed from %s" %
+                                 self._fromDir)
+
+        self._clipMgr.endRelocation()
+        self._mover.shutdown()
+        self._sweepWalk = None
+        self._done = True
+        self._logger.info("Finished moving video from %s to %s; %d bytes, "
+                          "%d failures" % (self._fromDir, self._toDir,
+                                           self._bytesCopied,
+                                           self._numFailures))
+
+
+
+##############################################################################
+def _runUntilDone(relocator, maxSecs=10):
+    """Drive a relocator until it's done; only used by the tests.
+
+    @param  relocator  The VideoRelocator.
+    @param  maxSecs    Give up after this long.
+    @return isDone     True if the relocator finished.
+    """
+    stopTime = time.time() + maxSecs
+    now = 0
+    while time.time() < stopTime:
+        now += _kRefillSecs
+        if relocator.update(now):
+            return True
+        time.sleep(.01)
+    return False
+
+
+##############################################################################
+def _testRelocation():
+    """Test a move, including turning it around part way.
+
+    >>> import shutil, tempfile
+    >>> from ClipManager import ClipManager
+    >>> tmpDir = tempfile.mkdtemp()
+    >>> oldDir = os.path.join(tmpDir, 'old')
+    >>> newDir = os.path.join(tmpDir, 'new')
+    >>> clipMgr = ClipManager(EmptyLogger())
+    >>> clipMgr.open(unicode(os.path.join(tmpDir, 'clips.db')))
+    >>> for i in xrange(6):
+    ...     name = 'cam/%d.mp4' % i
+    ...     clipMgr.addClip(name, 'cam', i*1000, i*1000+999, '', '', 0, 320,
+    ...                     240)
+    ...     path = os.path.join(oldDir, 'cam', '%d.mp4' % i)
+    ...     if not os.path.isdir(os.path.dirname(path)):
+    ...         os.makedirs(os.path.dirname(path))
+    ...     open(path, 'wb').write(name)
+    >>> os.makedirs(os.path.join(oldDir, 'cam', '00001', 'thumbs'))
+    >>> open(os.path.join(oldDir, 'cam', '00001', 'thumbs', '1.jpg'),
+    ...      'wb').write('jpg')
+    >>> clipMgr.save()
+
+    Start a move; clips are still found in the old folder:
+
+    >>> clipMgr.beginRelocation(oldDir, newDir)
+    >>> clipMgr.getClipPath(newDir, 'cam/0.mp4') == \\
+    ...     os.path.join(oldDir, 'cam/0.mp4')
+    True
+    >>> clipMgr.getRelocationInfo()[2:]
+    (6, 6)
+
+    New clips go to the new folder:
+
+    >>> clipMgr.addClip('cam/6.mp4', 'cam', 6000, 6999, '', '', 0, 320, 240)
+    >>> os.makedirs(os.path.join(newDir, 'cam'))
+    >>> open(os.path.join(newDir, 'cam', '6.mp4'), 'wb').write('cam/6.mp4')
+    >>> clipMgr.getClipPath(newDir, 'cam/6.mp4') == \\
+    ...     os.path.join(newDir, 'cam/6.mp4')
+    True
+
+    Move a couple of clips, oldest first:
+
+    >>> relocator = VideoRelocator(None, clipMgr, os.remove, 1, 2)
+    >>> clipMgr.getClipsToRelocate(2)[0][0]
+    u'cam/0.mp4'
+    >>> clipMgr.getClipsToRelocate(2, ['cam/0.mp4'])[0][0]
+    u'cam/1.mp4'
+    >>> relocator.update(0)
+    False
+    >>> while relocator.getProgress()['inFlight']:
+    ...     time.sleep(.01)
+    ...     _ = relocator.update(0)
+    >>> clipMgr.getRelocationInfo()[2:]
+    (6, 4)
+    >>> sorted(os.listdir(os.path.join(oldDir, 'cam')))
+    ['00001', '2.mp4', '3.mp4', '4.mp4', '5.mp4']
+
+    Turn around; the moved clips and the new one need to go back:
+
+    >>> relocator.reverse() == oldDir
+    True
+    >>> clipMgr.getRelocationInfo()[2:]
+    (3, 3)
+    >>> clipMgr.getClipPath(oldDir, 'cam/2.mp4') == \\
+    ...     os.path.join(oldDir, 'cam/2.mp4')
+    True
+    >>> clipMgr.getClipPath(oldDir, 'cam/6.mp4') == \\
+    ...     os.path.join(newDir, 'cam/6.mp4')
+    True
+    >>> _runUntilDone(relocator)
+    True
+    >>> relocator.getProgress()['remaining']
+    0
+    >>> os.path.exists(newDir)
+    False
+    >>> sorted(os.listdir(os.path.join(oldDir, 'cam')))
+    ['0.mp4', '00001', '1.mp4', '2.mp4', '3.mp4', '4.mp4', '5.mp4', '6.mp4']
+    >>> open(os.path.join(oldDir, 'cam', '6.mp4'), 'rb').read()
+    'cam/6.mp4'
+
+    Now move everything, starting over as if after a restart:
+
+    >>> clipMgr.beginRelocation(oldDir, newDir)
+    >>> VideoRelocator(None, clipMgr, os.remove).shutdown()
+    >>> relocator = VideoRelocator(None, clipMgr, os.remove)
+    >>> _runUntilDone(relocator)
+    True
+    >>> os.path.exists(oldDir)
+    False
+    >>> sorted(os.listdir(os.path.join(newDir, 'cam')))
+    ['0.mp4', '00001', '1.mp4', '2.mp4', '3.mp4', '4.mp4', '5.mp4', '6.mp4']
+    >>> os.listdir(os.path.join(newDir, 'cam', '00001', 'thumbs'))
+    ['1.jpg']
+    >>> clipMgr.getRelocationInfo()
+    (None, None, 0, 0)
+
+    >>> clipMgr.close()
+    >>> shutil.rmtree(tmpDir)
+    """
+
+
+##############################################################################
+def test_main():
+    """OB_REDACT
+    Our main function, which runs test code
+    """
+    import doctest
+    doctest.testmod(verbose=True)
+
+
+##############################################################################
+if __name__ == '__main__':
+    test_main()
@@ -39,6 +39,7 @@
 import sys, os, socket, time, subprocess, shutil, hashlib, base64, httplib, re
 import traceback, random, pickle, webstuff, MessageIds, uuid
 import ctypes
+import threading
 import urllib
 
 from subprocess import Popen, PIPE
@@ -46,6 +47,8 @@ from subprocess import Popen, PIPE
 from string import Template
 from vitaToolbox.loggingUtils.LoggingUtils import getLogger
 from vitaToolbox.networking.HttpClient import HttpClient
+from vitaToolbox.networking.WsgiServer import WsgiServer
+from vitaToolbox.networking.WsgiServer import makeServerAddressInfos
 from vitaToolbox.process.ProcessUtils import getProcessesWithName
 from vitaToolbox.process.ProcessUtils import killProcess
 from vitaToolbox.process.ProcessUtils import filteredProcessCommands
@@ -167,6 +170,9 @@ _kErrorLog        = "WebServerError.log"    # name of the nginx error log file
 _kAccessLog       = "WebServerAccess.log"   # name of the nginx access log file
 _kServerName      = "SighthoundWebServer"   # official name for our nginx server
 _kRemoteAppName   = os.path.join("share", "svremoteviewer") # directory where we expect the remote app code
+_kRouterWaitSecs  = 5    # how long to wait for the camera router to start
+_kRouterThreads   = 4    # number of request threads of the camera router
+_kCameraRouteFormat = "/_camera/%d/%s"  # where nginx gets live media from
 
 # Template to render the basic auth portion of the nginx config file.
 _kAuthBasicTemplate = """
@@ -312,6 +318,13 @@ http {
         location ~ ^/camera/(.*?)/(.*\.jpg)$$ {
             proxy_pass http://127.0.0.1:$$1/$$2$$is_args$$args;
             proxy_set_header X-Real-IP $$remote_addr;
+        }
+        location ~ ^/clip/([0-9]+)/(.*\.(m3u8|ts))$$ {
+            expires off;
+            add_header Cache-Control no-cache;
+            proxy_pass http://127.0.0.1:$$1/$$2;
+            proxy_set_header X-Real-IP $$remote_addr;
+            proxy_read_timeout 90;
         }$cameraStreams
         location @sslr {
             add_header Cache-Control no-cache;
@@ -320,6 +333,20 @@ http {
     }$mimeTypes
 }"""
 
+# Sub-template for live media, going into $cameraStreams above. Requests go
+# to our camera router, which tells nginx (with X-Accel-Redirect) which camera
+# WSGI server to get them from, so camera restarts don't need a reload.
+_kCfgTemplateCameraRouter = """
+        location /live/ {
+            proxy_pass http://127.0.0.1:$router_port/;
+            proxy_set_header X-Real-IP $$remote_addr;
+        }
+        location ~ ^/_camera/([0-9]+)/(.*)$$ {
+            internal;
+            proxy_pass http://127.0.0.1:$$1/$$2$$is_args$$args;
+            proxy_set_header X-Real-IP $$remote_addr;
+        }"""
+
 # Sub-template in case we enabled HTTPS. Goes into $ssl_info above.
 # Notice that SSLv3 gets turned off due to the POODLE attack.
 _kCfgTemplateSSLInfo = """
@@ -640,6 +667,16 @@ class WebServer(object):
         self._loadCertificateId(True)
         self._cameraLocations={}
 
+        # The camera router, and what it routes: camera file name base (as
+        # used in live URIs) to WSGI port.  Routes are used by the router's
+        # threads, so they are guarded by the lock.
+        self._cameraRouter = None
+        self._cameraRouterPort = None
+        self._cameraRouterStarted = threading.Event()
+        self._configRouterPort = None  # router port of the current config
+        self._cameraRoutes = {}
+        self._cameraRoutesLock = threading.Lock()
+
         # Set up debug logging
         self._debugLogManager = DebugLogManager("WebServer", os.path.join(mainDir,".."))
 
@@ -745,12 +782,21 @@ class WebServer(object):
 
     ###########################################################
     def _newCamerasConfig(self):
+        """ Creates the configuration for live media of cameras. With the
+        camera router running it doesn't change as cameras come and go;
+        otherwise each camera gets its own locations, and the server needs to
+        be reloaded whenever a camera's WSGI port changes.
+        """
+        self._configRouterPort = self._cameraRouterPort
+        if self._configRouterPort is not None:
+            return Template(_kCfgTemplateCameraRouter).substitute(
+                router_port = self._configRouterPort)
         res="\n"
         for camera in self._cameraLocations:
             port = self._cameraLocations[camera]
             camUri = simplifyString(camera)
             res += "        location /live/" + camUri + ".jpg {\n" + \
-                   "            proxy_pass http://127.0.0.1:" + str(port) + "/image.jpg$is_args$args;\n" + \
+                   "            proxy_pass http://127.0.0.1:" + str(port) + "/" + camUri + ".jpg$is_args$args;\n" + \
                    "            proxy_set_header X-Real-IP $remote_addr;\n" + \
                    "        }\n"
             res += "        location /live/" + camUri + ".m3u8 {\n" + \
@@ -1162,6 +1208,11 @@ class WebServer(object):
                 break
             self._backendPing(now)
             self._processCmdQ()
+            # The router came up late, or on a new port after a restart.
+            if self._cameraRouterPort != self._configRouterPort and \
+               self.turnedOn() and self._workDir is not None:
+                self._configRouterPort = self._cameraRouterPort
+                self._softRestart()
             if self._shutdown:
                 self._logger.info("shutdown detected")
                 return False
@@ -1295,8 +1346,87 @@ class WebServer(object):
         self._newConfig()
         self.startServer("reload")
 
+    ###########################################################
+    def _startCameraRouter(self):
+        """ Starts the camera router and waits a bit for it to come up, so
+        the first configuration can already use it.
+        """
+        self._cameraRouter = WsgiServer(
+            makeServerAddressInfos([0], .5, 30), self._routeCamera,
+            self._cameraRouterNotify, sharedLogger=self._logger,
+            threadPoolSize=_kRouterThreads, serverName="localhost")
+        self._cameraRouter.start()
+        if not self._cameraRouterStarted.wait(_kRouterWaitSecs):
+            self._logger.warn("camera router not up yet")
+
+
+    ###########################################################
+    def _stopCameraRouter(self):
+        """ Shuts down the camera router.
+        """
+        if self._cameraRouter is not None:
+            self._cameraRouter.shutdown(5)
+            self._cameraRouter = None
+
+
+    ###########################################################
+    def _cameraRouterNotify(self, address):
+        """ Called by the camera router once it runs, from its own thread.
+
+        @param address  The (host, port) the router runs at.
+        """
+        self._logger.info("camera router on port %d" % address[1])
+        self._cameraRouterPort = address[1]
+        self._cameraRouterStarted.set()
+
+
+    ###########################################################
+    def _routeCamera(self, environ, startResponse):
+        """ The camera router, a WSGI application. Sends nginx on to the
+        WSGI server of the camera whose live media is requested.
+
+        @param environ        The WSGI environment.
+        @param startResponse  The WSGI response starter.
+        @return               The (empty) response body.
+        """
+        fileName = environ.get('PATH_INFO', '').lstrip('/')
+        base, ext = os.path.splitext(fileName)
+        port = None
+        if ext in ('.jpg', '.m3u8'):
+            self._cameraRoutesLock.acquire()
+            try:
+                port = self._cameraRoutes.get(base)
+                if port is None:
+                    # HLS playlists of a certain size come as <camera>-<n>.
+                    match = re.match(r"^(.+)-[0-9]+$", base)
+                    if match is not None:
+                        port = self._cameraRoutes.get(match.group(1))
+            finally:
+                self._cameraRoutesLock.release()
+        if port is None:
+            startResponse('404 Not Found', [('Content-Type', 'text/plain'),
+                                            ('Content-Length', '0')])
+            return []
+        uri = _kCameraRouteFormat % (port, fileName)
+        query = environ.get('QUERY_STRING')
+        if query:
+            uri += "?" + query
+        startResponse('200 OK', [('X-Accel-Redirect', uri),
+                                 ('Content-Length', '0')])
+        return []
+
+
     ###########################################################
     def _setCameraPort(self, camLocation, wsgiPort):
+        self._cameraRoutesLock.acquire()
+        try:
+            if wsgiPort is None:
+                self._cameraRoutes.pop(simplifyString(camLocation), None)
+            else:
+                self._cameraRoutes[simplifyString(camLocation)] = wsgiPort
+        finally:
+            self._cameraRoutesLock.release()
+
         needRestart = False
         if wsgiPort is None:
             if camLocation in self._cameraLocations:
@@ -1308,7 +1438,8 @@ class WebServer(object):
                 self._cameraLocations[camLocation] = wsgiPort
                 needRestart = True
 
-        if needRestart and self.turnedOn():
+        # With the router running, the configuration doesn't depend on ports.
+        if needRestart and self.turnedOn() and self._configRouterPort is None:
             self._softRestart()
 
     ###########################################################
@@ -1348,6 +1479,7 @@ class WebServer(object):
         """ The main loop of the process.
         """
         try:
+            self._startCameraRouter()
             # main retry loop, to attempt starting the server...
             while not self._shutdown:
                 # clear the trigger flag for reconfiguration
@@ -1405,6 +1537,7 @@ class WebServer(object):
                 self._logger.error("final server cleanup failed (%s)" %
                                    sys.exc_info()[1])
             self._enablePortOpener(False)
+            self._stopCameraRouter()
             self.deleteStatusFile()
 
 
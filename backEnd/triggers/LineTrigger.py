@@ -109,6 +109,19 @@ class LineTrigger(BaseTrigger):
         self._cLine = BBOX(int(x1), int(y1), int(x2), int(y2))
 
 
+    ###########################################################
+    def optimizedDidObjCrossLine(self, prevBox, box):
+        """Check whether an object moving between two boxes crossed the line.
+
+        @param  prevBox  The earlier box, starting with (x1, y1, x2, y2).
+        @param  box      The later box, starting with (x1, y1, x2, y2).
+        @return crossed  True if the trigger would fire on this pair of boxes.
+        """
+        return optimizedDidObjCrossLine(BBOX(*prevBox[:4]), BBOX(*box[:4]),
+                                        self._cLine, self._cLocation,
+                                        self._cDirection)
+
+
     ###########################################################
     def getCoordinates(self):
         """Return coordinates defining the line segment
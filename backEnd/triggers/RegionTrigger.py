@@ -179,6 +179,15 @@ class RegionTrigger(BaseTrigger):
         return self._region.getPoints()
 
 
+    ###########################################################
+    def getLineTriggers(self):
+        """Return the line triggers used to watch the edges of the region
+
+        @return  lineTriggers  A list of LineTrigger, one per edge.
+        """
+        return self._lineTriggerList
+
+
     ###########################################################
     def optimizedIsPointInside(self, x1, y1, x2, y2):
         """Does the work of getBboxTrackingPoint and isPoint inside in C.
@@ -42,6 +42,7 @@ import cPickle
 import os
 import socket
 import sys
+import threading
 import time
 import xmlrpclib
 from xml.parsers.expat import ExpatError
@@ -73,6 +74,14 @@ from launch.Launch import Launch
 
 # Globals...
 
+# How long each wait for back end events lasts, in seconds.  The back end
+# caps it at 50.
+_kEventWaitSecs = 50
+
+# How long to wait before asking again, if the back end couldn't be reached
+# or didn't let us wait.
+_kEventRetrySecs = 4
+
 
 
 ###########################################################
@@ -98,6 +107,12 @@ class BackEndClient(object):
         """BackEndClient constructor."""
         super(BackEndClient, self).__init__()
         self._proxy = None
+        self._portFilePath = None
+
+        # Called on the UI thread with events from the back end; see
+        # startEventListener().
+        self._eventListener = None
+        self._eventThread = None
 
 
     ###########################################################
@@ -118,6 +133,7 @@ class BackEndClient(object):
                                              allow_none=True)
             proxy.ping() #PYCHECKER OK: Function exists on xmlrpc server
             self._proxy = proxy
+            self._portFilePath = portFilePath
             return True
         except Exception:
             self._proxy = None
@@ -408,6 +424,28 @@ class BackEndClient(object):
         return self._proxy.getVideoLocationChangeStatus()
 
 
+    ###########################################################
+    def cancelVideoRelocation(self):
+        """Move video back to where a background location change started.
+
+        Use getVideoLocationChangeStatus() to find out when it's done.
+        """
+        self._proxy.cancelVideoRelocation()
+
+
+    ###########################################################
+    def getVideoRelocationStatus(self):
+        """Get the progress of moving existing video to a new location.
+
+        @return fromDir    The video folder clips are moving from, or "" if
+                           no move is in progress.
+        @return toDir      The video folder clips are moving to, or "".
+        @return total      The number of clips there were to move.
+        @return remaining  The number of clips left to move.
+        """
+        return self._proxy.getVideoRelocationStatus()
+
+
     ###########################################################
     def getCameraLocations(self):
         """Retrieve the locations of all configured cameras.
@@ -922,6 +960,81 @@ class BackEndClient(object):
         """
         return self._proxy.getMessage()
 
+
+    ###########################################################
+    def startEventListener(self, listener):
+        """Start waiting for events from the back end.
+
+        Events say that a message is waiting for getMessage(), or that a
+        camera's status or a rule changed; see backEnd/EventChannel.py.  The
+        waiting happens on a thread with its own connection, since proxies
+        can't be shared between threads.
+
+        @param  listener  Called on the UI thread with (events, isReset),
+                          where events is a list of (kind, data), oldest
+                          first.  If isReset is True events were missed, and
+                          the listener should look at everything again.
+        """
+        self._eventListener = listener
+        if self._eventThread is None:
+            self._eventThread = threading.Thread(target=self._runEvents,
+                                                 args=(self._portFilePath,),
+                                                 name="backEndEvents")
+            self._eventThread.setDaemon(True)
+            self._eventThread.start()
+
+
+    ###########################################################
+    def stopEventListener(self):
+        """Stop handing out events from the back end.
+
+        Must be called on the UI thread.  The waiting thread stops with the
+        next events, or when the app quits.
+        """
+        self._eventListener = None
+
+
+    ###########################################################
+    def _runEvents(self, portFilePath):
+        """Wait for events from the back end, until stopped.
+
+        @param  portFilePath  The path to the back end's port file.
+        """
+        proxy = None
+        channelId = None
+        seq = 0
+        while self._eventListener is not None:
+            startTime = time.time()
+            try:
+                if proxy is None:
+                    proxy = ServerProxyWithClientId("http://0.0.0.0:0",
+                        _BackEndTransport(portFilePath), allow_none=True)
+                channelId, seq, events, isReset = \
+                    proxy.waitForEvents(channelId, seq, _kEventWaitSecs)
+            except Exception:
+                # The back end is gone or busy; whoever polls it will notice.
+                proxy = None
+                time.sleep(_kEventRetrySecs)
+                continue
+
+            if events or isReset:
+                wx.CallAfter(self._dispatchEvents, events, isReset)
+            elif time.time() - startTime < 1:
+                # Too many others waiting, so we just poll.
+                time.sleep(_kEventRetrySecs)
+
+
+    ###########################################################
+    def _dispatchEvents(self, events, isReset):
+        """Hand events to the listener, on the UI thread.
+
+        @param  events   A list of (kind, data).
+        @param  isReset  True if events were missed.
+        """
+        listener = self._eventListener
+        if listener is not None:
+            listener(events, isReset)
+
     ###########################################################
     def submitClipToSighthound(self, camLocation, note, startTime, duration):
         """Submit clip to Sighthound for analysing."""
@@ -1255,6 +1368,18 @@ class BackEndClient(object):
         self._proxy.setDebugConfiguration(config)
 
 
+    ###########################################################
+    def getObjectCensus(self, sampleStride=1):
+        """Count what the network message server holds on to, and what
+        changed since the last call, to find leaks.
+
+        @param  sampleStride  Count every this many objects; 1 counts all.
+        @return report        A dict of 'census' and 'diff'; see
+                              ObjectCensus.reportCensus().
+        """
+        return self._proxy.getObjectCensus(sampleStride)
+
+
 
 ##############################################################################
 class _BackEndTransport(xmlrpclib.Transport):
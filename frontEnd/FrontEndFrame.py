@@ -91,6 +91,8 @@ from backEnd.ClipManager import ClipManager
 from backEnd.DataManager import DataManager
 from backEnd.DebugLogManager import DebugLogManager
 import backEnd.MessageIds as MessageIds
+from backEnd.EventChannel import kEventMessage, kEventCameraStatus
+from backEnd.EventChannel import kEventRules
 
 from MonitorView import MonitorView
 from GridView import GridView
@@ -142,7 +144,9 @@ _kProblemEncountered = 'The application has encountered a problem and must exit.
 _kQuitTimeout = 25
 _kForceQuitTimeout = 3
 
-_kBackEndPollMsecs = 4000
+# Messages come right away with back end events; polling is left for noticing
+# the back end went away, and for when events don't get through.
+_kBackEndPollMsecs = 15000
 
 _kUpdateTimeMS = 24 *60*60 *1000
 
@@ -249,11 +253,13 @@ class FrontEndFrame(wx.Frame):
 
         self.Bind(wx.EVT_CLOSE, self.OnClose)
 
-        # Start a periodic timer we'll use to poll the back end for messages.
+        # Start a periodic timer we'll use to poll the back end for messages,
+        # and listen for its events telling us about them sooner.
         self._backEndTimer = wx.Timer(self, -1)
         self.Bind(wx.EVT_TIMER, self.OnBackEndTimer, self._backEndTimer)
         self._backEndTimer.Start(_kBackEndPollMsecs)
         self._backEndErrorCount = 0
+        self._backEndClient.startEventListener(self._onBackEndEvents)
 
         # Check for updates and then every 24 hours
         # ...do a CallAfter to see if it fixes the build machine...
@@ -530,6 +536,7 @@ class FrontEndFrame(wx.Frame):
         # play well with threads).  This is needed because it looks like
         # destructors aren't really getting called correctly when we use
         # sys.exit().
+        self._backEndClient.stopEventListener()
         for callableFn in self._exitNotificationList:
             callableFn()
 
@@ -1445,6 +1452,38 @@ class FrontEndFrame(wx.Frame):
             self._logger.warn("Unsupported message ID '%s'." % str(msgId))
 
 
+    ###########################################################
+    def _onBackEndEvents(self, events, isReset):
+        """Handle events from the back end.
+
+        @param  events   A list of (kind, data), oldest first.
+        @param  isReset  True if events were missed, so we look at everything.
+        """
+        # Like the timer, stay away from the back end while closing.
+        if not self._backEndTimer.IsRunning():
+            return
+
+        numMessages = 0
+        for kind, data in events:
+            if kind == kEventMessage:
+                numMessages += 1
+            elif kind == kEventCameraStatus:
+                self._monitorView.handleCameraStatusChange(data)
+            elif kind == kEventRules:
+                self._monitorView.handleCameraStatusChange(None)
+
+        if isReset:
+            numMessages += 1
+            self._monitorView.handleCameraStatusChange(None)
+
+        # One message is queued for each event; more may have been queued
+        # since, which the next events will be for.
+        for _ in xrange(numMessages):
+            self.OnBackEndTimer()
+            if not self._backEndTimer.IsRunning():
+                break
+
+
     ###########################################################
     def _onSupportExpired(self, expiredSeconds, serial):
         """ Prompts the support expiration dialog.
@@ -119,7 +119,9 @@ _kPreviewSelectionColour = (27, 87, 174)
 
 _kShadowColor = (0, 0, 0, 10)
 
-_kCameraStatusUpdateTime = 2
+# How often to check the status of unavailable cameras, in seconds.  Changes
+# come right away with back end events; this is for the ones that don't.
+_kCameraStatusUpdateTime = 10
 
 _kCameraWarningTitle = "Camera warning"
 
@@ -214,6 +216,9 @@ class MonitorView(BaseMonitorView):
 
         self._lastStatusQueryTime = time.time()
 
+        # Locations whose status changed since the last preview update.
+        self._changedStatusLocations = set()
+
         # The camera that caused a popup menu to display.
         self._cameraPopupSource = ''
 
@@ -874,6 +879,19 @@ class MonitorView(BaseMonitorView):
             self._pendingLicenseChangeEvent = True
 
 
+    ###########################################################
+    def handleCameraStatusChange(self, location):
+        """To be called if the back end says a camera's status changed.
+
+        @param  location  The location of the camera, or None to check all
+                          cameras, like when one of their rules changed.
+        """
+        if location is None:
+            self._lastStatusQueryTime = 0
+        else:
+            self._changedStatusLocations.add(location)
+
+
     ###########################################################
     def _loadCameraPreviews(self):
         """Create small views for each camera location."""
@@ -1674,6 +1692,7 @@ class MonitorView(BaseMonitorView):
             # displaying the correct status information for any unavailable
             # streams.
             self._lastStatusQueryTime = now
+            self._changedStatusLocations.clear()
 
             # We also use this interval to make sure the memory map file itself
             # still exists.  If it doesn't we close our handle to it.
@@ -1684,12 +1703,15 @@ class MonitorView(BaseMonitorView):
                     self._openCameras.discard(location)
 
 
+        changedLocations = self._changedStatusLocations
+        self._changedStatusLocations = set()
+
         for location in self._cameraLocations:
             # If the camera doesn't have a memory map to the live stream,
             # update the displayed status screen and attempt to open the
             # live stream again.
             if location not in list(self._openCameras):
-                if updateStatus:
+                if updateStatus or location in changedLocations:
                     self._updateCameraStatus(location)
 
                 if location in self._disabledCameras:
@@ -53,17 +53,11 @@ from appCommon.CommonStrings import kAnyCameraStr
 from QueryConstructionView import checkQueryName
 from QueryConstructionView import QueryConstructionView
 from constructionComponents.ResponseConfigPanel import checkResponses
-from constructionComponents.ResponseConfigPanel import hasResponses
 from frontEnd.FrontEndUtils import getUserLocalDataDir
 
 # Constants...
 _kDialogTitle = "Rule Editor"
 
-_kAnyCameraResponseErr = 'A response can only apply to one camera. Change the'\
-                         ' video source from "%s" to a specific camera.' \
-                         % kAnyCameraStr
-_kAnyCameraResponseTitle = "Rule Response"
-
 ##############################################################################
 class QueryEditorDialog(wx.Dialog):
     """A dialog for editing a query."""
@@ -147,11 +141,6 @@ class QueryEditorDialog(wx.Dialog):
         if not checkResponses(self._queryDataModel, self._backEndClient, self):
             return
 
-        if cameraName == kAnyCameraStr and hasResponses(self._queryDataModel):
-            wx.MessageBox(_kAnyCameraResponseErr, _kAnyCameraResponseTitle,
-                          wx.OK | wx.ICON_ERROR, self.GetTopLevelParent())
-            return
-
         self.EndModal(wx.ID_OK)
 
 
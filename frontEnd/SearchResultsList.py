@@ -66,6 +66,7 @@ from appCommon.CommonStrings import kImportSuffix
 from appCommon.CommonStrings import kSearchingString, kSearchingOnString
 
 import MenuIds
+from ThumbnailLoader import ThumbnailLoader
 
 
 _kItemHeight = 64
@@ -79,6 +80,7 @@ _kNotSavedlYOffset = 42
 _kTimeXOffset = 88
 _kTimeYOffset = 26
 _kNumLoadRetries = 100
+_kNumPrefetchRows = 5
 _kPopupTimeout = 2
 
 # Font size different on Win and Mac
@@ -157,6 +159,16 @@ class SearchResultsList(wx.VListBox):
 
         self._abortEvent = None
         self._loadRunning = False
+
+        # Thumbnails are loaded on a few threads of their own.  What they
+        # load for is (generation, results, data cache, retries); the
+        # generation goes up whenever those are replaced, so loads for old
+        # ones are dropped.
+        self._loadGeneration = (0, None, None, None)
+        self._thumbLoader = ThumbnailLoader(self._openManagers,
+                                            self._loadThumb,
+                                            self._closeManagers,
+                                            self._logger)
         self._searching = False
         self._pendingPopupPoint = None
         self._pendingPopupTimeout = None
@@ -194,9 +206,9 @@ class SearchResultsList(wx.VListBox):
                            self._exportForBugReportMenuItem, self._submitClipForAnalysisMenuItem,
                            self._submitClipForAnalysisWithNoteMenuItem ]
 
-        # Register to know about sys.exit(), so we can stop our thread if it's
-        # running
-        topWin.registerExitNotification(self.stopLoader)
+        # Register to know about sys.exit(), so we can stop our threads if
+        # they're running
+        topWin.registerExitNotification(self._shutdownLoader)
 
         self.Bind(wx.EVT_LISTBOX, self.OnResult)
         self.Bind(wx.EVT_LEFT_DOWN, self.OnResultsListClick)
@@ -209,7 +221,7 @@ class SearchResultsList(wx.VListBox):
 
         This will stop any delayed results code that we have running.
         """
-        self.stopLoader()
+        self._shutdownLoader()
 
 
     ###########################################################
@@ -501,13 +513,16 @@ class SearchResultsList(wx.VListBox):
         """Stop (if needed) and start the loader."""
 
         # Ensure that any previous threads will exit
-        self.stopLoader()
+        self._stopLoadLoop()
 
         numResults = len(self._curResults)
 
         self._abortEvent = delayedresult.AbortEvent()
         self._loadRunning = True
         self._dataCache = [(None, None, None, True)] * numResults
+        self._loadGeneration = (self._loadGeneration[0]+1, self._curResults,
+                                self._dataCache, {})
+        self._thumbLoader.setWanted([])
 
         # Create a new item loader
         delayedresult.startWorker(self._resultItemsLoaded,
@@ -518,6 +533,24 @@ class SearchResultsList(wx.VListBox):
 
     ###########################################################
     def stopLoader(self):
+        """Makes sure that the delayed result loader has stopped, and drops
+        the thumbnails it wanted; called before every search.
+        """
+        self._stopLoadLoop()
+        self._thumbLoader.setWanted([])
+
+
+    ###########################################################
+    def _shutdownLoader(self):
+        """Stops loading for good, including the threads loading thumbnails;
+        called when we're going away.
+        """
+        self._stopLoadLoop()
+        self._thumbLoader.shutdown()
+
+
+    ###########################################################
+    def _stopLoadLoop(self):
         """Makes sure that the delayed result loader has stopped."""
         # Set the abort...
         if self._abortEvent is not None:
@@ -540,12 +573,8 @@ class SearchResultsList(wx.VListBox):
 
         timeLogger = TimerLogger("loading results")
 
-        dataMgrPath, clipMgrPath, videoDir = self._dataMgr.getPaths()
-        clipMgr = ClipManager(self._logger)
-        clipMgr.open(clipMgrPath)
-        dataMgr = DataManager(self._logger, clipMgr, videoDir)
-        dataMgr.open(dataMgrPath)
-        dataMgr.setMarkupModel(self._subMarkupModel)
+        managers = self._openManagers()
+        dataMgr, clipMgr = managers
 
         try:
             self._loadLoop(abortEvent, numResults, dataMgr, clipMgr)
@@ -560,106 +589,145 @@ class SearchResultsList(wx.VListBox):
                 "Unhandled exception in thumb loader!", exc_info=True
             )
         finally:
-            clipMgr.close()
-            dataMgr.close()
+            self._closeManagers(managers)
 
             self._loadRunning = False
             self._logger.debug(timeLogger.status() + ": " +
                             str(self.GetItemCount()) + " results loaded");
 
 
+    ###########################################################
+    def _openManagers(self):
+        """Open our own data and clip managers, for use on the calling thread.
+
+        We can't search databases opened in other threads so we need to open
+        our own.  Fortunately this seems to be pretty lightweight.
+
+        @return dataMgr  The data manager.
+        @return clipMgr  The clip manager.
+        """
+        dataMgrPath, clipMgrPath, videoDir = self._dataMgr.getPaths()
+        clipMgr = ClipManager(self._logger)
+        clipMgr.open(clipMgrPath)
+        dataMgr = DataManager(self._logger, clipMgr, videoDir)
+        dataMgr.open(dataMgrPath)
+        dataMgr.setMarkupModel(self._subMarkupModel)
+        return dataMgr, clipMgr
+
+
+    ###########################################################
+    def _closeManagers(self, managers):
+        """Close managers opened by _openManagers().
+
+        @param  managers  The (dataMgr, clipMgr) to close.
+        """
+        dataMgr, clipMgr = managers
+        clipMgr.close()
+        dataMgr.close()
+
+
     ###########################################################
     def _loadLoop(self, abortEvent, numResults, dataMgr, clipMgr):
         """The actual load loop for the _resultItemLoader().
 
         We'll raise a delayedresult.AbortedException if we are aborted.
 
-        Note: We now only load what were currently viewing and a few before and
-              after, rather than continuing to laod everything as we did before.
-              Eventually we should have a thumbnail cache of sorts, but for now
-              simply cutting off the loads is a help, as particularly on larger
-              setups we were burning through CPU loading thousands of never
-              viewed results. Now we wind up never exiting this loop and
-              just sleeping a lot.
+        Note: We only load what were currently viewing and a few before and
+              after, rather than continuing to load everything as we did
+              before, as particularly on larger setups we were burning through
+              CPU loading thousands of never viewed results.
+
+        Labels are quick, so we make them right here.  Thumbnails are handed
+        to self._thumbLoader, which loads them on a few threads: the rows in
+        view first, then the ones coming into view in the direction we're
+        scrolling, then the ones behind.  Whenever the view moves we tell it
+        again, dropping the loads of rows that went out of reach.
 
         @param  abortEvent  An event that will be set if loading should abort.
         @param  numResults  The number of searchResults.
         @param  dataMgr     Our own private instance of the data manger.
         @param  clipMgr     Our own private instance of the clip manager.
         """
+        generation, results, dataCache, _ = self._loadGeneration
         unloadedIndicies = set(xrange(numResults))
-        loadedIndicies = set([])
-        retryLookup = {}
+        prevFirstVisible = None
+        scrollingUp = False
 
         while unloadedIndicies:
             firstVisible = self.GetVisibleBegin()
             lastVisible = self.GetVisibleEnd()
+            if prevFirstVisible is not None and \
+               firstVisible != prevFirstVisible:
+                scrollingUp = firstVisible < prevFirstVisible
+            prevFirstVisible = firstVisible
+
+            # Convert to indices in our list, most wanted first...
+            before = range(firstVisible-1, firstVisible-1-_kNumPrefetchRows, -1)
+            after = range(lastVisible, lastVisible+_kNumPrefetchRows)
+            if scrollingUp:
+                before, after = after, before
+            viewIndices = range(firstVisible, lastVisible)
+            wantedIndices = [x for x in viewIndices + after + before
+                             if x in unloadedIndicies]
+
+            for index in wantedIndices:
+                cacheIndex = self._selectionIdxToClientIdx[index]
+                _, label, _, _ = dataCache[cacheIndex]
+                if label is None:
+                    if self._loadItem(results, dataCache, cacheIndex,
+                                      dataMgr, clipMgr, 0, True) and \
+                       index in viewIndices:
+                        wx.CallAfter(self._safeRefresh)
+
+                # If the user scrolled break and reprioritize what we load.
+                if firstVisible != self.GetVisibleBegin():
+                    break
+
+                # Check for abort events; raise an exception if one...
+                abortEvent()
+
+            # Thumbnails are only loaded once there's a label, so that
+            # nobody else writes the item while they're being loaded.
+            thumbKeys = []
+            for index in wantedIndices:
+                cacheIndex = self._selectionIdxToClientIdx[index]
+                img, label, _, _ = dataCache[cacheIndex]
+                if img and label:
+                    unloadedIndicies.discard(index)
+                elif img is None and label is not None:
+                    thumbKeys.append((generation, cacheIndex))
+            self._thumbLoader.setWanted(thumbKeys)
+
+            # Sleep for a little bit; this also gives time between retries
+            # of thumbnails that couldn't be loaded yet.
+            abortEvent(.1)
 
-            # Convert to indices in our list...
-            viewIndices = xrange(firstVisible, lastVisible)
-            viewIndices = [x for x in viewIndices if x in unloadedIndicies]
 
-            if viewIndices:
-                shouldSleep = False
-            else:
-                # If we've loaded what's in our current view, load a few after
-                # and before to speed scrolling.
-                viewIndices = xrange(firstVisible-5, lastVisible+5)
-                viewIndices = [x for x in viewIndices if x in unloadedIndicies]
-                shouldSleep = True
-
-            searchList = viewIndices
-
-            if not searchList:
-                # If we've got nothing to do, ensure we sleep a bit.
-                abortEvent(.2)
-
-            firstTraversal = True
-            while searchList:
-                for index in searchList:
-                    retries = retryLookup.get(index, 0)
-                    try:
-                        if self._loadItem(self._selectionIdxToClientIdx[index],
-                                          dataMgr, clipMgr, retries,
-                                          firstTraversal):
-                            if index in viewIndices:
-                                wx.CallAfter(self._safeRefresh)
-                            img, label, _, _ = self._dataCache[
-                                self._selectionIdxToClientIdx[index]
-                            ]
-                            if img and label:
-                                loadedIndicies.add(index)
-                    except Exception:
-                        if retries == _kNumLoadRetries:
-                            self._logger.error(
-                                "Unhandled exception: " + traceback.format_exc(), exc_info=True
-                            )
-
-                    if not firstTraversal:
-                        retryLookup[index] = retries+1
-
-                    # If the user scrolled break and reprioritize what we load.
-                    if firstVisible != self.GetVisibleBegin():
-                        searchList = []
-                        break
-
-                    # Check for abort events; raise an exception if one...
-                    # ...we also use this as a chance to sleep between loads
-                    # when we're loading the bitmaps (2nd traversal)...
-                    if (not firstTraversal) and shouldSleep:
-                        abortEvent(.1)
-                    else:
-                        abortEvent()
-
-                firstTraversal = False
-
-                searchList = set(searchList).difference(loadedIndicies)
-                unloadedIndicies.difference_update(loadedIndicies)
-
-                # Sleep for a little bit.  Technically, this is only needed if
-                # we didn't actually load anything so that there will be a
-                # little bit of time between retries.
-                abortEvent(.1)
+    ###########################################################
+    def _loadThumb(self, managers, key):
+        """Load the thumbnail of an item; called on the thumb loader's threads.
+
+        @param  managers  The (dataMgr, clipMgr) of the calling thread.
+        @param  key       The (generation, cacheIndex) of the item.
+        """
+        generation, results, dataCache, retryLookup = self._loadGeneration
+        if key[0] != generation:
+            # For results we aren't showing anymore.
+            return
+        cacheIndex = key[1]
+        dataMgr, clipMgr = managers
+
+        retries = retryLookup.get(cacheIndex, 0)
+        try:
+            if self._loadItem(results, dataCache, cacheIndex, dataMgr,
+                              clipMgr, retries):
+                wx.CallAfter(self._safeRefresh)
+        except Exception:
+            if retries == _kNumLoadRetries:
+                self._logger.error(
+                    "Unhandled exception: " + traceback.format_exc(), exc_info=True
+                )
+        retryLookup[cacheIndex] = retries+1
 
 
     ###########################################################
@@ -851,9 +919,12 @@ class SearchResultsList(wx.VListBox):
 
 
     ###########################################################
-    def _loadItem(self, cacheIndex, dataMgr, clipMgr, retries, textOnly=False):
+    def _loadItem(self, results, dataCache, cacheIndex, dataMgr, clipMgr,
+                  retries, textOnly=False):
         """Load and store data necessary to display a clip preview
 
+        @param  results     The search results the item is in.
+        @param  dataCache   The data cache for those results.
         @param  cacheIndex  The index of the item to load.
         @param  dataMgr     The data manager to use for retrieving data.
         @param  clipMgr     The data manager to use for retrieving data.
@@ -861,7 +932,7 @@ class SearchResultsList(wx.VListBox):
         @param  textOnly    If True do not attempt to load the thumbnail.
         @return loaded      True if an item's UI was loaded.
         """
-        result = self._curResults[cacheIndex]
+        result = results[cacheIndex]
         camLoc = result.camLoc
         startMs = result.startTime
         playMs = result.playStart
@@ -870,7 +941,7 @@ class SearchResultsList(wx.VListBox):
         objListForMarkup = objList if self._markupModel.getShowBoxesAroundObjects() else None
         isSaved = result.isSaved
 
-        img, label, timeStr, _ = self._dataCache[cacheIndex]
+        img, label, timeStr, _ = dataCache[cacheIndex]
         hadImg = img is not None
         hadLabel = label is not None
 
@@ -896,18 +967,32 @@ class SearchResultsList(wx.VListBox):
                 result.isSaved = isSaved
 
         if img is None and not textOnly and isSaved in (True, False):
-            if retries < _kNumLoadRetries:
-                # we're still trying to load the frame at the correct offset
-                img = dataMgr.getSingleMarkedFrame(camLoc, previewMs, objListForMarkup,
-                                            (_kPreviewWidth, 0))
-            elif retries == _kNumLoadRetries:
-                # On the off chance that an image simply didn't exist at the
-                # time we were requesting, attempt to grab the beginning
-                # frame to avoid "video not found"
-                img = dataMgr.getSingleMarkedFrame(camLoc, startMs, objListForMarkup,
-                                               (_kPreviewWidth,
-                                                0),
-                                               False)
+            if retries <= _kNumLoadRetries:
+                if retries < _kNumLoadRetries:
+                    # we're still trying to load the frame at the correct offset
+                    ms, useTolerance = previewMs, True
+                else:
+                    # On the off chance that an image simply didn't exist at the
+                    # time we were requesting, attempt to grab the beginning
+                    # frame to avoid "video not found"
+                    ms, useTolerance = startMs, False
+
+                # Decoded thumbs are kept across searches, keyed by
+                # everything that goes into them.
+                markupKey = None
+                if objListForMarkup is not None:
+                    markupKey = (tuple(objListForMarkup),
+                                 self._subMarkupModel.getShowDifferentColorBoxes())
+                imgKey = (camLoc, ms, (_kPreviewWidth, 0), useTolerance,
+                          markupKey)
+                img = self._thumbLoader.getCached(imgKey)
+                if img is None:
+                    img = dataMgr.getSingleMarkedFrame(camLoc, ms,
+                                                       objListForMarkup,
+                                                       (_kPreviewWidth, 0),
+                                                       useTolerance)
+                    if img is not None:
+                        self._thumbLoader.putCached(imgKey, img)
             else:
                 # go for the safe option
                 label = "Video not found"
@@ -915,14 +1000,13 @@ class SearchResultsList(wx.VListBox):
                 # We'll set isSaved to True...seems right to just not
                 # show anything about saving/not saving when the video
                 # doesn't exist...
-                self._dataCache[cacheIndex] = (img, label, camLoc,
-                                               True)
+                dataCache[cacheIndex] = (img, label, camLoc, True)
                 return True
 
             if img is None:
                 return False
 
-            self._dataCache[cacheIndex] = (img, label, timeStr, isSaved)
+            dataCache[cacheIndex] = (img, label, timeStr, isSaved)
 
         if not label:
             # Generate the label
@@ -997,7 +1081,7 @@ class SearchResultsList(wx.VListBox):
                     if timeStr[0] == '0':
                         timeStr = timeStr[1:]
 
-            self._dataCache[cacheIndex] = (img, label, timeStr, isSaved)
+            dataCache[cacheIndex] = (img, label, timeStr, isSaved)
 
         if (label and not hadLabel) or (img and not hadImg):
             return True
@@ -1672,7 +1672,8 @@ class SearchResultsPlaybackPanel(BorderImagePanel):
 
         fileList = []
         for filename, startms, _ in files:
-            fileList.append((os.path.join(storagePath, filename), startms))
+            fileList.append((clipManager.getClipPath(storagePath, filename),
+                             startms))
 
         self._progressDlg = ExportProgressDialog(self, fileList, savePath, startTime, endTime,
             getUserLocalDataDir(), extras, self._logger, self._progressFn)
@@ -0,0 +1,339 @@
+#!/usr/bin/env python
+
+#*****************************************************************************
+#
+# ThumbnailLoader.py
+#     Loads thumbnails on a few threads, most wanted first, and keeps them.
+#
+#
+#*****************************************************************************
+#
+#
+# Copyright 2013-2022 Sighthound, Inc.
+#
+# Licensed under the GNU GPLv3 license found at
+# https://www.gnu.org/licenses/gpl-3.0.txt
+#
+# Alternative licensing available from Sighthound, Inc.
+# by emailing opensource@sighthound.com
+#
+# This file is part of the Sighthound Video project which can be found at
+# https://github.com/sighthoundinc/SighthoundVideo
+#
+# This program is free software; you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation; using version 3 of the License.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program; if not, write to the Free Software
+# Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02111, USA.
+#
+#
+#*****************************************************************************
+
+"""
+## @file
+Contains the ThumbnailLoader class.
+"""
+
+# Python imports...
+from collections import OrderedDict
+import threading
+
+# Common 3rd-party imports...
+
+# Toolbox imports...
+
+# Local imports...
+
+# How many threads load thumbnails.  Each has its own database connections
+# and decodes video on its own, so more would mostly fight over the disk.
+_kNumWorkers = 3
+
+# How much memory decoded thumbnails may take up.
+_kMaxCacheBytes = 32*1024*1024
+
+
+###############################################################
+def getImageBytes(img):
+    """Return roughly how much memory a decoded PIL image takes up.
+
+    @param  img       The image.
+    @return numBytes  Its size in bytes.
+    """
+    width, height = img.size
+    return width * height * len(img.getbands())
+
+
+###############################################################
+class ThumbnailLoader(object):
+    """Runs loads on a bounded number of threads, and keeps what they decode.
+
+    Whoever uses it says what it wants loaded, most wanted first, and says
+    so again whenever that changes, like when the view scrolls.  Whatever
+    was wanted before and isn't anymore is dropped, unless a thread already
+    started on it.
+
+    Decoded images are kept in a cache bounded by memory, keyed by anything
+    describing what went into them, like camera, time, size and markup.  It
+    outlives any one set of loads, so showing the same thing again needs no
+    decoding.
+    """
+    ###########################################################
+    def __init__(self, openWorker, load, closeWorker, logger,
+                 numWorkers=_kNumWorkers, maxCacheBytes=_kMaxCacheBytes,
+                 sizeOf=getImageBytes):
+        """Initializer for ThumbnailLoader
+
+        @param  openWorker     Function returning whatever a thread needs to
+                               load, like its own database connections; called
+                               on the thread before its first load.
+        @param  load           Function taking (state, key), where state came
+                               from openWorker; called on our threads.
+        @param  closeWorker    Function taking state, called when a thread
+                               stops.
+        @param  logger         The logger to use.
+        @param  numWorkers     How many threads to load on.
+        @param  maxCacheBytes  How much memory cached images may take up.
+        @param  sizeOf         Function returning the size of a cached image.
+        """
+        self._openWorker = openWorker
+        self._load = load
+        self._closeWorker = closeWorker
+        self._logger = logger
+        self._maxCacheBytes = maxCacheBytes
+        self._sizeOf = sizeOf
+
+        # Guards everything below; threads wait on it for work.
+        self._cond = threading.Condition()
+
+        # Keys of loads not started yet, most wanted first.
+        self._wanted = OrderedDict()
+        # Keys being loaded right now.
+        self._running = set()
+        self._shutdown = False
+
+        # Key to (image, size); least recently used first.
+        self._cache = OrderedDict()
+        self._cacheBytes = 0
+
+        self._threads = []
+        for i in xrange(numWorkers):
+            thread = threading.Thread(target=self._run,
+                                      name="thumbnailLoader-%d" % i)
+            thread.setDaemon(True)
+            thread.start()
+            self._threads.append(thread)
+
+
+    ###########################################################
+    def setWanted(self, keys):
+        """Say what should be loaded, replacing what was wanted before.
+
+        @param  keys  Keys to pass to load(), most wanted first.  Ones being
+                      loaded right now are skipped.  Ignored once shut down.
+        """
+        self._cond.acquire()
+        try:
+            if self._shutdown:
+                return
+            self._wanted = OrderedDict((key, None) for key in keys
+                                       if key not in self._running)
+            if self._wanted:
+                self._cond.notifyAll()
+        finally:
+            self._cond.release()
+
+
+    ###########################################################
+    def getPending(self):
+        """Return what's wanted or being loaded.
+
+        @return keys  A set of keys.
+        """
+        self._cond.acquire()
+        try:
+            return set(self._wanted) | self._running
+        finally:
+            self._cond.release()
+
+
+    ###########################################################
+    def getCached(self, cacheKey):
+        """Return a decoded image, if we have it.
+
+        @param  cacheKey  What went into making the image.
+        @return img       The image, or None.
+        """
+        self._cond.acquire()
+        try:
+            item = self._cache.pop(cacheKey, None)
+            if item is None:
+                return None
+            self._cache[cacheKey] = item
+            return item[0]
+        finally:
+            self._cond.release()
+
+
+    ###########################################################
+    def putCached(self, cacheKey, img):
+        """Keep a decoded image, dropping the least recently used ones if
+        they take up too much memory.
+
+        @param  cacheKey  What went into making the image.
+        @param  img       The image; must not be changed after this.
+        """
+        size = self._sizeOf(img)
+
+        self._cond.acquire()
+        try:
+            old = self._cache.pop(cacheKey, None)
+            if old is not None:
+                self._cacheBytes -= old[1]
+            self._cache[cacheKey] = (img, size)
+            self._cacheBytes += size
+            while self._cacheBytes > self._maxCacheBytes and \
+                  len(self._cache) > 1:
+                _, (_, oldSize) = self._cache.popitem(last=False)
+                self._cacheBytes -= oldSize
+        finally:
+            self._cond.release()
+
+
+    ###########################################################
+    def shutdown(self):
+        """Drop what's wanted and wait for the threads to stop."""
+        self._cond.acquire()
+        try:
+            self._shutdown = True
+            self._wanted.clear()
+            self._cond.notifyAll()
+        finally:
+            self._cond.release()
+
+        for thread in self._threads:
+            if thread is not threading.currentThread():
+                thread.join()
+
+
+    ###########################################################
+    def _run(self):
+        """Load what's wanted, until shut down."""
+        state = None
+        try:
+            while True:
+                self._cond.acquire()
+                try:
+                    while not self._shutdown and not self._wanted:
+                        self._cond.wait()
+                    if self._shutdown:
+                        return
+                    key, _ = self._wanted.popitem(last=False)
+                    self._running.add(key)
+                finally:
+                    self._cond.release()
+
+                try:
+                    if state is None:
+                        state = self._openWorker()
+                    self._load(state, key)
+                except Exception:
+                    self._logger.error("Unhandled exception in thumb loader!",
+                                       exc_info=True)
+                finally:
+                    self._cond.acquire()
+                    try:
+                        self._running.discard(key)
+                    finally:
+                        self._cond.release()
+        finally:
+            if state is not None:
+                try:
+                    self._closeWorker(state)
+                except Exception:
+                    self._logger.error("Couldn't close thumb loader",
+                                       exc_info=True)
+
+
+
+##############################################################################
+def _testThumbnailLoader():
+    """Test loading thumbnails.
+
+    >>> import time
+    >>> from vitaToolbox.loggingUtils.LoggingUtils import EmptyLogger
+    >>> started = threading.Event()
+    >>> release = threading.Event()
+    >>> loaded = []
+    >>> def load(state, key):
+    ...     started.set()
+    ...     release.wait()
+    ...     loaded.append(key)
+    >>> opened, closed = [], []
+    >>> loader = ThumbnailLoader(lambda: opened.append(1) or 'db', load,
+    ...                          closed.append, EmptyLogger(), numWorkers=1,
+    ...                          maxCacheBytes=10, sizeOf=len)
+
+    Loads go most wanted first; ones not wanted anymore are dropped, except
+    what already started:
+
+    >>> loader.setWanted([1, 2, 3])
+    >>> _ = started.wait(1); time.sleep(.05)
+    >>> sorted(loader.getPending())
+    [1, 2, 3]
+    >>> loader.setWanted([5, 1, 4])
+    >>> release.set()
+    >>> time.sleep(.2)
+    >>> loaded, loader.getPending()
+    ([1, 5, 4], set([]))
+
+    Searches in a row drop what the one before wanted, but keep loading:
+
+    >>> del loaded[:]
+    >>> for search in ([10, 11], [20, 21]):
+    ...     loader.setWanted([])
+    ...     loader.setWanted(search)
+    ...     time.sleep(.2)
+    >>> loaded, loader.getPending()
+    ([10, 11, 20, 21], set([]))
+
+    Cached images are kept until they take up too much memory:
+
+    >>> loader.putCached('a', 'aaaa'); loader.putCached('b', 'bbbb')
+    >>> loader.getCached('a')
+    'aaaa'
+    >>> loader.putCached('c', 'cccc')
+    >>> loader.getCached('a'), loader.getCached('b'), loader.getCached('c')
+    ('aaaa', None, 'cccc')
+
+    Threads open what they need once, and close it when shut down:
+
+    >>> loader.shutdown()
+    >>> opened, closed
+    ([1], ['db'])
+
+    Nothing is wanted after that:
+
+    >>> loader.setWanted([1, 2, 3]); loader.getPending()
+    set([])
+    """
+
+
+##############################################################################
+def test_main():
+    """OB_REDACT
+    Our main function, which runs test code
+    """
+    import doctest
+    doctest.testmod(verbose=True)
+
+
+##############################################################################
+if __name__ == '__main__':
+    test_main()
@@ -0,0 +1,120 @@
+#!/usr/bin/env python
+
+#*****************************************************************************
+#
+# benchmarkCameraWorkers.py
+#     Measures memory and CPU per camera of a running back end.
+#
+#
+#*****************************************************************************
+#
+#
+# Copyright 2013-2022 Sighthound, Inc.
+#
+# Licensed under the GNU GPLv3 license found at
+# https://www.gnu.org/licenses/gpl-3.0.txt
+#
+# Alternative licensing available from Sighthound, Inc.
+# by emailing opensource@sighthound.com
+#
+# This file is part of the Sighthound Video project which can be found at
+# https://github.com/sighthoundinc/SighthoundVideo
+#
+# This program is free software; you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation; using version 3 of the License.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program; if not, write to the Free Software
+# Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02111, USA.
+#
+#*****************************************************************************
+
+# Usage:
+#   python benchmarkCameraWorkers.py <backEndPid> <numCameras> [seconds]
+#
+# Adds up the resident memory and CPU time of all processes started by the
+# back end, over the given number of seconds (60 by default).  Run it once
+# with the default of one process per camera and once with the
+# "camerasPerWorker" debug pref set, with the same cameras running; the
+# processes that aren't cameras cost the same both times, so the difference
+# is what the cameras save.  Needs "ps", so Mac and Linux only.
+
+import os
+import sys
+import time
+
+
+###############################################################
+def _parseCpuTime(cpuTime):
+    """Convert a ps time, [[dd-]hh:]mm:ss, to seconds.
+
+    @param  cpuTime  The time, as printed by ps.
+    @return secs     The time in seconds.
+    """
+    days = 0
+    if '-' in cpuTime:
+        days, cpuTime = cpuTime.split('-', 1)
+    secs = 0
+    for part in cpuTime.split(':'):
+        secs = secs*60 + float(part)
+    return int(days)*24*60*60 + secs
+
+
+###############################################################
+def _getChildStats(parentPid):
+    """Return memory and CPU time of the children of a process.
+
+    @param  parentPid  The process id of the parent.
+    @return stats      A dict of pid to (rss in KB, CPU seconds).
+    """
+    stats = {}
+    for line in os.popen('ps ax -o ppid=,pid=,rss=,time=').readlines():
+        fields = line.split()
+        if len(fields) != 4 or int(fields[0]) != parentPid:
+            continue
+        stats[int(fields[1])] = (int(fields[2]), _parseCpuTime(fields[3]))
+    return stats
+
+
+###############################################################
+def main(argv):
+    if len(argv) < 3:
+        print "Usage: %s <backEndPid> <numCameras> [seconds]" % argv[0]
+        return 1
+
+    parentPid = int(argv[1])
+    numCameras = max(1, int(argv[2]))
+    seconds = float(argv[3]) if len(argv) > 3 else 60
+
+    startTime = time.time()
+    startStats = _getChildStats(parentPid)
+    time.sleep(seconds)
+    endStats = _getChildStats(parentPid)
+    elapsed = time.time() - startTime
+
+    # Only count processes that were there the whole time, so that restarts
+    # don't skew the CPU numbers.
+    pids = sorted(set(startStats) & set(endStats))
+    totalRss = sum(endStats[pid][0] for pid in pids)
+    totalCpu = sum(endStats[pid][1] - startStats[pid][1] for pid in pids)
+
+    print "%d processes, %d cameras, %.0f seconds" % (len(pids), numCameras,
+                                                      elapsed)
+    for pid in pids:
+        print "  pid %6d: %8d KB, %5.1f%% CPU" % (pid, endStats[pid][0],
+            100.0*(endStats[pid][1] - startStats[pid][1])/elapsed)
+    print "Total:      %8d KB, %5.1f%% CPU" % (totalRss,
+                                              100.0*totalCpu/elapsed)
+    print "Per camera: %8d KB, %5.1f%% CPU" % (totalRss/numCameras,
+                                              100.0*totalCpu/elapsed/numCameras)
+    return 0
+
+
+if __name__ == '__main__':
+    sys.exit(main(sys.argv))
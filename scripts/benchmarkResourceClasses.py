@@ -0,0 +1,228 @@
+#!/usr/bin/env python
+
+#*****************************************************************************
+#
+# benchmarkResourceClasses.py
+#     Measures how steady frame timing stays during an export.
+#
+#
+#*****************************************************************************
+#
+#
+# Copyright 2013-2022 Sighthound, Inc.
+#
+# Licensed under the GNU GPLv3 license found at
+# https://www.gnu.org/licenses/gpl-3.0.txt
+#
+# Alternative licensing available from Sighthound, Inc.
+# by emailing opensource@sighthound.com
+#
+# This file is part of the Sighthound Video project which can be found at
+# https://github.com/sighthoundinc/SighthoundVideo
+#
+# This program is free software; you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation; using version 3 of the License.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program; if not, write to the Free Software
+# Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02111, USA.
+#
+#
+#*****************************************************************************
+
+# Usage:
+#   python benchmarkResourceClasses.py <tmpDir> [seconds] [pin]
+#
+# Runs a stand-in for a camera: a process that wakes up for each frame at
+# 30 fps, does a little work on it and writes it out, syncing to disk every
+# second like a recording does.  It measures how late each frame is.  That
+# is done three times, for the given number of seconds each (10 by
+# default):
+#   idle:        nothing else running.
+#   export:      next to a stand-in for an export, which keeps every CPU busy
+#                and writes large files to the same disk.
+#   classes:     the same, with the camera in the realtime resource class and
+#                the export in the bulk one, as the back end does it.
+# Pass "pin" to also pin processes to CPUs.  Run from the top of the tree,
+# with it on PYTHONPATH.  Niceness works everywhere but Windows; I/O
+# priority and pinning need Linux.
+
+import logging
+import os
+import sys
+import time
+from multiprocessing import Process, Queue
+
+from vitaToolbox.process.ProcessUtils import ResourceClasses
+from vitaToolbox.process.ProcessUtils import kResourceClassRealtime
+from vitaToolbox.process.ProcessUtils import kResourceClassBulk
+
+_kFps = 30
+_kFrameWork = 20000
+_kFrameBytes = 64*1024
+_kExportBytes = 4*1024*1024
+_kExportFileBytes = 256*1024*1024
+
+
+###############################################################
+def _runCamera(tmpDir, seconds, resultQueue):
+    """Pretend to record a camera, reporting how late frames were.
+
+    @param  tmpDir       A directory to write to.
+    @param  seconds      How long to run.
+    @param  resultQueue  Gets a list of how late each frame was, in ms.
+    """
+    path = os.path.join(tmpDir, "camera-%d.tmp" % os.getpid())
+    f = open(path, 'wb')
+    frame = os.urandom(_kFrameBytes)
+    lateness = []
+    try:
+        interval = 1.0 / _kFps
+        start = time.time()
+        for frameNum in xrange(int(seconds * _kFps)):
+            due = start + frameNum * interval
+            delay = due - time.time()
+            if delay > 0:
+                time.sleep(delay)
+            lateness.append(max(0, time.time() - due) * 1000)
+
+            total = 0
+            for i in xrange(_kFrameWork):
+                total += i
+            f.write(frame)
+            if frameNum % _kFps == _kFps - 1:
+                f.flush()
+                os.fsync(f.fileno())
+    finally:
+        f.close()
+        os.remove(path)
+    resultQueue.put(lateness)
+
+
+###############################################################
+def _runExportCpu():
+    """Keep one CPU busy, like encoding an export does."""
+    total = 0
+    while True:
+        total += 1
+
+
+###############################################################
+def _runExportWriter(tmpDir):
+    """Write large files over and over, like saving an export does; the
+    file is left behind when we're terminated.
+
+    @param  tmpDir  A directory to write to.
+    """
+    path = os.path.join(tmpDir, "export-%d.tmp" % os.getpid())
+    block = os.urandom(_kExportBytes)
+    while True:
+        f = open(path, 'wb')
+        try:
+            for _ in xrange(_kExportFileBytes // _kExportBytes):
+                f.write(block)
+            f.flush()
+            os.fsync(f.fileno())
+        finally:
+            f.close()
+
+
+###############################################################
+def _startProcess(target, args, resourceClasses, resourceClass):
+    """Start a process, in a resource class if asked to.
+
+    @param  target           The function to run.
+    @param  args             Arguments for it.
+    @param  resourceClasses  A ResourceClasses, or None.
+    @param  resourceClass    The class to put the process in.
+    @return proc             The process.
+    """
+    proc = Process(target=target, args=args)
+    proc.daemon = True
+    proc.start()
+    if resourceClasses is not None:
+        resourceClasses.apply(proc.pid, resourceClass, True)
+    return proc
+
+
+###############################################################
+def _runTrial(tmpDir, seconds, withExport, resourceClasses):
+    """Run the camera once, and return how late its frames were.
+
+    @param  tmpDir           A directory to write to.
+    @param  seconds          How long to run.
+    @param  withExport       True to run an export next to the camera.
+    @param  resourceClasses  A ResourceClasses to use, or None.
+    @return lateness         A sorted list of how late each frame was, in ms.
+    """
+    exportProcs = []
+    if withExport:
+        for _ in xrange(max(1, os.sysconf('SC_NPROCESSORS_ONLN'))):
+            exportProcs.append(_startProcess(_runExportCpu, (),
+                                             resourceClasses,
+                                             kResourceClassBulk))
+        exportProcs.append(_startProcess(_runExportWriter, (tmpDir,),
+                                         resourceClasses, kResourceClassBulk))
+
+    resultQueue = Queue()
+    camera = _startProcess(_runCamera, (tmpDir, seconds, resultQueue),
+                           resourceClasses, kResourceClassRealtime)
+    try:
+        lateness = resultQueue.get(True, seconds * 2 + 30)
+        camera.join()
+    finally:
+        for proc in exportProcs:
+            proc.terminate()
+            proc.join()
+            path = os.path.join(tmpDir, "export-%d.tmp" % proc.pid)
+            if os.path.exists(path):
+                os.remove(path)
+    return sorted(lateness)
+
+
+###############################################################
+def _percentile(values, share):
+    """Return a percentile of sorted values.
+
+    @param  values  A sorted, non-empty list.
+    @param  share   Which percentile, like .99.
+    @return value   The value.
+    """
+    return values[min(len(values) - 1, int(len(values) * share))]
+
+
+###############################################################
+def main(argv):
+    if len(argv) < 2:
+        print "Usage: %s <tmpDir> [seconds] [pin]" % argv[0]
+        return 1
+
+    tmpDir = argv[1]
+    seconds = float(argv[2]) if len(argv) > 2 else 10
+    pinCpus = len(argv) > 3 and argv[3] == "pin"
+
+    logging.basicConfig()
+    resourceClasses = ResourceClasses(logging.getLogger("benchmark"),
+                                      pinCpus)
+
+    print "%d fps, %.0f seconds each; frame lateness in ms" % (_kFps, seconds)
+    print "%-8s %8s %8s %8s %8s" % ("", "p50", "p99", "max", ">1 frame")
+    for name, withExport, classes in (("idle", False, None),
+                                      ("export", True, None),
+                                      ("classes", True, resourceClasses)):
+        lateness = _runTrial(tmpDir, seconds, withExport, classes)
+        numDropped = len([ms for ms in lateness if ms > 1000.0 / _kFps])
+        print "%-8s %8.1f %8.1f %8.1f %8d" % (name,
+            _percentile(lateness, .5), _percentile(lateness, .99),
+            lateness[-1], numDropped)
+    return 0
+
+
+if __name__ == '__main__':
+    sys.exit(main(sys.argv))
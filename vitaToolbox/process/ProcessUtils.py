@@ -45,18 +45,26 @@ if sys.platform == 'win32':
     from ProcessUtilsWin import killProcess
     from ProcessUtilsWin import getMemoryStats
     from ProcessUtilsWin import checkMemoryLimit
+    from ProcessUtilsWin import getMemoryUsage
     from ProcessUtilsWin import getOpenModuleInfoList
     from ProcessUtilsWin import setPriority
     from ProcessUtilsWin import filteredProcessCommands
     def listChildProcessesOfPID(*args, **kwargs): return []
+
+    class ResourceClasses(object):
+        """Resource classes aren't supported here; see ProcessUtilsUnix."""
+        def __init__(self, *args, **kwargs): pass
+        def apply(self, *args, **kwargs): pass
 else:
     from ProcessUtilsUnix import listProcesses
     from ProcessUtilsUnix import getProcessName
     from ProcessUtilsUnix import killProcess
     from ProcessUtilsUnix import getMemoryStats
     from ProcessUtilsUnix import checkMemoryLimit
+    from ProcessUtilsUnix import getMemoryUsage
     from ProcessUtilsUnix import filteredProcessCommands
     from ProcessUtilsUnix import listChildProcessesOfPID
+    from ProcessUtilsUnix import ResourceClasses
     from os import nice as setPriority
     def getOpenModuleInfoList(_): return []
 
@@ -65,6 +73,13 @@ kPriorityLow = 10
 kPriorityNormal = 0
 kPriorityHigh = -10
 
+# Resource classes, for ResourceClasses.apply(); ProcessUtilsUnix has no
+# platform dependent imports, so these come from there everywhere.
+from ProcessUtilsUnix import kResourceClassRealtime
+from ProcessUtilsUnix import kResourceClassService
+from ProcessUtilsUnix import kResourceClassBulk
+from ProcessUtilsUnix import kResourceClassIdle
+
 
 ##############################################################################
 def getProcessesWithName(toFind):
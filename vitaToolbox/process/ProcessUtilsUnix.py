@@ -37,7 +37,11 @@
 #*****************************************************************************
 
 # Python imports...
+import ctypes
+import ctypes.util
+import glob
 import os
+import platform
 import sys
 import traceback
 
@@ -60,6 +64,59 @@ else:
     # Our processes normally should not exceed 500MB
     _kMemoryDieKB = 4000 * 1000
 
+# Resource classes, from most to least important.
+#   kResourceClassRealtime:  must keep up with cameras; capture and analytics.
+#   kResourceClassService:   answers people; the UI server and web server.
+#   kResourceClassBulk:      big jobs that may take a little longer, like
+#                            exporting and sending clips, or deleting old
+#                            video.
+#   kResourceClassIdle:      only when nothing else wants the machine; may
+#                            starve for good, so only for work that never
+#                            has to finish.
+kResourceClassRealtime = "realtime"
+kResourceClassService = "service"
+kResourceClassBulk = "bulk"
+kResourceClassIdle = "idle"
+
+# I/O scheduling classes, for setIoPriority().
+kIoClassBestEffort = 2
+kIoClassIdle = 3
+
+# What each resource class gets, as (niceness, I/O class, I/O level from 0,
+# first, to 7, cgroup cpu.weight where 100 is the default).  Niceness only
+# goes up without root, so nothing is below what we start with.
+_kResourceClasses = {
+    kResourceClassRealtime: (0, kIoClassBestEffort, 0, 400),
+    kResourceClassService:  (2, kIoClassBestEffort, 4, 100),
+    kResourceClassBulk:     (10, kIoClassBestEffort, 7, 25),
+    kResourceClassIdle:     (19, kIoClassIdle, 0, 10),
+}
+
+# Classes kept off the CPUs that capture runs on, when pinning.
+_kBulkClasses = (kResourceClassBulk, kResourceClassIdle)
+
+# Pinning leaves this share of CPUs, at least one, to bulk work; with fewer
+# CPUs than _kMinPinCpus it isn't worth it, and nothing is pinned.
+_kBulkCpuShare = 4
+_kMinPinCpus = 4
+
+# The ioprio_set system call, by machine; there's no libc wrapper for it.
+_kIoprioSetSyscalls = {
+    'x86_64': 251,
+    'i386': 289,
+    'i686': 289,
+    'aarch64': 30,
+    'armv7l': 314,
+}
+_kIoprioWhoProcess = 1
+_kIoprioClassShift = 13
+
+_kPrioProcess = 0
+
+_kIsLinux = sys.platform.startswith('linux')
+
+_libc = None
+
 
 ##############################################################################
 def listProcesses():
@@ -168,6 +225,42 @@ def getMemoryStats(processId):
 
     return memoryStats
 
+###########################################################
+def getMemoryUsage(processId):
+    """Return how much memory a process uses; cheap enough to call often.
+
+    On Linux this reads /proc, which also tells the proportional set size:
+    resident memory, with pages shared with other processes, like the ones
+    a forked child still shares with its parent, split between them.
+    Elsewhere it falls back to getMemoryStats().
+
+    @param  processId  The process ID.
+    @return rssKB      The resident set size in KB, or None on error.
+    @return pssKB      The proportional set size in KB, or None if unknown.
+    """
+    if not _kIsLinux:
+        return getMemoryStats(processId).get('real'), None
+
+    rssKB = pssKB = None
+    for path in ('/proc/%d/smaps_rollup' % processId,
+                 '/proc/%d/status' % processId):
+        try:
+            f = open(path)
+            try:
+                for line in f:
+                    if line.startswith('Rss:') or line.startswith('VmRSS:'):
+                        rssKB = int(line.split()[1])
+                    elif line.startswith('Pss:'):
+                        pssKB = int(line.split()[1])
+            finally:
+                f.close()
+        except (IOError, ValueError):
+            continue
+        if rssKB is not None:
+            break
+    return rssKB, pssKB
+
+
 ###########################################################
 def checkMemoryLimit(processId):
     """ Return false if the process exceeds defined memory limit
@@ -185,3 +278,321 @@ def checkMemoryLimit(processId):
     return result, memoryStats
 
 
+###########################################################
+def _getLibc():
+    """Return the C library, loading it the first time.
+
+    @return libc  The C library, as a ctypes.CDLL.
+    """
+    global _libc
+    if _libc is None:
+        _libc = ctypes.CDLL(ctypes.util.find_library('c'), use_errno=True)
+    return _libc
+
+
+###########################################################
+def _checkCall(result, what):
+    """Raise an OSError if a C library call failed.
+
+    @param  result  What the call returned; -1 means it failed.
+    @param  what    What was called, for the error.
+    """
+    if result == -1:
+        err = ctypes.get_errno()
+        raise OSError(err, "%s: %s" % (what, os.strerror(err)))
+
+
+###########################################################
+def _listThreads(processId):
+    """Return the threads of a process.
+
+    Niceness, I/O priority and CPU affinity belong to each thread on Linux,
+    so changing them for a process that already started threads means
+    changing them for each one.
+
+    @param  processId  The process ID.
+    @return threadIds  A list of thread IDs; just the process ID where
+                       threads can't be listed.
+    """
+    if _kIsLinux:
+        try:
+            return [int(tid) for tid in
+                    os.listdir('/proc/%d/task' % processId)]
+        except OSError:
+            pass
+    return [processId]
+
+
+###########################################################
+def setNiceness(processId, niceness):
+    """Set the niceness of another process, and all of its threads.
+
+    @param  processId  The process ID.
+    @param  niceness   The niceness, from -20 to 19.
+    """
+    libc = _getLibc()
+    for threadId in _listThreads(processId):
+        _checkCall(libc.setpriority(_kPrioProcess, threadId, niceness),
+                   "setpriority")
+
+
+###########################################################
+def setIoPriority(processId, ioClass, level=0):
+    """Set the I/O priority of another process, and all of its threads.
+
+    Linux only; does nothing elsewhere.
+
+    @param  processId  The process ID.
+    @param  ioClass    kIoClassBestEffort or kIoClassIdle.
+    @param  level      For kIoClassBestEffort, from 0, first, to 7.
+    """
+    if not _kIsLinux:
+        return
+    syscallNum = _kIoprioSetSyscalls.get(platform.machine())
+    if syscallNum is None:
+        raise OSError(0, "ioprio_set: unknown machine %s" % platform.machine())
+    ioprio = (ioClass << _kIoprioClassShift) | level
+    libc = _getLibc()
+    for threadId in _listThreads(processId):
+        _checkCall(libc.syscall(syscallNum, _kIoprioWhoProcess, threadId,
+                                ioprio), "ioprio_set")
+
+
+###########################################################
+def setCpuAffinity(processId, cpus):
+    """Keep another process, and all of its threads, on the given CPUs.
+
+    Linux only; does nothing elsewhere.
+
+    @param  processId  The process ID.
+    @param  cpus       A list of CPU numbers.
+    """
+    if not _kIsLinux or not cpus:
+        return
+    bitsPerWord = 8 * ctypes.sizeof(ctypes.c_ulong)
+    mask = (ctypes.c_ulong * (max(cpus) // bitsPerWord + 1))()
+    for cpu in cpus:
+        mask[cpu // bitsPerWord] |= 1 << (cpu % bitsPerWord)
+    libc = _getLibc()
+    for threadId in _listThreads(processId):
+        _checkCall(libc.sched_setaffinity(threadId, ctypes.sizeof(mask),
+                                          ctypes.byref(mask)),
+                   "sched_setaffinity")
+
+
+###########################################################
+def _parseCpuList(cpuList):
+    """Parse a kernel CPU list, like "0-3,8".
+
+    @param  cpuList  The list, as text.
+    @return cpus     A sorted list of CPU numbers.
+
+    >>> _parseCpuList("0-3,8,10-11\\n")
+    [0, 1, 2, 3, 8, 10, 11]
+    >>> _parseCpuList("")
+    []
+    """
+    cpus = set()
+    for part in cpuList.strip().split(','):
+        if '-' in part:
+            first, last = part.split('-')
+            cpus.update(xrange(int(first), int(last)+1))
+        elif part:
+            cpus.add(int(part))
+    return sorted(cpus)
+
+
+###########################################################
+def getNumaNodes():
+    """Return the CPUs of each NUMA node.
+
+    @return nodes  A list with a sorted list of CPU numbers for each node
+                   that has CPUs; one node with all CPUs where there's no
+                   NUMA information.
+    """
+    nodes = []
+    for path in sorted(glob.glob('/sys/devices/system/node/node*/cpulist')):
+        try:
+            f = open(path)
+            try:
+                cpus = _parseCpuList(f.read())
+            finally:
+                f.close()
+        except (IOError, ValueError):
+            continue
+        if cpus:
+            nodes.append(cpus)
+    if not nodes:
+        try:
+            numCpus = os.sysconf('SC_NPROCESSORS_ONLN')
+        except (ValueError, OSError):
+            numCpus = 1
+        nodes = [range(max(1, numCpus))]
+    return nodes
+
+
+###########################################################
+def splitCpus(nodes):
+    """Decide which CPUs capture runs on and which bulk work runs on.
+
+    The last CPUs go to bulk work, since the first ones tend to be the ones
+    interrupts go to.
+
+    @param  nodes        The CPUs of each NUMA node, as from getNumaNodes().
+    @return captureCpus  A list with a list of CPUs for capture for each node
+                         that has any, or None if nothing should be pinned.
+    @return bulkCpus     A list of CPUs for bulk work, or None.
+
+    >>> splitCpus([[0, 1, 2, 3, 4, 5, 6, 7]])
+    ([[0, 1, 2, 3, 4, 5]], [6, 7])
+    >>> splitCpus([[0, 1, 2, 3], [4, 5, 6, 7]])
+    ([[0, 1, 2, 3], [4, 5]], [6, 7])
+    >>> splitCpus([[0, 1]])
+    (None, None)
+    """
+    allCpus = sorted(cpu for node in nodes for cpu in node)
+    if len(allCpus) < _kMinPinCpus:
+        return None, None
+    bulkCpus = allCpus[-max(1, len(allCpus) // _kBulkCpuShare):]
+    captureCpus = [[cpu for cpu in node if cpu not in bulkCpus]
+                   for node in nodes]
+    return [cpus for cpus in captureCpus if cpus], bulkCpus
+
+
+###############################################################
+class ResourceClasses(object):
+    """Gives child processes the share of CPU and disk their work needs.
+
+    Each process gets a resource class when it starts, which sets its
+    niceness and I/O priority.  Optionally:
+    - processes are pinned to CPUs, realtime ones spread across NUMA nodes
+      and bulk and idle ones kept to a few CPUs of their own;
+    - processes are put in a cgroup v2 group for their class, below a
+      directory we were given to manage, which weighs their CPU and I/O.
+
+    Each of these is best effort: what the system doesn't allow is logged
+    once and skipped.  Nothing here needs root, except niceness below the
+    one we run at.
+    """
+    ###########################################################
+    def __init__(self, logger, pinCpus=False, cgroupDir=None,
+                 classes=_kResourceClasses):
+        """Initializer for ResourceClasses
+
+        @param  logger     The logger to use.
+        @param  pinCpus    True to pin processes to CPUs.
+        @param  cgroupDir  A cgroup v2 directory we may make groups in, with
+                           no processes of its own, or None.
+        @param  classes    A dict of resource class to (niceness, I/O class,
+                           I/O level, cpu.weight).
+        """
+        self._logger = logger
+        self._classes = classes
+
+        # Failures already logged, so that each is logged only once.
+        self._warned = set()
+
+        self._captureCpus = None
+        self._bulkCpus = None
+        self._nextNode = 0
+        if pinCpus and _kIsLinux:
+            self._captureCpus, self._bulkCpus = splitCpus(getNumaNodes())
+            if self._captureCpus is None:
+                self._logger.info("Too few CPUs to pin processes to")
+            else:
+                self._logger.info("Pinning capture to CPUs %s, bulk work to "
+                                  "CPUs %s" % (self._captureCpus,
+                                               self._bulkCpus))
+
+        self._cgroupDir = None
+        if cgroupDir and _kIsLinux:
+            if os.path.isfile(os.path.join(cgroupDir, 'cgroup.controllers')):
+                self._cgroupDir = cgroupDir
+                self._initCgroups()
+            else:
+                self._logger.warn("No cgroup v2 at %s" % cgroupDir)
+
+
+    ###########################################################
+    def apply(self, processId, resourceClass, spread=False):
+        """Put a process in a resource class.
+
+        @param  processId      The ID of the process.
+        @param  resourceClass  One of the kResourceClass constants.
+        @param  spread         For realtime processes when pinning, True to
+                               pin to the capture CPUs of one NUMA node, the
+                               next one each time, instead of all of them.
+        """
+        niceness, ioClass, ioLevel, _ = self._classes[resourceClass]
+
+        self._try("niceness", setNiceness, processId, niceness)
+        self._try("I/O priority", setIoPriority, processId, ioClass, ioLevel)
+
+        if self._captureCpus is not None:
+            if resourceClass in _kBulkClasses:
+                cpus = self._bulkCpus
+            elif resourceClass != kResourceClassRealtime:
+                cpus = None
+            elif spread:
+                cpus = self._captureCpus[self._nextNode %
+                                         len(self._captureCpus)]
+                self._nextNode += 1
+            else:
+                cpus = [cpu for node in self._captureCpus for cpu in node]
+            if cpus:
+                self._try("CPU affinity", setCpuAffinity, processId, cpus)
+
+        if self._cgroupDir is not None:
+            self._try("cgroup", self._writeCgroupFile, resourceClass,
+                      'cgroup.procs', str(processId))
+
+
+    ###########################################################
+    def _initCgroups(self):
+        """Make a group for each resource class, and weigh them."""
+        self._try("cgroup controllers", self._writeCgroupFile, None,
+                  'cgroup.subtree_control', '+cpu +io')
+        for resourceClass, (_, _, _, weight) in self._classes.iteritems():
+            groupDir = os.path.join(self._cgroupDir, resourceClass)
+            if not os.path.isdir(groupDir):
+                self._try("cgroup", os.mkdir, groupDir)
+            self._try("cgroup weight", self._writeCgroupFile, resourceClass,
+                      'cpu.weight', str(weight))
+            self._try("cgroup weight", self._writeCgroupFile, resourceClass,
+                      'io.weight', str(weight))
+
+
+    ###########################################################
+    def _writeCgroupFile(self, resourceClass, fileName, value):
+        """Write to a control file of our cgroup or a class's group.
+
+        @param  resourceClass  The class whose group to write to, or None for
+                               the cgroup we were given.
+        @param  fileName       The name of the control file.
+        @param  value          What to write.
+        """
+        groupDir = self._cgroupDir
+        if resourceClass is not None:
+            groupDir = os.path.join(groupDir, resourceClass)
+        f = open(os.path.join(groupDir, fileName), 'w')
+        try:
+            f.write(value)
+        finally:
+            f.close()
+
+
+    ###########################################################
+    def _try(self, what, fn, *args):
+        """Call a function, logging the first failure of each kind.
+
+        @param  what  What the function sets, for the log.
+        @param  fn    The function.
+        @param  args  Arguments for the function.
+        """
+        try:
+            fn(*args)
+        except (OSError, IOError), e:
+            if what not in self._warned:
+                self._warned.add(what)
+                self._logger.warn("Couldn't set %s, skipping it: %s" %
+                                  (what, e))
@@ -296,6 +296,17 @@ def getMemoryStats(processId):
 
     return memoryStats
 
+###########################################################
+def getMemoryUsage(processId):
+    """Return how much memory a process uses; see ProcessUtilsUnix.
+
+    @param  processId  The process ID.
+    @return rssKB      The private bytes in KB, or None on error.
+    @return pssKB      Always None.
+    """
+    return getMemoryStats(processId).get('priv'), None
+
+
 ###########################################################
 def checkMemoryLimit(processId):
     """ Return false if the process exceeds defined memory limit
@@ -0,0 +1,389 @@
+#!/usr/bin/env python
+
+#*****************************************************************************
+#
+# ObjectCensus.py
+#     Counts live objects and cache sizes, to find what a process leaks.
+#
+#
+#*****************************************************************************
+#
+#
+# Copyright 2013-2022 Sighthound, Inc.
+#
+# Licensed under the GNU GPLv3 license found at
+# https://www.gnu.org/licenses/gpl-3.0.txt
+#
+# Alternative licensing available from Sighthound, Inc.
+# by emailing opensource@sighthound.com
+#
+# This file is part of the Sighthound Video project which can be found at
+# https://github.com/sighthoundinc/SighthoundVideo
+#
+# This program is free software; you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation; using version 3 of the License.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program; if not, write to the Free Software
+# Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02111, USA.
+#
+#
+#*****************************************************************************
+
+# Python imports...
+import gc
+import itertools
+import threading
+import time
+import types
+import weakref
+
+# Common 3rd-party imports...
+
+
+# Constants...
+
+# How many types to report, most common or fastest changing first.
+_kTopTypes = 20
+
+# Sampling only looks at every this many objects.
+kSampleStride = 16
+
+
+# Globals...
+
+# Guards everything below.
+_lock = threading.Lock()
+
+# Cache name to a list of (weak reference to owner, attribute, sizeOf).
+_caches = {}
+
+# The census reportCensus() took last, to diff against.
+_lastReported = None
+
+
+##############################################################################
+def registerCache(name, owner, attrName, sizeOf=len):
+    """Have censuses report the size of a cache or queue.
+
+    Registering the same name for several owners, like one per camera,
+    reports the sizes added up.  Owners may be classes, for caches kept in
+    class attributes; they're not kept alive by this, and those that are gone
+    are forgotten whenever the name is registered again.
+
+    @param  name      The name to report the size under.
+    @param  owner     The object holding the cache.
+    @param  attrName  The name of the attribute holding the cache.
+    @param  sizeOf    Function returning the size of the cache.
+    """
+    _lock.acquire()
+    try:
+        # Pruned here too, since processes making an owner per request may
+        # never take a census.
+        entries = [entry for entry in _caches.get(name, [])
+                   if entry[0]() is not None]
+        entries.append((weakref.ref(owner), attrName, sizeOf))
+        _caches[name] = entries
+    finally:
+        _lock.release()
+
+
+##############################################################################
+def _getCacheSizes():
+    """Return the sizes of registered caches, forgetting dead owners.
+
+    @return sizes  A dict of cache name to size.
+    """
+    _lock.acquire()
+    try:
+        for name, entries in _caches.items():
+            entries[:] = [entry for entry in entries if entry[0]() is not None]
+            if not entries:
+                del _caches[name]
+        caches = [(name, list(entries)) for name, entries in _caches.items()]
+    finally:
+        _lock.release()
+
+    sizes = {}
+    for name, entries in caches:
+        size = 0
+        for ownerRef, attrName, sizeOf in entries:
+            owner = ownerRef()
+            try:
+                size += sizeOf(getattr(owner, attrName))
+            except Exception:
+                # The owner may be gone, or not set up yet.
+                pass
+        sizes[name] = size
+    return sizes
+
+
+##############################################################################
+def _getTypeName(obj):
+    """Return a name for the type of an object, for the census.
+
+    @param  obj   The object.
+    @return name  Its type's name, with the module for all but builtins.
+    """
+    objType = type(obj)
+    if objType is types.InstanceType:
+        objType = obj.__class__
+    module = getattr(objType, '__module__', None)
+    if module in (None, '__builtin__', 'exceptions'):
+        return objType.__name__
+    return "%s.%s" % (module, objType.__name__)
+
+
+##############################################################################
+def takeCensus(sampleStride=1):
+    """Count live objects by type, and registered caches by size.
+
+    Only objects the garbage collector tracks are counted: containers and
+    instances, not strings or numbers.  Sampling counts every so many
+    objects and scales the counts up, which is much cheaper for processes
+    with millions of objects, and good enough to see what grows.
+
+    @param  sampleStride  Count every this many objects; 1 counts them all.
+    @return census        A dict of 'time', 'numObjects', 'sampleStride',
+                          'types' (a dict of type name to count), 'caches'
+                          (a dict of cache name to size) and 'garbage'
+                          (uncollectable objects).
+    """
+    objects = gc.get_objects()
+    counts = {}
+    for obj in itertools.islice(objects, 0, None, sampleStride):
+        name = _getTypeName(obj)
+        counts[name] = counts.get(name, 0) + sampleStride
+    numObjects = len(objects)
+    del objects
+
+    return {
+        'time': time.time(),
+        'numObjects': numObjects,
+        'sampleStride': sampleStride,
+        'types': counts,
+        'caches': _getCacheSizes(),
+        'garbage': len(gc.garbage),
+    }
+
+
+##############################################################################
+def summarizeCensus(census, limit=_kTopTypes):
+    """Keep the most common types of a census, to report it.
+
+    @param  census   A census from takeCensus().
+    @param  limit    How many types to keep.
+    @return summary  The census, with 'types' a list of (type name, count),
+                     most common first.
+    """
+    summary = dict(census)
+    summary['types'] = sorted(census['types'].iteritems(),
+                              key=lambda (name, count): (-count, name))[:limit]
+    return summary
+
+
+##############################################################################
+def diffCensus(old, new, limit=_kTopTypes):
+    """Tell what changed between two censuses.
+
+    @param  old    The earlier census from takeCensus().
+    @param  new    The later census.
+    @param  limit  How many types to report.
+    @return diff   A dict of 'secs' between them, 'numObjects' change,
+                   'types' and 'caches'; each a list of (name, old, new),
+                   biggest change first.  Only types that changed are listed,
+                   but all caches are.
+    """
+    def changes(oldCounts, newCounts, keepSame):
+        names = set(oldCounts) | set(newCounts)
+        result = [(name, oldCounts.get(name, 0), newCounts.get(name, 0))
+                  for name in names]
+        if not keepSame:
+            result = [item for item in result if item[1] != item[2]]
+        return sorted(result, key=lambda (name, was, now):
+                      (-abs(now - was), name))
+
+    return {
+        'secs': new['time'] - old['time'],
+        'numObjects': new['numObjects'] - old['numObjects'],
+        'types': changes(old['types'], new['types'], False)[:limit],
+        'caches': changes(old['caches'], new['caches'], True),
+    }
+
+
+##############################################################################
+def reportCensus(sampleStride=1, limit=_kTopTypes):
+    """Take a census, for asking a process what it holds on to.
+
+    @param  sampleStride  Count every this many objects; 1 counts them all.
+    @param  limit         How many types to report.
+    @return report        A dict of 'census', from summarizeCensus(), and
+                          'diff', from diffCensus() against the census
+                          reported last time, or None the first time.
+    """
+    global _lastReported
+
+    census = takeCensus(sampleStride)
+    _lock.acquire()
+    try:
+        last = _lastReported
+        _lastReported = census
+    finally:
+        _lock.release()
+
+    diff = None
+    if last is not None:
+        diff = diffCensus(last, census, limit)
+    return {'census': summarizeCensus(census, limit), 'diff': diff}
+
+
+##############################################################################
+def _formatChanges(changes):
+    """Make changes from diffCensus() readable for the log.
+
+    @param  changes  A list of (name, old, new).
+    @return text     Something like "dict 100->150 (+50)".
+    """
+    return ", ".join("%s %d->%d (%+d)" % (name, was, now, now - was)
+                     for name, was, now in changes)
+
+
+##############################################################################
+class CensusSampler(object):
+    """Logs what grew in a process every so often, sampling objects to keep
+    the cost down.
+    """
+    ###########################################################
+    def __init__(self, logger, interval, sampleStride=kSampleStride,
+                 limit=10):
+        """Initializer for CensusSampler
+
+        @param  logger        The logger to use.
+        @param  interval      Seconds between censuses; 0 to never take any.
+        @param  sampleStride  Count every this many objects.
+        @param  limit         How many types to log.
+        """
+        self._logger = logger
+        self._interval = interval
+        self._sampleStride = sampleStride
+        self._limit = limit
+
+        self._nextTime = None
+        self._last = None
+
+
+    ###########################################################
+    def update(self, now):
+        """Take a census and log what changed, if it's time.
+
+        @param  now  The current time, in seconds.
+        """
+        if self._interval <= 0:
+            return
+        if self._nextTime is not None and now < self._nextTime:
+            return
+        self._nextTime = now + self._interval
+
+        census = takeCensus(self._sampleStride)
+        if self._last is not None:
+            diff = diffCensus(self._last, census, self._limit)
+            self._logger.info("Object census: %d objects (%+d in %d secs); "
+                              "types: %s; caches: %s" % (
+                              census['numObjects'], diff['numObjects'],
+                              diff['secs'], _formatChanges(diff['types']),
+                              _formatChanges(diff['caches'])))
+        self._last = census
+
+
+
+##############################################################################
+def _testObjectCensus():
+    """Test counting objects.
+
+    >>> class _Logger(object):
+    ...     def __init__(self): self.lines = []
+    ...     def info(self, line): self.lines.append(line)
+    >>> class _Leaky(object):
+    ...     pass
+    >>> class _Owner(object):
+    ...     def __init__(self): self.cache = {}
+    >>> owner = _Owner()
+    >>> leaky = _getTypeName(_Leaky())
+    >>> registerCache('test.cache', owner, 'cache')
+    >>> registerCache('test.leaky', _Leaky, '__name__', lambda name: 1)
+
+    Censuses count objects by type, and caches by size:
+
+    >>> before = takeCensus()
+    >>> leaks = [_Leaky() for _ in xrange(100)]
+    >>> owner.cache.update((i, i) for i in xrange(5))
+    >>> after = takeCensus()
+    >>> after['types'][leaky] - before['types'].get(leaky, 0)
+    100
+    >>> before['caches']['test.cache'], after['caches']['test.cache']
+    (0, 5)
+
+    Diffs list what changed most first:
+
+    >>> diff = diffCensus(before, after, limit=1)
+    >>> diff['types'] == [(leaky, 0, 100)]
+    True
+    >>> sorted(diff['caches'])
+    [('test.cache', 0, 5), ('test.leaky', 1, 1)]
+
+    Caches of owners that are gone aren't reported:
+
+    >>> del owner
+    >>> 'test.cache' in takeCensus()['caches']
+    False
+
+    Nor kept around when owners come and go without censuses:
+
+    >>> for _ in xrange(10):
+    ...     registerCache('test.churn', _Owner(), 'cache')
+    >>> len(_caches['test.churn'])
+    1
+
+    Reports diff against the last one:
+
+    >>> reportCensus()['diff'] is None
+    True
+    >>> leaks += [_Leaky() for _ in xrange(50)]
+    >>> report = reportCensus(limit=3)
+    >>> len(report['census']['types']), report['diff']['types'][0][1:]
+    (3, (100, 150))
+
+    Samplers take censuses every so often, counting some of the objects:
+
+    >>> logger = _Logger()
+    >>> sampler = CensusSampler(logger, 10, sampleStride=4, limit=1)
+    >>> sampler.update(0); sampler.update(5); len(logger.lines)
+    0
+    >>> leaks += [_Leaky() for _ in xrange(1000)]
+    >>> sampler.update(10); len(logger.lines)
+    1
+    >>> leaky in logger.lines[0]
+    True
+    >>> CensusSampler(logger, 0).update(0); len(logger.lines)
+    1
+    """
+
+
+##############################################################################
+def test_main():
+    """OB_REDACT
+    Our main function, which runs test code
+    """
+    import doctest
+    doctest.testmod(verbose=True)
+
+
+##############################################################################
+if __name__ == '__main__':
+    test_main()
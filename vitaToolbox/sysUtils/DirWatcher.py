@@ -0,0 +1,333 @@
+#*****************************************************************************
+#
+# DirWatcher.py
+#     Tells which files in a directory changed, without blocking.
+#
+#
+#*****************************************************************************
+#
+#
+# Copyright 2013-2022 Sighthound, Inc.
+#
+# Licensed under the GNU GPLv3 license found at
+# https://www.gnu.org/licenses/gpl-3.0.txt
+#
+# Alternative licensing available from Sighthound, Inc.
+# by emailing opensource@sighthound.com
+#
+# This file is part of the Sighthound Video project which can be found at
+# https://github.com/sighthoundinc/SighthoundVideo
+#
+# This program is free software; you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation; using version 3 of the License.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program; if not, write to the Free Software
+# Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02111, USA.
+#
+#
+#*****************************************************************************
+
+import ctypes
+import ctypes.util
+import errno
+import os
+import struct
+import sys
+import time
+
+# inotify constants, from <sys/inotify.h>.
+_IN_CLOSE_WRITE = 0x00000008
+_IN_MOVED_FROM = 0x00000040
+_IN_MOVED_TO = 0x00000080
+_IN_DELETE = 0x00000200
+_IN_DELETE_SELF = 0x00000400
+_IN_MOVE_SELF = 0x00000800
+_IN_Q_OVERFLOW = 0x00004000
+_IN_IGNORED = 0x00008000
+_IN_NONBLOCK = 0x00000800
+_IN_CLOEXEC = 0x00080000
+
+_kWatchMask = _IN_CLOSE_WRITE | _IN_MOVED_FROM | _IN_MOVED_TO | \
+              _IN_DELETE | _IN_DELETE_SELF | _IN_MOVE_SELF
+
+# We lose events if the queue overflows, and our watch if any of the others
+# come in.
+_kLostWatchMask = _IN_IGNORED | _IN_DELETE_SELF | _IN_MOVE_SELF
+_kRescanMask = _IN_Q_OVERFLOW | _kLostWatchMask
+
+_kEventHeader = struct.Struct('iIII')
+_kReadSize = 64*1024
+
+
+###############################################################
+def _loadInotify():
+    """Find the inotify functions in libc.
+
+    @return libc  The C library, or None if inotify isn't available.
+    """
+    if not sys.platform.startswith('linux'):
+        return None
+    try:
+        libc = ctypes.CDLL(ctypes.util.find_library('c'), use_errno=True)
+        libc.inotify_init1.argtypes = [ctypes.c_int]
+        libc.inotify_add_watch.argtypes = [ctypes.c_int, ctypes.c_char_p,
+                                           ctypes.c_uint32]
+        return libc
+    except Exception:
+        return None
+
+_libc = _loadInotify()
+
+
+###############################################################
+def _toUnicode(name):
+    """Return a file name as unicode.
+
+    @param  name  A file name, as str or unicode.
+    @return name  The file name as unicode.
+    """
+    if isinstance(name, unicode):
+        return name
+    return name.decode(sys.getfilesystemencoding() or 'utf-8', 'replace')
+
+
+###############################################################
+class DirWatcher(object):
+    """Reports the names of files in one directory that changed.
+
+    On Linux this uses inotify, so checking costs one system call.  Elsewhere,
+    or if inotify can't be set up, it lists and stats the directory every so
+    often instead.  Subdirectories aren't watched.
+
+    getChanges() may also answer None, meaning "couldn't tell, look at
+    everything"; it always does that the first time it's called.
+    """
+    ###########################################################
+    def __init__(self, path, pollInterval=2.0, usePolling=False):
+        """Initializer for DirWatcher
+
+        @param  path          The directory to watch; it may not exist yet.
+        @param  pollInterval  Seconds between listings when polling.
+        @param  usePolling    True to poll even if inotify is available.
+        """
+        self._path = path
+        self._pollInterval = pollInterval
+        self._usePolling = usePolling or _libc is None
+
+        self._fd = None
+        self._needRescan = True
+        self._watchLost = False
+
+        # Key = file name, value = (mtime, size); for polling.
+        self._lastListing = None
+        self._lastPollTime = None
+
+
+    ###########################################################
+    def isPolling(self):
+        """Return True if we're polling rather than getting notified.
+
+        @return isPolling  True if polling.
+        """
+        return self._usePolling
+
+
+    ###########################################################
+    def close(self):
+        """Stop watching."""
+        if self._fd is not None:
+            os.close(self._fd)
+            self._fd = None
+
+
+    ###########################################################
+    def getChanges(self, now=None):
+        """Return what changed since the last call; never blocks.
+
+        @param  now    The current time, or None to use time.time().
+        @return names  A set of file names that were written, created, moved
+                       or deleted, or None if everything should be looked at.
+        """
+        if self._usePolling:
+            return self._poll(now)
+
+        if self._fd is None and not self._startWatching():
+            # Directory isn't there yet, or we're out of watches.  Nothing can
+            # change in a directory that doesn't exist, so just try again
+            # later; if we're out of watches, poll from now on.
+            if self._usePolling:
+                return self._poll(now)
+            needRescan = self._needRescan
+            self._needRescan = False
+            return None if needRescan else set()
+
+        names = self._readEvents()
+        if self._watchLost:
+            # Directory went away or was moved; start over next time.
+            self._watchLost = False
+            self.close()
+        if self._needRescan:
+            self._needRescan = False
+            return None
+        return names
+
+
+    ###########################################################
+    def _startWatching(self):
+        """Set up inotify on our directory.
+
+        @return success  True if we're now watching.
+        """
+        if not os.path.isdir(self._path):
+            return False
+
+        fd = _libc.inotify_init1(_IN_NONBLOCK | _IN_CLOEXEC)
+        if fd < 0:
+            self._usePolling = True
+            return False
+
+        path = self._path
+        if isinstance(path, unicode):
+            path = path.encode(sys.getfilesystemencoding() or 'utf-8')
+        if _libc.inotify_add_watch(fd, path, _kWatchMask) < 0:
+            os.close(fd)
+            if ctypes.get_errno() != errno.ENOENT:
+                self._usePolling = True
+            return False
+
+        self._fd = fd
+        # Anything could have happened before we started watching.
+        self._needRescan = True
+        return True
+
+
+    ###########################################################
+    def _readEvents(self):
+        """Drain the inotify events that are waiting.
+
+        @return names  The set of file names mentioned by the events.
+        """
+        names = set()
+        while True:
+            try:
+                buf = os.read(self._fd, _kReadSize)
+            except OSError, e:
+                if e.errno in (errno.EAGAIN, errno.EINTR):
+                    break
+                raise
+            if not buf:
+                break
+
+            offset = 0
+            while offset + _kEventHeader.size <= len(buf):
+                _, mask, _, nameLen = _kEventHeader.unpack_from(buf, offset)
+                offset += _kEventHeader.size
+                name = buf[offset:offset+nameLen].rstrip('\0')
+                offset += nameLen
+
+                if mask & _kRescanMask:
+                    self._needRescan = True
+                    self._watchLost |= bool(mask & _kLostWatchMask)
+                elif name:
+                    names.add(_toUnicode(name))
+        return names
+
+
+    ###########################################################
+    def _poll(self, now):
+        """List the directory and compare with the last listing.
+
+        @param  now    The current time, or None to use time.time().
+        @return names  As per getChanges().
+        """
+        if now is None:
+            now = time.time()
+        if self._lastPollTime is not None and \
+           0 <= now - self._lastPollTime < self._pollInterval:
+            return set()
+        self._lastPollTime = now
+
+        listing = {}
+        try:
+            fileNames = os.listdir(self._path)
+        except OSError:
+            fileNames = []
+        for fileName in fileNames:
+            try:
+                st = os.stat(os.path.join(self._path, fileName))
+            except OSError:
+                continue
+            listing[_toUnicode(fileName)] = (st.st_mtime, st.st_size)
+
+        lastListing = self._lastListing
+        self._lastListing = listing
+        if lastListing is None:
+            return None
+
+        names = set(name for name in listing
+                    if lastListing.get(name) != listing[name])
+        names.update(name for name in lastListing if name not in listing)
+        return names
+
+
+
+##############################################################################
+def _testDirWatcher():
+    """Test both flavors of the watcher.
+
+    >>> import shutil, tempfile
+    >>> tmpDir = tempfile.mkdtemp()
+    >>> def touch(name, data='x'):
+    ...     f = open(os.path.join(tmpDir, name), 'w'); f.write(data); f.close()
+
+    >>> for usePolling in (True, False):
+    ...     watcher = DirWatcher(tmpDir, 0, usePolling)
+    ...     first = watcher.getChanges()
+    ...     touch('a.rule', 'a'*(2+usePolling))
+    ...     touch('b.rule')
+    ...     time.sleep(.05)
+    ...     changes = watcher.getChanges()
+    ...     os.remove(os.path.join(tmpDir, 'b.rule'))
+    ...     time.sleep(.05)
+    ...     removed = watcher.getChanges()
+    ...     print first, sorted(changes), sorted(removed), watcher.getChanges()
+    ...     watcher.close()
+    ...     os.remove(os.path.join(tmpDir, 'a.rule'))
+    None [u'a.rule', u'b.rule'] [u'b.rule'] set([])
+    None [u'a.rule', u'b.rule'] [u'b.rule'] set([])
+
+    A directory that shows up later is picked up:
+
+    >>> missing = os.path.join(tmpDir, 'later')
+    >>> watcher = DirWatcher(missing)
+    >>> watcher.getChanges() is None
+    True
+    >>> os.mkdir(missing)
+    >>> watcher.getChanges() is None
+    True
+    >>> watcher.isPolling() or watcher.getChanges() == set()
+    True
+    >>> watcher.close()
+    >>> shutil.rmtree(tmpDir)
+    """
+
+
+##############################################################################
+def test_main():
+    """OB_REDACT
+    Our main function, which runs test code
+    """
+    import doctest
+    doctest.testmod(verbose=True)
+
+
+##############################################################################
+if __name__ == '__main__':
+    test_main()
@@ -34,6 +34,9 @@
 #
 #*****************************************************************************
 
+import ctypes
+import ctypes.util
+import sys
 import time
 import datetime
 import locale
@@ -43,6 +46,62 @@ def getTimeAsMs():
     return int(time.time()*1000)
 
 
+###########################################################
+def _loadMonotonicClock():
+    """ Find a clock that never goes backwards, shared by all processes.
+
+    @return clockFn  A function returning the clock in seconds.
+    """
+    try:
+        if sys.platform == 'win32':
+            getTickCount64 = ctypes.windll.kernel32.GetTickCount64
+            getTickCount64.restype = ctypes.c_ulonglong
+            return lambda: getTickCount64() / 1000.
+
+        if sys.platform == 'darwin':
+            class _TimebaseInfo(ctypes.Structure):
+                _fields_ = [('numer', ctypes.c_uint32),
+                            ('denom', ctypes.c_uint32)]
+            libc = ctypes.CDLL(ctypes.util.find_library('c'))
+            machAbsoluteTime = libc.mach_absolute_time
+            machAbsoluteTime.restype = ctypes.c_uint64
+            timebase = _TimebaseInfo()
+            libc.mach_timebase_info(ctypes.byref(timebase))
+            scale = timebase.numer / (timebase.denom * 1e9)
+            return lambda: machAbsoluteTime() * scale
+
+        class _Timespec(ctypes.Structure):
+            _fields_ = [('tv_sec', ctypes.c_long), ('tv_nsec', ctypes.c_long)]
+        kClockMonotonic = 1
+        librt = ctypes.CDLL(ctypes.util.find_library('rt') or
+                            ctypes.util.find_library('c'), use_errno=True)
+        clockGettime = librt.clock_gettime
+        clockGettime.argtypes = [ctypes.c_int, ctypes.POINTER(_Timespec)]
+        def getClock():
+            ts = _Timespec()
+            clockGettime(kClockMonotonic, ctypes.byref(ts))
+            return ts.tv_sec + ts.tv_nsec * 1e-9
+        getClock()
+        return getClock
+    except Exception:
+        return time.time
+
+_monotonicClock = _loadMonotonicClock()
+
+
+###########################################################
+def getMonotonicTime():
+    """ Return the time in seconds on a clock that doesn't jump when the wall
+    clock is changed.  Only differences are meaningful; they can be compared
+    between processes on the same machine.
+
+    >>> t = getMonotonicTime()
+    >>> 0 <= getMonotonicTime() - t < 1
+    True
+    """
+    return _monotonicClock()
+
+
 ###########################################################
 def formatTime(formatStr, timeStruct=None):
     if timeStruct is None:
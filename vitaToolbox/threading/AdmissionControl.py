@@ -0,0 +1,377 @@
+#*****************************************************************************
+#
+# AdmissionControl.py
+#     Limits how many expensive requests run, and how many each client makes.
+#
+#
+#*****************************************************************************
+#
+#
+# Copyright 2013-2022 Sighthound, Inc.
+#
+# Licensed under the GNU GPLv3 license found at
+# https://www.gnu.org/licenses/gpl-3.0.txt
+#
+# Alternative licensing available from Sighthound, Inc.
+# by emailing opensource@sighthound.com
+#
+# This file is part of the Sighthound Video project which can be found at
+# https://github.com/sighthoundinc/SighthoundVideo
+#
+# This program is free software; you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation; using version 3 of the License.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program; if not, write to the Free Software
+# Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02111, USA.
+#
+#
+#*****************************************************************************
+
+import collections
+import math
+import threading
+import time
+
+# While queued, how often to check whether the client went away, in seconds.
+_kGoneCheckSecs = .5
+
+# Forget clients once there are this many, if their buckets are full again.
+_kMaxClients = 256
+
+
+###############################################################
+class AdmissionControl(object):
+    """Decides whether an expensive request may run now, later, or not at all.
+
+    Requests come in classes, each with a limit of how many may run at once,
+    a limit of how many may wait for that, and a cost.  Each client has a
+    bucket of tokens which refills at a steady rate; a request takes its
+    cost out of it, or is turned away if there isn't enough.  Waiting
+    requests are let in taking turns between clients, so that one client
+    with many requests doesn't hold up the others.
+
+    Turned away requests get told how long to wait before trying again.
+    """
+    ###########################################################
+    def __init__(self, classes, rate, burst, maxWaitSecs):
+        """Initializer for AdmissionControl
+
+        @param  classes      A dict of class name to (maxRunning, maxWaiting,
+                             cost).
+        @param  rate         Tokens each client gets per second.
+        @param  burst        Most tokens a client can save up.
+        @param  maxWaitSecs  Most seconds a request waits to run.
+        """
+        self._rate = float(rate)
+        self._burst = float(burst)
+        self._maxWaitSecs = maxWaitSecs
+
+        # Guards everything below; waiting requests wait on it.
+        self._cond = threading.Condition()
+
+        self._classes = {}
+        for name, (maxRunning, maxWaiting, cost) in classes.iteritems():
+            self._classes[name] = _Class(maxRunning, maxWaiting, cost)
+
+        # Client to (tokens, time they were counted).
+        self._buckets = {}
+
+
+    ###########################################################
+    def admit(self, className, client, isGone=None):
+        """Wait until a request may run.
+
+        If this returns None, release() must be called once the request ran.
+
+        @param  className   The class of the request.
+        @param  client      Something identifying the client, like its address.
+        @param  isGone      An optional function returning True if the client
+                            stopped waiting for an answer.
+        @return retrySecs   None if the request may run, otherwise how many
+                            seconds the client should wait before trying again.
+        """
+        cls = self._classes[className]
+
+        self._cond.acquire()
+        try:
+            retrySecs = self._takeTokens(client, cls.cost)
+            if retrySecs is not None:
+                cls.rejected += 1
+                return retrySecs
+
+            if cls.running < cls.maxRunning and not cls.numWaiting:
+                cls.running += 1
+                cls.admitted += 1
+                return None
+
+            if cls.numWaiting >= cls.maxWaiting:
+                cls.rejected += 1
+                return self._estimateRetrySecs(cls)
+
+            # Wait our turn.
+            waiter = _Waiter()
+            cls.waiters.setdefault(client, collections.deque()).append(waiter)
+            cls.numWaiting += 1
+            cls.queued += 1
+
+            deadline = time.time() + self._maxWaitSecs
+            while not waiter.admitted:
+                remaining = deadline - time.time()
+                if remaining <= 0:
+                    cls.rejected += 1
+                    break
+                if isGone is not None:
+                    self._cond.release()
+                    try:
+                        gone = isGone()
+                    finally:
+                        self._cond.acquire()
+                    if gone and not waiter.admitted:
+                        cls.cancelled += 1
+                        break
+                    remaining = min(remaining, _kGoneCheckSecs)
+                self._cond.wait(remaining)
+
+            if waiter.admitted:
+                cls.admitted += 1
+                return None
+
+            queue = cls.waiters[client]
+            queue.remove(waiter)
+            if not queue:
+                del cls.waiters[client]
+            cls.numWaiting -= 1
+
+            # The client didn't get what it paid for.
+            self._giveTokens(client, cls.cost)
+            return self._estimateRetrySecs(cls)
+        finally:
+            self._cond.release()
+
+
+    ###########################################################
+    def release(self, className):
+        """Note that an admitted request is done, letting in the next one.
+
+        @param  className  The class of the request.
+        """
+        cls = self._classes[className]
+
+        self._cond.acquire()
+        try:
+            cls.running -= 1
+            if not cls.waiters:
+                return
+
+            # Take turns: the first client's request goes, and the client goes
+            # to the back of the line.
+            client, queue = cls.waiters.popitem(last=False)
+            waiter = queue.popleft()
+            if queue:
+                cls.waiters[client] = queue
+            cls.numWaiting -= 1
+            cls.running += 1
+            waiter.admitted = True
+            self._cond.notifyAll()
+        finally:
+            self._cond.release()
+
+
+    ###########################################################
+    def getStats(self):
+        """Return counts of what happened to requests, for each class.
+
+        @return stats  A dict of class name to a dict with the number of
+                       requests 'admitted', 'queued' (admitted or not),
+                       'rejected' and 'cancelled' so far, plus how many are
+                       'running' and 'waiting' right now.
+        """
+        self._cond.acquire()
+        try:
+            stats = {}
+            for name, cls in self._classes.iteritems():
+                stats[name] = {
+                    'admitted': cls.admitted,
+                    'queued': cls.queued,
+                    'rejected': cls.rejected,
+                    'cancelled': cls.cancelled,
+                    'running': cls.running,
+                    'waiting': cls.numWaiting,
+                }
+            return stats
+        finally:
+            self._cond.release()
+
+
+    ###########################################################
+    def _takeTokens(self, client, cost):
+        """Take tokens out of a client's bucket, if there are enough.
+
+        Must be called with _cond held.
+
+        @param  client     The client.
+        @param  cost       How many tokens to take.
+        @return retrySecs  None if they were taken, otherwise seconds until
+                           there will be enough.
+        """
+        now = time.time()
+        tokens = self._getTokens(client, now)
+        if tokens < cost:
+            self._buckets[client] = (tokens, now)
+            return int(math.ceil((cost - tokens) / self._rate))
+        self._buckets[client] = (tokens - cost, now)
+
+        if len(self._buckets) > _kMaxClients:
+            for other in self._buckets.keys():
+                if self._getTokens(other, now) >= self._burst:
+                    del self._buckets[other]
+        return None
+
+
+    ###########################################################
+    def _giveTokens(self, client, cost):
+        """Put tokens back into a client's bucket.
+
+        Must be called with _cond held.
+
+        @param  client  The client.
+        @param  cost    How many tokens to put back.
+        """
+        now = time.time()
+        self._buckets[client] = (min(self._burst,
+                                     self._getTokens(client, now) + cost), now)
+
+
+    ###########################################################
+    def _getTokens(self, client, now):
+        """Return how many tokens a client has.
+
+        Must be called with _cond held.
+
+        @param  client  The client.
+        @param  now     The current time.
+        @return tokens  The number of tokens.
+        """
+        tokens, then = self._buckets.get(client, (self._burst, now))
+        return min(self._burst, tokens + max(0, now - then) * self._rate)
+
+
+    ###########################################################
+    def _estimateRetrySecs(self, cls):
+        """Guess when a class will have room again.
+
+        Must be called with _cond held.
+
+        @param  cls        The class.
+        @return retrySecs  Seconds to wait before trying again.
+        """
+        # Everybody waiting now gets in before a retry would; guess a second
+        # for each of them.
+        turns = 1 + cls.numWaiting // max(1, cls.maxRunning)
+        return int(math.ceil(min(self._maxWaitSecs, turns)))
+
+
+
+###############################################################
+class _Class(object):
+    """The limits and counts of one class of requests."""
+    def __init__(self, maxRunning, maxWaiting, cost):
+        self.maxRunning = maxRunning
+        self.maxWaiting = maxWaiting
+        self.cost = cost
+
+        self.running = 0
+
+        # Client to a deque of its waiting requests, in the order clients
+        # get their turn.
+        self.waiters = collections.OrderedDict()
+        self.numWaiting = 0
+
+        self.admitted = 0
+        self.queued = 0
+        self.rejected = 0
+        self.cancelled = 0
+
+
+###############################################################
+class _Waiter(object):
+    """A request waiting to run."""
+    def __init__(self):
+        self.admitted = False
+
+
+
+##############################################################################
+def _testAdmissionControl():
+    """Test admitting requests.
+
+    >>> control = AdmissionControl({'clip': (1, 2, 2)}, rate=1, burst=3,
+    ...                            maxWaitSecs=.3)
+
+    The first request runs; the next ones wait, and give up when they wait
+    too long.
+
+    >>> control.admit('clip', 'a')
+    >>> start = time.time()
+    >>> control.admit('clip', 'b'), time.time() - start >= .25
+    (1, True)
+
+    A client without tokens left is turned away right away, and told when
+    it will have some again.
+
+    >>> control.admit('clip', 'a')
+    1
+
+    Waiting requests take turns between clients.
+
+    >>> order = []
+    >>> def request(client):
+    ...     if control.admit('clip', client, lambda: False) is None:
+    ...         order.append(client)
+    >>> control = AdmissionControl({'clip': (1, 3, 1)}, rate=1, burst=4,
+    ...                            maxWaitSecs=5)
+    >>> control.admit('clip', 'a')
+    >>> threads = []
+    >>> for client in ('a', 'a', 'b'):
+    ...     threads.append(threading.Thread(target=request, args=(client,)))
+    ...     threads[-1].start()
+    ...     time.sleep(.05)
+    >>> control.admit('clip', 'c')
+    4
+    >>> for _ in xrange(3):
+    ...     control.release('clip')
+    ...     time.sleep(.05)
+    >>> for thread in threads: thread.join()
+    >>> order
+    ['a', 'b', 'a']
+
+    Clients that go away stop waiting.
+
+    >>> thread = threading.Thread(target=control.admit,
+    ...                           args=('clip', 'd', lambda: True))
+    >>> thread.start(); thread.join()
+    >>> sorted(control.getStats()['clip'].items())
+    [('admitted', 4), ('cancelled', 1), ('queued', 4), ('rejected', 1), \
+('running', 1), ('waiting', 0)]
+    """
+
+
+##############################################################################
+def test_main():
+    """OB_REDACT
+    Our main function, which runs test code
+    """
+    import doctest
+    doctest.testmod(verbose=True)
+
+
+##############################################################################
+if __name__ == '__main__':
+    test_main()
@@ -0,0 +1,175 @@
+#*****************************************************************************
+#
+# LongPoll.py
+#     Lets request threads wait for changes, without taking up all of them.
+#
+#
+#*****************************************************************************
+#
+#
+# Copyright 2013-2022 Sighthound, Inc.
+#
+# Licensed under the GNU GPLv3 license found at
+# https://www.gnu.org/licenses/gpl-3.0.txt
+#
+# Alternative licensing available from Sighthound, Inc.
+# by emailing opensource@sighthound.com
+#
+# This file is part of the Sighthound Video project which can be found at
+# https://github.com/sighthoundinc/SighthoundVideo
+#
+# This program is free software; you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation; using version 3 of the License.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program; if not, write to the Free Software
+# Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02111, USA.
+#
+#
+#*****************************************************************************
+
+import threading
+import time
+
+
+###############################################################
+class LongPoll(object):
+    """Lets request threads of a server wait for something to change, up to
+    a limit of them at once.
+
+    Each waiting client ties up a thread of the server's pool, so everything
+    answering long-polls on the same pool should share one LongPoll; the
+    pool then needs maxWaiters threads more than it would otherwise.  Past
+    the limit, waits return right away, so clients just poll.
+    """
+    ###########################################################
+    def __init__(self, maxWaiters, maxWaitSecs):
+        """Initializer for LongPoll
+
+        @param  maxWaiters   How many threads may wait at once.
+        @param  maxWaitSecs  Longest a thread may wait, in seconds.
+        """
+        self._maxWaiters = maxWaiters
+        self._maxWaitSecs = maxWaitSecs
+
+        # Guards _numWaiters.  Taken while holding the condition of a waiter,
+        # never the other way around.
+        self._lock = threading.Lock()
+        self._numWaiters = 0
+
+
+    ###########################################################
+    def getMaxWaiters(self):
+        """Return how many threads may wait at once.
+
+        @return maxWaiters  The most threads waiting.
+        """
+        return self._maxWaiters
+
+
+    ###########################################################
+    def getMaxWaitSecs(self):
+        """Return the longest a thread may wait.
+
+        @return maxWaitSecs  The most seconds of a wait.
+        """
+        return self._maxWaitSecs
+
+
+    ###########################################################
+    def wait(self, cond, isDone, timeout):
+        """Wait on a condition until there's something to answer.
+
+        Must be called with cond held; it's released while waiting.
+
+        @param  cond     The condition to wait on; whoever changes what
+                         isDone() looks at must notify it.
+        @param  isDone   Function returning True once there's something to
+                         answer, or waiting is pointless.  Called with cond
+                         held.
+        @param  timeout  Most seconds to wait; capped at maxWaitSecs.
+        @return waited   False if too many others were waiting already.
+        """
+        deadline = time.time() + max(0, min(timeout, self._maxWaitSecs))
+        if isDone():
+            return True
+
+        with self._lock:
+            if self._numWaiters >= self._maxWaiters:
+                return False
+            self._numWaiters += 1
+
+        try:
+            while not isDone():
+                remaining = deadline - time.time()
+                if remaining <= 0:
+                    break
+                cond.wait(remaining)
+        finally:
+            with self._lock:
+                self._numWaiters -= 1
+        return True
+
+
+
+##############################################################################
+def _testLongPoll():
+    """Test waiting for changes.
+
+    >>> longPoll = LongPoll(1, 5)
+    >>> cond = threading.Condition()
+    >>> changed = []
+
+    Waits end once something changed, or with the timeout:
+
+    >>> def change():
+    ...     with cond:
+    ...         changed.append(True)
+    ...         cond.notifyAll()
+    >>> _ = threading.Timer(.1, change).start()
+    >>> start = time.time()
+    >>> with cond:
+    ...     longPoll.wait(cond, lambda: bool(changed), 5)
+    True
+    >>> time.time() - start < 1
+    True
+    >>> start = time.time()
+    >>> with cond:
+    ...     longPoll.wait(cond, lambda: False, .2)
+    True
+    >>> time.time() - start >= .15
+    True
+
+    Past the limit, waits return right away:
+
+    >>> def waitThread():
+    ...     with cond:
+    ...         longPoll.wait(cond, lambda: False, .5)
+    >>> thread = threading.Thread(target=waitThread)
+    >>> thread.start(); time.sleep(.1)
+    >>> start = time.time()
+    >>> with cond:
+    ...     longPoll.wait(cond, lambda: False, 5), time.time() - start < .3
+    (False, True)
+    >>> thread.join()
+    """
+
+
+##############################################################################
+def test_main():
+    """OB_REDACT
+    Our main function, which runs test code
+    """
+    import doctest
+    doctest.testmod(verbose=True)
+
+
+##############################################################################
+if __name__ == '__main__':
+    test_main()
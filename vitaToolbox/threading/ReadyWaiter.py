@@ -0,0 +1,213 @@
+#*****************************************************************************
+#
+# ReadyWaiter.py
+#     Waits for a pipe to have data, or for another thread to wake us up.
+#
+#
+#*****************************************************************************
+#
+#
+# Copyright 2013-2022 Sighthound, Inc.
+#
+# Licensed under the GNU GPLv3 license found at
+# https://www.gnu.org/licenses/gpl-3.0.txt
+#
+# Alternative licensing available from Sighthound, Inc.
+# by emailing opensource@sighthound.com
+#
+# This file is part of the Sighthound Video project which can be found at
+# https://github.com/sighthoundinc/SighthoundVideo
+#
+# This program is free software; you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation; using version 3 of the License.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program; if not, write to the Free Software
+# Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02111, USA.
+#
+#
+#*****************************************************************************
+
+import errno
+import os
+import select
+import sys
+import threading
+import time
+
+# When we can't select() on pipes (Windows), how often to look for wake ups
+# while waiting on the pipe, in seconds.
+_kWakeCheckSecs = .01
+
+
+###############################################################
+class ReadyWaiter(object):
+    """Blocks until a multiprocessing Connection has data, another thread
+    calls wake(), or a timeout passes; whichever comes first.
+
+    On Unix, wake() writes to a pipe of our own, so one select() covers both.
+    Elsewhere the Connection is polled in short slices, checking for wake
+    ups in between.
+    """
+    ###########################################################
+    def __init__(self, conn):
+        """Initializer for ReadyWaiter
+
+        @param  conn  The Connection to wait on.
+        """
+        self._conn = conn
+        self._wakeEvent = threading.Event()
+
+        self._wakeRead = None
+        self._wakeWrite = None
+        if sys.platform != 'win32':
+            self._wakeRead, self._wakeWrite = os.pipe()
+            for fd in (self._wakeRead, self._wakeWrite):
+                _setNonBlocking(fd)
+
+
+    ###########################################################
+    def close(self):
+        """Free our pipe; the waiter can't be used after this."""
+        for fd in (self._wakeRead, self._wakeWrite):
+            if fd is not None:
+                os.close(fd)
+        self._wakeRead = self._wakeWrite = None
+
+
+    ###########################################################
+    def wake(self):
+        """Make wait() return; may be called from any thread.
+
+        If nobody is waiting, the next wait() returns right away.
+        """
+        self._wakeEvent.set()
+        if self._wakeWrite is not None:
+            try:
+                os.write(self._wakeWrite, 'x')
+            except (OSError, TypeError):
+                # A full pipe means a wake up is already waiting; a closed one
+                # that nobody is waiting anymore.
+                pass
+
+
+    ###########################################################
+    def wait(self, timeout):
+        """Wait for data on the connection or a wake up.
+
+        @param  timeout  The most seconds to wait; 0 to just check.
+        @return woken    True if wake() was called since the last wait().
+        """
+        if self._wakeRead is not None:
+            if not self._wakeEvent.isSet():
+                try:
+                    ready, _, _ = select.select([self._conn.fileno(),
+                                                 self._wakeRead], [], [],
+                                                max(0, timeout))
+                except select.error, e:
+                    if e.args[0] != errno.EINTR:
+                        raise
+                    ready = []
+                if self._wakeRead in ready:
+                    self._drainWakePipe()
+            return self._takeWake()
+
+        endTime = time.time() + timeout
+        while not self._wakeEvent.isSet():
+            remaining = endTime - time.time()
+            if self._conn.poll(max(0, min(remaining, _kWakeCheckSecs))) or \
+               remaining <= _kWakeCheckSecs:
+                break
+        return self._takeWake()
+
+
+    ###########################################################
+    def _takeWake(self):
+        """Clear any wake up.
+
+        @return woken  True if there was a wake up.
+        """
+        if not self._wakeEvent.isSet():
+            return False
+        self._wakeEvent.clear()
+        return True
+
+
+    ###########################################################
+    def _drainWakePipe(self):
+        """Empty our pipe, so that select() blocks again.
+
+        A byte written after this just makes the next wait() end early.
+        """
+        try:
+            while os.read(self._wakeRead, 512):
+                pass
+        except OSError, e:
+            if e.errno != errno.EAGAIN:
+                raise
+
+
+###############################################################
+def _setNonBlocking(fd):
+    """Make a file descriptor non-blocking.
+
+    @param  fd  The file descriptor.
+    """
+    import fcntl
+    flags = fcntl.fcntl(fd, fcntl.F_GETFL)
+    fcntl.fcntl(fd, fcntl.F_SETFL, flags | os.O_NONBLOCK)
+
+
+
+##############################################################################
+def _testReadyWaiter():
+    """Test waiting.
+
+    >>> from multiprocessing import Pipe
+    >>> conn1, conn2 = Pipe()
+    >>> waiter = ReadyWaiter(conn1)
+
+    Nothing happening means we wait out the timeout:
+
+    >>> start = time.time()
+    >>> waiter.wait(.1), time.time() - start >= .09
+    (False, True)
+
+    Data on the pipe ends the wait early:
+
+    >>> conn2.send('hi')
+    >>> start = time.time()
+    >>> waiter.wait(5), time.time() - start < 1, conn1.recv()
+    (False, True, 'hi')
+
+    So does a wake up from another thread, even one from before we waited:
+
+    >>> _ = threading.Timer(.1, waiter.wake).start()
+    >>> start = time.time()
+    >>> waiter.wait(5), time.time() - start < 1
+    (True, True)
+    >>> waiter.wake(); waiter.wake()
+    >>> waiter.wait(5), waiter.wait(0)
+    (True, False)
+    >>> waiter.close()
+    """
+
+
+##############################################################################
+def test_main():
+    """OB_REDACT
+    Our main function, which runs test code
+    """
+    import doctest
+    doctest.testmod(verbose=True)
+
+
+##############################################################################
+if __name__ == '__main__':
+    test_main()